@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "AttributeSet.hpp"
 #include "DisplayDevice.hpp"
 #include "LayerBlitInfo.hpp"
@@ -41,3 +43,45 @@ void LayerBlitInfo::setVertices(std::vector<tile_corner>* op, std::vector<tile_c
 		transparent_->update(tr);
 	}
 }
+
+namespace
+{
+	bool same_corner(const tile_corner& a, const tile_corner& b)
+	{
+		return a.vertex == b.vertex && a.uv == b.uv;
+	}
+
+	int update_changed_range(const KRE::AttributeSetPtr& as, KRE::Attribute<tile_corner>& attr, std::vector<tile_corner>* v)
+	{
+		if(v->size() != attr.size()) {
+			const int count = static_cast<int>(v->size());
+			as->setCount(v->size());
+			attr.update(v);
+			return count;
+		}
+
+		auto first = std::mismatch(v->begin(), v->end(), attr.begin(), same_corner);
+		if(first.first == v->end()) {
+			return 0;
+		}
+
+		auto last = std::mismatch(v->rbegin(), v->rend(), std::reverse_iterator<KRE::Attribute<tile_corner>::iterator>(attr.end()), same_corner);
+
+		const size_t begin = first.first - v->begin();
+		const size_t end = v->rend() - last.first;
+		attr.updateRange(&(*v)[begin], begin, end - begin);
+		return static_cast<int>(end - begin);
+	}
+}
+
+int LayerBlitInfo::updateVertices(std::vector<tile_corner>* op, std::vector<tile_corner>* tr)
+{
+	int result = 0;
+	if(op != nullptr) {
+		result += update_changed_range(getAttributeSet()[0], *opaques_, op);
+	}
+	if(tr != nullptr) {
+		result += update_changed_range(getAttributeSet()[1], *transparent_, tr);
+	}
+	return result;
+}
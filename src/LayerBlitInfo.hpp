@@ -41,6 +41,11 @@ public:
 	void setBase(int xb, int yb) { xbase_ = xb; ybase_ = yb; initialised_ = true; }
 
 	void setVertices(std::vector<tile_corner>* op, std::vector<tile_corner>* tr);
+
+	//like setVertices(), but when an array keeps its size only the range
+	//which differs from the current vertices is uploaded. Returns the
+	//number of vertices uploaded.
+	int updateVertices(std::vector<tile_corner>* op, std::vector<tile_corner>* tr);
 private:
 	int xbase_;
 	int ybase_;
@@ -50,6 +50,14 @@ namespace gui
 
 	}
 
+	ParticleSystemWidget::~ParticleSystemWidget()
+	{
+		//a step still running needs the container alive until it is done.
+		if(container_ && container_->getParticleSystem()) {
+			container_->getParticleSystem()->sync();
+		}
+	}
+
 	void ParticleSystemWidget::handleDraw() const
 	{
 		auto wnd = KRE::WindowManager::getMainWindow();
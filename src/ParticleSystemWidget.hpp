@@ -35,6 +35,7 @@ namespace gui
 	{
 		public:
 			explicit ParticleSystemWidget(const variant& v, game_logic::FormulaCallable* e);
+			~ParticleSystemWidget();
 			WidgetPtr clone() const override;
 		private:
 			DECLARE_CALLABLE(ParticleSystemWidget);
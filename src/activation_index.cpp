@@ -0,0 +1,247 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+
+#include "activation_index.hpp"
+#include "asserts.hpp"
+#include "entity.hpp"
+
+namespace
+{
+	//objects whose activation area covers more than this many cells are
+	//simply tested every cycle.
+	const int MaxCellsPerObject = 16;
+
+	int cell_floor(int n, int cell_size)
+	{
+		return n >= 0 ? n/cell_size : -((-n - 1)/cell_size) - 1;
+	}
+}
+
+ActivationIndex::ActivationIndex(int cell_size)
+	: cell_size_(cell_size), next_seq_(0)
+{
+	ASSERT_LOG(cell_size_ > 0, "Illegal activation index cell size: " << cell_size_);
+}
+
+ActivationIndex::~ActivationIndex()
+{
+	clear();
+}
+
+void ActivationIndex::add(Entity* e)
+{
+	ActivationIndexHook& hook = e->activationIndexHook();
+	if(hook.index == this) {
+		return;
+	}
+
+	if(hook.index != nullptr) {
+		hook.index->remove(e);
+	}
+
+	Entry& entry = entries_[e];
+	entry.entity = e;
+	entry.seq = next_seq_++;
+	entry.cx1 = entry.cy1 = entry.cx2 = entry.cy2 = 0;
+	entry.awake_pos = -1;
+	makeAwake(entry);
+
+	hook.index = this;
+	hook.dormant = false;
+}
+
+void ActivationIndex::remove(Entity* e)
+{
+	auto itor = entries_.find(e);
+	if(itor == entries_.end()) {
+		return;
+	}
+
+	Entry& entry = itor->second;
+	if(entry.awake_pos == -1) {
+		removeFromCells(entry);
+	} else {
+		removeFromAwake(entry);
+	}
+
+	entries_.erase(itor);
+
+	ActivationIndexHook& hook = e->activationIndexHook();
+	hook.index = nullptr;
+	hook.dormant = false;
+}
+
+void ActivationIndex::clear()
+{
+	for(auto& p : entries_) {
+		ActivationIndexHook& hook = p.first->activationIndexHook();
+		hook.index = nullptr;
+		hook.dormant = false;
+	}
+
+	entries_.clear();
+	cells_.clear();
+	awake_.clear();
+}
+
+void ActivationIndex::getCandidates(const rect& screen_area, std::vector<Entity*>* result)
+{
+	candidates_buf_.clear();
+	for(const Entry* entry : awake_) {
+		candidates_buf_.push_back(std::pair<uint64_t, Entity*>(entry->seq, entry->entity));
+	}
+
+	const int sx1 = cell_floor(screen_area.x(), cell_size_);
+	const int sy1 = cell_floor(screen_area.y(), cell_size_);
+	const int sx2 = cell_floor(std::max(screen_area.x2(), screen_area.x() + 1) - 1, cell_size_);
+	const int sy2 = cell_floor(std::max(screen_area.y2(), screen_area.y() + 1) - 1, cell_size_);
+
+	//an object spanning several cells is reported from the top-left one of
+	//those which the screen touches.
+	auto add_cell = [&](int cx, int cy, const std::vector<Entry*>& cell) {
+		for(const Entry* entry : cell) {
+			if(std::max(entry->cx1, sx1) == cx && std::max(entry->cy1, sy1) == cy) {
+				candidates_buf_.push_back(std::pair<uint64_t, Entity*>(entry->seq, entry->entity));
+			}
+		}
+	};
+
+	const int64_t screen_cells = static_cast<int64_t>(sx2 - sx1 + 1)*(sy2 - sy1 + 1);
+	if(screen_cells > static_cast<int64_t>(cells_.size())) {
+		//zoomed far out, so it's cheaper to look at every occupied cell.
+		for(const auto& cell : cells_) {
+			const int cx = static_cast<int32_t>(static_cast<uint32_t>(cell.first >> 32));
+			const int cy = static_cast<int32_t>(static_cast<uint32_t>(cell.first));
+			if(cx >= sx1 && cx <= sx2 && cy >= sy1 && cy <= sy2) {
+				add_cell(cx, cy, cell.second);
+			}
+		}
+	} else {
+		for(int cy = sy1; cy <= sy2; ++cy) {
+			for(int cx = sx1; cx <= sx2; ++cx) {
+				auto cell = cells_.find(cellKey(cx, cy));
+				if(cell != cells_.end()) {
+					add_cell(cx, cy, cell->second);
+				}
+			}
+		}
+	}
+
+	std::sort(candidates_buf_.begin(), candidates_buf_.end());
+
+	result->clear();
+	result->reserve(candidates_buf_.size());
+	for(const auto& p : candidates_buf_) {
+		result->push_back(p.second);
+	}
+}
+
+void ActivationIndex::setActive(Entity* e, bool active)
+{
+	auto itor = entries_.find(e);
+	ASSERT_LOG(itor != entries_.end(), "Object not found in activation index: " << e->getDebugDescription());
+	Entry& entry = itor->second;
+
+	if(active || entry.awake_pos == -1) {
+		//active objects stay awake, and dormant objects which were tested
+		//but are still inactive can stay where they are.
+		return;
+	}
+
+	rect bounds;
+	if(!e->getActivationBounds(&bounds)) {
+		return;
+	}
+
+	//pad the bounds so objects with empty areas still land in a cell.
+	bounds = rect(bounds.x() - 1, bounds.y() - 1, std::max(bounds.w(), 0) + 2, std::max(bounds.h(), 0) + 2);
+
+	const int cx1 = cell_floor(bounds.x(), cell_size_);
+	const int cy1 = cell_floor(bounds.y(), cell_size_);
+	const int cx2 = cell_floor(bounds.x2() - 1, cell_size_);
+	const int cy2 = cell_floor(bounds.y2() - 1, cell_size_);
+	if(static_cast<int64_t>(cx2 - cx1 + 1)*(cy2 - cy1 + 1) > MaxCellsPerObject) {
+		return;
+	}
+
+	removeFromAwake(entry);
+
+	entry.cx1 = cx1;
+	entry.cy1 = cy1;
+	entry.cx2 = cx2;
+	entry.cy2 = cy2;
+	for(int cy = cy1; cy <= cy2; ++cy) {
+		for(int cx = cx1; cx <= cx2; ++cx) {
+			cells_[cellKey(cx, cy)].push_back(&entry);
+		}
+	}
+
+	e->activationIndexHook().dormant = true;
+}
+
+void ActivationIndex::wake(Entity* e)
+{
+	auto itor = entries_.find(e);
+	if(itor == entries_.end() || itor->second.awake_pos != -1) {
+		return;
+	}
+
+	removeFromCells(itor->second);
+	makeAwake(itor->second);
+	e->activationIndexHook().dormant = false;
+}
+
+void ActivationIndex::makeAwake(Entry& entry)
+{
+	entry.awake_pos = static_cast<int>(awake_.size());
+	awake_.push_back(&entry);
+}
+
+void ActivationIndex::removeFromAwake(Entry& entry)
+{
+	ASSERT_LOG(entry.awake_pos >= 0 && entry.awake_pos < static_cast<int>(awake_.size()) && awake_[entry.awake_pos] == &entry, "Activation index awake list corrupted");
+	awake_[entry.awake_pos] = awake_.back();
+	awake_[entry.awake_pos]->awake_pos = entry.awake_pos;
+	awake_.pop_back();
+	entry.awake_pos = -1;
+}
+
+void ActivationIndex::removeFromCells(Entry& entry)
+{
+	for(int cy = entry.cy1; cy <= entry.cy2; ++cy) {
+		for(int cx = entry.cx1; cx <= entry.cx2; ++cx) {
+			auto cell = cells_.find(cellKey(cx, cy));
+			ASSERT_LOG(cell != cells_.end(), "Activation index cell not found: " << cx << ", " << cy);
+			std::vector<Entry*>& v = cell->second;
+			auto i = std::find(v.begin(), v.end(), &entry);
+			ASSERT_LOG(i != v.end(), "Object not found in activation index cell: " << cx << ", " << cy);
+			*i = v.back();
+			v.pop_back();
+			if(v.empty()) {
+				cells_.erase(cell);
+			}
+		}
+	}
+}
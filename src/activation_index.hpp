@@ -0,0 +1,113 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "geometry.hpp"
+
+class ActivationIndex;
+class Entity;
+
+//Kept inside each Entity so that an ActivationIndex can be told when one of
+//the objects it considers dormant moves or changes. Copies of an entity
+//start out unindexed.
+struct ActivationIndexHook
+{
+	ActivationIndexHook() : index(nullptr), dormant(false) {}
+	ActivationIndexHook(const ActivationIndexHook&) : index(nullptr), dormant(false) {}
+	ActivationIndexHook& operator=(const ActivationIndexHook&) { return *this; }
+
+	ActivationIndex* index;
+	bool dormant;
+};
+
+//Spatial index of the objects in a level used by Level::set_active_chars().
+//Objects which were found to be inactive and whose activity only depends on
+//where they are relative to the screen are bucketed into a grid of cells
+//and left alone until the screen comes near their cell or they change.
+//Everything else is tested every cycle.
+class ActivationIndex
+{
+public:
+	enum { DefaultCellSize = 512 };
+
+	explicit ActivationIndex(int cell_size=DefaultCellSize);
+	~ActivationIndex();
+
+	//adds an object to the index. Objects are tested the first cycle after
+	//they are added, and candidates are always returned in the order their
+	//objects were added.
+	void add(Entity* e);
+	void remove(Entity* e);
+	void clear();
+
+	int size() const { return static_cast<int>(entries_.size()); }
+
+	//finds all the objects which need their activity tested against the
+	//given screen area.
+	void getCandidates(const rect& screen_area, std::vector<Entity*>* result);
+
+	//records the result of testing an object. Inactive objects with bounded
+	//activation areas become dormant.
+	void setActive(Entity* e, bool active);
+
+	//makes a dormant object be tested again next cycle.
+	void wake(Entity* e);
+private:
+	ActivationIndex(const ActivationIndex&);
+	void operator=(const ActivationIndex&);
+
+	struct Entry {
+		Entity* entity;
+		uint64_t seq;
+
+		//inclusive range of cells the object is in while dormant.
+		int cx1, cy1, cx2, cy2;
+
+		//position in awake_ if the object isn't dormant, -1 otherwise.
+		int awake_pos;
+	};
+
+	static uint64_t cellKey(int cx, int cy) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+	}
+
+	void makeAwake(Entry& entry);
+	void removeFromAwake(Entry& entry);
+	void removeFromCells(Entry& entry);
+
+	int cell_size_;
+	uint64_t next_seq_;
+
+	std::unordered_map<Entity*, Entry> entries_;
+	std::unordered_map<uint64_t, std::vector<Entry*> > cells_;
+
+	//objects which must be tested every cycle.
+	std::vector<Entry*> awake_;
+
+	std::vector<std::pair<uint64_t, Entity*> > candidates_buf_;
+};
@@ -10,6 +10,7 @@
 #include "compress.hpp"
 #include "filesystem.hpp"
 #include "json_parser.hpp"
+#include "md5.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
 #include "profile_timer.hpp"
@@ -398,7 +399,26 @@ public:
 	{}
 private:
 	auto_update_window& window_;
+	//md5 of each high priority file, or of each of its chunks if it is
+	//sent in chunks, to the path of the file.
 	std::map<std::string, std::string> update_chunks_;
+	//manifest entries of high priority files sent in chunks.
+	std::map<std::string, variant> update_files_;
+
+	//puts together a file sent in chunks, if all of them have arrived.
+	bool readChunkedFile(const variant& info, std::string* contents) const {
+		for(variant chunk : info["chunks"].as_list()) {
+			const std::string cache_path = "update-cache/" + chunk["md5"].as_string();
+			if(!sys::file_exists(cache_path)) {
+				return false;
+			}
+
+			*contents += module::decode_chunk_data(sys::read_file(cache_path), chunk["size"].as_int());
+		}
+
+		return md5::sum(*contents) == info["md5"].as_string();
+	}
+
 	virtual bool isHighPriorityChunk(const variant& chunk_id, variant& chunk) override {
 		if(!chunk_id.is_string()) {
 			return false;
@@ -411,7 +431,14 @@ private:
 			return false;
 		}
 
-		update_chunks_[chunk["md5"].as_string()] = id;
+		if(chunk["chunks"].is_list()) {
+			update_files_[id] = chunk;
+			for(variant c : chunk["chunks"].as_list()) {
+				update_chunks_[c["md5"].as_string()] = id;
+			}
+		} else {
+			update_chunks_[chunk["md5"].as_string()] = id;
+		}
 		return true;
 
 		static const std::string update_bg("update/update-bg.jpg");
@@ -425,20 +452,29 @@ private:
 		auto itor = update_chunks_.find(chunk["md5"].as_string());
 		if(itor != update_chunks_.end()) {
 			try {
-				std::string data_str;
-				if(chunk["data"].is_string()) {
-					data_str = chunk["data"].as_string();
+				std::string contents;
+				auto file_itor = update_files_.find(itor->second);
+				if(file_itor != update_files_.end()) {
+					//the file is written once the last of its chunks arrives.
+					if(!readChunkedFile(file_itor->second, &contents)) {
+						return;
+					}
 				} else {
-					data_str = sys::read_file("update-cache/" + chunk["md5"].as_string());
-				}
+					std::string data_str;
+					if(chunk["data"].is_string()) {
+						data_str = chunk["data"].as_string();
+					} else {
+						data_str = sys::read_file("update-cache/" + chunk["md5"].as_string());
+					}
 
-				std::vector<char> data_buf;
-				data_buf.insert(data_buf.begin(), data_str.begin(), data_str.end());
+					std::vector<char> data_buf;
+					data_buf.insert(data_buf.begin(), data_str.begin(), data_str.end());
 
-				const int data_size = chunk["size"].as_int();
+					const int data_size = chunk["size"].as_int();
 
-				std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), data_size);
-				std::string contents(data.begin(), data.end());
+					std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), data_size);
+					contents.assign(data.begin(), data.end());
+				}
 
 				fprintf(stderr, "WRITE FILE: %s\n", itor->second.c_str());
 
@@ -0,0 +1,608 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+#include "asserts.hpp"
+#include "binary_cache.hpp"
+#include "checksum.hpp"
+#include "filesystem.hpp"
+#include "formula_callable.hpp"
+#include "json_parser.hpp"
+#include "logger.hpp"
+#include "md5.hpp"
+#include "preferences.hpp"
+#include "reference_counted_object.hpp"
+#include "string_utils.hpp"
+#include "unit_test.hpp"
+
+namespace binary_cache
+{
+	namespace
+	{
+		PREF_BOOL(binary_cache, true, "Keep parsed object types and levels in a binary cache in the user data directory, so they load without parsing");
+
+		const char Magic[4] = { 'A', 'N', 'B', 'C' };
+
+		//bump whenever the encoding changes.
+		const int32_t FormatVersion = 2;
+
+		enum class TAG : unsigned char {
+			NULL_VALUE,
+			FALSE_VALUE,
+			TRUE_VALUE,
+			INT,
+			DECIMAL,
+			STRING,
+			TRANSLATED_STRING,
+			LIST,
+			MAP,
+		};
+
+		struct unencodable_value {};
+		struct corrupt_cache {};
+
+		THREAD_LOCAL DependencyScope* g_current_scope;
+
+		//debug info needs filenames that live forever.
+		const std::string* intern_filename(const std::string& fname)
+		{
+			static std::mutex mutex;
+			static std::set<std::string> filenames;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			return &*filenames.insert(fname).first;
+		}
+
+		//marks the files whose parse evaluated @eval; see note_eval().
+		const char EvalMarker[] = "@eval";
+
+		//the file is named by the key's hash, so no two keys share a file.
+		//The readable prefix is only there to help whoever looks in the
+		//directory; the key itself is stored in the file and checked on load.
+		std::string cache_path(const std::string& key)
+		{
+			std::string prefix = key.substr(0, 32);
+			for(char& c : prefix) {
+				if(!util::c_isalnum(c) && c != '-' && c != '_' && c != '.') {
+					c = '_';
+				}
+			}
+
+			return sys::get_user_data_dir() + "/binary_cache/" + prefix + "-" + md5::sum(key) + ".bin";
+		}
+
+		class Writer
+		{
+		public:
+			void writeByte(unsigned char c) {
+				out_.push_back(static_cast<char>(c));
+			}
+
+			void writeInt(int32_t n) {
+				out_.append(reinterpret_cast<const char*>(&n), sizeof(n));
+			}
+
+			void writeInt64(int64_t n) {
+				out_.append(reinterpret_cast<const char*>(&n), sizeof(n));
+			}
+
+			void writeString(const std::string& s) {
+				writeInt(static_cast<int32_t>(s.size()));
+				out_ += s;
+			}
+
+			void writeValue(const variant& v) {
+				switch(v.type()) {
+				case variant::VARIANT_TYPE_NULL:
+					writeByte(static_cast<unsigned char>(TAG::NULL_VALUE));
+					break;
+				case variant::VARIANT_TYPE_BOOL:
+					writeByte(static_cast<unsigned char>(v.as_bool() ? TAG::TRUE_VALUE : TAG::FALSE_VALUE));
+					break;
+				case variant::VARIANT_TYPE_INT:
+					writeByte(static_cast<unsigned char>(TAG::INT));
+					writeInt(v.as_int());
+					break;
+				case variant::VARIANT_TYPE_DECIMAL:
+					writeByte(static_cast<unsigned char>(TAG::DECIMAL));
+					writeInt64(v.as_decimal().value());
+					break;
+				case variant::VARIANT_TYPE_STRING: {
+					//translated strings are stored untranslated, since the
+					//language may be different next time.
+					const std::string* translated_from = v.get_translated_from();
+					writeByte(static_cast<unsigned char>(translated_from ? TAG::TRANSLATED_STRING : TAG::STRING));
+					writeString(translated_from ? *translated_from : v.as_string());
+					writeDebugInfo(v);
+					break;
+				}
+				case variant::VARIANT_TYPE_LIST:
+					writeByte(static_cast<unsigned char>(TAG::LIST));
+					writeInt(v.num_elements());
+					for(const variant& item : v.as_list()) {
+						writeValue(item);
+					}
+
+					writeDebugInfo(v);
+					break;
+				case variant::VARIANT_TYPE_MAP:
+					writeByte(static_cast<unsigned char>(TAG::MAP));
+					writeInt(v.num_elements());
+					for(const variant_pair& p : v.as_map()) {
+						writeValue(p.first);
+						writeValue(p.second);
+					}
+
+					writeDebugInfo(v);
+					break;
+				default:
+					throw unencodable_value();
+				}
+			}
+
+			//the filenames referenced by debug info, in index order.
+			const std::vector<std::string>& filenames() const { return filenames_; }
+
+			const std::string& data() const { return out_; }
+		private:
+			void writeDebugInfo(const variant& v) {
+				const variant::debug_info* info = v.get_debug_info();
+				if(info == nullptr) {
+					writeByte(0);
+					return;
+				}
+
+				auto itor = filename_index_.find(*info->filename);
+				if(itor == filename_index_.end()) {
+					itor = filename_index_.insert(std::make_pair(*info->filename, static_cast<int>(filenames_.size()))).first;
+					filenames_.push_back(*info->filename);
+				}
+
+				writeByte(1);
+				writeInt(itor->second);
+				writeInt(info->line);
+				writeInt(info->column);
+				writeInt(info->end_line);
+				writeInt(info->end_column);
+			}
+
+			std::string out_;
+			std::vector<std::string> filenames_;
+			std::map<std::string, int> filename_index_;
+		};
+
+		class Reader
+		{
+		public:
+			Reader(const char* begin, const char* end) : pos_(begin), end_(end)
+			{}
+
+			unsigned char readByte() {
+				need(1);
+				return static_cast<unsigned char>(*pos_++);
+			}
+
+			int32_t readInt() {
+				int32_t result;
+				need(sizeof(result));
+				memcpy(&result, pos_, sizeof(result));
+				pos_ += sizeof(result);
+				return result;
+			}
+
+			int64_t readInt64() {
+				int64_t result;
+				need(sizeof(result));
+				memcpy(&result, pos_, sizeof(result));
+				pos_ += sizeof(result);
+				return result;
+			}
+
+			std::string readString() {
+				const int32_t len = readInt();
+				if(len < 0) {
+					throw corrupt_cache();
+				}
+
+				need(len);
+				std::string result(pos_, pos_ + len);
+				pos_ += len;
+				return result;
+			}
+
+			int readCount() {
+				const int32_t count = readInt();
+				if(count < 0 || count > end_ - pos_) {
+					throw corrupt_cache();
+				}
+
+				return count;
+			}
+
+			void readFilenames() {
+				const int count = readCount();
+				for(int n = 0; n != count; ++n) {
+					filenames_.push_back(intern_filename(readString()));
+				}
+			}
+
+			variant readValue() {
+				const TAG tag = static_cast<TAG>(readByte());
+				switch(tag) {
+				case TAG::NULL_VALUE:
+					return variant();
+				case TAG::FALSE_VALUE:
+					return variant::from_bool(false);
+				case TAG::TRUE_VALUE:
+					return variant::from_bool(true);
+				case TAG::INT:
+					return variant(readInt());
+				case TAG::DECIMAL:
+					return variant(decimal::from_raw_value(readInt64()));
+				case TAG::STRING:
+				case TAG::TRANSLATED_STRING: {
+					const std::string s = readString();
+					variant result = tag == TAG::STRING ? variant(s) : variant::create_translated_string(s);
+					readDebugInfo(&result);
+					return result;
+				}
+				case TAG::LIST: {
+					const int count = readCount();
+					std::vector<variant> items;
+					items.reserve(count);
+					for(int n = 0; n != count; ++n) {
+						items.push_back(readValue());
+					}
+
+					variant result(&items);
+					readDebugInfo(&result);
+					return result;
+				}
+				case TAG::MAP: {
+					const int count = readCount();
+					std::map<variant,variant> items;
+					for(int n = 0; n != count; ++n) {
+						variant key = readValue();
+						items[key] = readValue();
+					}
+
+					variant result(&items);
+					readDebugInfo(&result);
+					return result;
+				}
+				default:
+					throw corrupt_cache();
+				}
+			}
+
+			bool atEnd() const { return pos_ == end_; }
+		private:
+			void need(std::ptrdiff_t n) {
+				if(end_ - pos_ < n) {
+					throw corrupt_cache();
+				}
+			}
+
+			void readDebugInfo(variant* v) {
+				if(readByte() == 0) {
+					return;
+				}
+
+				const int32_t index = readInt();
+				if(index < 0 || static_cast<size_t>(index) >= filenames_.size()) {
+					throw corrupt_cache();
+				}
+
+				variant::debug_info info;
+				info.filename = filenames_[index];
+				info.line = readInt();
+				info.column = readInt();
+				info.end_line = readInt();
+				info.end_column = readInt();
+				v->setDebugInfo(info);
+			}
+
+			const char* pos_;
+			const char* end_;
+			std::vector<const std::string*> filenames_;
+		};
+
+		std::string encode(const std::string& key, const variant& v, const std::vector<Dependency>& deps)
+		{
+			Writer body;
+			body.writeValue(v);
+
+			Writer header;
+			for(char c : Magic) {
+				header.writeByte(static_cast<unsigned char>(c));
+			}
+
+			header.writeInt(FormatVersion);
+			header.writeString(preferences::version());
+			header.writeString(key);
+
+			header.writeInt(static_cast<int32_t>(deps.size()));
+			for(const Dependency& dep : deps) {
+				header.writeString(dep.fname);
+				header.writeString(dep.hash);
+			}
+
+			header.writeInt(static_cast<int32_t>(body.filenames().size()));
+			for(const std::string& fname : body.filenames()) {
+				header.writeString(fname);
+			}
+
+			return header.data() + body.data();
+		}
+
+		//reads up to the dependencies, returning false if the data was
+		//written by a different version or for a different key.
+		bool decode_header(Reader& reader, const std::string& key, std::vector<Dependency>* deps)
+		{
+			for(char c : Magic) {
+				if(reader.readByte() != static_cast<unsigned char>(c)) {
+					return false;
+				}
+			}
+
+			if(reader.readInt() != FormatVersion || reader.readString() != preferences::version() || reader.readString() != key) {
+				return false;
+			}
+
+			const int ndeps = reader.readCount();
+			for(int n = 0; n != ndeps; ++n) {
+				Dependency dep;
+				dep.fname = reader.readString();
+				dep.hash = reader.readString();
+				deps->push_back(dep);
+			}
+
+			return true;
+		}
+
+		variant decode_body(Reader& reader)
+		{
+			reader.readFilenames();
+			variant result = reader.readValue();
+			if(!reader.atEnd()) {
+				throw corrupt_cache();
+			}
+
+			return result;
+		}
+	}
+
+	bool enabled()
+	{
+		return g_binary_cache;
+	}
+
+	DependencyScope::DependencyScope() : parent_(g_current_scope)
+	{
+		g_current_scope = this;
+	}
+
+	DependencyScope::~DependencyScope()
+	{
+		g_current_scope = parent_;
+	}
+
+	void note_file_read(const std::string& fname, const std::string& hash)
+	{
+		for(DependencyScope* scope = g_current_scope; scope != nullptr; scope = scope->parent_) {
+			bool found = false;
+			for(const Dependency& dep : scope->deps_) {
+				if(dep.fname == fname) {
+					found = true;
+					break;
+				}
+			}
+
+			if(!found) {
+				Dependency dep = { fname, hash };
+				scope->deps_.push_back(dep);
+			}
+		}
+	}
+
+	void note_eval()
+	{
+		note_file_read(EvalMarker, "");
+	}
+
+	bool store(const std::string& key, const variant& v, const std::vector<Dependency>& deps)
+	{
+		for(const Dependency& dep : deps) {
+			if(dep.fname == EvalMarker) {
+				LOG_DEBUG("Not caching " << key << ": it was built using @eval");
+				return false;
+			}
+		}
+
+		std::string data;
+		try {
+			data = encode(key, v, deps);
+		} catch(unencodable_value&) {
+			LOG_DEBUG("Not caching " << key << ": it holds values which can't be stored");
+			return false;
+		}
+
+		sys::write_file(cache_path(key), data);
+		return true;
+	}
+
+	variant load(const std::string& key, std::vector<Dependency>* deps_out)
+	{
+		const std::string path = cache_path(key);
+		if(!sys::file_exists(path)) {
+			return variant();
+		}
+
+		const std::string data = sys::read_file(path);
+
+		try {
+			Reader reader(data.c_str(), data.c_str() + data.size());
+			std::vector<Dependency> deps;
+			if(!decode_header(reader, key, &deps)) {
+				return variant();
+			}
+
+			std::vector<std::string> contents;
+			for(const Dependency& dep : deps) {
+				contents.push_back(json::get_file_contents(dep.fname));
+				if(md5::sum(contents.back()) != dep.hash) {
+					return variant();
+				}
+			}
+
+			{
+				//the files are verified just as they would be if parsed.
+				//load() may be run from several threads at once.
+				static std::mutex verify_mutex;
+				std::lock_guard<std::mutex> lock(verify_mutex);
+				for(int n = 0; n != static_cast<int>(deps.size()); ++n) {
+					checksum::verify_file(deps[n].fname, contents[n]);
+				}
+			}
+
+			variant result = decode_body(reader);
+
+			//anything being built from this depends on the same files.
+			for(const Dependency& dep : deps) {
+				note_file_read(dep.fname, dep.hash);
+			}
+
+			if(deps_out) {
+				deps_out->swap(deps);
+			}
+
+			return result;
+		} catch(corrupt_cache&) {
+			LOG_INFO("Ignoring corrupt binary cache file " << path);
+			return variant();
+		}
+	}
+
+	UNIT_TEST(binary_cache_roundtrip)
+	{
+		const variant v = json::parse("{\n  a: [1, 2.5, null, true, \"str\"],\n  b: {c: ~hello~, d: false},\n}");
+
+		std::vector<Dependency> deps;
+		Dependency dep = { "data/objects/test.cfg", "0123" };
+		deps.push_back(dep);
+
+		const std::string data = encode("test-key", v, deps);
+		Reader reader(data.c_str(), data.c_str() + data.size());
+
+		std::vector<Dependency> decoded_deps;
+		CHECK_EQ(decode_header(reader, "test-key", &decoded_deps), true);
+		CHECK_EQ(static_cast<int>(decoded_deps.size()), 1);
+		CHECK_EQ(decoded_deps[0].fname, dep.fname);
+		CHECK_EQ(decoded_deps[0].hash, dep.hash);
+
+		const variant result = decode_body(reader);
+		CHECK_EQ(result, v);
+		CHECK_EQ(result["a"][1].is_decimal(), true);
+		CHECK_EQ(result["b"]["c"].get_translated_from() != nullptr, true);
+
+		const variant::debug_info* info = result["a"].get_debug_info();
+		CHECK_EQ(info != nullptr, true);
+		CHECK_EQ(info->line, v["a"].get_debug_info()->line);
+		CHECK_EQ(info->column, v["a"].get_debug_info()->column);
+
+		std::map<variant,variant> m;
+		m[variant("obj")] = variant(new game_logic::MapFormulaCallable);
+		bool rejected = false;
+		try {
+			encode("test-key", variant(&m), deps);
+		} catch(unencodable_value&) {
+			rejected = true;
+		}
+
+		CHECK_EQ(rejected, true);
+
+		//truncated data must be refused rather than misread.
+		Reader truncated(data.c_str(), data.c_str() + data.size() - 1);
+		decoded_deps.clear();
+		bool corrupt = false;
+		try {
+			decode_header(truncated, "test-key", &decoded_deps);
+			decode_body(truncated);
+		} catch(corrupt_cache&) {
+			corrupt = true;
+		}
+
+		CHECK_EQ(corrupt, true);
+
+		//an entry is only ever read back under the key it was stored with.
+		Reader other(data.c_str(), data.c_str() + data.size());
+		decoded_deps.clear();
+		CHECK_EQ(decode_header(other, "test_key", &decoded_deps), false);
+	}
+
+	UNIT_TEST(binary_cache_path)
+	{
+		//keys that only differ in characters which can't go in a filename
+		//must still get their own files.
+		CHECK_NE(cache_path("level-mod-a:b.cfg"), cache_path("level-mod-a_b.cfg"));
+		CHECK_NE(cache_path("level-mod-a/b.cfg"), cache_path("level-mod-a:b.cfg"));
+		CHECK_EQ(cache_path("level-mod-a:b.cfg"), cache_path("level-mod-a:b.cfg"));
+	}
+
+	UNIT_TEST(binary_cache_refuses_eval)
+	{
+		std::vector<Dependency> deps;
+		{
+			DependencyScope scope;
+			note_file_read("data/objects/test.cfg", "0123");
+			note_eval();
+			deps = scope.dependencies();
+		}
+
+		CHECK_EQ(store("test-eval", variant(1), deps), false);
+	}
+
+	BENCHMARK(binary_cache_decode)
+	{
+		std::ostringstream doc;
+		doc << "{\n\tobjects: [\n";
+		for(int n = 0; n != 2000; ++n) {
+			doc << "\t\t{ type: \"object_" << (n%50) << "\", x: " << n << ", y: " << (n*7) << ", label: \"some text\", flags: [true, false, null], scale: 1.5 },\n";
+		}
+		doc << "\t],\n}\n";
+
+		const std::string data = encode("bench", json::parse(doc.str()), std::vector<Dependency>());
+		BENCHMARK_LOOP {
+			Reader reader(data.c_str(), data.c_str() + data.size());
+			std::vector<Dependency> deps;
+			decode_header(reader, "bench", &deps);
+			decode_body(reader);
+		}
+	}
+}
@@ -0,0 +1,79 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "variant.hpp"
+
+//An on-disk cache of variant trees built from data files -- object types
+//merged with their prototypes, levels -- kept in a compact binary form so
+//they can be loaded without parsing. Each entry records the files it was
+//built from along with their hashes, and is ignored once any of them
+//changes or the engine version differs.
+namespace binary_cache
+{
+	bool enabled();
+
+	struct Dependency
+	{
+		std::string fname, hash;
+	};
+
+	//Records every file read through json::parse_from_file on this thread
+	//while it is in scope, including by nested scopes.
+	class DependencyScope
+	{
+	public:
+		DependencyScope();
+		~DependencyScope();
+
+		const std::vector<Dependency>& dependencies() const { return deps_; }
+	private:
+		DependencyScope(const DependencyScope&);
+		void operator=(const DependencyScope&);
+
+		std::vector<Dependency> deps_;
+		DependencyScope* parent_;
+
+		friend void note_file_read(const std::string& fname, const std::string& hash);
+	};
+
+	//called by the json parser for each file it parses.
+	void note_file_read(const std::string& fname, const std::string& hash);
+
+	//called by the preprocessor when it evaluates @eval. Its result can
+	//depend on more than the files read, so values built while it happens
+	//are never stored.
+	void note_eval();
+
+	//Stores v under key. Returns false, storing nothing, if v holds values
+	//which can't be written, such as callables, or was built using @eval.
+	bool store(const std::string& key, const variant& v, const std::vector<Dependency>& deps);
+
+	//Returns the value stored under key, or null if there is none or it is
+	//stale. deps, if given, receives the files the value was built from.
+	variant load(const std::string& key, std::vector<Dependency>* deps=nullptr);
+}
@@ -0,0 +1,181 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "asserts.hpp"
+#include "chunking.hpp"
+#include "md5.hpp"
+#include "unit_test.hpp"
+
+namespace chunking
+{
+	namespace
+	{
+		//a cut point needs the top bits of the hash to be clear, giving
+		//chunks of AverageChunkSize past the minimum on average.
+		const uint64_t CutMask = ~(~uint64_t(0) >> 13);
+
+		struct GearTable
+		{
+			uint64_t values[256];
+
+			//the table must be the same in every build, since chunks are
+			//matched against ones cut on other machines.
+			GearTable() {
+				uint64_t state = 0x2545f4914f6cdd1dULL;
+				for(uint64_t& v : values) {
+					//splitmix64
+					state += 0x9e3779b97f4a7c15ULL;
+					uint64_t z = state;
+					z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+					z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+					v = z ^ (z >> 31);
+				}
+			}
+		};
+
+		const GearTable& gear()
+		{
+			static const GearTable table;
+			return table;
+		}
+
+		size_t find_cut(const unsigned char* p, size_t len)
+		{
+			if(len <= MinChunkSize) {
+				return len;
+			}
+
+			const size_t end = std::min(len, MaxChunkSize);
+			const uint64_t* table = gear().values;
+
+			//each byte shifts the hash left one, so it only depends on the
+			//last 64 bytes and resynchronizes shortly after an edit.
+			uint64_t hash = 0;
+			for(size_t i = MinChunkSize; i < end; ++i) {
+				hash = (hash << 1) + table[p[i]];
+				if((hash & CutMask) == 0) {
+					return i + 1;
+				}
+			}
+
+			return end;
+		}
+	}
+
+	std::vector<Chunk> split(const std::string& data)
+	{
+		std::vector<Chunk> result;
+		result.reserve(data.size()/AverageChunkSize + 1);
+
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(data.c_str());
+		size_t offset = 0;
+		while(offset < data.size()) {
+			const size_t size = find_cut(p + offset, data.size() - offset);
+			Chunk chunk = { offset, size };
+			result.push_back(chunk);
+			offset += size;
+		}
+
+		return result;
+	}
+}
+
+namespace
+{
+	std::string chunk_test_data(size_t size, uint32_t seed)
+	{
+		std::string result(size, '\0');
+		for(char& c : result) {
+			seed = seed*1103515245 + 12345;
+			c = static_cast<char>(seed >> 16);
+		}
+		return result;
+	}
+
+	std::vector<std::string> chunk_sums(const std::string& data)
+	{
+		std::vector<std::string> result;
+		for(const chunking::Chunk& chunk : chunking::split(data)) {
+			result.push_back(md5::sum(data.substr(chunk.offset, chunk.size)));
+		}
+		return result;
+	}
+}
+
+UNIT_TEST(chunking_covers_data)
+{
+	CHECK_EQ(chunking::split("").size(), 0);
+	CHECK_EQ(chunking::split("abc").size(), 1);
+
+	const std::string data = chunk_test_data(1 << 20, 7);
+	size_t offset = 0;
+	const std::vector<chunking::Chunk> chunks = chunking::split(data);
+	for(int n = 0; n != static_cast<int>(chunks.size()); ++n) {
+		CHECK_EQ(chunks[n].offset, offset);
+		CHECK_LE(chunks[n].size, chunking::MaxChunkSize);
+		if(n+1 != static_cast<int>(chunks.size())) {
+			CHECK_GT(chunks[n].size, chunking::MinChunkSize);
+		}
+		offset += chunks[n].size;
+	}
+
+	CHECK_EQ(offset, data.size());
+
+	//a run of identical bytes never cuts, so it's split at the maximum.
+	const std::string zeros(chunking::MaxChunkSize*2 + 100, '\0');
+	CHECK_EQ(chunking::split(zeros).size(), 3);
+}
+
+UNIT_TEST(chunking_survives_edits)
+{
+	const std::string data = chunk_test_data(1 << 20, 11);
+	const std::vector<std::string> before = chunk_sums(data);
+
+	std::string edited = data;
+	edited.insert(edited.size()/2, "an insertion in the middle of the data");
+	edited[edited.size()/4] ^= 0x55;
+	const std::vector<std::string> after = chunk_sums(edited);
+
+	int changed = 0;
+	for(const std::string& sum : after) {
+		if(std::find(before.begin(), before.end(), sum) == before.end()) {
+			++changed;
+		}
+	}
+
+	//each edit should only disturb the chunk it lands in and perhaps the
+	//one after.
+	CHECK_LE(changed, 4);
+	CHECK_GT(static_cast<int>(after.size()), 32);
+}
+
+BENCHMARK(chunking_split)
+{
+	static const std::string data = chunk_test_data(8 << 20, 3);
+	BENCHMARK_LOOP {
+		chunking::split(data);
+	}
+}
@@ -0,0 +1,47 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+//Content-defined chunking: splits data where a rolling hash of the last
+//few dozen bytes matches a pattern, rather than at fixed offsets. An edit
+//only changes the chunks around it; the chunks before and after it come
+//out the same as they did for the old data, so they needn't be sent again.
+namespace chunking
+{
+	static const size_t MinChunkSize = 2048;
+	static const size_t AverageChunkSize = 8192;
+	static const size_t MaxChunkSize = 65536;
+
+	struct Chunk
+	{
+		size_t offset, size;
+	};
+
+	//splits data into chunks which cover it in order. Data of up to
+	//MinChunkSize bytes is a single chunk, and empty data has none.
+	std::vector<Chunk> split(const std::string& data);
+}
@@ -29,6 +29,7 @@
 #include "object_events.hpp"
 #include "rectangle_rotator.hpp"
 #include "solid_map.hpp"
+#include "user_collision_grid.hpp"
 
 namespace 
 {
@@ -351,7 +352,7 @@ bool entity_collides_with_level(const Level& lvl, const Entity& e, MOVE_DIRECTIO
 	}
 
 	for(const ConstSolidMapPtr& m : s->solid()) {
-		if(lvl.solid(e, m->dir(dir), info ? &info->surf_info : nullptr)) {
+		if(lvl.solid(e, m->dirSpans(dir), info ? &info->surf_info : nullptr)) {
 			if(info) {
 				info->readSurfInfo();
 			}
@@ -502,6 +503,37 @@ bool place_entity_in_level_with_large_displacement(Level& lvl, Entity& e)
 	return true;
 }
 
+namespace
+{
+	//the rect that an entity's collision area may touch. For rotated entities
+	//this is a conservative square around the area.
+	rect collision_area_bounding_rect(const rect& r, int rotation)
+	{
+		if(rotation == 0) {
+			return r;
+		}
+
+		const int center_x = r.x() + r.w()/2;
+		const int center_y = r.y() + r.h()/2;
+		const int dim = std::max(r.w(), r.h());
+
+		return rect(center_x - dim/2 - 1, center_y - dim/2 - 1, dim+2, dim+2);
+	}
+}
+
+rect entity_user_collision_bounds(const Entity& e)
+{
+	const Frame& f = e.getCurrentFrame();
+	const int rotation = e.currentRotation();
+
+	rect result;
+	for(const auto& area : f.getCollisionAreas()) {
+		result = rect_union(result, collision_area_bounding_rect(e.calculateCollisionRect(f, area), rotation));
+	}
+
+	return result;
+}
+
 int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas_colliding, int buf_size)
 {
 	const Frame& fa = a.getCurrentFrame();
@@ -532,27 +564,8 @@ int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas
 			if(rotate_a != 0 || rotate_b != 0) {
 				//calculate axis-aligned bounding rects to
 				//try to exclude any possible collision quickly.
-				rect bounding_a, bounding_b;
-
-				if(rotate_a == 0) {
-					bounding_a = rect_a;
-				} else {
-					const int center_x = rect_a.x() + rect_a.w()/2;
-					const int center_y = rect_a.y() + rect_a.h()/2;
-					const int dim = std::max(rect_a.w(), rect_a.h());
-
-					bounding_a = rect(center_x - dim/2 - 1, center_y - dim/2 - 1, dim+2, dim+2);
-				}
-
-				if(rotate_b == 0) {
-					bounding_b = rect_b;
-				} else {
-					const int center_x = rect_b.x() + rect_b.w()/2;
-					const int center_y = rect_b.y() + rect_b.h()/2;
-					const int dim = std::max(rect_b.w(), rect_b.h());
-
-					bounding_b = rect(center_x - dim/2 - 1, center_y - dim/2 - 1, dim+2, dim+2);
-				}
+				const rect bounding_a = collision_area_bounding_rect(rect_a, rotate_a);
+				const rect bounding_b = collision_area_bounding_rect(rect_b, rotate_b);
 
 				if(rects_intersect(bounding_a, bounding_b)) {
 					const int Stride = 2;
@@ -756,11 +769,22 @@ void detect_user_collisions(Level& lvl)
 {
 	std::vector<EntityPtr> chars;
 	chars.reserve(lvl.get_active_chars().size());
+
+	//keep the broad-phase grid in sync with where everything is this cycle.
+	UserCollisionGrid& grid = lvl.user_collision_grid();
+	grid.beginUpdate();
 	for(const EntityPtr& a : lvl.get_active_chars()) {
 		if(a->getWeakCollideDimensions() != 0 && a->getCurrentFrame().getCollisionAreas().empty() == false) {
+			grid.add(a.get(), static_cast<int>(chars.size()), entity_user_collision_bounds(*a), a->getCollideDimensions(), a->getWeakCollideDimensions());
 			chars.push_back(a);
 		}
 	}
+	grid.endUpdate();
+
+	//candidates come back sorted, so collisions are found in the same order
+	//as testing every pair would find them.
+	std::vector<std::pair<int,int> > candidates;
+	grid.getCandidatePairs(&candidates);
 
 	typedef std::pair<EntityPtr, const std::string*> collision_key;
 	std::map<collision_key, std::vector<collision_key> > collision_info;
@@ -769,30 +793,22 @@ void detect_user_collisions(Level& lvl)
 
 	const int MaxCollisions = 16;
 	CollisionPair collision_buf[MaxCollisions];
-	for(std::vector<EntityPtr>::const_iterator i = chars.begin(); i != chars.end(); ++i) {
-		for(std::vector<EntityPtr>::const_iterator j = i + 1; j != chars.end(); ++j) {
-			const EntityPtr& a = *i;
-			const EntityPtr& b = *j;
-			if(a == b ||
-			   ((a->getWeakCollideDimensions()&b->getCollideDimensions()) == 0 &&
-			   (a->getCollideDimensions()&b->getWeakCollideDimensions()) == 0)) {
-				//the objects do not share a dimension, and so can't collide.
-				continue;
-			}
+	for(const std::pair<int,int>& candidate : candidates) {
+		const EntityPtr& a = chars[candidate.first];
+		const EntityPtr& b = chars[candidate.second];
 
-			int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
-			if(ncollisions > MaxCollisions) {
-				ncollisions = MaxCollisions;
-			}
+		int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
+		if(ncollisions > MaxCollisions) {
+			ncollisions = MaxCollisions;
+		}
 
-			for(int n = 0; n != ncollisions; ++n) {
-				{
-					collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
-				}
+		for(int n = 0; n != ncollisions; ++n) {
+			{
+				collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
+			}
 
-				{
-					collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
-				}
+			{
+				collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
 			}
 		}
 	}
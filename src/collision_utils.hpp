@@ -123,6 +123,10 @@ bool non_solid_entity_collides_with_level(const Level& lvl, const Entity& e);
 typedef std::pair<const std::string*, const std::string*> CollisionPair;
 int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas_colliding, int buf_size);
 
+//function which returns a rect containing everywhere the collision areas
+//of the entity could collide with another entity's collision areas.
+rect entity_user_collision_bounds(const Entity& e);
+
 //function which returns true iff area_a of 'a' collides with area_b of 'b'
 bool entity_user_collision_specific_areas(const Entity& a, const std::string& area_a, const Entity& b, const std::string& area_b);
 
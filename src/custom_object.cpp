@@ -1653,6 +1653,57 @@ void CustomObject::draw(int xx, int yy) const
 	}
 }
 
+bool CustomObject::getAutoBatchItem(Frame::BatchDrawItem* item) const
+{
+	if(frame_ == nullptr || shader_ || type_->drawBatchID().empty() == false) {
+		return false;
+	}
+
+	if(type_->isHiddenInGame() || type_->isShadow()) {
+		return false;
+	}
+
+	if(blur_objects_.empty() == false || attachedObjects().empty() == false || effects_shaders_.empty() == false || draw_primitives_.empty() == false || widgets_.empty() == false || particle_systems_.empty() == false) {
+		return false;
+	}
+
+	if(use_absolute_screen_coordinates_ || clip_area_ || driver_ || draw_color_ || custom_draw_ || custom_draw_xy_.empty() == false || draw_area_ || draw_scale_ || text_ || particles_ || document_ || platform_area_) {
+		return false;
+	}
+
+	if(getRotateZ() != decimal() || parallaxScaleMillis() != nullptr || preferences::show_debug_hitboxes() || Level::current().debug_properties().empty() == false) {
+		return false;
+	}
+
+	int draw_x = x();
+	int draw_y = y();
+
+	if(g_draw_objects_on_even_pixel_boundaries) {
+		draw_x -= draw_x%2;
+		draw_y -= draw_y%2;
+	}
+
+	item->frame = frame_.get();
+	item->x = draw_x;
+	item->y = draw_y;
+	item->face_right = isFacingRight();
+	item->upside_down = isUpsideDown();
+	item->time = time_in_frame_;
+	item->rotate = 0.0f;
+	item->scale = 1.0f;
+	return true;
+}
+
+void CustomObject::drawAutoBatch(const Frame::BatchDrawItem* i1, const Frame::BatchDrawItem* i2)
+{
+	//draw() drops any clip scope left by a previous object that didn't
+	//clip; batched objects never clip, so do the same here.
+	g_clip_stencil_scope.reset();
+	g_clip_stencil_rect.reset();
+
+	Frame::drawAutoBatch(i1, i2);
+}
+
 void CustomObject::drawGroup() const
 {
 	auto wnd = KRE::WindowManager::getMainWindow();
@@ -3756,6 +3807,27 @@ int CustomObject::getValueSlot(const std::string& key) const
 	return type_->callableDefinition()->getSlot(key);
 }
 
+const reference_counted_object* CustomObject::getSlotLayout() const
+{
+	return type_->callableDefinition().get();
+}
+
+int CustomObject::getCacheableSlot(const std::string& key) const
+{
+	//only the slots getValue() itself reads by slot: builtins and
+	//properties of the type.
+	const int slot = type_->callableDefinition()->getSlot(key);
+	if(slot >= 0 && slot < NUM_CUSTOM_OBJECT_PROPERTIES) {
+		return slot;
+	}
+
+	if(slot >= type_->getSlotPropertiesBase() && size_t(slot - type_->getSlotPropertiesBase()) < type_->getSlotProperties().size()) {
+		return slot;
+	}
+
+	return -1;
+}
+
 variant CustomObject::getValue(const std::string& key) const
 {
 	const int slot = type_->callableDefinition()->getSlot(key);
@@ -3825,6 +3897,9 @@ void CustomObject::getInputs(std::vector<game_logic::FormulaInput>* inputs) cons
 
 void CustomObject::setValue(const std::string& key, const variant& value)
 {
+	activationChanged();
+	writeBarrier();
+
 	const int slot = CustomObjectCallable::getKeySlot(key);
 	if(slot != -1) {
 		setValueBySlot(slot, value);
@@ -4117,6 +4192,9 @@ void CustomObject::setValue(const std::string& key, const variant& value)
 
 void CustomObject::setValueBySlot(int slot, const variant& value)
 {
+	activationChanged();
+	writeBarrier();
+
 	switch(slot) {
 	case CUSTOM_OBJECT_DATA: {
 		ASSERT_LOG(active_property_ >= 0, "Illegal access of 'data' in object when not in writable property");
@@ -5360,6 +5438,38 @@ bool CustomObject::isActive(const rect& screen_area) const
 	return false;
 }
 
+bool CustomObject::getActivationBounds(rect* bounds) const
+{
+	//these all make isActive() depend on more than where the object is.
+	if(controls::num_players() > 1 || isAlwaysActive() || useAbsoluteScreenCoordinates() || type_->goesInactiveOnlyWhenStanding()) {
+		return false;
+	}
+
+	if(parallax_scale_millis_.get() != nullptr && (parallax_scale_millis_->first != 1000 || parallax_scale_millis_->second != 1000)) {
+		return false;
+	}
+
+	if(activation_area_) {
+		*bounds = *activation_area_;
+		return true;
+	}
+
+	rect result;
+	if(text_) {
+		result = rect(x(), y(), text_->dimensions.w(), text_->dimensions.h());
+	}
+
+	const rect& area = frameRect();
+	if(draw_area_) {
+		*bounds = rect_union(result, rect(area.x(), area.y(), draw_area_->w()*2, draw_area_->h()*2));
+		return true;
+	}
+
+	const int border = std::max(activation_border_, 0);
+	*bounds = rect_union(result, rect(area.x() - border, area.y() - border, area.w() + border*2, area.h() + border*2));
+	return true;
+}
+
 bool CustomObject::moveToStanding(Level& lvl, int max_displace)
 {
 	int start_y = y();
@@ -6015,6 +6125,8 @@ void CustomObject::removeParticleSystem(const std::string& key)
 
 void CustomObject::setText(const std::string& text, const std::string& font, int size, int align)
 {
+	activationChanged();
+
 	text_.reset(new CustomObjectText);
 	text_->text = text;
 	text_->font = GraphicalFont::get(font);
@@ -6463,6 +6575,42 @@ BENCHMARK(custom_object_spike) {
 	}
 }
 
+//measures the cost of finding user collisions with an increasing number of
+//colliding objects packed into the same area.
+BENCHMARK_ARG(custom_object_user_collisions, int nobjects)
+{
+	static std::map<int, LevelPtr> levels;
+	LevelPtr& lvl = levels[nobjects];
+	if(!lvl) {
+		lvl.reset(new Level("test.cfg"));
+		lvl->finishLoading();
+
+		//spread the objects out so the density stays roughly constant as the
+		//count goes up, like a busy screen of bullets scrolling past.
+		const int area_width = 20*nobjects;
+		for(int n = 0; n != nobjects; ++n) {
+			const int x = (n*7919)%area_width;
+			const int y = (n*104729)%480;
+			EntityPtr obj(new CustomObject("ant_black", x, y, (n%2) == 0));
+			obj->mutateValue("always_active", variant::from_bool(true));
+			lvl->add_character(obj);
+		}
+	}
+
+	lvl->setAsCurrentLevel();
+	lvl->set_active_chars();
+	BENCHMARK_LOOP {
+		detect_user_collisions(*lvl);
+	}
+}
+
+BENCHMARK_ARG_CALL(custom_object_user_collisions, objects_50, 50);
+BENCHMARK_ARG_CALL(custom_object_user_collisions, objects_100, 100);
+BENCHMARK_ARG_CALL(custom_object_user_collisions, objects_200, 200);
+BENCHMARK_ARG_CALL(custom_object_user_collisions, objects_400, 400);
+BENCHMARK_ARG_CALL(custom_object_user_collisions, objects_800, 800);
+BENCHMARK_ARG_CALL(custom_object_user_collisions, objects_1600, 1600);
+
 int CustomObject::events_handled_per_second = 0;
 
 BENCHMARK_ARG(custom_object_get_attr, const std::string& attr)
@@ -94,6 +94,10 @@ public:
 	virtual void draw(int xx, int yy) const override;
 	virtual void drawLater(int x, int y) const override;
 	virtual void drawGroup() const override;
+	virtual bool getAutoBatchItem(Frame::BatchDrawItem* item) const override;
+
+	//draws objects previously accepted by getAutoBatchItem() in one call.
+	static void drawAutoBatch(const Frame::BatchDrawItem* i1, const Frame::BatchDrawItem* i2);
 	virtual void process(Level& lvl) override;
 	virtual void construct();
 	virtual bool createObject() override;
@@ -147,6 +151,7 @@ public:
 	void die();
 	void dieWithNoEvent() override;
 	virtual bool isActive(const rect& screen_area) const override;
+	bool getActivationBounds(rect* bounds) const override;
 	bool diesOnInactive() const override;
 	bool isAlwaysActive() const override;
 	bool moveToStanding(Level& lvl, int max_displace=10000) override;
@@ -295,6 +300,8 @@ protected:
 	int getValueSlot(const std::string& key) const override;
 	variant getValue(const std::string& key) const override;
 	variant getValueBySlot(int slot) const override;
+	const reference_counted_object* getSlotLayout() const override;
+	int getCacheableSlot(const std::string& key) const override;
 	void setValue(const std::string& key, const variant& value) override;
 	void setValueBySlot(int slot, const variant& value) override;
 
@@ -23,8 +23,10 @@
 
 #include <cassert>
 #include <iostream>
+#include <thread>
 
 #include "asserts.hpp"
+#include "binary_cache.hpp"
 #include "code_editor_dialog.hpp"
 #include "collision_utils.hpp"
 #include "custom_object.hpp"
@@ -51,6 +53,7 @@
 #include "unit_test.hpp"
 #include "variant_callable.hpp"
 #include "variant_utils.hpp"
+#include "worker_pool.hpp"
 
 using game_logic::FormulaCallableDefinition;
 using game_logic::FormulaCallableDefinitionPtr;
@@ -82,6 +85,8 @@ namespace
 	PREF_BOOL(strict_mode_warnings, false, "If turned on, all objects will be run in strict mode, with errors non-fatal");
 	PREF_BOOL(suppress_strict_mode, false, "If turned on, turns off strict mode checking on all objects");
 	PREF_BOOL(force_strict_mode, false, "If turned on, turns on strict mode checking on all objects");
+	PREF_BOOL(preload_object_types, false, "Load every object type at startup instead of when first used");
+	PREF_INT(object_loading_threads, 0, "Number of threads used to decode cached object types when preloading them, or 0 for one per core");
 
 	bool custom_object_strict_mode = false;
 
@@ -819,6 +824,49 @@ void CustomObjectType::ReloadFilePaths()
 }
 
 
+namespace
+{
+	//loads a prototype, with its own prototypes merged in.
+	variant load_prototype(const std::string& proto, std::vector<std::string>* proto_paths)
+	{
+		std::map<std::string, std::string>::const_iterator path_itor = module::find(::prototype_file_paths(), proto + ".cfg");
+		ASSERT_LOG(path_itor != ::prototype_file_paths().end(), "Could not find file for prototype '" << proto << "'");
+
+		variant prototype_node = json::parse_from_file(path_itor->second);
+		ASSERT_LOG(prototype_node["id"].as_string() == proto, "PROTOTYPE NODE FOR " << proto << " DOES NOT SPECIFY AN ACCURATE id FIELD");
+		if(proto_paths) {
+			proto_paths->push_back(path_itor->second);
+		}
+		return CustomObjectType::mergePrototype(prototype_node, proto_paths);
+	}
+
+	struct MergedPrototype
+	{
+		variant node;
+		std::vector<std::string> paths;
+		std::vector<binary_cache::Dependency> deps;
+	};
+
+	//set while preloading, so a prototype shared by many objects is only
+	//loaded and merged once.
+	std::map<std::string, MergedPrototype>* g_merged_prototypes = nullptr;
+
+	class MergedPrototypeScope
+	{
+	public:
+		MergedPrototypeScope() : old_(g_merged_prototypes) {
+			g_merged_prototypes = &prototypes_;
+		}
+
+		~MergedPrototypeScope() {
+			g_merged_prototypes = old_;
+		}
+	private:
+		std::map<std::string, MergedPrototype> prototypes_;
+		std::map<std::string, MergedPrototype>* old_;
+	};
+}
+
 //function which finds if a node has a prototype, and if so, applies the
 //prototype to the node.
 variant CustomObjectType::mergePrototype(variant node, std::vector<std::string>* proto_paths)
@@ -833,17 +881,33 @@ variant CustomObjectType::mergePrototype(variant node, std::vector<std::string>*
 	}
 
 	for(const std::string& proto : protos) {
-		//look up the object's prototype and merge it in
-		std::map<std::string, std::string>::const_iterator path_itor = module::find(::prototype_file_paths(), proto + ".cfg");
-		ASSERT_LOG(path_itor != ::prototype_file_paths().end(), "Could not find file for prototype '" << proto << "'");
+		if(g_merged_prototypes == nullptr) {
+			//look up the object's prototype and merge it in
+			node = merge_into_prototype(load_prototype(proto, proto_paths), node);
+			continue;
+		}
+
+		auto itor = g_merged_prototypes->find(proto);
+		if(itor == g_merged_prototypes->end()) {
+			MergedPrototype merged;
+			{
+				binary_cache::DependencyScope deps;
+				merged.node = load_prototype(proto, &merged.paths);
+				merged.deps = deps.dependencies();
+			}
+			itor = g_merged_prototypes->insert(std::make_pair(proto, merged)).first;
+		} else {
+			//the files were read the first time; report them again so
+			//binary cache entries built from this still depend on them.
+			for(const binary_cache::Dependency& dep : itor->second.deps) {
+				binary_cache::note_file_read(dep.fname, dep.hash);
+			}
+		}
 
-		variant prototype_node = json::parse_from_file(path_itor->second);
-		ASSERT_LOG(prototype_node["id"].as_string() == proto, "PROTOTYPE NODE FOR " << proto << " DOES NOT SPECIFY AN ACCURATE id FIELD");
 		if(proto_paths) {
-			proto_paths->push_back(path_itor->second);
+			proto_paths->insert(proto_paths->end(), itor->second.paths.begin(), itor->second.paths.end());
 		}
-		prototype_node = mergePrototype(prototype_node, proto_paths);
-		node = merge_into_prototype(prototype_node, node);
+		node = merge_into_prototype(itor->second.node, node);
 	}
 	return node;
 }
@@ -919,6 +983,21 @@ CustomObjectTypePtr CustomObjectType::create(const std::string& id)
 namespace 
 {
 	std::map<std::string, std::vector<std::string> > object_prototype_paths;
+
+	std::string object_cache_key(const std::string& id)
+	{
+		return "object-" + module::get_module_name() + "-" + id;
+	}
+
+	struct PreparedNode
+	{
+		variant node;
+		std::vector<binary_cache::Dependency> deps;
+	};
+
+	//nodes made ready by CustomObjectType::preloadAll(), waiting to be
+	//built into types.
+	std::map<std::string, PreparedNode> prepared_nodes;
 }
 
 CustomObjectTypePtr CustomObjectType::recreate(const std::string& id,
@@ -941,7 +1020,34 @@ CustomObjectTypePtr CustomObjectType::recreate(const std::string& id,
 
 	try {
 		std::vector<std::string> proto_paths;
-		variant node = mergePrototype(json::parse_from_file(path_itor->second), &proto_paths);
+		variant node;
+
+		//reloads always come from source, refreshing the cached copy.
+		if(old_type == nullptr) {
+			std::vector<binary_cache::Dependency> deps;
+			auto prepared = prepared_nodes.find(id);
+			if(prepared != prepared_nodes.end()) {
+				node = prepared->second.node;
+				deps.swap(prepared->second.deps);
+				prepared_nodes.erase(prepared);
+			} else if(binary_cache::enabled()) {
+				node = binary_cache::load(object_cache_key(id), &deps);
+			}
+
+			for(const binary_cache::Dependency& dep : deps) {
+				if(dep.fname != path_itor->second) {
+					proto_paths.push_back(dep.fname);
+				}
+			}
+		}
+
+		if(node.is_null()) {
+			binary_cache::DependencyScope deps;
+			node = mergePrototype(json::parse_from_file(path_itor->second), &proto_paths);
+			if(binary_cache::enabled()) {
+				binary_cache::store(object_cache_key(id), node, deps.dependencies());
+			}
+		}
 
 		ASSERT_LOG(node["id"].as_string() == module::get_id(id), "IN " << path_itor->second << " OBJECT ID DOES NOT MATCH FILENAME");
 		
@@ -1133,8 +1239,105 @@ std::map<std::string,CustomObjectType::EditorSummary> CustomObjectType::getEdito
 	return m;
 }
 
+void CustomObjectType::preloadAll()
+{
+	if(!g_preload_object_types) {
+		return;
+	}
+
+	const int start_time = profile::get_tick_time();
+
+	if(object_file_paths().empty()) {
+		load_file_paths();
+	}
+
+	std::vector<std::string> ids;
+	for(const std::string& id : getAllIds()) {
+		if(cache().count(module::get_id(id)) == 0) {
+			ids.push_back(id);
+		}
+	}
+
+	const int scan_time = profile::get_tick_time();
+
+	//each cached node is checked against its files and decoded on its own,
+	//into variants no other thread can see until the loop is done.
+	std::vector<PreparedNode> nodes(ids.size());
+	const int nthreads = g_object_loading_threads > 0 ? g_object_loading_threads : static_cast<int>(std::thread::hardware_concurrency());
+	if(binary_cache::enabled()) {
+		formula_profiler::Instrument instrument("PRELOAD_DECODE");
+		std::vector<std::string> keys;
+		for(const std::string& id : ids) {
+			keys.push_back(object_cache_key(id));
+		}
+
+		worker_pool::parallel_for(static_cast<int>(ids.size()), std::max(1, nthreads), [&nodes, &keys](int n) {
+			try {
+				nodes[n].node = binary_cache::load(keys[n], &nodes[n].deps);
+			} catch(...) {
+				//leave it to be loaded from source, which reports any error.
+				nodes[n] = PreparedNode();
+			}
+		});
+	}
+
+	const int decode_time = profile::get_tick_time();
+
+	MergedPrototypeScope merged_prototypes;
+	int cached = 0;
+	{
+		formula_profiler::Instrument instrument("PRELOAD_MERGE");
+		for(int n = 0; n != static_cast<int>(ids.size()); ++n) {
+			PreparedNode& prepared = nodes[n];
+			if(prepared.node.is_null()) {
+				auto path_itor = module::find(object_file_paths(), ids[n] + ".cfg");
+				if(path_itor == object_file_paths().end()) {
+					continue;
+				}
+
+				try {
+					binary_cache::DependencyScope deps;
+					prepared.node = mergePrototype(json::parse_from_file(path_itor->second));
+					prepared.deps = deps.dependencies();
+				} catch(json::ParseError&) {
+					//reported when the type is created.
+					continue;
+				}
+
+				if(binary_cache::enabled()) {
+					binary_cache::store(object_cache_key(ids[n]), prepared.node, prepared.deps);
+				}
+			} else {
+				++cached;
+			}
+
+			prepared_nodes[ids[n]] = prepared;
+		}
+	}
+
+	const int merge_time = profile::get_tick_time();
+
+	{
+		formula_profiler::Instrument instrument("PRELOAD_BUILD");
+		for(const std::string& id : ids) {
+			get(id);
+		}
+	}
+
+	prepared_nodes.clear();
+
+	const int end_time = profile::get_tick_time();
+	LOG_INFO("Preloaded " << ids.size() << " object types in " << (end_time - start_time) << "ms:"
+		<< " scan " << (scan_time - start_time) << "ms,"
+		<< " decode " << (decode_time - scan_time) << "ms (" << cached << " cached, " << std::max(1, nthreads) << " threads),"
+		<< " merge " << (merge_time - decode_time) << "ms,"
+		<< " build " << (end_time - merge_time) << "ms");
+}
+
 std::vector<ConstCustomObjectTypePtr> CustomObjectType::getAll()
 {
+	preloadAll();
+
 	std::vector<ConstCustomObjectTypePtr> res;
 	for(const std::string& id : getAllIds()) {
 		res.push_back(get(id));
@@ -78,6 +78,12 @@ public:
 	static void invalidateObject(const std::string& id);
 	static void invalidateAllObjects();
 	static std::vector<ConstCustomObjectTypePtr> getAll();
+
+	//Loads every object type that isn't loaded yet, if the
+	//preload_object_types preference is set. Cached nodes are
+	//validated and decoded on worker threads; types are built on this
+	//thread since that compiles formulas and creates textures.
+	static void preloadAll();
 	static std::vector<std::string> getAllIds(bool prototypes=false);
 	static const std::vector<std::string>& possibleIdsIncludingPrototypes();
 
@@ -22,9 +22,12 @@
 */
 
 #include <deque>
+#include <memory>
 
 #include "db_client.hpp"
+#include "db_log_store.hpp"
 #include "filesystem.hpp"
+#include "formatter.hpp"
 #include "json_parser.hpp"
 #include "preferences.hpp"
 #include "unit_test.hpp"
@@ -32,6 +35,8 @@
 
 PREF_STRING(db_json_file, "", "The file to output database content to when using a file to simulate a database");
 PREF_STRING(db_key_prefix, "", "Prefix to put before all requests for keys.");
+PREF_STRING(db_backend, "json", "How the database is stored: 'json' in a single JSON file (or Couchbase, in USE_DBCLIENT builds with no db_json_file), 'log' in an append-only log");
+PREF_STRING(db_log_file, "", "The file to keep the database log in when db_backend is 'log'");
 
 BEGIN_DEFINE_CALLABLE_NOBASE(DbClient)
 BEGIN_DEFINE_FN(read_modify_write, "(string, function(any)->any) ->commands")
@@ -156,6 +161,71 @@ namespace
 		bool dirty_;
 		std::string prefix_;
 	};
+
+	//clients with different key prefixes share the log for a file.
+	std::map<std::string, std::shared_ptr<DbLogStore> > db_log_stores;
+
+	class LogStructuredDbClient : public DbClient
+	{
+	public:
+		LogStructuredDbClient(const std::string& fname, const std::string& prefix) : prefix_(prefix) {
+			std::shared_ptr<DbLogStore>& store = db_log_stores[fname];
+			if(!store) {
+				store.reset(new DbLogStore(fname));
+			}
+
+			store_ = store;
+		}
+
+		bool process(int timeout_us) override {
+			store_->flush();
+			return false;
+		}
+
+		void put(const std::string& key, variant doc, std::function<void()> on_done, std::function<void()> on_error, PUT_OPERATION op=PUT_SET) override
+		{
+			const std::string full_key = prefix_ + key;
+			if((op == PUT_ADD && store_->has(full_key)) || (op == PUT_REPLACE && !store_->has(full_key))) {
+				on_error();
+				return;
+			}
+
+			if(op == PUT_APPEND) {
+				store_->append(full_key, doc);
+			} else {
+				store_->put(full_key, doc);
+			}
+
+			on_done();
+		}
+
+		void get(const std::string& key, std::function<void(variant)> on_done, int lock_seconds, GET_OPERATION op) override {
+			on_done(store_->get(prefix_ + key));
+		}
+
+		void remove(const std::string& key) override {
+			store_->remove(prefix_ + key);
+		}
+
+		//keys are given without this client's prefix, ready to pass to get().
+		void getKeysWithPrefix(const std::string& key, std::function<void(std::vector<variant>)> on_done) override {
+			std::vector<variant> result;
+			for(const std::string& k : store_->getKeysWithPrefix(prefix_ + key)) {
+				result.push_back(variant(k.substr(prefix_.size())));
+			}
+
+			on_done(result);
+		}
+
+	private:
+		std::shared_ptr<DbLogStore> store_;
+		std::string prefix_;
+	};
+
+	DbClientPtr create_log_client(const std::string& prefix)
+	{
+		return DbClientPtr(new LogStructuredDbClient(g_db_log_file.empty() ? "db.log" : g_db_log_file, prefix));
+	}
 }
 
 #ifndef USE_DBCLIENT
@@ -165,6 +235,9 @@ DbClientPtr DbClient::create(const char* prefix)
 	if(prefix == nullptr) {
 		prefix = g_db_key_prefix.c_str();
 	}
+	if(g_db_backend == "log") {
+		return create_log_client(prefix);
+	}
 	return DbClientPtr(new FileBackedDbClient(g_db_json_file.empty() ? "db.json" : g_db_json_file.c_str(), prefix));
 }
 
@@ -544,7 +617,9 @@ DbClientPtr DbClient::create(const char* prefix)
 	if(prefix == nullptr) {
 		prefix = g_db_key_prefix.c_str();
 	}
-	if(g_db_json_file.empty()) {
+	if(g_db_backend == "log") {
+		return create_log_client(prefix);
+	} else if(g_db_json_file.empty()) {
 		return DbClientPtr(new CouchbaseDbClient(prefix));
 	} else {
 		return DbClientPtr(new FileBackedDbClient(g_db_json_file, prefix));
@@ -605,3 +680,57 @@ COMMAND_LINE_UTILITY(backup_db)
 	variant res = builder.build();
 	printf("%s\n", res.write_json().c_str());
 }
+
+//A matchmaking-like mix of operations on a few thousand keys: half gets,
+//a third puts and the rest appends, flushing every hundred operations.
+BENCHMARK_ARG(db_client_mixed_workload, const std::string& backend)
+{
+	static std::map<std::string, DbClientPtr> clients;
+	DbClientPtr& client = clients[backend];
+	if(!client) {
+		const std::string fname = "db_client_benchmark." + backend;
+		if(sys::file_exists(fname)) {
+			sys::remove_file(fname);
+		}
+
+		if(backend == "log") {
+			client.reset(new LogStructuredDbClient(fname, ""));
+		} else {
+			client.reset(new FileBackedDbClient(fname, ""));
+		}
+
+		for(int n = 0; n != 4000; ++n) {
+			std::map<variant,variant> m;
+			m[variant("id")] = variant(n);
+			m[variant("name")] = variant(formatter() << "player" << n);
+			client->put(formatter() << "user:" << n, variant(&m), [](){}, [](){});
+		}
+
+		client->process();
+	}
+
+	unsigned int seed = 17;
+	int nops = 0;
+	BENCHMARK_LOOP {
+		seed = seed*1103515245 + 12345;
+		const int choice = (seed >> 16) % 6;
+		const std::string key = formatter() << "user:" << ((seed >> 8) % 4000);
+		if(choice < 3) {
+			client->get(key, [](variant v) {}, 0, DbClient::GET_NORMAL);
+		} else if(choice < 5) {
+			std::map<variant,variant> m;
+			m[variant("id")] = variant(static_cast<int>(seed % 4000));
+			m[variant("rating")] = variant(static_cast<int>(seed % 2000));
+			client->put(key, variant(&m), [](){}, [](){});
+		} else {
+			client->put("history:" + key, variant(static_cast<int>(seed % 100)), [](){}, [](){}, DbClient::PUT_APPEND);
+		}
+
+		if(++nops % 100 == 0) {
+			client->process();
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(db_client_mixed_workload, json_file, "json");
+BENCHMARK_ARG_CALL(db_client_mixed_workload, append_log, "log");
@@ -0,0 +1,428 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem/operations.hpp>
+
+#include "asserts.hpp"
+#include "db_log_store.hpp"
+#include "filesystem.hpp"
+#include "json_parser.hpp"
+#include "preferences.hpp"
+#include "unit_test.hpp"
+#include "zlib.h"
+
+PREF_BOOL(db_log_sync, false, "Sync the database log to disk each time it is flushed, so writes survive the machine crashing and not only the process");
+PREF_INT(db_log_compact_bytes, 1 << 20, "Size in bytes the database log must reach before it is compacted");
+
+namespace
+{
+	const char FileMagic[4] = { 'A', 'N', 'D', 'B' };
+	const uint32_t FileVersion = 1;
+	const size_t FileHeaderSize = 8;
+
+	//a record is its payload size and checksum, followed by the payload:
+	//the operation, the key size, the key, then the value as JSON.
+	const size_t RecordHeaderSize = 8;
+
+	void write_u32(std::string* out, uint32_t n)
+	{
+		const char buf[4] = { char(n & 0xff), char((n >> 8) & 0xff), char((n >> 16) & 0xff), char((n >> 24) & 0xff) };
+		out->append(buf, 4);
+	}
+
+	uint32_t read_u32(const char* p)
+	{
+		const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+		return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+	}
+
+	uint32_t checksum(const char* p, size_t n)
+	{
+		return static_cast<uint32_t>(crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(p), static_cast<uInt>(n)));
+	}
+
+	std::string file_header()
+	{
+		std::string result(FileMagic, FileMagic + 4);
+		write_u32(&result, FileVersion);
+		return result;
+	}
+
+	//appends a record to out, returning its size.
+	size_t encode_record(std::string* out, DbLogStore::RECORD_OP op, const std::string& key, const std::string& value)
+	{
+		const size_t start = out->size();
+		write_u32(out, static_cast<uint32_t>(1 + 4 + key.size() + value.size()));
+		write_u32(out, 0);
+		out->push_back(static_cast<char>(op));
+		write_u32(out, static_cast<uint32_t>(key.size()));
+		*out += key;
+		*out += value;
+
+		std::string crc;
+		write_u32(&crc, checksum(out->c_str() + start + RecordHeaderSize, out->size() - start - RecordHeaderSize));
+		out->replace(start + 4, 4, crc);
+		return out->size() - start;
+	}
+
+	void sync_file(FILE* file)
+	{
+		fflush(file);
+		if(g_db_log_sync) {
+#if defined(_MSC_VER)
+			_commit(_fileno(file));
+#else
+			fsync(fileno(file));
+#endif
+		}
+	}
+}
+
+DbLogStore::DbLogStore(const std::string& fname)
+  : fname_(fname), file_(nullptr), file_bytes_(0), live_bytes_(0)
+{
+	load();
+
+	file_ = fopen(fname_.c_str(), "ab");
+	ASSERT_LOG(file_ != nullptr, "Could not open database log " << fname_);
+}
+
+DbLogStore::~DbLogStore()
+{
+	writePending();
+	fclose(file_);
+}
+
+void DbLogStore::load()
+{
+	const std::string data = sys::file_exists(fname_) ? sys::read_file(fname_) : std::string();
+	if(data.size() < FileHeaderSize) {
+		//a new log, or one whose creation was cut short.
+		const std::string header = file_header();
+		FILE* file = fopen(fname_.c_str(), "wb");
+		ASSERT_LOG(file != nullptr, "Could not create database log " << fname_);
+		fwrite(header.c_str(), 1, header.size(), file);
+		sync_file(file);
+		fclose(file);
+		file_bytes_ = header.size();
+		return;
+	}
+
+	ASSERT_LOG(memcmp(data.c_str(), FileMagic, 4) == 0 && read_u32(data.c_str() + 4) == FileVersion, "Not a database log: " << fname_);
+
+	size_t pos = FileHeaderSize;
+	while(data.size() - pos >= RecordHeaderSize) {
+		const char* record = data.c_str() + pos;
+		const size_t payload_size = read_u32(record);
+		if(payload_size < 5 || data.size() - pos - RecordHeaderSize < payload_size) {
+			break;
+		}
+
+		const char* payload = record + RecordHeaderSize;
+		if(checksum(payload, payload_size) != read_u32(record + 4)) {
+			break;
+		}
+
+		const RECORD_OP op = static_cast<RECORD_OP>(payload[0]);
+		const size_t key_size = read_u32(payload + 1);
+		if(key_size > payload_size - 5 || (op != OP_PUT && op != OP_APPEND && op != OP_REMOVE)) {
+			break;
+		}
+
+		const std::string key(payload + 5, key_size);
+		variant value;
+		if(op != OP_REMOVE) {
+			try {
+				value = json::parse(std::string(payload + 5 + key_size, payload + payload_size), json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+			} catch(json::ParseError&) {
+				break;
+			}
+		}
+
+		const size_t record_size = RecordHeaderSize + payload_size;
+		apply(op, key, value, record_size);
+		pos += record_size;
+	}
+
+	if(pos != data.size()) {
+		LOG_WARN("Discarding " << (data.size() - pos) << " bytes of incomplete or corrupt records at the end of " << fname_);
+		boost::filesystem::resize_file(fname_, pos);
+	}
+
+	file_bytes_ = pos;
+}
+
+void DbLogStore::apply(RECORD_OP op, const std::string& key, const variant& value, size_t bytes)
+{
+	auto itor = index_.find(key);
+	if(op == OP_REMOVE) {
+		if(itor != index_.end()) {
+			live_bytes_ -= itor->second.bytes;
+			index_.erase(itor);
+			sorted_keys_.erase(key);
+		}
+		return;
+	}
+
+	if(itor == index_.end()) {
+		Entry entry = { variant(), 0 };
+		itor = index_.insert(std::make_pair(key, entry)).first;
+		sorted_keys_.insert(key);
+	}
+
+	Entry& entry = itor->second;
+	if(op == OP_APPEND) {
+		std::vector<variant> items;
+		if(entry.value.is_list()) {
+			items = entry.value.as_list();
+		} else {
+			//anything else under the key is replaced, so its records
+			//no longer count.
+			live_bytes_ -= entry.bytes;
+			entry.bytes = 0;
+		}
+
+		items.push_back(value);
+		entry.value = variant(&items);
+	} else {
+		live_bytes_ -= entry.bytes;
+		entry.bytes = 0;
+		entry.value = value;
+	}
+
+	entry.bytes += bytes;
+	live_bytes_ += bytes;
+}
+
+void DbLogStore::write(RECORD_OP op, const std::string& key, const variant& value)
+{
+	const size_t bytes = encode_record(&pending_, op, key, op == OP_REMOVE ? std::string() : value.write_json());
+	apply(op, key, value, bytes);
+}
+
+variant DbLogStore::get(const std::string& key) const
+{
+	auto itor = index_.find(key);
+	return itor == index_.end() ? variant() : itor->second.value;
+}
+
+bool DbLogStore::has(const std::string& key) const
+{
+	return index_.count(key) != 0;
+}
+
+void DbLogStore::put(const std::string& key, const variant& value)
+{
+	write(OP_PUT, key, value);
+}
+
+void DbLogStore::append(const std::string& key, const variant& item)
+{
+	write(OP_APPEND, key, item);
+}
+
+void DbLogStore::remove(const std::string& key)
+{
+	if(has(key)) {
+		write(OP_REMOVE, key, variant());
+	}
+}
+
+std::vector<std::string> DbLogStore::getKeysWithPrefix(const std::string& prefix) const
+{
+	std::vector<std::string> result;
+	for(auto itor = sorted_keys_.lower_bound(prefix); itor != sorted_keys_.end() && itor->compare(0, prefix.size(), prefix) == 0; ++itor) {
+		result.push_back(*itor);
+	}
+
+	return result;
+}
+
+void DbLogStore::writePending()
+{
+	if(pending_.empty()) {
+		return;
+	}
+
+	const size_t written = fwrite(pending_.c_str(), 1, pending_.size(), file_);
+	ASSERT_LOG(written == pending_.size(), "Failed to write database log " << fname_);
+	sync_file(file_);
+
+	file_bytes_ += pending_.size();
+	pending_.clear();
+}
+
+void DbLogStore::flush()
+{
+	writePending();
+
+	if(file_bytes_ >= static_cast<size_t>(g_db_log_compact_bytes) && file_bytes_ > live_bytes_*2) {
+		compact();
+	}
+}
+
+void DbLogStore::compact()
+{
+	writePending();
+
+	std::string data = file_header();
+	live_bytes_ = 0;
+	for(const std::string& key : sorted_keys_) {
+		Entry& entry = index_[key];
+		entry.bytes = encode_record(&data, OP_PUT, key, entry.value.write_json());
+		live_bytes_ += entry.bytes;
+	}
+
+	//the new log is complete on disk before it replaces the old one, so
+	//a crash leaves one or the other.
+	const std::string tmp_fname = fname_ + ".compact";
+	FILE* file = fopen(tmp_fname.c_str(), "wb");
+	ASSERT_LOG(file != nullptr, "Could not create " << tmp_fname);
+	const size_t written = fwrite(data.c_str(), 1, data.size(), file);
+	sync_file(file);
+	fclose(file);
+	ASSERT_LOG(written == data.size(), "Failed to write " << tmp_fname);
+
+	LOG_INFO("Compacted database log " << fname_ << " from " << file_bytes_ << " to " << data.size() << " bytes");
+
+	fclose(file_);
+	sys::move_file(tmp_fname, fname_);
+
+	file_ = fopen(fname_.c_str(), "ab");
+	ASSERT_LOG(file_ != nullptr, "Could not open database log " << fname_);
+	file_bytes_ = data.size();
+}
+
+namespace
+{
+	const char* TestLogFile = "db_log_store_test.log";
+
+	struct TestLogFileRemover
+	{
+		TestLogFileRemover() { remove(); }
+		~TestLogFileRemover() { remove(); }
+		void remove() {
+			if(sys::file_exists(TestLogFile)) {
+				sys::remove_file(TestLogFile);
+			}
+		}
+	};
+}
+
+UNIT_TEST(db_log_store_replay)
+{
+	TestLogFileRemover remover;
+
+	{
+		DbLogStore store(TestLogFile);
+		store.put("user:alice", variant(1));
+		store.put("user:bob", variant(2));
+		store.put("game:1", variant("first"));
+		store.append("log:alice", variant(10));
+		store.append("log:alice", variant(11));
+		store.put("user:bob", variant(3));
+		store.remove("game:1");
+		store.flush();
+	}
+
+	DbLogStore store(TestLogFile);
+	CHECK_EQ(store.numKeys(), 3);
+	CHECK_EQ(store.get("user:alice"), variant(1));
+	CHECK_EQ(store.get("user:bob"), variant(3));
+	CHECK_EQ(store.get("game:1").is_null(), true);
+	CHECK_EQ(store.get("log:alice").num_elements(), 2);
+	CHECK_EQ(store.get("log:alice")[1], variant(11));
+
+	const std::vector<std::string> users = store.getKeysWithPrefix("user:");
+	CHECK_EQ(users.size(), 2);
+	CHECK_EQ(users[0], "user:alice");
+	CHECK_EQ(users[1], "user:bob");
+}
+
+UNIT_TEST(db_log_store_drops_torn_records)
+{
+	TestLogFileRemover remover;
+
+	size_t good_size = 0;
+	{
+		DbLogStore store(TestLogFile);
+		store.put("a", variant(1));
+		store.put("b", variant(2));
+		store.flush();
+		good_size = store.fileBytes();
+		store.put("c", variant(3));
+	}
+
+	//cut the last record short, as a crash partway through a write would.
+	std::string data = sys::read_file(TestLogFile);
+	data.resize(data.size() - 3);
+	sys::write_file(TestLogFile, data);
+
+	{
+		DbLogStore store(TestLogFile);
+		CHECK_EQ(store.numKeys(), 2);
+		CHECK_EQ(store.get("b"), variant(2));
+		CHECK_EQ(store.fileBytes(), good_size);
+
+		//writes after recovery follow on from the last good record.
+		store.put("d", variant(4));
+	}
+
+	DbLogStore store(TestLogFile);
+	CHECK_EQ(store.numKeys(), 3);
+	CHECK_EQ(store.get("d"), variant(4));
+}
+
+UNIT_TEST(db_log_store_compaction)
+{
+	TestLogFileRemover remover;
+
+	{
+		DbLogStore store(TestLogFile);
+		for(int n = 0; n != 1000; ++n) {
+			store.put("counter", variant(n));
+			store.append("list", variant(n % 7));
+		}
+
+		const size_t before = store.fileBytes();
+		store.compact();
+		CHECK_LT(store.fileBytes(), before);
+		CHECK_EQ(store.fileBytes(), store.liveBytes() + FileHeaderSize);
+
+		store.put("after", variant::from_bool(true));
+	}
+
+	DbLogStore store(TestLogFile);
+	CHECK_EQ(store.get("counter"), variant(999));
+	CHECK_EQ(store.get("list").num_elements(), 1000);
+	CHECK_EQ(store.get("after"), variant::from_bool(true));
+}
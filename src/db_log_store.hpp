@@ -0,0 +1,101 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <stdio.h>
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "variant.hpp"
+
+//A key-value store kept as an append-only log of writes in a single
+//file, with every value indexed in memory. Each write costs one record
+//at the end of the file rather than a rewrite of the database. Records
+//are checksummed, so one torn by a crash is found and dropped when the
+//log is next opened. Once most of the log is overwritten values it is
+//compacted into a new file, which then replaces the old one.
+class DbLogStore
+{
+public:
+	//opens the log in fname, creating it if needed, and replays it.
+	explicit DbLogStore(const std::string& fname);
+	~DbLogStore();
+
+	//the value stored under key, or null.
+	variant get(const std::string& key) const;
+	bool has(const std::string& key) const;
+
+	void put(const std::string& key, const variant& value);
+
+	//adds item to the end of the list stored under key, starting a new
+	//list if there is no list there.
+	void append(const std::string& key, const variant& item);
+
+	void remove(const std::string& key);
+
+	//the keys starting with prefix, in sorted order.
+	std::vector<std::string> getKeysWithPrefix(const std::string& prefix) const;
+
+	//writes buffered records to the file, compacting it afterwards if
+	//it has grown to more than twice the size of the live records.
+	void flush();
+
+	//rewrites the log with one record per key.
+	void compact();
+
+	size_t numKeys() const { return index_.size(); }
+	size_t fileBytes() const { return file_bytes_ + pending_.size(); }
+	size_t liveBytes() const { return live_bytes_; }
+
+	enum RECORD_OP { OP_PUT = 1, OP_APPEND = 2, OP_REMOVE = 3 };
+
+private:
+	DbLogStore(const DbLogStore&);
+	void operator=(const DbLogStore&);
+
+	struct Entry
+	{
+		variant value;
+
+		//the size of the records which make up the value.
+		size_t bytes;
+	};
+
+	void load();
+	void apply(RECORD_OP op, const std::string& key, const variant& value, size_t bytes);
+	void write(RECORD_OP op, const std::string& key, const variant& value);
+	void writePending();
+
+	std::string fname_;
+	FILE* file_;
+
+	std::string pending_;
+	size_t file_bytes_, live_bytes_;
+
+	std::unordered_map<std::string, Entry> index_;
+	std::set<std::string> sorted_keys_;
+};
@@ -86,6 +86,13 @@ Entity::Entity(int x, int y, bool face_right)
 	}
 }
 
+Entity::~Entity()
+{
+	if(activation_index_hook_.index) {
+		activation_index_hook_.index->remove(this);
+	}
+}
+
 void Entity::setAnchorX(decimal value)
 {
 	if(value < 0) {
@@ -259,6 +266,8 @@ void Entity::setDrawScale(float new_scale)
 
 void Entity::calculateSolidRect()
 {
+	activationChanged();
+
 	const Frame& f = getCurrentFrame();
 
 	frame_rect_ = rect(x(), y(), f.width(), f.height());
@@ -30,6 +30,7 @@
 
 #include "geometry.hpp"
 
+#include "activation_index.hpp"
 #include "controls.hpp"
 #include "current_generator.hpp"
 #include "editor_variable_info.hpp"
@@ -57,7 +58,7 @@ public:
 	static EntityPtr build(variant node);
 	explicit Entity(variant node);
 	Entity(int x, int y, bool face_right);
-	virtual ~Entity() {}
+	virtual ~Entity();
 
 	virtual void validate_properties() {}
 	virtual void addToLevel();
@@ -68,6 +69,10 @@ public:
 	virtual void draw(int x, int y) const = 0;
 	virtual void drawLater(int x, int y) const = 0;
 	virtual void drawGroup() const = 0;
+
+	//fills in a sprite batch item if this entity draws as nothing more than
+	//a plain frame blit, so the level may batch it with its neighbours.
+	virtual bool getAutoBatchItem(Frame::BatchDrawItem* item) const { return false; }
 	PlayerInfo* getPlayerInfo() { return isHuman(); }
 	const PlayerInfo* getPlayerInfo() const { return isHuman(); }
 	virtual const PlayerInfo* isHuman() const { return nullptr; }
@@ -184,6 +189,16 @@ public:
 	virtual bool isActive(const rect& screen_area) const = 0;
 	virtual bool diesOnInactive() const { return false; } 
 	virtual bool isAlwaysActive() const { return false; } 
+
+	//gets a rect such that isActive() can only be true for screen areas
+	//which touch it, for as long as the object doesn't change. Returns false
+	//if there is no such rect and the object must be tested every cycle.
+	virtual bool getActivationBounds(rect* bounds) const { return false; }
+
+	ActivationIndexHook& activationIndexHook() { return activation_index_hook_; }
+
+	//should be called when something which affects isActive() changes.
+	void activationChanged() { if(activation_index_hook_.dormant) { activation_index_hook_.index->wake(this); } }
 	
 	virtual FormulaCallable* vars() { return nullptr; }
 	virtual const FormulaCallable* vars() const { return nullptr; }
@@ -441,6 +456,8 @@ private:
 
 	bool true_z_;
 	double tx_, ty_, tz_;
+
+	ActivationIndexHook activation_index_hook_;
 };
 
 bool zorder_compare(const EntityPtr& e1, const EntityPtr& e2);	
@@ -29,6 +29,7 @@
 #include <stack>
 #include <stdio.h>
 #include <iostream>
+#include <typeinfo>
 #include <vector>
 #include <limits.h>
 
@@ -70,6 +71,11 @@ namespace
 	PREF_BOOL(ffl_vm_opt_constant_lookups, true, "Optimize contant lookups in VM");
 	PREF_BOOL(ffl_vm_opt_inline, true, "Try to inline FFL calls.");
 	PREF_BOOL(ffl_vm_opt_replace_where, true, "Try to replace trivial where calls.");
+	PREF_BOOL(ffl_register_vm, false, "Execute FFL with the register-based VM where the formula allows it.");
+	PREF_BOOL(ffl_inline_caches, true, "Cache the slot each FFL property lookup site resolves to for the object types it sees.");
+	PREF_BOOL(ffl_register_vm_check, false, "Execute FFL with both the stack and register VMs and assert their results match.");
+	PREF_BOOL(ffl_vm_opt_cse, false, "Fold constants and evaluate repeated pure subexpressions once in each FFL formula's bytecode.");
+	PREF_BOOL(ffl_vm_opt_cse_report, false, "Log how many instructions ffl_vm_opt_cse eliminates from each formula.");
 
 	//the last formula that was executed; used for outputting debugging info.
 	const game_logic::Formula* last_executed_formula;
@@ -325,6 +331,56 @@ namespace game_logic
 	
 	namespace 
 	{
+		//Compares results of the stack and register VMs. Callables and
+		//functions are created afresh by each VM, so only their types
+		//are compared.
+		bool vm_results_match(const variant& a, const variant& b)
+		{
+			if(a.type() != b.type()) {
+				return false;
+			}
+
+			if(a.is_list()) {
+				if(a.num_elements() != b.num_elements()) {
+					return false;
+				}
+
+				for(int n = 0; n != a.num_elements(); ++n) {
+					if(!vm_results_match(a[n], b[n])) {
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			if(a.is_map()) {
+				const std::map<variant,variant>& ma = a.as_map();
+				const std::map<variant,variant>& mb = b.as_map();
+				if(ma.size() != mb.size()) {
+					return false;
+				}
+
+				for(auto i = ma.begin(), j = mb.begin(); i != ma.end(); ++i, ++j) {
+					if(!vm_results_match(i->first, j->first) || !vm_results_match(i->second, j->second)) {
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			if(a.is_callable()) {
+				return a == b || typeid(*a.as_callable()) == typeid(*b.as_callable());
+			}
+
+			if(a.is_function() || a.type() == variant::VARIANT_TYPE_GENERIC_FUNCTION) {
+				return true;
+			}
+
+			return a == b;
+		}
+
 		class VMExpression : public FormulaExpression {
 		public:
 			VMExpression(VirtualMachine& vm, variant_type_ptr t, const FormulaExpression& o) : FormulaExpression("_vm"), vm_(vm), type_(t), can_reduce_to_variant_(false)
@@ -332,6 +388,8 @@ namespace game_logic
 				setDebugInfo(o);
 				setVMDebugInfo(vm_);
 				t->set_expr(this);
+
+				prepareExecution();
 			}
 
 			bool canCreateVM() const override {
@@ -339,7 +397,23 @@ namespace game_logic
 			}
 
 			void emitVM(formula_vm::VirtualMachine& vm) const override {
-				vm.append(vm_);
+				vm.append(get_vm());
+			}
+
+			//Folds constants and stores repeated subexpressions in the
+			//bytecode this expression executes. Others emitting this
+			//expression still get the original bytecode, since the stored
+			//subexpressions are only valid in a whole formula. Returns how
+			//many instructions were eliminated.
+			int optimizeBytecode() {
+				std::unique_ptr<formula_vm::VirtualMachine> source(new formula_vm::VirtualMachine(vm_));
+				const int removed = vm_.foldConstants() + vm_.eliminateCommonSubexpressions();
+				if(removed > 0) {
+					source_vm_ = std::move(source);
+					prepareExecution();
+				}
+
+				return removed;
 			}
 
 			variant executeMember(const FormulaCallable& variables, std::string& id, variant* variant_id) const override {
@@ -360,14 +434,60 @@ namespace game_logic
 				can_reduce_to_variant_ = true;
 			}
 
-			formula_vm::VirtualMachine& get_vm() { return vm_; }
-			const formula_vm::VirtualMachine& get_vm() const { return vm_; }
+			//the number of instructions actually executed, after any
+			//optimizeBytecode().
+			int numExecutedInstructions() const { return vm_.numInstructions(); }
+
+			formula_vm::VirtualMachine& get_vm() { return source_vm_ ? *source_vm_ : vm_; }
+			const formula_vm::VirtualMachine& get_vm() const { return source_vm_ ? *source_vm_ : vm_; }
 
 		private:
+			void prepareExecution() {
+				property_caches_.reset();
+				register_vm_.reset();
+
+#if !defined(MT_FFL)
+				//the caches aren't synchronized, so threaded FFL does without.
+				if(g_ffl_inline_caches) {
+					property_caches_.reset(new formula_vm::PropertyCaches(vm_));
+					if(property_caches_->empty()) {
+						property_caches_.reset();
+					}
+				}
+#endif
+
+				if(g_ffl_register_vm || g_ffl_register_vm_check) {
+					register_vm_ = formula_vm::RegisterVM::compile(vm_);
+				}
+			}
+
 			variant execute(const FormulaCallable& variables) const override {
 //				Formula::failIfStaticContext();
 
-				variant result = vm_.execute(variables);
+				if(register_vm_) {
+					if(g_ffl_register_vm_check) {
+						return executeChecked(variables);
+					}
+
+					return register_vm_->execute(variables, property_caches_.get());
+				}
+
+				variant result = vm_.execute(variables, property_caches_.get());
+				return result;
+			}
+
+			//Runs both VMs from the same random seed, so dice rolls
+			//agree, and asserts they produce matching results.
+			variant executeChecked(const FormulaCallable& variables) const {
+				const rng::Seed seed = rng::get_seed();
+				variant result = vm_.execute(variables, property_caches_.get());
+				const rng::Seed after = rng::get_seed();
+
+				rng::set_seed(seed);
+				variant register_result = register_vm_->execute(variables, property_caches_.get());
+				rng::set_seed(after);
+
+				ASSERT_LOG(vm_results_match(result, register_result), "Register VM result " << register_result.to_debug_string() << " does not match stack VM result " << result.to_debug_string() << " " << debugPinpointLocation() << "\n---STACK VM---\n" << vm_.debugOutput() << "---REGISTER VM---\n" << register_vm_->debugOutput());
 				return result;
 			}
 
@@ -376,6 +496,12 @@ namespace game_logic
 			}
 
 			formula_vm::VirtualMachine vm_;
+
+			//the bytecode from before optimizeBytecode(), if it changed vm_.
+			std::unique_ptr<formula_vm::VirtualMachine> source_vm_;
+
+			std::unique_ptr<formula_vm::PropertyCaches> property_caches_;
+			std::shared_ptr<const formula_vm::RegisterVM> register_vm_;
 			variant_type_ptr type_;
 
 			variant variant_;
@@ -5103,6 +5229,15 @@ Formula::Formula(const variant& val, FunctionSymbolTable* symbols, ConstFormulaC
 			type_->set_expr(vm_expr.get());
 			expr_ = vm_expr;
 		}
+
+		if(g_ffl_vm_opt_cse && expr_->isVM()) {
+			VMExpression* vm_root = static_cast<VMExpression*>(expr_.get());
+			const int before = vm_root->get_vm().numInstructions();
+			const int removed = vm_root->optimizeBytecode();
+			if(g_ffl_vm_opt_cse_report && removed > 0) {
+				LOG_INFO("ffl_vm_opt_cse: eliminated " << removed << " of " << before << " instructions from " << str_.debug_location());
+			}
+		}
 	}
 }
 
@@ -5768,6 +5903,98 @@ UNIT_TEST(array_dereference_accepts_nesting) {
 	}
 }
 
+UNIT_TEST(formula_register_vm_check) {
+	struct CheckGuard {
+		explicit CheckGuard(bool value) : old_(g_ffl_register_vm_check) { g_ffl_register_vm_check = value; }
+		~CheckGuard() { g_ffl_register_vm_check = old_; }
+		bool old_;
+	} guard(true);
+
+	MapFormulaCallable* callable = new MapFormulaCallable;
+	variant ref(callable);
+	callable->add("x", variant(3));
+	callable->add("y", variant(4));
+	callable->add("name", variant("anura"));
+
+	//every formula executes on both VMs, asserting if they disagree.
+	const char* formulas[] = {
+		"x*x + y*y",
+		"(x + 2) * (y - 1) / 2 - x % 2",
+		"if(x < y, x, y) + if(x > y, 1, 0)",
+		"x and y or 5",
+		"not x = y and x != y and x <= y and y >= x",
+		"[x, y, x+y][1:3]",
+		"{'a': x, 'b': [y, name]}",
+		"name[1:3] + str(x)",
+		"x in [1, 2, 3] or y not in [5]",
+		"x is int and name is not int",
+		"size([x, y, 2d6]) + -x",
+		"max(x, y, x*y) + abs(-y)",
+		"a * b + c where a = x where b = y where c = 2",
+		"def f(n) n*n; f(x) + f(y)",
+		"{'a': x}.a + y",
+	};
+
+	for(const char* str : formulas) {
+		Formula f((variant(str)));
+		f.execute(*callable);
+	}
+
+	CHECK_EQ(Formula(variant("x*x + y*y")).execute(*callable), variant(25));
+	CHECK_EQ(Formula(variant("if(x < y, x, y) + if(x > y, 1, 0)")).execute(*callable), variant(3));
+}
+
+UNIT_TEST(formula_vm_opt_cse) {
+	MapFormulaCallable* callable = new MapFormulaCallable;
+	variant ref(callable);
+	callable->add("x", variant(3));
+	callable->add("y", variant(4));
+
+	const char* formulas[] = {
+		"(x+y)*(x+y) + (x+y)*(x+y)",
+		"(x*y - 1) + if(x < y, (x*y - 1)*2, 0)",
+		"a + b where a = x*y + 1 where b = 2*3",
+		"map([1, 2], value + (x*y + y)) + [x*y + y, x*y + y]",
+		"[x+1, x+1, x+1][x+1 - 3]",
+	};
+
+	std::vector<variant> expected;
+	for(const char* str : formulas) {
+		expected.push_back(Formula(variant(str)).execute(*callable));
+	}
+
+	struct CSEGuard {
+		CSEGuard() : old_(g_ffl_vm_opt_cse) { g_ffl_vm_opt_cse = true; }
+		~CSEGuard() { g_ffl_vm_opt_cse = old_; }
+		bool old_;
+	} guard;
+
+	for(int n = 0; n != static_cast<int>(expected.size()); ++n) {
+		const variant result = Formula(variant(formulas[n])).execute(*callable);
+		CHECK(result == expected[n], "ffl_vm_opt_cse changed the result of " << formulas[n] << ": " << result.write_json() << " != " << expected[n].write_json());
+	}
+
+	//formulas with a repeated subexpression outside any loop must come out
+	//shorter, not just give the same result.
+	const char* shrinking_formulas[] = {
+		"(x+y)*(x+y) + (x+y)*(x+y)",
+		"[x+1, x+1, x+1][x+1 - 3]",
+	};
+
+	for(const char* str : shrinking_formulas) {
+		int ninstructions[2];
+		for(int optimize = 0; optimize != 2; ++optimize) {
+			g_ffl_vm_opt_cse = optimize != 0;
+			const Formula f((variant(str)));
+			const VMExpression* vm_expr = dynamic_cast<const VMExpression*>(f.expr().get());
+			CHECK(vm_expr != nullptr, "formula was not compiled to the VM: " << str);
+			ninstructions[optimize] = vm_expr->numExecutedInstructions();
+		}
+
+		CHECK(ninstructions[1] < ninstructions[0], "ffl_vm_opt_cse did not shorten " << str << ": " << ninstructions[1] << " instructions, " << ninstructions[0] << " without it");
+	}
+}
+
 BENCHMARK(formula_list_comprehension_bench) {
 	Formula f(variant("[x*x + 5 | x <- range(input)]"));
 	static MapFormulaCallable* callable = new MapFormulaCallable;
@@ -68,6 +68,22 @@ namespace game_logic
 			return getValueBySlot(slot);
 		}
 
+		//Identifies the slot layout of this callable for inline caches.
+		//Callables sharing a layout resolve each key to the same slot in
+		//queryCacheableSlot(). Null if lookups on this callable can't be cached.
+		const reference_counted_object* querySlotLayout() const {
+			return getSlotLayout();
+		}
+
+		//The slot queryValueBySlot() reads for key, or -1 if key has to
+		//be looked up by name.
+		int queryCacheableSlot(const std::string& key) const {
+			if(has_self_ && key == "self") {
+				return -1;
+			}
+			return getCacheableSlot(key);
+		}
+
 		bool queryConstantValue(const std::string& key, variant* value) const {
 			return getConstantValue(key, value);
 		}
@@ -141,6 +157,9 @@ namespace game_logic
 		virtual variant getValue(const std::string& key) const = 0;
 		virtual variant getValueBySlot(int slot) const;
 
+		virtual const reference_counted_object* getSlotLayout() const { return nullptr; }
+		virtual int getCacheableSlot(const std::string& key) const { return -1; }
+
 		virtual bool getConstantValue(const std::string& key, variant* value) const {
 			return false;
 		}
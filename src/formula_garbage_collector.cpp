@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 
@@ -14,7 +16,10 @@
 #include "logger.hpp"
 #include "profile_timer.hpp"
 #include "sys.hpp"
+#include "unit_test.hpp"
 
+#include "formula.hpp"
+#include "formula_callable.hpp"
 #include "formula_object.hpp"
 
 #ifdef DEBUG_GARBAGE_COLLECTOR
@@ -26,27 +31,89 @@ std::set<variant*>& get_all_global_variants();
 #endif
 	
 namespace {
-	GarbageCollectible* g_head;
-	int g_count;
+	//Collectibles are kept in one of several registries, chosen per thread,
+	//so threads allocating objects don't contend on a single lock. The
+	//collector locks all of them and walks each in turn.
+	const int NumRegistries = 16;
+
+	struct Registry {
+		Registry() : head(nullptr), count(0)
+		{}
+		GarbageCollectible* head;
+		int count;
+
+		//recursive since objects are destroyed while the collector holds it.
+		std::recursive_mutex mutex;
+	};
+
+	Registry g_registries[NumRegistries];
 	int g_threads;
-	SDL_mutex* g_gc_mutex;
+	std::atomic<int> g_next_registry(0);
+	THREAD_LOCAL int g_thread_registry = -1;
+
+	int get_thread_registry()
+	{
+		if(g_thread_registry < 0) {
+			g_thread_registry = g_next_registry++ % NumRegistries;
+		}
+
+		return g_thread_registry;
+	}
+
+	//registries are only locked while worker threads allocate collectibles.
+	struct LockRegistry {
+		explicit LockRegistry(Registry& r) : registry(r), locked(g_threads > 0) {
+			if(locked) {
+				registry.mutex.lock();
+			}
+		}
+
+		~LockRegistry() {
+			if(locked) {
+				registry.mutex.unlock();
+			}
+		}
+
+		Registry& registry;
+		bool locked;
+	};
 
 	struct LockGC {
-		LockGC() {
-			if(g_gc_mutex) {
-				SDL_mutexP(g_gc_mutex);
+		LockGC() : locked(g_threads > 0) {
+			if(locked) {
+				for(Registry& r : g_registries) {
+					r.mutex.lock();
+				}
 			}
 		}
 
 		~LockGC() {
-			if(g_gc_mutex) {
-				SDL_mutexV(g_gc_mutex);
+			if(locked) {
+				for(int n = NumRegistries-1; n >= 0; --n) {
+					g_registries[n].mutex.unlock();
+				}
 			}
 		}
+
+		bool locked;
 	};
 
+	int total_count()
+	{
+		int result = 0;
+		for(const Registry& r : g_registries) {
+			result += r.count;
+		}
+
+		return result;
+	}
+
+	void incremental_gc_note_write(GarbageCollectible* obj);
+	void incremental_gc_note_destroyed(GarbageCollectible* obj);
 }
 
+bool GarbageCollectible::incremental_collection_active_ = false;
+
 std::mutex& GarbageCollector::getGlobalMutex()
 {
 	static std::mutex instance;
@@ -55,35 +122,31 @@ std::mutex& GarbageCollector::getGlobalMutex()
 
 void GarbageCollectible::getAll(std::vector<GarbageCollectible*>* result)
 {
-	for(GarbageCollectible* p = g_head; p != nullptr; p = p->next_) {
-		result->push_back(p);
+	for(const Registry& r : g_registries) {
+		for(GarbageCollectible* p = r.head; p != nullptr; p = p->next_) {
+			result->push_back(p);
+		}
 	}
 }
 
 void GarbageCollectible::incrementWorkerThreads()
 {
 	++g_threads;
-
-	if(g_gc_mutex == nullptr) {
-		g_gc_mutex = SDL_CreateMutex();
-	}
 }
 
 void GarbageCollectible::decrementWorkerThreads()
 {
 	--g_threads;
-	if(g_threads == 0) {
-		SDL_DestroyMutex(g_gc_mutex);
-		g_gc_mutex = nullptr;
-	}
 }
 
 GarbageCollectible* GarbageCollectible::debugGetObject(void* ptr)
 {
 	LockGC lock;
-	for(GarbageCollectible* p = g_head; p != nullptr; p = p->next_) {
-		if(p == ptr) {
-			return p;
+	for(const Registry& r : g_registries) {
+		for(GarbageCollectible* p = r.head; p != nullptr; p = p->next_) {
+			if(p == ptr) {
+				return p;
+			}
 		}
 	}
 
@@ -92,31 +155,32 @@ GarbageCollectible* GarbageCollectible::debugGetObject(void* ptr)
 
 GarbageCollectible::GarbageCollectible() : reference_counted_object(), prev_(nullptr), tenure_(0)
 {
-	LockGC lock;
-	next_ = g_head;
 	insertAtHead();
 }
 
 GarbageCollectible::GarbageCollectible(const GarbageCollectible& o) : reference_counted_object(o), prev_(nullptr), tenure_(0)
 {
-	LockGC lock;
-	next_ = g_head;
 	insertAtHead();
 }
 
 GarbageCollectible::GarbageCollectible(GARBAGE_COLLECTOR_EXCLUDE_OPTIONS options)
-  : reference_counted_object(), next_(this), prev_(nullptr), tenure_(0)
+  : reference_counted_object(), next_(this), prev_(nullptr), tenure_(0), registry_(0)
 {
 }
 
 void GarbageCollectible::insertAtHead()
 {
-	++g_count;
-	if(g_head != nullptr) {
-		g_head->prev_ = this;
+	registry_ = get_thread_registry();
+	Registry& r = g_registries[registry_];
+	LockRegistry lock(r);
+
+	next_ = r.head;
+	++r.count;
+	if(r.head != nullptr) {
+		r.head->prev_ = this;
 	}
 
-	g_head = this;
+	r.head = this;
 }
 
 GarbageCollectible& GarbageCollectible::operator=(const GarbageCollectible& o)
@@ -130,9 +194,14 @@ GarbageCollectible::~GarbageCollectible()
 		return;
 	}
 
-	LockGC lock;
+	Registry& r = g_registries[registry_];
+	LockRegistry lock(r);
+
+	if(incremental_collection_active_) {
+		incremental_gc_note_destroyed(this);
+	}
 
-	--g_count;
+	--r.count;
 	if(prev_ != nullptr) {
 		prev_->next_ = next_;
 	}
@@ -141,8 +210,8 @@ GarbageCollectible::~GarbageCollectible()
 		next_->prev_ = prev_;
 	}
 
-	if(g_head == this) {
-		g_head = next_;
+	if(r.head == this) {
+		r.head = next_;
 	}
 }
 
@@ -150,6 +219,14 @@ void GarbageCollectible::surrenderReferences(GarbageCollector* collector)
 {
 }
 
+void GarbageCollectible::noteWrite()
+{
+	LockGC lock;
+	if(incremental_collection_active_) {
+		incremental_gc_note_write(this);
+	}
+}
+
 std::string GarbageCollectible::debugObjectName() const
 {
 	return typeid(*this).name();
@@ -194,7 +271,7 @@ void* GarbageCollectible::operator new(size_t sz)
 	return (void*)p;
 }
 
-void GarbageCollectible::operator delete(void* ptr) noexcept
+void GarbageCollectible::operator delete(void* ptr, size_t sz) noexcept
 {
 	if(ptr < g_gc_begin_data_pool || ptr >= g_gc_end_data_pool) {
 		free(ptr);
@@ -206,6 +283,164 @@ void GarbageCollectible::operator delete(void* ptr) noexcept
 	g_gc_alloc_free_slots.push_back(p);
 }
 
+void GarbageCollectible::releaseThreadCache()
+{
+}
+
+#else
+
+//Collectibles are carved out of slabs of same-sized blocks, rounded up to a
+//multiple of SlabGranularity. Each thread keeps its own free list for every
+//size class and only touches the shared depot, under its lock, to move a
+//batch of blocks at a time. Slabs are never returned to the system.
+namespace {
+	const size_t SlabGranularity = 16;
+	const size_t MaxSlabObjectSize = 512;
+	const int NumSizeClasses = MaxSlabObjectSize/SlabGranularity;
+	const size_t SlabSize = 64*1024;
+
+	//blocks moved between a thread and the depot at once, and the number a
+	//thread may hold in one class before giving a batch back.
+	const int SlabBatchSize = 64;
+	const int MaxThreadFreeBlocks = SlabBatchSize*4;
+
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	struct SlabDepot {
+		SlabDepot() : head(nullptr), count(0)
+		{}
+		std::mutex mutex;
+		FreeBlock* head;
+		int count;
+	};
+
+	SlabDepot g_slab_depots[NumSizeClasses];
+
+	struct SlabThreadCache {
+		SlabThreadCache() {
+			std::fill(head, head + NumSizeClasses, nullptr);
+			std::fill(count, count + NumSizeClasses, 0);
+		}
+		FreeBlock* head[NumSizeClasses];
+		int count[NumSizeClasses];
+	};
+
+	THREAD_LOCAL SlabThreadCache* g_slab_thread_cache;
+
+	SlabThreadCache& get_slab_thread_cache()
+	{
+		if(g_slab_thread_cache == nullptr) {
+			g_slab_thread_cache = new SlabThreadCache;
+		}
+
+		return *g_slab_thread_cache;
+	}
+
+	int slab_size_class(size_t sz)
+	{
+		return static_cast<int>((sz + SlabGranularity - 1)/SlabGranularity) - 1;
+	}
+
+	void refill_slab_thread_cache(SlabThreadCache& cache, int size_class)
+	{
+		SlabDepot& depot = g_slab_depots[size_class];
+		std::lock_guard<std::mutex> lock(depot.mutex);
+
+		if(depot.head == nullptr) {
+			const size_t block_size = (size_class+1)*SlabGranularity;
+			char* slab = static_cast<char*>(::operator new(SlabSize));
+			for(char* p = slab; p + block_size <= slab + SlabSize; p += block_size) {
+				FreeBlock* block = reinterpret_cast<FreeBlock*>(p);
+				block->next = depot.head;
+				depot.head = block;
+				++depot.count;
+			}
+		}
+
+		for(int n = 0; n != SlabBatchSize && depot.head != nullptr; ++n) {
+			FreeBlock* block = depot.head;
+			depot.head = block->next;
+			--depot.count;
+
+			block->next = cache.head[size_class];
+			cache.head[size_class] = block;
+			++cache.count[size_class];
+		}
+	}
+
+	void return_to_slab_depot(SlabThreadCache& cache, int size_class, int nblocks)
+	{
+		SlabDepot& depot = g_slab_depots[size_class];
+		std::lock_guard<std::mutex> lock(depot.mutex);
+
+		for(int n = 0; n != nblocks && cache.head[size_class] != nullptr; ++n) {
+			FreeBlock* block = cache.head[size_class];
+			cache.head[size_class] = block->next;
+			--cache.count[size_class];
+
+			block->next = depot.head;
+			depot.head = block;
+			++depot.count;
+		}
+	}
+}
+
+void* GarbageCollectible::operator new(size_t sz)
+{
+	if(sz > MaxSlabObjectSize) {
+		return ::operator new(sz);
+	}
+
+	const int size_class = slab_size_class(sz);
+	SlabThreadCache& cache = get_slab_thread_cache();
+	if(cache.head[size_class] == nullptr) {
+		refill_slab_thread_cache(cache, size_class);
+	}
+
+	FreeBlock* block = cache.head[size_class];
+	cache.head[size_class] = block->next;
+	--cache.count[size_class];
+	return block;
+}
+
+void GarbageCollectible::operator delete(void* ptr, size_t sz) noexcept
+{
+	if(ptr == nullptr) {
+		return;
+	}
+
+	if(sz > MaxSlabObjectSize) {
+		::operator delete(ptr);
+		return;
+	}
+
+	//blocks go to the freeing thread's list, whichever thread allocated them.
+	const int size_class = slab_size_class(sz);
+	SlabThreadCache& cache = get_slab_thread_cache();
+	FreeBlock* block = static_cast<FreeBlock*>(ptr);
+	block->next = cache.head[size_class];
+	cache.head[size_class] = block;
+	if(++cache.count[size_class] > MaxThreadFreeBlocks) {
+		return_to_slab_depot(cache, size_class, SlabBatchSize);
+	}
+}
+
+void GarbageCollectible::releaseThreadCache()
+{
+	if(g_slab_thread_cache == nullptr) {
+		return;
+	}
+
+	for(int n = 0; n != NumSizeClasses; ++n) {
+		return_to_slab_depot(*g_slab_thread_cache, n, g_slab_thread_cache->count[n]);
+	}
+
+	delete g_slab_thread_cache;
+	g_slab_thread_cache = nullptr;
+}
+
 #endif //DEBUG_GARBAGE_COLLECTOR
 
 GarbageCollector::~GarbageCollector()
@@ -233,11 +468,13 @@ public:
 	void surrenderPtrInternal(ffl::IntrusivePtr<GarbageCollectible>* ptr, const char* description) override;
 
 	void collect();
+	void collectItems(std::vector<GarbageCollectible*>* items);
 	void reap();
 	void debugOutputCollected();
 
 private:
 	void accumulateAll();
+	void accumulate();
 	void performCollection();
 
 	void destroyReferences(GarbageCollectible* item);
@@ -319,7 +556,7 @@ void GarbageCollectorImpl::collect()
 {
 	LockGC lock;
 
-	LOG_DEBUG("Beginning garbage collection of " << g_count << " items");
+	LOG_DEBUG("Beginning garbage collection of " << total_count() << " items");
 	profile::timer timer;
 
 	accumulateAll();
@@ -328,23 +565,47 @@ void GarbageCollectorImpl::collect()
 	LOG_DEBUG("Garbage collection complete in " << static_cast<int>(timer.get_time()) << "us. Collected " << items_.size() << " objects. " << saved_.size() << " objects remaining; variants: " << variants_.size() << "; pointers: " << pointers_.size());
 }
 
-void GarbageCollectorImpl::accumulateAll()
+//Collects only the given items, treating every reference from outside them
+//as a root. Used to finish an incremental collection on its candidates.
+void GarbageCollectorImpl::collectItems(std::vector<GarbageCollectible*>* items)
 {
-	items_.reserve(g_count);
+	LockGC lock;
+	profile::timer timer;
 
-	for(GarbageCollectible* p = g_head; p != nullptr; p = p->next_) {
-		if(gens_ < 0 || p->tenure_ < gens_) {
-			p->add_reference();
-			ASSERT_LOG(p->refcount() > 1, "Object with bad refcount: " << p->refcount() << ": " << p->debugObjectName());
-			items_.push_back(p);
-		} else if(p->tenure_ >= gens_) {
-			//the list of objects is sorted in order of tenure,
-			//since we always add at the head, so we don't need to continue
-			//once we found one already tenured.
-			break;
+	items_.swap(*items);
+	accumulate();
+	performCollection();
+
+	LOG_DEBUG("Incremental garbage collection complete in " << static_cast<int>(timer.get_time()) << "us. Collected " << items_.size() << " objects. " << saved_.size() << " candidates survived");
+}
+
+void GarbageCollectorImpl::accumulateAll()
+{
+	items_.reserve(total_count());
+
+	for(const Registry& r : g_registries) {
+		for(GarbageCollectible* p = r.head; p != nullptr; p = p->next_) {
+			if(gens_ < 0 || p->tenure_ < gens_) {
+				items_.push_back(p);
+			} else if(p->tenure_ >= gens_) {
+				//each registry is sorted in order of tenure,
+				//since we always add at the head, so we don't need to
+				//continue once we found one already tenured.
+				break;
+			}
 		}
 	}
 
+	accumulate();
+}
+
+void GarbageCollectorImpl::accumulate()
+{
+	for(GarbageCollectible* p : items_) {
+		p->add_reference();
+		ASSERT_LOG(p->refcount() > 1, "Object with bad refcount: " << p->refcount() << ": " << p->debugObjectName());
+	}
+
 	std::sort(items_.begin(), items_.end());
 
 	pointers_.reserve(items_.size()*2);
@@ -564,17 +825,20 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 {
 	LockGC lock;
 	FILE* out = fopen(fname, "w");
-	graph_ = Graph(g_count+1);
+	const int count = total_count();
+	graph_ = Graph(count+1);
 
 	items_.clear();
-	items_.reserve(g_count);
+	items_.reserve(count);
 
-	for(GarbageCollectible* p = g_head; p != nullptr; p = p->next_) {
-		graph_.setNode(items_.size(), p->debugObjectName());
+	for(const Registry& r : g_registries) {
+		for(GarbageCollectible* p = r.head; p != nullptr; p = p->next_) {
+			graph_.setNode(items_.size(), p->debugObjectName());
 
-		itemIndexes_[p] = items_.size();
-		items_.push_back(p);
-		itemsSet_.insert(p);
+			itemIndexes_[p] = items_.size();
+			items_.push_back(p);
+			itemsSet_.insert(p);
+		}
 	}
 
 	currentIndex_ = 0;
@@ -697,7 +961,7 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 #endif
 
 	std::map<std::string, int> obj_counts;
-	for(int i = 0; i != g_count; ++i) {
+	for(int i = 0; i != count; ++i) {
 		obj_counts[items_[i]->debugObjectName()]++;
 	}
 
@@ -716,9 +980,9 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 	fprintf(out, "TOTAL OBJECTS: %d\n", ncount);
 
 
-	int root_node = g_count;
+	int root_node = count;
 	graph_.setNode(root_node, "(root)");
-	for(int i = 0; i != g_count; ++i) {
+	for(int i = 0; i != count; ++i) {
 		const int refcount = items_[i]->refcount();
 		int refs = graph_.getNode(i).in_edges.size();
 		while(refs < refcount) {
@@ -730,7 +994,7 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 	std::map<int, std::vector<int> > paths;
 	breadthFirstSearch(graph_, root_node, paths);
 
-	for(int i = 0; i != g_count; ++i) {
+	for(int i = 0; i != count; ++i) {
 		fprintf(out, "REFS: ");
 		fprintf(out, "[%s @%p (%d)] ", items_[i]->debugObjectName().c_str(), items_[i], items_[i]->refcount());
 
@@ -760,7 +1024,265 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 	fclose(out);
 }
 
+//Spreads the expensive part of a collection -- calling surrenderReferences()
+//on every object -- over several steps. Instead of releasing references the
+//way GarbageCollectorImpl does, each object's outgoing references are only
+//recorded, so the heap stays intact and usable between steps. Once all
+//objects are scanned, any object with more references than recorded
+//incoming edges is reachable from outside the set, as is everything it
+//reaches. The rest are candidates, which GarbageCollectorImpl then collects
+//exactly, so a write the barrier missed can only cost precision, never
+//free a live object.
+class IncrementalGarbageCollector : public GarbageCollector
+{
+public:
+	explicit IncrementalGarbageCollector(int num_gens);
+	~IncrementalGarbageCollector();
+
+	void surrenderVariant(const variant* v, const char* description) override;
+	void surrenderPtrInternal(ffl::IntrusivePtr<GarbageCollectible>* ptr, const char* description) override;
+
+	//does up to budget_us of work. Returns true once scanning and analysis
+	//are done, with the candidates that should be collected in *garbage.
+	bool step(int budget_us, std::vector<GarbageCollectible*>* garbage);
+
+	void noteWrite(GarbageCollectible* obj);
+	void noteDestroyed(GarbageCollectible* obj);
+
+	int numObjects() const { return static_cast<int>(objects_.size()); }
+private:
+	struct Node {
+		Node() : begin_edge(0), end_edge(0), scanned(false), dead(false), queued(false)
+		{}
+		int begin_edge, end_edge;
+		bool scanned, dead, queued;
+	};
+
+	int findNode(const void* obj) const;
+	void addEdge(const void* obj);
+	void scan(int index);
+	void analyze();
+
+	//sorted, with nodes_ parallel to it.
+	std::vector<GarbageCollectible*> objects_;
+	std::vector<Node> nodes_;
+	std::vector<int> edges_;
+
+	std::vector<int> rescan_, candidates_;
+	int next_scan_;
+	bool analyzed_;
+};
+
 namespace {
+	//checking the clock is not free, so only do it this often while scanning.
+	const int ScanItemsPerTimeCheck = 16;
+}
+
+IncrementalGarbageCollector::IncrementalGarbageCollector(int num_gens) : next_scan_(0), analyzed_(false)
+{
+	objects_.reserve(total_count());
+	for(const Registry& r : g_registries) {
+		for(GarbageCollectible* p = r.head; p != nullptr; p = p->next_) {
+			if(num_gens >= 0 && p->tenure_ >= num_gens) {
+				break;
+			}
+
+			objects_.push_back(p);
+		}
+	}
+
+	std::sort(objects_.begin(), objects_.end());
+	nodes_.resize(objects_.size());
+	edges_.reserve(objects_.size()*2);
+
+	GarbageCollectible::incremental_collection_active_ = true;
+}
+
+IncrementalGarbageCollector::~IncrementalGarbageCollector()
+{
+	GarbageCollectible::incremental_collection_active_ = false;
+}
+
+int IncrementalGarbageCollector::findNode(const void* obj) const
+{
+	auto itor = std::lower_bound(objects_.begin(), objects_.end(), obj);
+	if(itor == objects_.end() || *itor != obj) {
+		return -1;
+	}
+
+	return static_cast<int>(itor - objects_.begin());
+}
+
+void IncrementalGarbageCollector::addEdge(const void* obj)
+{
+	const int index = findNode(obj);
+	if(index >= 0) {
+		edges_.push_back(index);
+	}
+}
+
+void IncrementalGarbageCollector::surrenderVariant(const variant* v, const char* description)
+{
+	switch(v->type_ ) {
+	case variant::VARIANT_TYPE_LIST:
+	case variant::VARIANT_TYPE_MAP:
+	case variant::VARIANT_TYPE_CALLABLE:
+	case variant::VARIANT_TYPE_FUNCTION:
+	case variant::VARIANT_TYPE_GENERIC_FUNCTION:
+	case variant::VARIANT_TYPE_MULTI_FUNCTION:
+		addEdge(v->get_addr());
+		break;
+	default:
+		break;
+	}
+}
+
+void IncrementalGarbageCollector::surrenderPtrInternal(ffl::IntrusivePtr<GarbageCollectible>* ptr, const char* description)
+{
+	if(ptr->get() != nullptr) {
+		addEdge(ptr->get());
+	}
+}
+
+void IncrementalGarbageCollector::scan(int index)
+{
+	Node& node = nodes_[index];
+	if(node.dead) {
+		return;
+	}
+
+	//a rescan just abandons the old range of edges.
+	node.begin_edge = static_cast<int>(edges_.size());
+	objects_[index]->surrenderReferences(this);
+	node.end_edge = static_cast<int>(edges_.size());
+	node.scanned = true;
+}
+
+void IncrementalGarbageCollector::analyze()
+{
+	std::vector<int> internal_refs(nodes_.size());
+	for(const Node& node : nodes_) {
+		if(node.dead) {
+			continue;
+		}
+
+		for(int n = node.begin_edge; n != node.end_edge; ++n) {
+			++internal_refs[edges_[n]];
+		}
+	}
+
+	std::vector<bool> live(nodes_.size());
+	std::vector<int> stack;
+	for(int n = 0; n != static_cast<int>(nodes_.size()); ++n) {
+		if(!nodes_[n].dead && objects_[n]->refcount() > internal_refs[n]) {
+			live[n] = true;
+			stack.push_back(n);
+		}
+	}
+
+	while(stack.empty() == false) {
+		const Node& node = nodes_[stack.back()];
+		stack.pop_back();
+
+		for(int n = node.begin_edge; n != node.end_edge; ++n) {
+			const int target = edges_[n];
+			if(!live[target] && !nodes_[target].dead) {
+				live[target] = true;
+				stack.push_back(target);
+			}
+		}
+	}
+
+	for(int n = 0; n != static_cast<int>(nodes_.size()); ++n) {
+		if(nodes_[n].dead) {
+			continue;
+		}
+
+		if(live[n]) {
+			objects_[n]->tenure_++;
+		} else {
+			candidates_.push_back(n);
+		}
+	}
+
+	analyzed_ = true;
+}
+
+bool IncrementalGarbageCollector::step(int budget_us, std::vector<GarbageCollectible*>* garbage)
+{
+	if(analyzed_) {
+		//candidates may have died since they were found.
+		for(int n : candidates_) {
+			if(!nodes_[n].dead) {
+				garbage->push_back(objects_[n]);
+			}
+		}
+
+		return true;
+	}
+
+	profile::timer timer;
+
+	int nscanned = 0;
+	while(next_scan_ != static_cast<int>(objects_.size()) || rescan_.empty() == false) {
+		if(++nscanned%ScanItemsPerTimeCheck == 0 && timer.get_time() >= budget_us) {
+			return false;
+		}
+
+		if(next_scan_ != static_cast<int>(objects_.size())) {
+			scan(next_scan_++);
+		} else {
+			const int index = rescan_.back();
+			rescan_.pop_back();
+			nodes_[index].queued = false;
+			scan(index);
+		}
+	}
+
+	//the candidates are freed on the next step, with a fresh budget.
+	analyze();
+	return false;
+}
+
+void IncrementalGarbageCollector::noteWrite(GarbageCollectible* obj)
+{
+	if(analyzed_) {
+		return;
+	}
+
+	const int index = findNode(obj);
+	if(index < 0) {
+		return;
+	}
+
+	Node& node = nodes_[index];
+	if(node.scanned && !node.queued && !node.dead) {
+		node.queued = true;
+		rescan_.push_back(index);
+	}
+}
+
+void IncrementalGarbageCollector::noteDestroyed(GarbageCollectible* obj)
+{
+	const int index = findNode(obj);
+	if(index >= 0) {
+		nodes_[index].dead = true;
+	}
+}
+
+namespace {
+	std::unique_ptr<IncrementalGarbageCollector> g_incremental_gc;
+
+	void incremental_gc_note_write(GarbageCollectible* obj)
+	{
+		g_incremental_gc->noteWrite(obj);
+	}
+
+	void incremental_gc_note_destroyed(GarbageCollectible* obj)
+	{
+		g_incremental_gc->noteDestroyed(obj);
+	}
+
 	std::vector<std::shared_ptr<GarbageCollectorImpl>> g_reapable_gc;
 }
 
@@ -775,12 +1297,16 @@ void runGarbageCollection(int num_gens, bool mandatory)
 	std::lock_guard<std::mutex> lock(GarbageCollector::getGlobalMutex(), std::adopt_lock_t());
 	
 	reapGarbageCollection();
+	abortIncrementalGarbageCollection();
 
 	formula_profiler::Instrument instrument("GC");
+	profile::timer timer;
 	std::shared_ptr<GarbageCollectorImpl> gc(new GarbageCollectorImpl(num_gens));
 	gc->collect();
 	gc->reap();
 //	g_reapable_gc.push_back(gc);
+
+	formula_profiler::add_pause_sample("GC", static_cast<int64_t>(timer.get_time()));
 }
 
 void reapGarbageCollection()
@@ -793,6 +1319,64 @@ void reapGarbageCollection()
 	g_reapable_gc.clear();
 }
 
+void beginIncrementalGarbageCollection(int num_gens)
+{
+	LockGC lock;
+	if(g_incremental_gc) {
+		return;
+	}
+
+	g_incremental_gc.reset(new IncrementalGarbageCollector(num_gens));
+	LOG_DEBUG("Beginning incremental garbage collection of " << g_incremental_gc->numObjects() << " items");
+}
+
+bool stepIncrementalGarbageCollection(int budget_us)
+{
+	if(!g_incremental_gc) {
+		return false;
+	}
+
+	//an asynchronous collection is running; try again next frame.
+	if(GarbageCollector::getGlobalMutex().try_lock() == false) {
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(GarbageCollector::getGlobalMutex(), std::adopt_lock_t());
+
+	formula_profiler::Instrument instrument("GC");
+	profile::timer timer;
+
+	std::vector<GarbageCollectible*> garbage;
+	bool done = false;
+	{
+		LockGC lock_gc;
+		done = g_incremental_gc->step(budget_us, &garbage);
+		if(done) {
+			g_incremental_gc.reset();
+		}
+	}
+
+	if(garbage.empty() == false) {
+		GarbageCollectorImpl gc;
+		gc.collectItems(&garbage);
+		gc.reap();
+	}
+
+	formula_profiler::add_pause_sample("GC", static_cast<int64_t>(timer.get_time()));
+	return !done;
+}
+
+bool isIncrementalGarbageCollectionInProgress()
+{
+	return g_incremental_gc.get() != nullptr;
+}
+
+void abortIncrementalGarbageCollection()
+{
+	LockGC lock;
+	g_incremental_gc.reset();
+}
+
 void runGarbageCollectionDebug(const char* fname)
 {
 	reapGarbageCollection();
@@ -804,3 +1388,115 @@ void runGarbageCollectionDebug(const char* fname)
 	GarbageCollectorAnalyzer().run(fname);
 }
 
+
+namespace {
+	struct GCTestObject : public GarbageCollectible
+	{
+		explicit GCTestObject(int* destroyed) : destroyed_(destroyed) {}
+		~GCTestObject() { ++*destroyed_; }
+
+		void surrenderReferences(GarbageCollector* collector) override {
+			collector->surrenderPtr(&ref);
+		}
+
+		ffl::IntrusivePtr<GCTestObject> ref;
+		int* destroyed_;
+	};
+}
+
+UNIT_TEST(incremental_garbage_collection)
+{
+	int destroyed = 0;
+	{
+		ffl::IntrusivePtr<GCTestObject> a(new GCTestObject(&destroyed)), b(new GCTestObject(&destroyed));
+		a->ref = b;
+		b->ref = a;
+	}
+
+	ffl::IntrusivePtr<GCTestObject> c(new GCTestObject(&destroyed));
+	c->ref.reset(new GCTestObject(&destroyed));
+
+	beginIncrementalGarbageCollection();
+	stepIncrementalGarbageCollection(0);
+
+	//move the only reference to c's child onto the stack mid-collection.
+	ffl::IntrusivePtr<GCTestObject> d = c->ref;
+	c->writeBarrier();
+	c->ref.reset();
+
+	while(stepIncrementalGarbageCollection(0)) {
+	}
+
+	CHECK_EQ(destroyed, 2);
+	CHECK_EQ(d->refcount(), 1);
+}
+
+UNIT_TEST(collectibles_from_worker_threads)
+{
+	int destroyed = 0;
+	GarbageCollectible::incrementWorkerThreads();
+
+	std::vector<std::thread> threads;
+	for(int n = 0; n != 4; ++n) {
+		threads.push_back(std::thread([&destroyed]() {
+			ffl::IntrusivePtr<GCTestObject> a(new GCTestObject(&destroyed)), b(new GCTestObject(&destroyed));
+			a->ref = b;
+			b->ref = a;
+			GarbageCollectible::releaseThreadCache();
+		}));
+	}
+
+	for(std::thread& t : threads) {
+		t.join();
+	}
+
+	GarbageCollectible::decrementWorkerThreads();
+
+	beginIncrementalGarbageCollection();
+	while(stepIncrementalGarbageCollection(1000)) {
+	}
+
+	CHECK_EQ(destroyed, 8);
+}
+
+BENCHMARK_ARG(collectible_allocation_threads, int nthreads)
+{
+	//every thread gets its own formula and callable, since FFL reference
+	//counts are only atomic when built with MT_FFL.
+	std::vector<std::unique_ptr<game_logic::Formula>> formulae;
+	std::vector<ffl::IntrusivePtr<game_logic::MapFormulaCallable>> callables;
+	for(int n = 0; n != nthreads; ++n) {
+		formulae.emplace_back(new game_logic::Formula(variant("map(range(input), {index: value, pair: [value, value*2]})")));
+		callables.push_back(ffl::IntrusivePtr<game_logic::MapFormulaCallable>(new game_logic::MapFormulaCallable));
+		callables.back()->add("input", variant(100));
+	}
+
+	GarbageCollectible::incrementWorkerThreads();
+
+	BENCHMARK_LOOP {
+		std::vector<std::thread> threads;
+		for(int n = 0; n != nthreads; ++n) {
+			game_logic::Formula* f = formulae[n].get();
+			game_logic::MapFormulaCallable* callable = callables[n].get();
+			threads.push_back(std::thread([f, callable]() {
+				variant::registerThread();
+				for(int i = 0; i != 100; ++i) {
+					f->execute(*callable);
+				}
+				variant::unregisterThread();
+				GarbageCollectible::releaseThreadCache();
+			}));
+		}
+
+		for(std::thread& t : threads) {
+			t.join();
+		}
+	}
+
+	GarbageCollectible::decrementWorkerThreads();
+}
+
+BENCHMARK_ARG_CALL(collectible_allocation_threads, 1, 1);
+BENCHMARK_ARG_CALL(collectible_allocation_threads, 2, 2);
+BENCHMARK_ARG_CALL(collectible_allocation_threads, 4, 4);
+BENCHMARK_ARG_CALL(collectible_allocation_threads, 8, 8);
@@ -27,22 +27,37 @@ public:
 
 	virtual void surrenderReferences(GarbageCollector* collector);
 
+	//should be called whenever the set of collectibles this object refers
+	//to changes, so an incremental collection in progress rescans it.
+	void writeBarrier() {
+		if(incremental_collection_active_) {
+			noteWrite();
+		}
+	}
+
 	virtual std::string debugObjectName() const;
 	virtual std::string debugObjectSpew() const;
 
 	friend class GarbageCollectorImpl;
 	friend class GarbageCollectorAnalyzer;
+	friend class IncrementalGarbageCollector;
 
-#ifdef DEBUG_GARBAGE_COLLECTOR
 	void* operator new(size_t sz);
-	void operator delete(void* ptr) noexcept;
-#endif
+	void operator delete(void* ptr, size_t sz) noexcept;
+
+	//returns the calling thread's cached free memory to the shared pool.
+	//Threads which allocate collectibles should call this before exiting.
+	static void releaseThreadCache();
 private:
 	void insertAtHead();
+	void noteWrite();
+	static bool incremental_collection_active_;
+
 	GarbageCollectible* next_;
 	GarbageCollectible* prev_;
 
 	int tenure_;
+	int registry_;
 };
 
 class GarbageCollector
@@ -65,3 +80,11 @@ private:
 void runGarbageCollection(int num_gens=-1, bool mandatory=true);
 void reapGarbageCollection();
 void runGarbageCollectionDebug(const char* fname);
+
+//Incremental collection. Marking is spread over calls to
+//stepIncrementalGarbageCollection(), each of which does roughly budget_us of
+//work; garbage found is then freed by a final pass over just the candidates.
+void beginIncrementalGarbageCollection(int num_gens=-1);
+bool stepIncrementalGarbageCollection(int budget_us);
+bool isIncrementalGarbageCollectionInProgress();
+void abortIncrementalGarbageCollection();
@@ -1795,8 +1795,38 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 		}
 	}
 
+	const reference_counted_object* FormulaObject::getSlotLayout() const
+	{
+		return class_.get();
+	}
+
+	int FormulaObject::getCacheableSlot(const std::string& key) const
+	{
+		//keys getValue() special-cases are left to lookup by name.
+		if(key == "_data" || key == "value" || key == "self" || key == "me" || key == "_class" || key == "lib" || key == "_uuid") {
+			return -1;
+		}
+
+		auto def = class_->getBuiltinDef();
+		if(def) {
+			const int slot = def->getSlot(key);
+			if(slot >= 0) {
+				return slot < class_->getBuiltinSlots() ? NUM_BASE_FIELDS + slot : -1;
+			}
+		}
+
+		std::map<std::string, int>::const_iterator itor = class_->properties().find(key);
+		if(itor == class_->properties().end()) {
+			return -1;
+		}
+
+		return NUM_BASE_FIELDS + class_->getBuiltinSlots() + itor->second;
+	}
+
 	void FormulaObject::setValue(const std::string& key, const variant& value)
 	{
+		writeBarrier();
+
 		if(private_data_ != -1 && key == "_data") {
 			variables_[private_data_] = value;
 			return;
@@ -1820,6 +1850,8 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 
 	void FormulaObject::setValueBySlot(int slot, const variant& value)
 	{
+		writeBarrier();
+
 		if(slot < NUM_BASE_FIELDS) {
 			switch(slot) {
 			case FIELD_PRIVATE:
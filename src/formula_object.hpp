@@ -108,6 +108,8 @@ namespace game_logic
 
 		variant getValue(const std::string& key) const override;
 		variant getValueBySlot(int slot) const override;
+		const reference_counted_object* getSlotLayout() const override;
+		int getCacheableSlot(const std::string& key) const override;
 		void setValue(const std::string& key, const variant& value) override;
 		void setValueBySlot(int slot, const variant& value) override;
 
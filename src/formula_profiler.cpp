@@ -28,6 +28,7 @@
 #include <SDL_thread.h>
 #include <SDL_timer.h>
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
 #include <map>
@@ -51,6 +52,7 @@
 #include "formula_profiler.hpp"
 #include "formula_function.hpp"
 #include "formula_function_registry.hpp"
+#include "formula_vm.hpp"
 #include "level_runner.hpp"
 #include "object_events.hpp"
 #include "preferences.hpp"
@@ -1072,6 +1074,50 @@ namespace formula_profiler
 		};
 
 		std::map<const char*, InstrumentationRecord> g_instrumentation;
+		std::map<const char*, int64_t> g_counters;
+
+		//upper bound of every pause bucket but the last, in microseconds.
+		const int64_t PauseBucketLimits[] = { 250, 500, 1000, 2000, 4000, 8000, 16000 };
+		const int NumPauseBuckets = sizeof(PauseBucketLimits)/sizeof(*PauseBucketLimits) + 1;
+
+		struct PauseHistogram
+		{
+			PauseHistogram() : nsamples(0), max_us(0)
+			{
+				std::fill(buckets, buckets + NumPauseBuckets, 0);
+			}
+			int64_t buckets[NumPauseBuckets];
+			int64_t nsamples, max_us;
+		};
+
+		std::map<const char*, PauseHistogram> g_pauses;
+
+		std::string pause_bucket_name(int bucket)
+		{
+			if(bucket == NumPauseBuckets-1) {
+				return formatter() << ">=" << PauseBucketLimits[bucket-1] << "us";
+			}
+
+			return formatter() << "<" << PauseBucketLimits[bucket] << "us";
+		}
+	}
+
+	void add_counter(const char* id, int64_t amount)
+	{
+		g_counters[id] += amount;
+	}
+
+	void add_pause_sample(const char* id, int64_t time_us)
+	{
+		PauseHistogram& h = g_pauses[id];
+		int bucket = 0;
+		while(bucket != NumPauseBuckets-1 && time_us >= PauseBucketLimits[bucket]) {
+			++bucket;
+		}
+
+		h.buckets[bucket]++;
+		h.nsamples++;
+		h.max_us = std::max(h.max_us, time_us);
 	}
 
 	const char* Instrument::generate_id(const char* id, int num)
@@ -1153,10 +1199,45 @@ namespace formula_profiler
 					const int percent = (i->second.time_ns/10)/time_us;
 					ss << i->first << ": " << i->second.time_ns/1000 << "us (" << percent << "%) in " << i->second.nsamples << " calls; ";
 				}
+
+				if(g_counters.empty() == false) {
+					ss << "COUNTERS: ";
+					for(const auto& counter : g_counters) {
+						ss << counter.first << ": " << counter.second << "; ";
+					}
+				}
+
+				if(g_pauses.empty() == false) {
+					ss << "PAUSES: ";
+					for(const auto& p : g_pauses) {
+						ss << p.first << ": " << p.second.nsamples << " samples, max " << p.second.max_us << "us [";
+						for(int n = 0; n != NumPauseBuckets; ++n) {
+							if(p.second.buckets[n]) {
+								ss << " " << pause_bucket_name(n) << ": " << p.second.buckets[n];
+							}
+						}
+						ss << " ]; ";
+					}
+				}
+
+				const std::vector<formula_vm::PropertyCaches::Report> caches = formula_vm::PropertyCaches::getReport(true);
+				if(caches.empty() == false) {
+					int64_t hits = 0, misses = 0;
+					int megamorphic = 0;
+					for(const auto& site : caches) {
+						hits += site.hits;
+						misses += site.misses;
+						megamorphic += site.megamorphic ? 1 : 0;
+					}
+
+					ss << "INLINE CACHES: " << hits << " hits, " << misses << " misses, " << megamorphic << " megamorphic sites; ";
+				}
 				LOG_INFO(ss.str());
 			}
 
 			g_instrumentation.clear();
+			g_counters.clear();
+			g_pauses.clear();
 		}
 
 		first_call = false;
@@ -1573,6 +1654,42 @@ namespace formula_profiler
 			}
 		}
 
+		return variant(&result);
+	DEFINE_FIELD(counters, "{string -> int}")
+		std::map<variant,variant> m;
+		for(const auto& counter : g_counters) {
+			m[variant(counter.first)] = variant(static_cast<int>(counter.second));
+		}
+
+		return variant(&m);
+	DEFINE_FIELD(pauses, "{string -> {samples: int, max_us: int, buckets: {string -> int}}}")
+		std::map<variant,variant> m;
+		for(const auto& p : g_pauses) {
+			std::map<variant,variant> buckets;
+			for(int n = 0; n != NumPauseBuckets; ++n) {
+				buckets[variant(pause_bucket_name(n))] = variant(static_cast<int>(p.second.buckets[n]));
+			}
+
+			std::map<variant,variant> info;
+			info[variant("samples")] = variant(static_cast<int>(p.second.nsamples));
+			info[variant("max_us")] = variant(static_cast<int>(p.second.max_us));
+			info[variant("buckets")] = variant(&buckets);
+			m[variant(p.first)] = variant(&info);
+		}
+
+		return variant(&m);
+	DEFINE_FIELD(inline_caches, "[{site: string, hits: int, misses: int, layouts: int, megamorphic: bool}]")
+		std::vector<variant> result;
+		for(const auto& site : formula_vm::PropertyCaches::getReport()) {
+			std::map<variant,variant> m;
+			m[variant("site")] = variant(site.site);
+			m[variant("hits")] = variant(static_cast<int>(site.hits));
+			m[variant("misses")] = variant(static_cast<int>(site.misses));
+			m[variant("layouts")] = variant(site.layouts);
+			m[variant("megamorphic")] = variant::from_bool(site.megamorphic);
+			result.push_back(variant(&m));
+		}
+
 		return variant(&result);
 	END_DEFINE_CALLABLE(ProfilerInterface)
 
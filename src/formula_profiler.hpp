@@ -76,6 +76,10 @@ namespace formula_profiler
 	};
 
 	inline std::string get_profile_summary() { return ""; }
+
+	inline void add_counter(const char* id, int64_t amount=1) {}
+
+	inline void add_pause_sample(const char* id, int64_t time_us) {}
 }
 
 #else
@@ -158,6 +162,16 @@ namespace formula_profiler
 	};
 
 	std::string get_profile_summary();
+
+	//adds to a named counter. Counters are reported and reset along with the
+	//instrumentation each time it is dumped, and are readable from FFL
+	//through anura_profiler().counters. id must be a string literal.
+	void add_counter(const char* id, int64_t amount=1);
+
+	//records a pause, such as a garbage collection step, in a named histogram
+	//whose buckets double from 250us. Reported and reset along with the
+	//counters, and readable through anura_profiler().pauses.
+	void add_pause_sample(const char* id, int64_t time_us);
 }
 
 #endif
@@ -88,6 +88,8 @@ namespace game_logic
 
 	void FormulaVariableStorage::add(const std::string& key, const variant& value)
 	{
+		writeBarrier();
+
 		std::map<std::string,int>::const_iterator i = strings_to_values_.find(key);
 		if(i != strings_to_values_.end()) {
 			values_[i->second] = value;
@@ -128,6 +130,7 @@ namespace game_logic
 
 	void FormulaVariableStorage::setValueBySlot(int slot, const variant& value)
 	{
+		writeBarrier();
 		values_[slot] = value;
 	}
 
@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <limits>
+#include <map>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <vector>
 
@@ -11,6 +15,7 @@
 #include "formula_vm.hpp"
 #include "formula_where.hpp"
 #include "random.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "utf8_to_codepoint.hpp"
 #include "variant_type.hpp"
@@ -59,7 +64,7 @@ struct VMOverflowGuard {
 
 
 
-variant VirtualMachine::execute(const FormulaCallable& variables) const
+variant VirtualMachine::execute(const FormulaCallable& variables, PropertyCaches* caches) const
 {
 	VMOverflowGuard overflow_guard;
 
@@ -72,34 +77,17 @@ variant VirtualMachine::execute(const FormulaCallable& variables) const
 		ASSERT_LOG(false, "Overflow in VM: " << debugPinpointLocation(&instructions_[0], stack));
 	}
 
-	executeInternal(variables, variables_stack, stack, symbol_stack, &instructions_[0], &instructions_[0] + instructions_.size());
+	executeInternal(variables, variables_stack, stack, symbol_stack, &instructions_[0], &instructions_[0] + instructions_.size(), caches);
 	return stack.back();
 }
 
-void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vector<FormulaCallablePtr>& variables_stack, std::vector<variant>& stack, std::vector<variant>& symbol_stack, const InstructionType* p, const InstructionType* p2) const
+void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vector<FormulaCallablePtr>& variables_stack, std::vector<variant>& stack, std::vector<variant>& symbol_stack, const InstructionType* p, const InstructionType* p2, PropertyCaches* caches) const
 {
 	for(; p != p2; ++p) {
 		switch((unsigned char)*p) {
 		case OP_IN:
 		case OP_NOT_IN: {
-			variant& left = stack[stack.size()-2];
-			variant& right = stack[stack.size()-1];
-
-			bool result = false;
-			if(right.is_list()) {
-				for(int n = 0; n != right.num_elements(); ++n) {
-					if(left == right[n]) {
-						result = true;
-					}
-				}
-
-			} else if(right.is_map()) {
-				result = right.has_key(left);
-			} else {
-				ASSERT_LOG(false, "ILLEGAL OPERAND TO 'in': " << right.write_json() << " AT " << debugPinpointLocation(p, stack));
-				
-			}
-
+			bool result = valueIn(stack[stack.size()-2], stack.back(), p, stack);
 			if(*p == OP_NOT_IN) {
 				result = !result;
 			}
@@ -283,7 +271,8 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 
 		case OP_LOOKUP_STR: {
 			const FormulaCallable& vars = variables_stack.empty() ? variables : *variables_stack.back();
-			variant value = vars.queryValue(stack.back().as_string());
+			const int site = caches ? caches->siteAt(static_cast<int>(p - &instructions_[0])) : -1;
+			variant value = site >= 0 ? caches->query(site, vars, stack.back().as_string()) : vars.queryValue(stack.back().as_string());
 			stack.back() = value;
 			break;
 		}
@@ -319,52 +308,11 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 		}
 
 		case OP_INDEX_STR: {
-			variant& left = stack[stack.size()-2];
-			variant& right = stack[stack.size()-1];
-
-			if(left.is_callable()) {
-				variant result = left.as_callable()->queryValue(right.as_string());
-				left = result;
-			} else if(left.is_map()) {
-				variant result = left[right];
-				left = result;
-			}
-			else if (left.is_list() && !right.is_string()) {
-				variant result = left[right];
-				left = result;
-			}
-			else if (left.is_list()) {
-				const std::string& s = right.as_string();
-				int index;
-				if (s == "x" || s == "r") {
-					index = 0;
-				}
-				else if (s == "y" || s == "g") {
-					index = 1;
-				}
-				else if (s == "z" || s == "b") {
-					index = 2;
-				}
-				else if (s == "a") {
-					index = 3;
-				}
-				else {
-					ASSERT_LOG(false, "Illegal string lookup on list: " << s << ": " << debugPinpointLocation(p, stack));
-				}
-
-				variant result = left[index];
-				left = result;
-			}
-			else if (left.is_string()) {
-				const std::string& s = left.as_string();
-				unsigned int index = right.as_int();
-				ASSERT_LOG(index < s.length(), "index outside bounds: " << s << "[" << index << "]'\n'"  << debugPinpointLocation(p, stack));
-				left = variant(s.substr(index, 1));
-
-			} else {
-				ASSERT_LOG(false, "Illegal lookup in bytecode: " << left.to_debug_string() << " indexed by " << right.to_debug_string() << " expected map or object");
-			}
+			const variant& left = stack[stack.size()-2];
+			const int site = caches && left.is_callable() ? caches->siteAt(static_cast<int>(p - &instructions_[0])) : -1;
+			variant result = site >= 0 ? caches->query(site, *left.as_callable(), stack.back().as_string()) : indexStr(left, stack.back(), p, stack);
 			stack.pop_back();
+			stack.back() = result;
 			break;
 		}
 
@@ -414,52 +362,9 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 		}
 
 		case OP_ARRAY_SLICE: {
-
-			variant& left = stack[stack.size()-3];
-
-			int begin_index = stack[stack.size()-2].as_int();
-			int end_index = stack[stack.size()-1].as_int(left.num_elements());
-
-			if(left.is_string()) {
-				const std::string& s = left.as_string();
-				int s_len = static_cast<int>(s.length());
-				if(begin_index > s_len) {
-					begin_index = s_len;
-				}
-				if(end_index > s_len) {
-					end_index = s_len;
-				}
-
-				std::string result;
-
-				if(s_len != 0 && end_index >= begin_index) {
-					result = s.substr(begin_index, end_index-begin_index);
-				}
-
-				stack.resize(stack.size()-2);
-				stack.back() = variant(result);
-			} else {
-				if(begin_index > left.num_elements()) {
-					begin_index = left.num_elements();
-				}
-
-				if(end_index > left.num_elements()) {
-					end_index = left.num_elements();
-				}
-
-				if(left.is_list()) {
-					if(end_index >= begin_index && left.num_elements() > 0) {
-						left = left.get_list_slice(begin_index, end_index);
-						stack.resize(stack.size()-2);
-					} else {
-						std::vector<variant> empty;
-						stack.resize(stack.size()-2);
-						stack.back() = variant(&empty);
-					}
-				} else {
-					ASSERT_LOG(false, "illegal usage of operator [:]: " << debugPinpointLocation(p, stack) << " called on " << variant::variant_type_to_string(left.type()));
-				}
-			}
+			variant result = arraySlice(stack[stack.size()-3], stack[stack.size()-2], stack.back(), p, stack);
+			stack.resize(stack.size()-2);
+			stack.back() = result;
 			break;
 		}
 
@@ -578,7 +483,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 						variables_stack.back().reset(callable);
 					}
 					callable->set(in, index);
-					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1);
+					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1, caches);
 					++index;
 				}
 
@@ -614,7 +519,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 						variables_stack.back().reset(callable);
 					}
 					callable->set(in.first, in.second, index);
-					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1);
+					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1, caches);
 					++index;
 				}
 
@@ -685,7 +590,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 						variables_stack.back().reset(callable);
 					}
 					callable->set(in, index);
-					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1);
+					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1, caches);
 
 					if(stack.back().as_bool()) {
 						res.push_back(in);
@@ -727,7 +632,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 						variables_stack.back().reset(callable);
 					}
 					callable->set(in.first, in.second, index);
-					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1);
+					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1, caches);
 
 					if(stack.back().as_bool()) {
 						res.insert(in);
@@ -773,7 +678,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 						variables_stack.back().reset(callable);
 					}
 					callable->set(item, index);
-					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1);
+					executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1, caches);
 					if(stack.back().as_bool()) {
 						stack.pop_back();
 						break;
@@ -854,7 +759,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 					*args[n] = lists[n][indexes[n]];
 				}
 
-				executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1);
+				executeInternal(variables, variables_stack, stack, symbol_stack, p+2, p + *(p+1) + 1, caches);
 
 				if(!incrementVec(indexes, nelements)) {
 					break;
@@ -1027,18 +932,122 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 	}
 }
 
+bool VirtualMachine::valueIn(const variant& left, const variant& right, const InstructionType* p, const std::vector<variant>& stack) const
+{
+	bool result = false;
+	if(right.is_list()) {
+		for(int n = 0; n != right.num_elements(); ++n) {
+			if(left == right[n]) {
+				result = true;
+			}
+		}
+
+	} else if(right.is_map()) {
+		result = right.has_key(left);
+	} else {
+		ASSERT_LOG(false, "ILLEGAL OPERAND TO 'in': " << right.write_json() << " AT " << debugPinpointLocation(p, stack));
+	}
+
+	return result;
+}
+
+variant VirtualMachine::indexStr(const variant& left, const variant& right, const InstructionType* p, const std::vector<variant>& stack) const
+{
+	if(left.is_callable()) {
+		return left.as_callable()->queryValue(right.as_string());
+	} else if(left.is_map()) {
+		return left[right];
+	} else if(left.is_list() && !right.is_string()) {
+		return left[right];
+	} else if(left.is_list()) {
+		const std::string& s = right.as_string();
+		int index;
+		if(s == "x" || s == "r") {
+			index = 0;
+		} else if(s == "y" || s == "g") {
+			index = 1;
+		} else if(s == "z" || s == "b") {
+			index = 2;
+		} else if(s == "a") {
+			index = 3;
+		} else {
+			ASSERT_LOG(false, "Illegal string lookup on list: " << s << ": " << debugPinpointLocation(p, stack));
+		}
+
+		return left[index];
+	} else if(left.is_string()) {
+		const std::string& s = left.as_string();
+		unsigned int index = right.as_int();
+		ASSERT_LOG(index < s.length(), "index outside bounds: " << s << "[" << index << "]'\n'"  << debugPinpointLocation(p, stack));
+		return variant(s.substr(index, 1));
+	}
+
+	ASSERT_LOG(false, "Illegal lookup in bytecode: " << left.to_debug_string() << " indexed by " << right.to_debug_string() << " expected map or object");
+	return variant();
+}
+
+variant VirtualMachine::arraySlice(const variant& left, const variant& begin, const variant& end, const InstructionType* p, const std::vector<variant>& stack) const
+{
+	int begin_index = begin.as_int();
+	int end_index = end.as_int(left.num_elements());
+
+	if(left.is_string()) {
+		const std::string& s = left.as_string();
+		int s_len = static_cast<int>(s.length());
+		if(begin_index > s_len) {
+			begin_index = s_len;
+		}
+		if(end_index > s_len) {
+			end_index = s_len;
+		}
+
+		std::string result;
+
+		if(s_len != 0 && end_index >= begin_index) {
+			result = s.substr(begin_index, end_index-begin_index);
+		}
+
+		return variant(result);
+	}
+
+	if(begin_index > left.num_elements()) {
+		begin_index = left.num_elements();
+	}
+
+	if(end_index > left.num_elements()) {
+		end_index = left.num_elements();
+	}
+
+	if(left.is_list()) {
+		if(end_index >= begin_index && left.num_elements() > 0) {
+			return left.get_list_slice(begin_index, end_index);
+		}
+
+		std::vector<variant> empty;
+		return variant(&empty);
+	}
+
+	ASSERT_LOG(false, "illegal usage of operator [:]: " << debugPinpointLocation(p, stack) << " called on " << variant::variant_type_to_string(left.type()));
+	return variant();
+}
+
 void VirtualMachine::replaceInstructions(Iterator i1, Iterator i2, const std::vector<InstructionType>& new_instructions)
 {
-	const int diff = static_cast<int>(new_instructions.size()) - (static_cast<int>(i2.get_index()) - static_cast<int>(i1.get_index()));
+	replaceRange(static_cast<int>(i1.get_index()), static_cast<int>(i2.get_index()), new_instructions);
+}
+
+void VirtualMachine::replaceRange(int begin, int end, const std::vector<InstructionType>& new_instructions)
+{
+	const int diff = static_cast<int>(new_instructions.size()) - (end - begin);
 
 	for(DebugInfo& info : debug_info_) {
-		if(info.bytecode_pos >= i2.get_index()) {
+		if(info.bytecode_pos >= end) {
 			info.bytecode_pos += diff;
 		}
 	}
 
 	for(Iterator i = begin_itor(); i.at_end() == false; i.next()) {
-		if(i.get_index() >= i1.get_index() && i.get_index() < i2.get_index()) {
+		if(static_cast<int>(i.get_index()) >= begin && static_cast<int>(i.get_index()) < end) {
 			continue;
 		}
 
@@ -1048,15 +1057,15 @@ void VirtualMachine::replaceInstructions(Iterator i1, Iterator i2, const std::ve
 
 		const int src_index = static_cast<int>(i.get_index());
 		const int dst_index = src_index + static_cast<int>(i.arg()) + 1;
-		if(src_index < i1.get_index() && dst_index >= i2.get_index()) {
+		if(src_index < begin && dst_index >= end) {
 			i.arg_mutable() += diff;
-		} else if(src_index >= i2.get_index() && dst_index <= i1.get_index()) {
+		} else if(src_index >= end && dst_index <= begin) {
 			i.arg_mutable() -= diff;
 		}
 	}
 
-	instructions_.erase(instructions_.begin() + i1.get_index(), instructions_.begin() + i2.get_index());
-	instructions_.insert(instructions_.begin() + i1.get_index(), new_instructions.begin(), new_instructions.end());
+	instructions_.erase(instructions_.begin() + begin, instructions_.begin() + end);
+	instructions_.insert(instructions_.begin() + begin, new_instructions.begin(), new_instructions.end());
 }
 
 void VirtualMachine::addInstruction(OP op)
@@ -1077,26 +1086,33 @@ void VirtualMachine::addInt(InstructionType i)
 
 void VirtualMachine::addLoadConstantInstruction(const variant& v)
 {
+	const std::vector<InstructionType> load = loadConstantInstructions(v);
+	instructions_.insert(instructions_.end(), load.begin(), load.end());
+}
+
+std::vector<VirtualMachine::InstructionType> VirtualMachine::loadConstantInstructions(const variant& v)
+{
+	std::vector<InstructionType> result;
 	if(v.is_null()) {
-		addInstruction(OP_PUSH_NULL);
-		return;
+		result.push_back(OP_PUSH_NULL);
+		return result;
 	}
 
 	if(v.is_int()) {
 		if(v == variant(0)) {
-			addInstruction(OP_PUSH_0);
-			return;
+			result.push_back(OP_PUSH_0);
+			return result;
 		}
 
 		if(v == variant(1)) {
-			addInstruction(OP_PUSH_1);
-			return;
+			result.push_back(OP_PUSH_1);
+			return result;
 		}
 
 		if(v.as_int() <= std::numeric_limits<InstructionType>::max() && v.as_int() >= std::numeric_limits<InstructionType>::min()) {
-			addInstruction(OP_PUSH_INT);
-			addInt(v.as_int());
-			return;
+			result.push_back(OP_PUSH_INT);
+			result.push_back(static_cast<InstructionType>(v.as_int()));
+			return result;
 		}
 	}
 
@@ -1106,8 +1122,9 @@ void VirtualMachine::addLoadConstantInstruction(const variant& v)
 		itor = constants_.end()-1;
 	}
 
-	addInstruction(OP_CONSTANT);
-	addInt(static_cast<int>(itor - constants_.begin()));
+	result.push_back(OP_CONSTANT);
+	result.push_back(static_cast<InstructionType>(itor - constants_.begin()));
+	return result;
 }
 
 int VirtualMachine::addJumpSource(InstructionType i)
@@ -1505,18 +1522,1511 @@ bool VirtualMachine::isInstructionJump(InstructionType i)
 	return isInstructionLoop(i) || (i >= OP_JMP_IF && i <= OP_JMP);
 }
 
-UNIT_TEST(formula_vm) {
-	MapFormulaCallable* callable = new MapFormulaCallable;
-	variant ref(callable);
+namespace {
+	//Operand counts for the folding and subexpression passes. Pure
+	//instructions have no side effects and their result depends only on
+	//their operands or, for lookups, on the current scope. Returns -1 for
+	//anything else, and -2 for OP_LIST and OP_MAP, which also pop an item
+	//count.
+	int pureOperandCount(int op, bool* scoped)
 	{
-		VirtualMachine vm;
-		vm.addInstruction(OP_CONSTANT);
-		vm.addConstant(variant(5));
-		vm.addInstruction(OP_CONSTANT);
-		vm.addConstant(variant(8));
-		vm.addInstruction(OP_ADD);
-		CHECK_EQ(vm.execute(*callable), variant(13));
+		*scoped = false;
+		switch(op) {
+		case OP_CONSTANT: case OP_PUSH_INT: case OP_PUSH_NULL:
+		case OP_PUSH_0: case OP_PUSH_1:
+			return 0;
+
+		case OP_LOOKUP:
+			*scoped = true;
+			return 0;
+
+		case OP_LOOKUP_STR:
+			*scoped = true;
+			return 1;
+
+		case OP_UNARY_NOT: case OP_UNARY_SUB: case OP_UNARY_STR:
+		case OP_UNARY_NUM_ELEMENTS: case OP_INCREMENT:
+		case OP_INDEX_0: case OP_INDEX_1: case OP_INDEX_2:
+			return 1;
+
+		case OP_IN: case OP_NOT_IN: case OP_AND: case OP_OR: case OP_NEQ:
+		case OP_LTE: case OP_GTE: case OP_IS: case OP_IS_NOT: case OP_GT:
+		case OP_LT: case OP_EQ: case OP_ADD: case OP_SUB: case OP_MUL:
+		case OP_DIV: case OP_POW: case OP_MOD:
+		case OP_INDEX: case OP_INDEX_STR:
+			return 2;
+
+		case OP_ARRAY_SLICE:
+			return 3;
+
+		case OP_LIST: case OP_MAP:
+			return -2;
+
+		default:
+			return -1;
+		}
+	}
+
+	const int UnknownCount = -1;
+
+	//what a constant instruction pushes, if it could be an item count.
+	int leafCount(const VirtualMachine::InstructionType* p, const std::vector<variant>& constants)
+	{
+		switch(*p) {
+		case OP_PUSH_0: return 0;
+		case OP_PUSH_1: return 1;
+		case OP_PUSH_INT: return *(p+1) >= 0 ? *(p+1) : UnknownCount;
+		case OP_CONSTANT: {
+			const variant& v = constants[*(p+1)];
+			return v.is_int() && v.as_int() >= 0 ? v.as_int() : UnknownCount;
+		}
+		default: return UnknownCount;
+		}
+	}
+}
+
+int VirtualMachine::numInstructions() const
+{
+	return static_cast<int>(instructionPositions().size());
+}
+
+std::vector<int> VirtualMachine::instructionPositions() const
+{
+	std::vector<int> result;
+	for(Iterator i = begin_itor(); !i.at_end(); i.next()) {
+		result.push_back(static_cast<int>(i.get_index()));
+	}
+
+	return result;
+}
+
+std::vector<bool> VirtualMachine::jumpTargets() const
+{
+	std::vector<bool> result(instructions_.size()+1, false);
+	for(Iterator i = begin_itor(); !i.at_end(); i.next()) {
+		if(isInstructionJump(i.get())) {
+			const int target = static_cast<int>(i.get_index()) + i.arg() + 1;
+			if(target >= 0 && target < static_cast<int>(result.size())) {
+				result[target] = true;
+			}
+		}
+	}
+
+	return result;
+}
+
+int VirtualMachine::foldConstants()
+{
+	const std::vector<int> positions = instructionPositions();
+	const std::vector<bool> targets = jumpTargets();
+	const int npositions = static_cast<int>(positions.size());
+	const int ncode = static_cast<int>(instructions_.size());
+
+	struct Fold {
+		int begin, end;
+		variant value;
+	};
+
+	std::vector<Fold> folds;
+	int removed = 0;
+
+	for(int n = 0; n < npositions; ) {
+		//find the longest run of pure instructions from here which leaves
+		//a single value computed only from constants.
+		std::vector<int> counts;
+		int end = -1;
+		for(int m = n; m < npositions; ++m) {
+			const int pos = positions[m];
+			if(m != n && targets[pos]) {
+				break;
+			}
+
+			bool scoped = false;
+			int nargs = pureOperandCount(instructions_[pos], &scoped);
+			if(nargs == -2) {
+				if(counts.empty() || counts.back() == UnknownCount) {
+					break;
+				}
+
+				nargs = counts.back() + 1;
+			}
+
+			if(nargs < 0 || scoped || nargs > static_cast<int>(counts.size())) {
+				break;
+			}
+
+			counts.resize(counts.size() - nargs);
+			counts.push_back(nargs == 0 ? leafCount(&instructions_[pos], constants_) : UnknownCount);
+			if(nargs > 0 && counts.size() == 1) {
+				end = m+1;
+			}
+		}
+
+		if(end < 0) {
+			++n;
+			continue;
+		}
+
+		Fold fold;
+		fold.begin = positions[n];
+		fold.end = end < npositions ? positions[end] : ncode;
+
+		VirtualMachine constant_vm;
+		constant_vm.instructions_.assign(instructions_.begin() + fold.begin, instructions_.begin() + fold.end);
+		constant_vm.constants_ = constants_;
+		constant_vm.parent_formula_ = parent_formula_;
+
+		//anything which would fail, like indexing out of bounds, is left
+		//to fail when the formula runs.
+		try {
+			const assert_recover_scope recover_scope;
+			MapFormulaCallable* no_variables = new MapFormulaCallable;
+			const variant ref(no_variables);
+			fold.value = constant_vm.execute(*no_variables);
+		} catch(validation_failure_exception&) {
+			++n;
+			continue;
+		}
+
+		folds.push_back(fold);
+		removed += end - n - 1;
+		n = end;
+	}
+
+	for(auto i = folds.rbegin(); i != folds.rend(); ++i) {
+		replaceRange(i->begin, i->end, loadConstantInstructions(i->value));
+	}
+
+	return removed;
+}
+
+int VirtualMachine::eliminateCommonSubexpressions()
+{
+	const std::vector<int> positions = instructionPositions();
+	const std::vector<bool> targets = jumpTargets();
+	const int npositions = static_cast<int>(positions.size());
+	const int ncode = static_cast<int>(instructions_.size());
+
+	//lookups only mean the same thing in the formula's own scope, and
+	//outside of loop bodies, which run with the loop's scope.
+	std::vector<bool> top_level(ncode, false);
+	int depth = 0, loop_end = -1;
+	for(int pos : positions) {
+		const int op = instructions_[pos];
+		if(op == OP_PUSH_SYMBOL_STACK || op == OP_POP_SYMBOL_STACK || op == OP_LOOKUP_SYMBOL_STACK) {
+			return 0;
+		}
+
+		top_level[pos] = depth == 0 && pos >= loop_end;
+
+		if(isInstructionLoop(op)) {
+			loop_end = std::max(loop_end, pos + instructions_[pos+1] + 1);
+		} else if(op == OP_PUSH_SCOPE || op == OP_INLINE_FUNCTION || (op == OP_WHERE && instructions_[pos+1] >= 0)) {
+			++depth;
+		} else if(op == OP_POP_SCOPE && --depth < 0) {
+			return 0;
+		}
+	}
+
+	//Run through the straight-line code at the start of the formula,
+	//which every path executes first, finding the instructions each
+	//stack item was computed by when those are pure. The first occurrence
+	//of a subexpression has to be here so its result is stored before
+	//anything can look it up.
+	struct Item {
+		int begin, end, ninstructions, count;
+	};
+
+	struct Occurrences {
+		int ninstructions;
+		std::vector<int> positions;
+	};
+
+	std::map<std::vector<InstructionType>, Occurrences> subexpressions;
+	std::vector<Item> stack;
+	int prefix_end = ncode;
+
+	for(int n = 0; n < npositions; ++n) {
+		const int pos = positions[n];
+		const int next = n+1 < npositions ? positions[n+1] : ncode;
+		const int op = instructions_[pos];
+		const int size = static_cast<int>(stack.size());
+
+		bool scoped = false;
+		int nargs = pureOperandCount(op, &scoped);
+		if(nargs == -2) {
+			if(stack.empty() || stack.back().count == UnknownCount) {
+				prefix_end = pos;
+				break;
+			}
+
+			nargs = stack.back().count + 1;
+		}
+
+		if(nargs >= 0) {
+			if(nargs > size) {
+				prefix_end = pos;
+				break;
+			}
+
+			Item item = { pos, next, 1, UnknownCount };
+			if(nargs == 0) {
+				item.count = leafCount(&instructions_[pos], constants_);
+			} else {
+				//the operands must come from the instructions directly
+				//before this one.
+				for(int i = size-1; i >= size-nargs; --i) {
+					if(stack[i].begin < 0 || stack[i].end != item.begin) {
+						item.begin = -1;
+						break;
+					}
+
+					item.begin = stack[i].begin;
+					item.ninstructions += stack[i].ninstructions;
+				}
+
+				if(item.begin >= 0) {
+					Occurrences& occurrences = subexpressions[std::vector<InstructionType>(instructions_.begin() + item.begin, instructions_.begin() + next)];
+					occurrences.ninstructions = item.ninstructions;
+					occurrences.positions.push_back(item.begin);
+				}
+			}
+
+			stack.resize(size - nargs);
+			stack.push_back(item);
+			continue;
+		}
+
+		//impure instructions which don't end the straight-line code.
+		int npop = 0, npush = 1;
+		switch(op) {
+		case OP_CALL:
+		case OP_CALL_BUILTIN:
+		case OP_CALL_BUILTIN_DYNAMIC:
+			npop = instructions_[pos+1] + 1;
+			break;
+		case OP_DICE:
+		case OP_CREATE_INTERFACE:
+			npop = 2;
+			break;
+		case OP_LAMBDA_WITH_CLOSURE:
+			npop = 1;
+			break;
+		case OP_POP:
+			npop = 1;
+			npush = 0;
+			break;
+		case OP_DUP:
+			npop = 1;
+			npush = 2;
+			break;
+		case OP_DUP2:
+			npop = 2;
+			npush = 4;
+			break;
+		case OP_SWAP:
+			npop = npush = 2;
+			break;
+		default:
+			npop = -1;
+			break;
+		}
+
+		if(npop < 0 || npop > size) {
+			prefix_end = pos;
+			break;
+		}
+
+		const Item unknown = { -1, -1, 0, UnknownCount };
+		stack.resize(size - npop);
+		stack.insert(stack.end(), npush, unknown);
+	}
+
+	if(subexpressions.empty()) {
+		return 0;
+	}
+
+	//later occurrences can be anywhere at the top level, even in branches.
+	std::set<int> lengths;
+	for(const auto& p : subexpressions) {
+		lengths.insert(static_cast<int>(p.first.size()));
+	}
+
+	for(int n = 0; n < npositions; ++n) {
+		const int pos = positions[n];
+		if(pos < prefix_end || !top_level[pos]) {
+			continue;
+		}
+
+		for(int length : lengths) {
+			if(pos + length > ncode) {
+				break;
+			}
+
+			auto itor = subexpressions.find(std::vector<InstructionType>(instructions_.begin() + pos, instructions_.begin() + pos + length));
+			if(itor == subexpressions.end()) {
+				continue;
+			}
+
+			bool valid = true;
+			for(int m = n+1; m < npositions && positions[m] < pos + length; ++m) {
+				if(targets[positions[m]] || !top_level[positions[m]]) {
+					valid = false;
+					break;
+				}
+			}
+
+			if(valid) {
+				itor->second.positions.push_back(pos);
+			}
+		}
+	}
+
+	//take the longest subexpressions first; the ones nested inside them
+	//are no longer needed.
+	typedef std::map<std::vector<InstructionType>, Occurrences>::const_iterator Candidate;
+	std::vector<Candidate> candidates;
+	for(Candidate i = subexpressions.begin(); i != subexpressions.end(); ++i) {
+		if(i->second.positions.size() > 1) {
+			candidates.push_back(i);
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](Candidate a, Candidate b) -> bool {
+		if(a->first.size() != b->first.size()) {
+			return a->first.size() > b->first.size();
+		}
+
+		return a->second.positions.front() < b->second.positions.front();
+	});
+
+	struct Group {
+		int length;
+		std::vector<int> positions;
+	};
+
+	std::vector<Group> groups;
+	std::vector<bool> claimed(ncode, false);
+	int removed = 0;
+
+	for(Candidate c : candidates) {
+		Group group;
+		group.length = static_cast<int>(c->first.size());
+		for(int pos : c->second.positions) {
+			if(!group.positions.empty() && pos < group.positions.back() + group.length) {
+				continue;
+			}
+
+			if(std::find(claimed.begin() + pos, claimed.begin() + pos + group.length, true) != claimed.begin() + pos + group.length) {
+				continue;
+			}
+
+			group.positions.push_back(pos);
+		}
+
+		//storing the value costs a dup and a push.
+		const int saving = (static_cast<int>(group.positions.size()) - 1)*(c->second.ninstructions - 1) - 2;
+		if(group.positions.size() < 2 || group.positions.front() >= prefix_end || saving <= 0) {
+			continue;
+		}
+
+		for(int pos : group.positions) {
+			std::fill(claimed.begin() + pos, claimed.begin() + pos + group.length, true);
+		}
+
+		groups.push_back(group);
+		removed += saving;
+	}
+
+	if(groups.empty()) {
+		return 0;
+	}
+
+	//values are pushed in the order of their first occurrences.
+	std::sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) -> bool {
+		return a.positions.front() < b.positions.front();
+	});
+
+	struct Replacement {
+		int begin, end;
+		std::vector<InstructionType> instructions;
+	};
+
+	std::vector<Replacement> replacements;
+	for(int index = 0; index != static_cast<int>(groups.size()); ++index) {
+		const Group& group = groups[index];
+		for(int pos : group.positions) {
+			Replacement r;
+			r.begin = pos;
+			r.end = pos + group.length;
+			if(pos == group.positions.front()) {
+				r.instructions.assign(instructions_.begin() + r.begin, instructions_.begin() + r.end);
+				r.instructions.push_back(OP_DUP);
+				r.instructions.push_back(OP_PUSH_SYMBOL_STACK);
+			} else {
+				r.instructions.push_back(OP_LOOKUP_SYMBOL_STACK);
+				r.instructions.push_back(static_cast<InstructionType>(index));
+			}
+
+			replacements.push_back(r);
+		}
+	}
+
+	std::sort(replacements.begin(), replacements.end(), [](const Replacement& a, const Replacement& b) -> bool {
+		return a.begin > b.begin;
+	});
+
+	for(const Replacement& r : replacements) {
+		replaceRange(r.begin, r.end, r.instructions);
 	}
+
+	return removed;
+}
+
+std::shared_ptr<const RegisterVM> RegisterVM::compile(const VirtualMachine& vm)
+{
+	typedef VirtualMachine::InstructionType InstructionType;
+
+	std::shared_ptr<RegisterVM> result(new RegisterVM);
+	RegisterVM& r = *result;
+	r.vm_ = &vm;
+	r.constants_ = vm.constants_;
+
+	const std::vector<InstructionType>& code = vm.instructions_;
+	const int ncode = static_cast<int>(code.size());
+	if(ncode == 0) {
+		return nullptr;
+	}
+
+	//Symbolic stack. Entry n is canonical once it is held in register n.
+	//Register operands only ever refer to a register at or below their own
+	//depth, so writing register n can't clobber anything still live below.
+	std::vector<Operand> stack;
+
+	std::map<int,int> int_constants;
+	int null_constant = -1;
+	auto int_constant = [&](int value) -> int {
+		auto itor = int_constants.find(value);
+		if(itor != int_constants.end()) {
+			return itor->second;
+		}
+
+		const int index = static_cast<int>(r.constants_.size());
+		r.constants_.push_back(variant(value));
+		int_constants[value] = index;
+		return index;
+	};
+
+	int source = 0;
+
+	auto emit = [&](int op, int dst, int nargs) -> Instruction& {
+		Instruction ins;
+		ins.op = op;
+		ins.dst = dst;
+		ins.nargs = nargs;
+		ins.source = source;
+		ins.a.kind = ins.b.kind = OPERAND_CONSTANT;
+		ins.a.index = ins.b.index = -1;
+		r.instructions_.push_back(ins);
+		return r.instructions_.back();
+	};
+
+	auto canonicalize = [&](int n) {
+		Operand& o = stack[n];
+		if(o.kind != OPERAND_REGISTER || o.index != n) {
+			emit(REG_MOVE, n, 0).a = o;
+			o.kind = OPERAND_REGISTER;
+			o.index = n;
+		}
+	};
+
+	//Lookups are evaluated lazily when consumed. Before an instruction
+	//consumes the top 'consumed' items, any lookups beneath them are
+	//evaluated so symbols are still queried in bytecode order.
+	auto evaluate_lookups = [&](int consumed) {
+		for(int n = 0; n < static_cast<int>(stack.size()) - consumed; ++n) {
+			if(stack[n].kind == OPERAND_LOOKUP) {
+				canonicalize(n);
+			}
+		}
+	};
+
+	auto flush = [&]() {
+		for(int n = 0; n != static_cast<int>(stack.size()); ++n) {
+			canonicalize(n);
+		}
+	};
+
+	auto push_register = [&](int n) {
+		Operand o;
+		o.kind = OPERAND_REGISTER;
+		o.index = n;
+		stack.resize(n);
+		stack.push_back(o);
+	};
+
+	auto push_operand = [&](OPERAND_KIND kind, int index) {
+		Operand o;
+		o.kind = kind;
+		o.index = index;
+		stack.push_back(o);
+	};
+
+	auto note_stack_size = [&]() {
+		if(static_cast<int>(stack.size()) > r.num_registers_) {
+			r.num_registers_ = static_cast<int>(stack.size());
+		}
+	};
+
+	//bytecode position -> stack size on arrival, and the jumps to patch.
+	std::map<int,int> label_size;
+	std::map<int,std::vector<int> > label_jumps;
+
+	bool reachable = true;
+	int num_stored = 0;
+
+	auto add_jump = [&](int op, int target) -> bool {
+		if(target <= source || target > ncode) {
+			return false;
+		}
+
+		auto itor = label_size.find(target);
+		if(itor != label_size.end() && itor->second != static_cast<int>(stack.size())) {
+			return false;
+		}
+
+		label_size[target] = static_cast<int>(stack.size());
+		label_jumps[target].push_back(static_cast<int>(r.instructions_.size()));
+		emit(op, -1, 0);
+		return true;
+	};
+
+	auto arrive_at = [&](int pos) -> bool {
+		auto itor = label_size.find(pos);
+		if(itor == label_size.end()) {
+			return reachable;
+		}
+
+		if(reachable) {
+			flush();
+			if(static_cast<int>(stack.size()) != itor->second) {
+				return false;
+			}
+		} else {
+			stack.clear();
+			for(int n = 0; n != itor->second; ++n) {
+				push_register(n);
+			}
+		}
+
+		for(int jump : label_jumps[pos]) {
+			r.instructions_[jump].dst = static_cast<int>(r.instructions_.size());
+		}
+
+		reachable = true;
+		return true;
+	};
+
+	for(int pos = 0; pos < ncode; ++pos) {
+		if(!arrive_at(pos)) {
+			return nullptr;
+		}
+
+		source = pos;
+		const int op = code[pos];
+		const int size = static_cast<int>(stack.size());
+		const int arg = pos+1 < ncode ? code[pos+1] : 0;
+
+		switch(op) {
+		case OP_IN: case OP_NOT_IN: case OP_AND: case OP_OR: case OP_NEQ:
+		case OP_LTE: case OP_GTE: case OP_IS: case OP_IS_NOT: case OP_GT:
+		case OP_LT: case OP_EQ: case OP_ADD: case OP_SUB: case OP_MUL:
+		case OP_DIV: case OP_DICE: case OP_POW: case OP_MOD:
+		case OP_INDEX: case OP_INDEX_STR: case OP_CREATE_INTERFACE: {
+			if(size < 2) {
+				return nullptr;
+			}
+
+			evaluate_lookups(2);
+			Instruction& ins = emit(op, size-2, 0);
+			ins.a = stack[size-2];
+			ins.b = stack[size-1];
+			push_register(size-2);
+			break;
+		}
+
+		case OP_UNARY_NOT: case OP_UNARY_SUB: case OP_UNARY_STR:
+		case OP_UNARY_NUM_ELEMENTS: case OP_INCREMENT: case OP_LOOKUP_STR:
+		case OP_INDEX_0: case OP_INDEX_1: case OP_INDEX_2:
+		case OP_LAMBDA_WITH_CLOSURE: {
+			if(size < 1) {
+				return nullptr;
+			}
+
+			evaluate_lookups(1);
+			emit(op, size-1, 0).a = stack[size-1];
+			push_register(size-1);
+			break;
+		}
+
+		case OP_LOOKUP:
+			push_operand(OPERAND_LOOKUP, arg);
+			++pos;
+			break;
+
+		case OP_CONSTANT:
+			push_operand(OPERAND_CONSTANT, arg);
+			++pos;
+			break;
+
+		case OP_PUSH_INT:
+			push_operand(OPERAND_CONSTANT, int_constant(arg));
+			++pos;
+			break;
+
+		case OP_PUSH_NULL:
+			if(null_constant < 0) {
+				null_constant = static_cast<int>(r.constants_.size());
+				r.constants_.push_back(variant());
+			}
+
+			push_operand(OPERAND_CONSTANT, null_constant);
+			break;
+
+		case OP_PUSH_0:
+			push_operand(OPERAND_CONSTANT, int_constant(0));
+			break;
+
+		case OP_PUSH_1:
+			push_operand(OPERAND_CONSTANT, int_constant(1));
+			break;
+
+		case OP_LIST:
+		case OP_MAP:
+		case OP_ARRAY_SLICE: {
+			int nitems = 3;
+			if(op != OP_ARRAY_SLICE) {
+				//the item count must be known when lowering.
+				if(size < 1 || stack.back().kind != OPERAND_CONSTANT || !r.constants_[stack.back().index].is_int()) {
+					return nullptr;
+				}
+
+				nitems = r.constants_[stack.back().index].as_int();
+				stack.pop_back();
+			}
+
+			const int base = static_cast<int>(stack.size()) - nitems;
+			if(nitems < 0 || base < 0) {
+				return nullptr;
+			}
+
+			evaluate_lookups(nitems);
+			for(int n = base; n != static_cast<int>(stack.size()); ++n) {
+				canonicalize(n);
+			}
+
+			emit(op, base, nitems);
+			push_register(base);
+			break;
+		}
+
+		case OP_CALL:
+		case OP_CALL_BUILTIN:
+		case OP_CALL_BUILTIN_DYNAMIC: {
+			//the function is an operand; the arguments go in the
+			//registers directly after the destination.
+			const int base = size - arg - 1;
+			if(arg < 0 || base < 0) {
+				return nullptr;
+			}
+
+			evaluate_lookups(arg);
+			for(int n = base+1; n != size; ++n) {
+				canonicalize(n);
+			}
+
+			emit(op, base, arg).a = stack[base];
+			push_register(base);
+			++pos;
+			break;
+		}
+
+		case OP_POP:
+			if(size < 1) {
+				return nullptr;
+			}
+
+			evaluate_lookups(0);
+			stack.pop_back();
+			break;
+
+		case OP_DUP:
+			if(size < 1) {
+				return nullptr;
+			}
+
+			evaluate_lookups(0);
+			stack.push_back(stack.back());
+			break;
+
+		case OP_DUP2:
+			if(size < 2) {
+				return nullptr;
+			}
+
+			evaluate_lookups(0);
+			stack.push_back(stack[size-2]);
+			stack.push_back(stack[size-1]);
+			break;
+
+		case OP_SWAP:
+			if(size < 2) {
+				return nullptr;
+			}
+
+			evaluate_lookups(2);
+			canonicalize(size-2);
+			canonicalize(size-1);
+			emit(REG_SWAP, size-2, 0);
+			break;
+
+		case OP_JMP_IF:
+		case OP_JMP_UNLESS: {
+			if(size < 1) {
+				return nullptr;
+			}
+
+			flush();
+			if(!add_jump(op == OP_JMP_IF ? REG_JMP_IF : REG_JMP_UNLESS, pos + arg + 1)) {
+				return nullptr;
+			}
+
+			r.instructions_.back().a = stack.back();
+			++pos;
+			break;
+		}
+
+		case OP_POP_JMP_IF:
+		case OP_POP_JMP_UNLESS: {
+			if(size < 1) {
+				return nullptr;
+			}
+
+			const Operand cond = stack.back();
+			stack.pop_back();
+			flush();
+			if(!add_jump(op == OP_POP_JMP_IF ? REG_JMP_IF : REG_JMP_UNLESS, pos + arg + 1)) {
+				return nullptr;
+			}
+
+			r.instructions_.back().a = cond;
+			++pos;
+			break;
+		}
+
+		case OP_JMP:
+			flush();
+			if(!add_jump(REG_JMP, pos + arg + 1)) {
+				return nullptr;
+			}
+
+			reachable = false;
+			++pos;
+			break;
+
+		case OP_PUSH_SYMBOL_STACK:
+			//stored subexpressions get registers of their own, numbered
+			//from -1 down until the stack registers are counted. They
+			//must be stored before any branch so the numbering is fixed.
+			if(size < 1 || !label_jumps.empty()) {
+				return nullptr;
+			}
+
+			evaluate_lookups(1);
+			emit(REG_MOVE, -1 - num_stored, 0).a = stack.back();
+			stack.pop_back();
+			++num_stored;
+			break;
+
+		case OP_LOOKUP_SYMBOL_STACK:
+			if(arg < 0 || arg >= num_stored) {
+				return nullptr;
+			}
+
+			push_operand(OPERAND_REGISTER, -1 - arg);
+			++pos;
+			break;
+
+		default:
+			//scopes, algorithms and popping the symbol stack stay on the
+			//stack VM.
+			return nullptr;
+		}
+
+		note_stack_size();
+	}
+
+	source = ncode-1;
+	if(!arrive_at(ncode) || stack.empty()) {
+		return nullptr;
+	}
+
+	evaluate_lookups(1);
+	emit(REG_RETURN, -1, 0).a = stack.back();
+
+	//place the stored subexpressions after the stack registers.
+	auto place_stored = [&](int index) -> int {
+		return index < 0 ? r.num_registers_ - 1 - index : index;
+	};
+
+	for(Instruction& ins : r.instructions_) {
+		if(ins.op == REG_MOVE) {
+			ins.dst = place_stored(ins.dst);
+		}
+
+		if(ins.a.kind == OPERAND_REGISTER) {
+			ins.a.index = place_stored(ins.a.index);
+		}
+
+		if(ins.b.kind == OPERAND_REGISTER) {
+			ins.b.index = place_stored(ins.b.index);
+		}
+	}
+
+	r.num_registers_ += num_stored;
+
+	return result;
+}
+
+inline const variant& RegisterVM::fetch(const Operand& o, const variant* regs, const FormulaCallable& variables, variant& scratch) const
+{
+	switch(o.kind) {
+	case OPERAND_REGISTER: return regs[o.index];
+	case OPERAND_CONSTANT: return constants_[o.index];
+	default:
+		scratch = variables.queryValueBySlot(o.index);
+		return scratch;
+	}
+}
+
+variant RegisterVM::execute(const FormulaCallable& variables, PropertyCaches* caches) const
+{
+	VMOverflowGuard overflow_guard;
+
+	if(g_vmDepth > g_max_ffl_recursion) {
+		ASSERT_LOG(false, "Overflow in VM: " << vm_->debugPinpointLocation(&vm_->instructions_[0], std::vector<variant>()));
+	}
+
+	//most formulas need only a handful of registers, which saves
+	//allocating a stack on every execution.
+	enum { LocalRegisters = 8 };
+	variant result;
+	if(num_registers_ <= LocalRegisters) {
+		variant regs[LocalRegisters];
+		run(variables, regs, result, caches);
+	} else {
+		std::vector<variant> regs(num_registers_);
+		run(variables, &regs[0], result, caches);
+	}
+
+	return result;
+}
+
+void RegisterVM::run(const FormulaCallable& variables, variant* regs, variant& result, PropertyCaches* caches) const
+{
+	const std::vector<variant> no_stack;
+	variant scratch_a, scratch_b;
+
+	for(const Instruction* i = &instructions_[0];; ++i) {
+		switch(i->op) {
+		case REG_MOVE:
+			regs[i->dst] = fetch(i->a, regs, variables, scratch_a);
+			break;
+
+		case REG_SWAP:
+			regs[i->dst].swap(regs[i->dst+1]);
+			break;
+
+		case REG_JMP:
+			i = &instructions_[i->dst] - 1;
+			break;
+
+		case REG_JMP_IF:
+		case REG_JMP_UNLESS:
+			if(fetch(i->a, regs, variables, scratch_a).as_bool() == (i->op == REG_JMP_IF)) {
+				i = &instructions_[i->dst] - 1;
+			}
+			break;
+
+		case REG_RETURN:
+			result = fetch(i->a, regs, variables, scratch_a);
+			return;
+
+		case OP_IN:
+		case OP_NOT_IN: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			const variant& right = fetch(i->b, regs, variables, scratch_b);
+			const bool in = vm_->valueIn(left, right, &vm_->instructions_[i->source], no_stack);
+			regs[i->dst] = variant::from_bool(i->op == OP_IN ? in : !in);
+			break;
+		}
+
+		case OP_AND:
+		case OP_OR: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			const variant& right = fetch(i->b, regs, variables, scratch_b);
+			regs[i->dst] = left.as_bool() == (i->op == OP_AND) ? right : left;
+			break;
+		}
+
+		case OP_NEQ: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = variant::from_bool(left != fetch(i->b, regs, variables, scratch_b));
+			break;
+		}
+
+		case OP_LTE: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = variant::from_bool(left <= fetch(i->b, regs, variables, scratch_b));
+			break;
+		}
+
+		case OP_GTE: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = variant::from_bool(left >= fetch(i->b, regs, variables, scratch_b));
+			break;
+		}
+
+		case OP_GT: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = variant::from_bool(left > fetch(i->b, regs, variables, scratch_b));
+			break;
+		}
+
+		case OP_LT: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = variant::from_bool(left < fetch(i->b, regs, variables, scratch_b));
+			break;
+		}
+
+		case OP_EQ: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = variant::from_bool(left == fetch(i->b, regs, variables, scratch_b));
+			break;
+		}
+
+		case OP_IS:
+		case OP_IS_NOT: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			variant_type_ptr t(fetch(i->b, regs, variables, scratch_b).convert_to<variant_type>());
+			const bool match = t->match(left);
+			regs[i->dst] = variant::from_bool(i->op == OP_IS ? match : !match);
+			break;
+		}
+
+		case OP_ADD: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = left + fetch(i->b, regs, variables, scratch_b);
+			break;
+		}
+
+		case OP_SUB: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = left - fetch(i->b, regs, variables, scratch_b);
+			break;
+		}
+
+		case OP_MUL: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = left * fetch(i->b, regs, variables, scratch_b);
+			break;
+		}
+
+		case OP_DIV: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			const variant& right = fetch(i->b, regs, variables, scratch_b);
+			//same divide-by-zero guard as the stack VM.
+			if(right == variant(0)) {
+				regs[i->dst] = left / variant(decimal::epsilon());
+			} else {
+				regs[i->dst] = left / right;
+			}
+			break;
+		}
+
+		case OP_DICE: {
+			const int num_rolls = fetch(i->a, regs, variables, scratch_a).as_int();
+			regs[i->dst] = variant(dice_roll(num_rolls, fetch(i->b, regs, variables, scratch_b).as_int()));
+			break;
+		}
+
+		case OP_POW: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = left ^ fetch(i->b, regs, variables, scratch_b);
+			break;
+		}
+
+		case OP_MOD: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			regs[i->dst] = left % fetch(i->b, regs, variables, scratch_b);
+			break;
+		}
+
+		case OP_INDEX: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			variant value = left[fetch(i->b, regs, variables, scratch_b)];
+			regs[i->dst] = value;
+			break;
+		}
+
+		case OP_INDEX_STR: {
+			const variant& left = fetch(i->a, regs, variables, scratch_a);
+			const variant& right = fetch(i->b, regs, variables, scratch_b);
+			const int site = caches && left.is_callable() ? caches->siteAt(i->source) : -1;
+			variant value = site >= 0 ? caches->query(site, *left.as_callable(), right.as_string()) : vm_->indexStr(left, right, &vm_->instructions_[i->source], no_stack);
+			regs[i->dst] = value;
+			break;
+		}
+
+		case OP_CREATE_INTERFACE: {
+			const variant& value = fetch(i->a, regs, variables, scratch_a);
+			variant instance = fetch(i->b, regs, variables, scratch_b).convert_to<FormulaInterfaceInstanceFactory>()->create(value);
+			regs[i->dst] = instance;
+			break;
+		}
+
+		case OP_UNARY_NOT:
+			regs[i->dst] = variant::from_bool(!fetch(i->a, regs, variables, scratch_a).as_bool());
+			break;
+
+		case OP_UNARY_SUB:
+			regs[i->dst] = -fetch(i->a, regs, variables, scratch_a);
+			break;
+
+		case OP_UNARY_STR: {
+			const variant& value = fetch(i->a, regs, variables, scratch_a);
+			if(value.is_string() == false) {
+				std::string str;
+				value.serializeToString(str);
+				regs[i->dst] = variant(str);
+			} else {
+				regs[i->dst] = value;
+			}
+			break;
+		}
+
+		case OP_UNARY_NUM_ELEMENTS:
+			regs[i->dst] = variant(fetch(i->a, regs, variables, scratch_a).num_elements());
+			break;
+
+		case OP_INCREMENT:
+			regs[i->dst] = fetch(i->a, regs, variables, scratch_a) + variant(1);
+			break;
+
+		case OP_LOOKUP_STR: {
+			const std::string& key = fetch(i->a, regs, variables, scratch_a).as_string();
+			const int site = caches ? caches->siteAt(i->source) : -1;
+			variant value = site >= 0 ? caches->query(site, variables, key) : variables.queryValue(key);
+			regs[i->dst] = value;
+			break;
+		}
+
+		case OP_INDEX_0:
+		case OP_INDEX_1:
+		case OP_INDEX_2: {
+			variant value = fetch(i->a, regs, variables, scratch_a)[static_cast<size_t>(i->op - OP_INDEX_0)];
+			regs[i->dst] = value;
+			break;
+		}
+
+		case OP_LAMBDA_WITH_CLOSURE:
+			regs[i->dst] = fetch(i->a, regs, variables, scratch_a).change_function_callable(variables);
+			break;
+
+		case OP_LIST: {
+			std::vector<variant> items;
+			items.reserve(i->nargs);
+			for(int n = 0; n != i->nargs; ++n) {
+				items.push_back(std::move(regs[i->dst + n]));
+			}
+
+			regs[i->dst] = variant(&items);
+			break;
+		}
+
+		case OP_MAP: {
+			std::map<variant,variant> res;
+			for(int n = 0; n+1 < i->nargs; n += 2) {
+				res[regs[i->dst + n]] = regs[i->dst + n + 1];
+			}
+
+			regs[i->dst] = variant(&res);
+			break;
+		}
+
+		case OP_ARRAY_SLICE: {
+			variant value = vm_->arraySlice(regs[i->dst], regs[i->dst+1], regs[i->dst+2], &vm_->instructions_[i->source], no_stack);
+			regs[i->dst] = value;
+			break;
+		}
+
+		case OP_CALL: {
+			const variant& fn = fetch(i->a, regs, variables, scratch_a);
+			std::vector<variant> args;
+			args.reserve(i->nargs);
+			for(int n = 1; n <= i->nargs; ++n) {
+				args.push_back(std::move(regs[i->dst + n]));
+			}
+
+			regs[i->dst] = fn(&args);
+			break;
+		}
+
+		case OP_CALL_BUILTIN:
+		case OP_CALL_BUILTIN_DYNAMIC: {
+			const variant& fn = fetch(i->a, regs, variables, scratch_a);
+			game_logic::FunctionExpression* expr = static_cast<game_logic::FunctionExpression*>(fn.mutable_callable());
+			regs[i->dst] = expr->executeWithArgs(variables, &regs[i->dst + 1], i->nargs);
+			break;
+		}
+
+		default:
+			ASSERT_LOG(false, "Illegal register VM instruction: " << i->op);
+		}
+	}
+}
+
+std::string RegisterVM::debugOutput() const
+{
+	std::ostringstream s;
+	auto operand = [&](const Operand& o) {
+		switch(o.kind) {
+		case OPERAND_REGISTER: s << " r" << o.index; break;
+		case OPERAND_CONSTANT: s << " " << constants_[o.index].to_debug_string(); break;
+		case OPERAND_LOOKUP: s << " lookup(" << o.index << ")"; break;
+		}
+	};
+
+	for(size_t n = 0; n != instructions_.size(); ++n) {
+		const Instruction& i = instructions_[n];
+		s << "   " << n << ": ";
+		switch(i.op) {
+		case REG_MOVE: s << "MOVE r" << i.dst; operand(i.a); break;
+		case REG_SWAP: s << "SWAP r" << i.dst << " r" << (i.dst+1); break;
+		case REG_JMP: s << "JMP -> " << i.dst; break;
+		case REG_JMP_IF: s << "JMP_IF"; operand(i.a); s << " -> " << i.dst; break;
+		case REG_JMP_UNLESS: s << "JMP_UNLESS"; operand(i.a); s << " -> " << i.dst; break;
+		case REG_RETURN: s << "RETURN"; operand(i.a); break;
+		default:
+			s << getOpName(static_cast<VirtualMachine::InstructionType>(i.op)) << " r" << i.dst;
+			if(i.a.index >= 0) {
+				operand(i.a);
+			}
+			if(i.b.index >= 0) {
+				operand(i.b);
+			}
+			if(i.nargs > 0) {
+				s << " [r" << (i.dst + (i.op == OP_CALL || i.op == OP_CALL_BUILTIN || i.op == OP_CALL_BUILTIN_DYNAMIC ? 1 : 0)) << " x" << i.nargs << "]";
+			}
+			break;
+		}
+		s << "\n";
+	}
+
+	return s.str();
+}
+
+namespace {
+threading::mutex& property_caches_mutex()
+{
+	static threading::mutex* m = new threading::mutex;
+	return *m;
+}
+
+std::set<PropertyCaches*>& all_property_caches()
+{
+	static std::set<PropertyCaches*>* caches = new std::set<PropertyCaches*>;
+	return *caches;
+}
+}
+
+PropertyCaches::PropertyCaches(const VirtualMachine& vm) : vm_(&vm), site_index_(vm.instructions_.size(), -1)
+{
+	//a site whose key may come from a jump rather than the constant
+	//just before it can't be cached.
+	std::vector<bool> jump_targets(vm.instructions_.size() + 1);
+	for(VirtualMachine::Iterator i = vm.begin_itor(); !i.at_end(); i.next()) {
+		if(VirtualMachine::isInstructionJump(i.get())) {
+			const int target = static_cast<int>(i.get_index()) + i.arg() + 1;
+			if(target >= 0 && target < static_cast<int>(jump_targets.size())) {
+				jump_targets[target] = true;
+			}
+		}
+	}
+
+	int prev = -1;
+	for(VirtualMachine::Iterator i = vm.begin_itor(); !i.at_end(); i.next()) {
+		const int pos = static_cast<int>(i.get_index());
+		if((i.get() == OP_INDEX_STR || i.get() == OP_LOOKUP_STR) && prev >= 0 && !jump_targets[pos] &&
+		   vm.instructions_[prev] == OP_CONSTANT && vm.constants_[vm.instructions_[prev+1]].is_string()) {
+			Site site;
+			site.pos = pos;
+			site.nlayouts = 0;
+			site.megamorphic = false;
+			site.hits = site.misses = 0;
+			site_index_[pos] = static_cast<int>(sites_.size());
+			sites_.push_back(site);
+		}
+
+		prev = pos;
+	}
+
+	if(!sites_.empty()) {
+		threading::lock l(property_caches_mutex());
+		all_property_caches().insert(this);
+	}
+}
+
+PropertyCaches::~PropertyCaches()
+{
+	if(!sites_.empty()) {
+		threading::lock l(property_caches_mutex());
+		all_property_caches().erase(this);
+	}
+}
+
+variant PropertyCaches::query(int index, const FormulaCallable& callable, const std::string& key)
+{
+	Site& site = sites_[index];
+	const reference_counted_object* layout = callable.querySlotLayout();
+	if(layout != nullptr) {
+		for(int n = 0; n != site.nlayouts; ++n) {
+			if(site.layouts[n].get() == layout) {
+				if(site.slots[n] >= 0) {
+					++site.hits;
+					return callable.queryValueBySlot(site.slots[n]);
+				}
+
+				++site.misses;
+				return callable.queryValue(key);
+			}
+		}
+
+		++site.misses;
+		if(site.nlayouts == MaxLayouts) {
+			site.megamorphic = true;
+		} else if(!site.megamorphic) {
+			const int slot = callable.queryCacheableSlot(key);
+			site.layouts[site.nlayouts].reset(layout);
+			site.slots[site.nlayouts] = slot;
+			++site.nlayouts;
+			if(slot >= 0) {
+				return callable.queryValueBySlot(slot);
+			}
+		}
+	} else {
+		++site.misses;
+	}
+
+	return callable.queryValue(key);
+}
+
+std::vector<PropertyCaches::Report> PropertyCaches::getReport(bool reset)
+{
+	std::vector<Report> result;
+
+	threading::lock l(property_caches_mutex());
+	for(PropertyCaches* caches : all_property_caches()) {
+		const VirtualMachine& vm = *caches->vm_;
+		for(Site& site : caches->sites_) {
+			if(site.hits == 0 && site.misses == 0) {
+				continue;
+			}
+
+			Report r;
+			r.site = vm.parent_formula_.is_string() ? vm.parent_formula_.debug_location() : std::string("unknown");
+			r.site += ": " + vm.constants_[vm.instructions_[site.pos-1]].as_string();
+			r.hits = site.hits;
+			r.misses = site.misses;
+			r.layouts = site.nlayouts;
+			r.megamorphic = site.megamorphic;
+			result.push_back(r);
+
+			if(reset) {
+				site.hits = site.misses = 0;
+			}
+		}
+	}
+
+	std::sort(result.begin(), result.end(), [](const Report& a, const Report& b) { return a.misses > b.misses; });
+	return result;
+}
+
+UNIT_TEST(formula_vm) {
+	MapFormulaCallable* callable = new MapFormulaCallable;
+	variant ref(callable);
+	{
+		VirtualMachine vm;
+		vm.addInstruction(OP_CONSTANT);
+		vm.addConstant(variant(5));
+		vm.addInstruction(OP_CONSTANT);
+		vm.addConstant(variant(8));
+		vm.addInstruction(OP_ADD);
+		CHECK_EQ(vm.execute(*callable), variant(13));
+	}
+}
+
+UNIT_TEST(formula_register_vm) {
+	MapFormulaCallable* callable = new MapFormulaCallable;
+	variant ref(callable);
+	{
+		VirtualMachine vm;
+		vm.addInstruction(OP_CONSTANT);
+		vm.addConstant(variant(5));
+		vm.addInstruction(OP_DUP);
+		vm.addInstruction(OP_PUSH_INT);
+		vm.addInt(3);
+		vm.addInstruction(OP_SWAP);
+		vm.addInstruction(OP_SUB);
+		vm.addInstruction(OP_ADD);
+		vm.addInstruction(OP_DUP);
+		vm.addInstruction(OP_PUSH_INT);
+		vm.addInt(2);
+		vm.addInstruction(OP_GT);
+		const int else_jump = vm.addJumpSource(OP_POP_JMP_UNLESS);
+		vm.addInstruction(OP_PUSH_INT);
+		vm.addInt(10);
+		vm.addInstruction(OP_MUL);
+		const int end_jump = vm.addJumpSource(OP_JMP);
+		vm.jumpToEnd(else_jump);
+		vm.addInstruction(OP_PUSH_0);
+		vm.addInstruction(OP_MUL);
+		vm.jumpToEnd(end_jump);
+
+		std::shared_ptr<const RegisterVM> reg = RegisterVM::compile(vm);
+		CHECK(reg.get() != nullptr, "could not lower to register VM: " << vm.debugOutput());
+		CHECK_EQ(vm.execute(*callable), variant(30));
+		CHECK_EQ(reg->execute(*callable), variant(30));
+	}
+
+	{
+		VirtualMachine vm;
+		vm.addInstruction(OP_PUSH_NULL);
+		vm.addInstruction(OP_PUSH_SCOPE);
+		vm.addInstruction(OP_PUSH_1);
+		CHECK(RegisterVM::compile(vm).get() == nullptr, "scopes should stay on the stack VM");
+	}
+}
+
+UNIT_TEST(formula_vm_subexpressions) {
+	MapFormulaCallable* callable = new MapFormulaCallable;
+	variant ref(callable);
+	callable->add("x", variant(7));
+
+	{
+		//2*3 + x
+		VirtualMachine vm;
+		vm.addInstruction(OP_PUSH_INT);
+		vm.addInt(2);
+		vm.addInstruction(OP_PUSH_INT);
+		vm.addInt(3);
+		vm.addInstruction(OP_MUL);
+		vm.addLoadConstantInstruction(variant("x"));
+		vm.addInstruction(OP_LOOKUP_STR);
+		vm.addInstruction(OP_ADD);
+
+		CHECK_EQ(vm.foldConstants(), 2);
+		CHECK_EQ(vm.numInstructions(), 4);
+		CHECK_EQ(vm.execute(*callable), variant(13));
+	}
+
+	{
+		//x*2 + if(x > 0, x*2, 0)
+		VirtualMachine vm;
+		vm.addLoadConstantInstruction(variant("x"));
+		vm.addInstruction(OP_LOOKUP_STR);
+		vm.addInstruction(OP_PUSH_INT);
+		vm.addInt(2);
+		vm.addInstruction(OP_MUL);
+		vm.addLoadConstantInstruction(variant("x"));
+		vm.addInstruction(OP_LOOKUP_STR);
+		vm.addInstruction(OP_PUSH_0);
+		vm.addInstruction(OP_GT);
+		const int else_jump = vm.addJumpSource(OP_POP_JMP_UNLESS);
+		vm.addLoadConstantInstruction(variant("x"));
+		vm.addInstruction(OP_LOOKUP_STR);
+		vm.addInstruction(OP_PUSH_INT);
+		vm.addInt(2);
+		vm.addInstruction(OP_MUL);
+		const int end_jump = vm.addJumpSource(OP_JMP);
+		vm.jumpToEnd(else_jump);
+		vm.addInstruction(OP_PUSH_0);
+		vm.jumpToEnd(end_jump);
+		vm.addInstruction(OP_ADD);
+
+		CHECK_EQ(vm.eliminateCommonSubexpressions(), 1);
+		CHECK_EQ(vm.execute(*callable), variant(28));
+
+		std::shared_ptr<const RegisterVM> reg = RegisterVM::compile(vm);
+		CHECK(reg.get() != nullptr, "could not lower to register VM: " << vm.debugOutput());
+		CHECK_EQ(reg->execute(*callable), variant(28));
+	}
+}
+
+namespace {
+class CachedLookupTestCallable : public FormulaCallable
+{
+public:
+	explicit CachedLookupTestCallable(const reference_counted_object* layout) : layout_(layout), by_name_(0)
+	{}
+
+	mutable int by_name_;
+private:
+	variant getValue(const std::string& key) const override {
+		++by_name_;
+		return key == "x" ? variant(7) : variant();
+	}
+
+	variant getValueBySlot(int slot) const override {
+		return slot == 0 ? variant(7) : variant();
+	}
+
+	const reference_counted_object* getSlotLayout() const override { return layout_; }
+
+	int getCacheableSlot(const std::string& key) const override {
+		return key == "x" ? 0 : -1;
+	}
+
+	const reference_counted_object* layout_;
+};
+}
+
+UNIT_TEST(formula_vm_property_cache) {
+	MapFormulaCallable* layout = new MapFormulaCallable;
+	variant layout_ref(layout);
+
+	CachedLookupTestCallable* callable = new CachedLookupTestCallable(layout);
+	variant ref(callable);
+
+	VirtualMachine vm;
+	vm.addLoadConstantInstruction(variant("x"));
+	vm.addInstruction(OP_LOOKUP_STR);
+
+	PropertyCaches caches(vm);
+	CHECK(!caches.empty(), "lookup site not cached");
+
+	PropertyCaches::getReport(true);
+	for(int n = 0; n != 3; ++n) {
+		CHECK_EQ(vm.execute(*callable, &caches), variant(7));
+	}
+
+	CHECK_EQ(callable->by_name_, 0);
+
+	const std::vector<PropertyCaches::Report> report = PropertyCaches::getReport(true);
+	CHECK_EQ(report.size(), 1);
+	CHECK_EQ(report.front().hits, 2);
+	CHECK_EQ(report.front().misses, 1);
+	CHECK_EQ(report.front().megamorphic, false);
 }
 
 UNIT_TEST(formula_vm_and_0) {
@@ -23,6 +23,8 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "formula_callable.hpp"
@@ -284,6 +286,8 @@ enum OP {
 		  };
 
 
+class PropertyCaches;
+
 class VirtualMachine
 {
 public:
@@ -319,7 +323,8 @@ public:
 		return Iterator(this);
 	}
 
-	variant execute(const game_logic::FormulaCallable& variables) const;
+	//caches, if given, must have been built from this VM.
+	variant execute(const game_logic::FormulaCallable& variables, PropertyCaches* caches=nullptr) const;
 
 	void replaceInstructions(Iterator i1, Iterator i2, const std::vector<InstructionType>& new_instructions);
 
@@ -347,10 +352,38 @@ public:
 
 	std::string debugOutput(const InstructionType* p=nullptr) const;
 
+	//the number of instructions, not counting their arguments.
+	int numInstructions() const;
+
+	//Replaces pure instruction sequences which only operate on constants
+	//with the value they compute. Returns the number of instructions removed.
+	int foldConstants();
+
+	//Finds pure subexpressions evaluated more than once in the formula's
+	//own scope and keeps the first result on the symbol stack, so later
+	//occurrences load it instead of recomputing it. The symbol stack
+	//indexes are absolute, so only run this on a complete formula which
+	//won't be appended to another VM. Returns the number of instructions
+	//removed.
+	int eliminateCommonSubexpressions();
+
 	void setDebugInfo(const variant& parent_formula, unsigned short begin, unsigned short end);
 private:
-	void executeInternal(const game_logic::FormulaCallable& variables, std::vector<game_logic::FormulaCallablePtr>& variables_stack, std::vector<variant>& stack, std::vector<variant>& symbol_stack, const InstructionType* p, const InstructionType* p2) const;
+	friend class RegisterVM;
+	friend class PropertyCaches;
+
+	bool valueIn(const variant& left, const variant& right, const InstructionType* p, const std::vector<variant>& stack) const;
+	variant indexStr(const variant& left, const variant& right, const InstructionType* p, const std::vector<variant>& stack) const;
+	variant arraySlice(const variant& left, const variant& begin, const variant& end, const InstructionType* p, const std::vector<variant>& stack) const;
+
+	void executeInternal(const game_logic::FormulaCallable& variables, std::vector<game_logic::FormulaCallablePtr>& variables_stack, std::vector<variant>& stack, std::vector<variant>& symbol_stack, const InstructionType* p, const InstructionType* p2, PropertyCaches* caches) const;
 	std::string debugPinpointLocation(const InstructionType* p, const std::vector<variant>& stack) const;
+
+	std::vector<InstructionType> loadConstantInstructions(const variant& v);
+	void replaceRange(int begin, int end, const std::vector<InstructionType>& new_instructions);
+	std::vector<int> instructionPositions() const;
+	std::vector<bool> jumpTargets() const;
+
 	std::vector<InstructionType> instructions_;
 	std::vector<variant> constants_;
 
@@ -363,4 +396,108 @@ private:
 	variant parent_formula_;
 };
 
+//Register-allocated form of a VirtualMachine program. Temporaries live
+//in numbered registers rather than being pushed and popped, and constants
+//and symbol lookups are read directly as instruction operands.
+class RegisterVM
+{
+public:
+	//Lowers the stack bytecode of vm, which must outlive the result.
+	//Returns null if vm uses instructions the register form doesn't
+	//support (scopes, algorithms, where clauses, etc).
+	static std::shared_ptr<const RegisterVM> compile(const VirtualMachine& vm);
+
+	variant execute(const game_logic::FormulaCallable& variables, PropertyCaches* caches=nullptr) const;
+
+	int numRegisters() const { return num_registers_; }
+	int numInstructions() const { return static_cast<int>(instructions_.size()); }
+
+	std::string debugOutput() const;
+private:
+	RegisterVM() : vm_(nullptr), num_registers_(0) {}
+
+	enum OPERAND_KIND { OPERAND_REGISTER, OPERAND_CONSTANT, OPERAND_LOOKUP };
+
+	struct Operand {
+		OPERAND_KIND kind;
+		int index;
+	};
+
+	//Instructions not shared with the stack VM. They're numbered above
+	//every OP value.
+	enum REG_OP { REG_MOVE = 256, REG_SWAP, REG_JMP, REG_JMP_IF, REG_JMP_UNLESS, REG_RETURN };
+
+	struct Instruction {
+		int op;
+
+		//destination register, or the target of a jump.
+		int dst;
+
+		//number of arguments in consecutive registers after dst for
+		//lists, maps, slices and calls.
+		int nargs;
+
+		//position of the originating instruction in the stack bytecode.
+		int source;
+
+		Operand a, b;
+	};
+
+	const variant& fetch(const Operand& o, const variant* regs, const game_logic::FormulaCallable& variables, variant& scratch) const;
+	void run(const game_logic::FormulaCallable& variables, variant* regs, variant& result, PropertyCaches* caches) const;
+
+	const VirtualMachine* vm_;
+	std::vector<Instruction> instructions_;
+	std::vector<variant> constants_;
+	int num_registers_;
+};
+
+//Inline caches for the property lookups of a VirtualMachine. Each site
+//that looks up a constant key by name (OP_INDEX_STR on a callable, or
+//OP_LOOKUP_STR) remembers the slot the key resolved to for the last few
+//callable layouts it saw, and reads by slot when the layout matches.
+//Sites which see too many layouts go megamorphic and stop caching.
+class PropertyCaches
+{
+public:
+	explicit PropertyCaches(const VirtualMachine& vm);
+	~PropertyCaches();
+
+	bool empty() const { return sites_.empty(); }
+
+	//the site for the instruction at pos, or -1 if it isn't cached.
+	int siteAt(int pos) const { return site_index_[pos]; }
+
+	variant query(int site, const game_logic::FormulaCallable& callable, const std::string& key);
+
+	struct Report {
+		std::string site;
+		int64_t hits, misses;
+		int layouts;
+		bool megamorphic;
+	};
+
+	//statistics for every live cache site, those with the most misses
+	//first. Optionally resets the hit/miss counts afterwards.
+	static std::vector<Report> getReport(bool reset=false);
+private:
+	PropertyCaches(const PropertyCaches&);
+	void operator=(const PropertyCaches&);
+
+	enum { MaxLayouts = 4 };
+
+	struct Site {
+		int pos;
+		ffl::IntrusivePtr<const reference_counted_object> layouts[MaxLayouts];
+		int slots[MaxLayouts];
+		int nlayouts;
+		bool megamorphic;
+		int64_t hits, misses;
+	};
+
+	const VirtualMachine* vm_;
+	std::vector<Site> sites_;
+	std::vector<int> site_index_;
+};
+
 }
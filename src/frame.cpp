@@ -884,6 +884,112 @@ void Frame::drawBatch(graphics::AnuraShaderPtr shader, const BatchDrawItem* i1,
 	wnd->render(&frame->blit_target_);
 }
 
+bool Frame::canBatchWith(const Frame& other) const
+{
+	if(this == &other) {
+		return true;
+	}
+
+	const KRE::TexturePtr& a = blit_target_.getTexture();
+	const KRE::TexturePtr& b = other.blit_target_.getTexture();
+	if(!a || !b) {
+		return false;
+	}
+
+	if(a != b && (*a != *b || a->isPaletteized() || b->isPaletteized())) {
+		return false;
+	}
+
+	if(blit_target_.getShader() != other.blit_target_.getShader()) {
+		return false;
+	}
+
+	if(blit_target_.isBlendModeSet() != other.blit_target_.isBlendModeSet()
+	   || (blit_target_.isBlendModeSet() && blit_target_.getBlendMode() != other.blit_target_.getBlendMode())) {
+		return false;
+	}
+
+	if(blit_target_.isBlendEquationSet() != other.blit_target_.isBlendEquationSet()
+	   || (blit_target_.isBlendEquationSet() && blit_target_.getBlendEquation() != other.blit_target_.getBlendEquation())) {
+		return false;
+	}
+
+	if(blit_target_.isBlendStateSet() != other.blit_target_.isBlendStateSet()
+	   || blit_target_.isBlendEnabled() != other.blit_target_.isBlendEnabled()) {
+		return false;
+	}
+
+	if(blit_target_.isColorSet() || other.blit_target_.isColorSet()) {
+		return false;
+	}
+
+	return true;
+}
+
+void Frame::drawAutoBatch(const BatchDrawItem* i1, const BatchDrawItem* i2)
+{
+	if(i1 == i2) {
+		return;
+	}
+
+	const Frame* frame = i1->frame;
+
+	std::vector<KRE::vertex_texcoord> queue;
+	queue.reserve((i2 - i1)*6);
+
+	for(; i1 != i2; ++i1) {
+		const Frame* f = i1->frame;
+		rect old_src_rect = f->blit_target_.getTexture()->getSourceRect();
+
+		const FrameInfo* info = nullptr;
+		f->getRectInTexture(i1->time, info);
+
+		const float x = static_cast<float>(i1->x + static_cast<int>((i1->face_right ? info->x_adjust : info->x2_adjust) * f->scale_));
+		const float y = static_cast<float>(i1->y + static_cast<int>(info->y_adjust * f->scale_));
+		const int w = static_cast<int>(info->area.w() * f->scale_);
+		const int h = static_cast<int>(info->area.h() * f->scale_);
+
+		//matches the vertices draw() produces for a MIDDLE-centred blit.
+		const float cx = x + w/2;
+		const float cy = y + h/2;
+		const float x1 = cx - w/2.0f;
+		const float y1 = cy - h/2.0f;
+		const float x2 = x1 + w;
+		const float y2 = y1 + h;
+
+		const float vx1 = i1->face_right ? x1 : x2;
+		const float vx2 = i1->face_right ? x2 : x1;
+		const float vy1 = i1->upside_down ? y2 : y1;
+		const float vy2 = i1->upside_down ? y1 : y2;
+
+		const rectf& r = info->draw_rect;
+
+		if(queue.empty() == false) {
+			//degenerate triangles to join the strips.
+			queue.emplace_back(queue.back());
+			queue.emplace_back(glm::vec2(vx1, vy1), glm::vec2(r.x(), r.y()));
+		}
+
+		queue.emplace_back(glm::vec2(vx1, vy1), glm::vec2(r.x(), r.y()));
+		queue.emplace_back(glm::vec2(vx2, vy1), glm::vec2(r.x2(), r.y()));
+		queue.emplace_back(glm::vec2(vx1, vy2), glm::vec2(r.x(), r.y2()));
+		queue.emplace_back(glm::vec2(vx2, vy2), glm::vec2(r.x2(), r.y2()));
+
+		f->blit_target_.getTexture()->setSourceRect(0, old_src_rect);
+	}
+
+	auto wnd = KRE::WindowManager::getMainWindow();
+	frame->blit_target_.setPosition(0, 0);
+	frame->blit_target_.setRotation(0, z_axis);
+	frame->blit_target_.setScale(1.0f, 1.0f);
+	frame->blit_target_.update(&queue);
+	wnd->render(&frame->blit_target_);
+
+	//the vertices no longer describe a single frame; make the next draw()
+	//rebuild them.
+	frame->blit_target_.setDrawRect(rect(0, 0, 0, 0));
+}
+
 void Frame::drawCustom(graphics::AnuraShaderPtr shader, int x, int y, const std::vector<CustomPoint>& points, const rect* area, bool face_right, bool upside_down, int time, float rotation) const
 {
 	KRE::Blittable blit;
@@ -99,6 +99,14 @@ public:
 
 	static void drawBatch(graphics::AnuraShaderPtr shader, const BatchDrawItem* i1, const BatchDrawItem* i2);
 
+	// True if this frame can be submitted in the same draw call as the given
+	// frame, i.e. they share texture, shader and blend state.
+	bool canBatchWith(const Frame& other) const;
+
+	// Draws the items as a single triangle strip, using the same geometry as
+	// draw() (including mirroring). All frames must satisfy canBatchWith().
+	static void drawAutoBatch(const BatchDrawItem* i1, const BatchDrawItem* i2);
+
 	void setImageAsSolid();
 	ConstSolidInfoPtr solid() const { return solid_; }
 	ConstSolidInfoPtr platform() const { return platform_; }
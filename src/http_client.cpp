@@ -43,7 +43,8 @@ http_client::http_client(const std::string& host, const std::string& port, int s
 	resolver_query_(new tcp::resolver::query(tcp::resolver::query::protocol_type::v4(), host.c_str(), port.c_str())),
 	in_flight_(0),
 	allow_keepalive_(false),
-	timeout_and_retry_(false)
+	timeout_and_retry_(false),
+	accept_("*/*")
 {
 }
 
@@ -219,7 +220,7 @@ void http_client::send_connection_request(connection_ptr conn)
 	std::ostringstream msg;
 	msg << conn->method_path << " HTTP/1.1\r\n"
 		   "Host: " << host_ << "\r\n"
-		   "Accept: */*\r\n"
+		   "Accept: " << accept_ << "\r\n"
 	       "User-Agent: Frogatto 1.1\r\n"
 		   "Content-Type: text/plain\r\n"
 		   "Accept-Encoding: deflate\r\n"
@@ -60,6 +60,9 @@ public:
 
 	void set_timeout_and_retry(bool value=true) { timeout_and_retry_ = value; }
 
+	//the Accept header sent with requests; */* by default.
+	void set_accept(const std::string& accept) { accept_ = accept; }
+
 private:
 	DECLARE_CALLABLE(http_client)
 	int session_id_;
@@ -131,5 +134,7 @@ private:
 	bool allow_keepalive_;
 	bool timeout_and_retry_;
 
+	std::string accept_;
+
 	std::vector<std::weak_ptr<Connection> > connections_monitor_timeout_;
 };
@@ -43,6 +43,7 @@
 #include "utils.hpp"
 #include "unit_test.hpp"
 #include "variant.hpp"
+#include "variant_binary.hpp"
 
 using boost::asio::ip::tcp;
 
@@ -134,7 +135,7 @@ namespace http
 	}
 
 	web_server::SocketInfo::SocketInfo(boost::asio::io_service& service)
-	  : socket(service), client_version(0), supports_deflate(false)
+	  : socket(service), client_version(0), supports_deflate(false), supports_binary_variant(false)
 	{
 	}
 
@@ -334,6 +335,12 @@ namespace http
 				}
 			}
 
+			static const std::string AcceptStr("accept");
+			auto accept_itor = env.find(AcceptStr);
+			if(accept_itor != env.end() && strstr(accept_itor->second.c_str(), variant_binary::MimeType)) {
+				socket->supports_binary_variant = true;
+			}
+
 			const int content_length = atoi(env["content-length"].c_str());
 			LOG_DEBUG("PARSE content-length: " << content_length);
 
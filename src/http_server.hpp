@@ -46,6 +46,7 @@ namespace http
 			boost::asio::ip::tcp::socket socket;
 			int client_version;
 			bool supports_deflate;
+			bool supports_binary_variant;
 		};
 
 		typedef std::shared_ptr<SocketInfo> socket_ptr;
@@ -22,8 +22,10 @@
 */
 
 #include <algorithm>
+#include <sstream>
 
 #include "asserts.hpp"
+#include "binary_cache.hpp"
 #include "code_editor_dialog.hpp"
 #include "checksum.hpp"
 #include "filesystem.hpp"
@@ -116,14 +118,20 @@ namespace json
 
 		void escape_string(std::string& s) 
 		{
-			for(size_t n = 0; n < s.size(); ++n) {
-				if(s[n] == '\\') {
-					s.erase(s.begin() + n);
-					if(n < s.size() && s[n] == 'n') {
-						s[n] = '\n';
+			std::string::iterator out = std::find(s.begin(), s.end(), '\\');
+			for(std::string::iterator i = out; i != s.end(); ++i) {
+				if(*i == '\\') {
+					if(++i == s.end()) {
+						break;
 					}
+
+					*out++ = *i == 'n' ? '\n' : *i;
+				} else {
+					*out++ = *i;
 				}
 			}
+
+			s.erase(out, s.end());
 		}
 	}
 
@@ -294,16 +302,8 @@ namespace json
 				stack[0].type = VAL_TYPE::ARRAY;
 
 				for(Token t = get_token(i1, i2); t.type != Token::TYPE::NUM_TYPES; t = get_token(i1, i2)) {
-					while(debug_pos != t.begin) {
-						if(*debug_pos == '\n') {
-							++debug_info.line;
-							debug_info.column = 0;
-						} else {
-							++debug_info.column;
-						}
-
-						++debug_pos;
-					}
+					advance_position(debug_pos, t.begin, &debug_info.line, &debug_info.column);
+					debug_pos = t.begin;
 
 					CHECK_PARSE(stack.size() > 1, "Unexpected characters at end of input", t.begin - doc.c_str());
 
@@ -410,14 +410,7 @@ namespace json
 						variant::debug_info str_debug_info = debug_info;
 						str_debug_info.end_line = str_debug_info.line;
 						str_debug_info.end_column = str_debug_info.column;
-						for(std::string::const_iterator i = s.begin(); i != s.end(); ++i) {
-							if(*i == '\n') {
-								str_debug_info.end_line++;
-								str_debug_info.end_column = 0;
-							} else {
-								str_debug_info.end_column++;
-							}
-						}
+						advance_position(t.begin, t.end, &str_debug_info.end_line, &str_debug_info.end_column);
 
 						if(t.type == Token::TYPE::STRING) {
 							escape_string(s);
@@ -427,8 +420,11 @@ namespace json
 				
 						bool is_macro = false;
 						bool is_flatten = false;
-						if(use_preprocessor) {
-							const std::string Macro = "@macro ";
+						if(use_preprocessor && (s.empty() || s[0] != '@')) {
+							//only strings starting with @ mean anything to the preprocessor.
+							v = variant(s);
+						} else if(use_preprocessor) {
+							static const std::string Macro = "@macro ";
 							if(stack.back().type == VAL_TYPE::OBJ && s.size() > Macro.size() && std::equal(Macro.begin(), Macro.end(), s.begin())) {
 								s.erase(s.begin(), s.begin() + Macro.size());
 								is_macro = true;
@@ -444,7 +440,6 @@ namespace json
 								CHECK_PARSE(false, "Preprocessor error: " + s, t.begin - doc.c_str());
 							}
 
-							const std::string CallStr = "@call";
 							if(stack.back().type == VAL_TYPE::OBJ && s == "@call") {
 								stack.back().is_call = true;
 							} else if(stack.back().type == VAL_TYPE::OBJ && stack[stack.size()-2].type == VAL_TYPE::ARRAY && s == "@base") {
@@ -581,12 +576,23 @@ namespace json
 			std::string data = get_file_contents(fname);
 
 			typedef std::pair<std::string, JSON_PARSE_OPTIONS> CacheKey;
-			static std::map<CacheKey, variant> cache;
+
+			//what parsing the file read and evaluated besides the file
+			//itself, reported again whenever the cached result is reused.
+			struct CacheEntry {
+				variant value;
+				std::vector<binary_cache::Dependency> deps;
+			};
+			static std::map<CacheKey, CacheEntry> cache;
 
 			CacheKey key(md5::sum(data), options);
-			std::map<CacheKey, variant>::iterator cache_itor = cache.find(key);
+			binary_cache::note_file_read(fname, key.first);
+			std::map<CacheKey, CacheEntry>::iterator cache_itor = cache.find(key);
 			if(cache_itor != cache.end()) {
-				return cache_itor->second;
+				for(const binary_cache::Dependency& dep : cache_itor->second.deps) {
+					binary_cache::note_file_read(dep.fname, dep.hash);
+				}
+				return cache_itor->second.value;
 			}
 
 			checksum::verify_file(fname, data);
@@ -596,9 +602,12 @@ namespace json
 			}
 
 			variant result;
+			std::vector<binary_cache::Dependency> deps;
 		
 			try {
+				binary_cache::DependencyScope scope;
 				result = parse_internal(data, fname, options, nullptr, nullptr);
+				deps = scope.dependencies();
 			} catch(ParseError& e) {
 				if(!preferences::edit_and_continue()) {
 					throw e;
@@ -617,15 +626,17 @@ namespace json
 				return parse_from_file(fname, options);
 			}
 
-			for(std::map<CacheKey, variant>::iterator i = cache.begin(); i != cache.end(); ) {
-				if(i->second.refcount() == 1) {
+			for(std::map<CacheKey, CacheEntry>::iterator i = cache.begin(); i != cache.end(); ) {
+				if(i->second.value.refcount() == 1) {
 					cache.erase(i++);
 				} else {
 					++i;
 				}
 			}
 
-			cache[key] = result;
+			CacheEntry& entry = cache[key];
+			entry.value = result;
+			entry.deps.swap(deps);
 			return result;
 		} catch(ParseError& e) {
 			// Removed the completely asinine practice of emitting they parser error message.
@@ -707,6 +718,26 @@ namespace json
 		CHECK_EQ(v["m"]["y"], variant(2));
 	}
 
+	UNIT_TEST(json_debug_positions)
+	{
+		std::string doc = "{\n" + std::string(20, ' ') + "key: \"value\"\n}";
+		variant v = parse(doc);
+		const variant::debug_info* info = v["key"].get_debug_info();
+		CHECK_EQ(info != nullptr, true);
+		CHECK_EQ(info->line, 2);
+		CHECK_EQ(info->column, 26);
+		CHECK_EQ(info->end_line, 2);
+		CHECK_EQ(info->end_column, 31);
+
+		try {
+			parse("{\n  a: 1,\n  b: }");
+			CHECK(false, "Expected a parse error");
+		} catch(ParseError& e) {
+			CHECK_EQ(e.line, 3);
+			CHECK_EQ(e.col, 7);
+		}
+	}
+
 	UNIT_TEST(json_macro)
 	{
 		std::string doc = "{\"@macro f\": {a: \"@eval 4 + x\", b: \"@eval y\"},"
@@ -720,4 +751,19 @@ namespace json
 		CHECK_EQ(v["b"]["a"], variant(4));
 		CHECK_EQ(v["b"]["z"], variant(5));
 	}
+
+	BENCHMARK(json_parse_document)
+	{
+		std::ostringstream doc;
+		doc << "{\n\tobjects: [\n";
+		for(int n = 0; n != 2000; ++n) {
+			doc << "\t\t{ type: \"object_" << (n%50) << "\", x: " << n << ", y: " << (n*7) << ", label: \"some \\\"quoted\\\" text\", flags: [true, false, null], scale: 1.5 },\n";
+		}
+		doc << "\t],\n}\n";
+
+		const std::string s = doc.str();
+		BENCHMARK_LOOP {
+			parse(s);
+		}
+	}
 }
@@ -24,12 +24,137 @@
 #include <algorithm>
 #include <cstring>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define JSON_SCAN_SSE2
+#endif
+
 #include "json_tokenizer.hpp"
 #include "unit_test.hpp"
 #include "string_utils.hpp"
 
 namespace json 
 {
+#ifdef JSON_SCAN_SSE2
+	namespace 
+	{
+		const int ScanBlockSize = 16;
+
+		int lowest_bit(unsigned int mask)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return static_cast<int>(index);
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		int count_bits(unsigned int mask)
+		{
+			int result = 0;
+			while(mask) {
+				mask &= mask - 1;
+				++result;
+			}
+
+			return result;
+		}
+
+		int highest_bit(unsigned int mask)
+		{
+			int result = 0;
+			while(mask >>= 1) {
+				++result;
+			}
+
+			return result;
+		}
+	}
+#endif
+
+	const char* find_quote_or_escape(const char* i1, const char* i2, char quote)
+	{
+#ifdef JSON_SCAN_SSE2
+		const __m128i quotes = _mm_set1_epi8(quote);
+		const __m128i escapes = _mm_set1_epi8('\\');
+		while(i2 - i1 >= ScanBlockSize) {
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i1));
+			const unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, quotes), _mm_cmpeq_epi8(block, escapes)));
+			if(mask) {
+				return i1 + lowest_bit(mask);
+			}
+
+			i1 += ScanBlockSize;
+		}
+#endif
+		while(i1 != i2 && *i1 != quote && *i1 != '\\') {
+			++i1;
+		}
+
+		return i1;
+	}
+
+	const char* skip_blanks(const char* i1, const char* i2)
+	{
+#ifdef JSON_SCAN_SSE2
+		const __m128i spaces = _mm_set1_epi8(' ');
+		const __m128i tabs = _mm_set1_epi8('\t');
+		const __m128i returns = _mm_set1_epi8('\r');
+		const __m128i newlines = _mm_set1_epi8('\n');
+		while(i2 - i1 >= ScanBlockSize) {
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i1));
+			const __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, spaces), _mm_cmpeq_epi8(block, tabs)),
+			                                   _mm_or_si128(_mm_cmpeq_epi8(block, returns), _mm_cmpeq_epi8(block, newlines)));
+			const unsigned int mask = ~_mm_movemask_epi8(blank) & 0xFFFF;
+			if(mask) {
+				return i1 + lowest_bit(mask);
+			}
+
+			i1 += ScanBlockSize;
+		}
+#endif
+		while(i1 != i2 && (*i1 == ' ' || *i1 == '\t' || *i1 == '\r' || *i1 == '\n')) {
+			++i1;
+		}
+
+		return i1;
+	}
+
+	void advance_position(const char* i1, const char* i2, int* line, int* column)
+	{
+		const char* const begin = i1;
+		const char* last_newline = nullptr;
+		int nlines = 0;
+#ifdef JSON_SCAN_SSE2
+		const __m128i newlines = _mm_set1_epi8('\n');
+		while(i2 - i1 >= ScanBlockSize) {
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i1));
+			const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+			if(mask) {
+				nlines += count_bits(mask);
+				last_newline = i1 + highest_bit(mask);
+			}
+
+			i1 += ScanBlockSize;
+		}
+#endif
+		for(; i1 != i2; ++i1) {
+			if(*i1 == '\n') {
+				++nlines;
+				last_newline = i1;
+			}
+		}
+
+		if(last_newline) {
+			*line += nlines;
+			*column = static_cast<int>(i2 - last_newline - 1);
+		} else {
+			*column += static_cast<int>(i2 - begin);
+		}
+	}
+
 	Token get_token(const char*& i1, const char* i2)
 	{
 		while((i1 != i2 && util::c_isspace(*i1)) || *i1 == '#' || (*i1 == '/' && i1+1 != i2 && (*(i1 + 1) == '/' || *(i1 + 1) == '*'))) {
@@ -61,9 +186,12 @@ namespace json
 				++i1;
 			} else if(*i1 == '#' || *i1 == '/') {
 				//ignore comments.
-				i1 = std::find(i1, i2, '\n');
+				i1 = static_cast<const char*>(memchr(i1, '\n', i2 - i1));
+				if(i1 == nullptr) {
+					i1 = i2;
+				}
 			} else {
-				++i1;
+				i1 = skip_blanks(i1 + 1, i2);
 			}
 		}
 
@@ -99,7 +227,14 @@ namespace json
 			i1 += 3;
 			result.begin = i1;
 
-			while(i1+2 != i2) {
+			while(i2 - i1 > 2) {
+				const char* quote = static_cast<const char*>(memchr(i1, '"', i2 - i1 - 2));
+				if(quote == nullptr) {
+					i1 = i2;
+					break;
+				}
+
+				i1 = quote;
 				if(std::equal(i1, i1+3, "\"\"\"")) {
 					break;
 				}
@@ -107,7 +242,7 @@ namespace json
 				++i1;
 			}
 
-			if(i1+2 == i2) {
+			if(i2 - i1 <= 2) {
 				TokenizerError error = { "Unexpected end of file while parsing string", result.begin };
 				throw error;
 			}
@@ -122,13 +257,15 @@ namespace json
 			result.type = Token::TYPE::STRING;
 			result.begin = ++i1;
 			while(i1 != i2) {
-				if(*i1 == quote_type) {
+				i1 = find_quote_or_escape(i1, i2, quote_type);
+				if(i1 == i2 || *i1 == quote_type) {
+					break;
+				}
+
+				//skip the backslash and the character it escapes.
+				++i1;
+				if(i1 == i2) {
 					break;
-				} else if(*i1 == '\\') {
-					++i1;
-					if(i1 == i2) {
-						break;
-					}
 				}
 
 				++i1;
@@ -208,3 +345,40 @@ namespace json
 		return res;
 	}
 }
+
+UNIT_TEST(json_scan_helpers)
+{
+	//long enough that matches land both inside and after whole 16 byte blocks.
+	for(int n = 0; n != 40; ++n) {
+		std::string s(n, 'a');
+		s += "\"tail";
+		CHECK_EQ(json::find_quote_or_escape(s.c_str(), s.c_str() + s.size(), '"') - s.c_str(), n);
+
+		s[n] = '\\';
+		CHECK_EQ(json::find_quote_or_escape(s.c_str(), s.c_str() + s.size(), '"') - s.c_str(), n);
+		CHECK_EQ(json::find_quote_or_escape(s.c_str(), s.c_str() + n, '"') - s.c_str(), n);
+
+		std::string blanks;
+		for(int m = 0; m != n; ++m) {
+			blanks += " \t\r\n"[m%4];
+		}
+
+		blanks += "x";
+		CHECK_EQ(json::skip_blanks(blanks.c_str(), blanks.c_str() + blanks.size()) - blanks.c_str(), n);
+
+		int line = 1, column = 3;
+		json::advance_position(blanks.c_str(), blanks.c_str() + blanks.size(), &line, &column);
+		int expected_line = 1, expected_column = 3;
+		for(char c : blanks) {
+			if(c == '\n') {
+				++expected_line;
+				expected_column = 0;
+			} else {
+				++expected_column;
+			}
+		}
+
+		CHECK_EQ(line, expected_line);
+		CHECK_EQ(column, expected_column);
+	}
+}
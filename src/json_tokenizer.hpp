@@ -56,6 +56,19 @@ namespace json
 
 	Token get_token(const char*& i1, const char* i2);
 
+	//Scanning helpers used by the tokenizer and parser. Where SSE2 is
+	//available they examine 16 characters at a time.
+
+	//finds the first quote or backslash in [i1, i2), returning i2 if none.
+	const char* find_quote_or_escape(const char* i1, const char* i2, char quote);
+
+	//skips spaces, tabs, carriage returns and newlines.
+	const char* skip_blanks(const char* i1, const char* i2);
+
+	//moves line and column over [i1, i2), where a newline goes to column 0
+	//of the next line and any other character advances the column.
+	void advance_position(const char* i1, const char* i2, int* line, int* column);
+
 	//Gets the full token, unlike get_token which will e.g. return the
 	//characters inside the string.
 	Token get_token_full(const char*& i1, const char* i2);
@@ -23,8 +23,11 @@
 
 #pragma once
 
-#if defined(_MSC_VER)
+#include <cstddef>
+#include <new>
 
+#if defined(_MSC_VER)
+#include <malloc.h>
 #else
 #include <boost/align/aligned_alloc.hpp>
 #endif
@@ -58,3 +61,43 @@ struct AlignedAllocator
 };
 
 typedef AlignedAllocator<16> AlignedAllocator16;
+
+// Allocator for standard containers whose storage must be N-byte aligned,
+// e.g. arrays processed with SIMD loads and stores.
+template<typename T, std::size_t N>
+struct AlignedStdAllocator
+{
+	typedef T value_type;
+	template<typename U> struct rebind { typedef AlignedStdAllocator<U, N> other; };
+
+	AlignedStdAllocator() {}
+	template<typename U> AlignedStdAllocator(const AlignedStdAllocator<U, N>&) {}
+
+	T* allocate(std::size_t n)
+	{
+#ifdef _MSC_VER
+		void* p = _aligned_malloc(n * sizeof(T), N);
+#else
+		void* p = boost::alignment::aligned_alloc(N, n * sizeof(T));
+#endif
+		if(p == nullptr) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, std::size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		boost::alignment::aligned_free(p);
+#endif
+	}
+};
+
+template<typename T, typename U, std::size_t N>
+bool operator==(const AlignedStdAllocator<T, N>&, const AlignedStdAllocator<U, N>&) { return true; }
+
+template<typename T, typename U, std::size_t N>
+bool operator!=(const AlignedStdAllocator<T, N>&, const AlignedStdAllocator<U, N>&) { return false; }
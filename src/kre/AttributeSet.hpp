@@ -342,6 +342,20 @@ namespace KRE
 				getParent()->setCount(elements_.size());
 			}
 		}
+		// Overwrites count elements starting at first, without changing the size, 
+		// and only sends that range to the hardware buffer.
+		void updateRange(const T* src, size_type first, size_type count) {
+			ASSERT_LOG(first + count <= elements_.size(), "Range update outside of attribute: " << first << "+" << count << " > " << elements_.size());
+			std::copy(src, src + count, elements_.begin() + first);
+			if(getDeviceBufferData() && count > 0) {
+				if(first == 0) {
+					// a zero offset re-specifies the whole buffer, so send all of it.
+					getDeviceBufferData()->update(&elements_[0], 0, elements_.size() * sizeof(T));
+				} else {
+					getDeviceBufferData()->update(&elements_[first], first * sizeof(T), count * sizeof(T));
+				}
+			}
+		}
 		void addMultiDraw(Container<T>* src) {
 			ASSERT_LOG(getParent() != nullptr && getParent()->isMultiDrawEnabled(), "Parent attribute set not enabled for multi-draw. Call enableMultiDraw() on parent.");
 			std::ptrdiff_t dst1 = elements_.size();
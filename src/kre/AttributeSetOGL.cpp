@@ -21,6 +21,8 @@
 	   distribution.
 */
 
+#include <algorithm>
+
 #include "AttributeSetOGL.hpp"
 
 namespace KRE
@@ -96,7 +98,7 @@ namespace KRE
 				<< " > " 
 				<< size_);
 			glBufferSubData(GL_ARRAY_BUFFER, offset, size, value);
-			size_ = size + offset;
+			size_ = std::max(size_, size + offset);
 		}
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
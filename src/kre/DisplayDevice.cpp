@@ -65,6 +65,8 @@ namespace KRE
 			static DisplayDevicePtr res;
 			return res;
 		};
+
+		int g_draw_call_count = 0;
 	}
 
 	DisplayDevice::DisplayDevice(WindowPtr wnd)
@@ -196,6 +198,16 @@ namespace KRE
 		return DisplayDevice::getCurrent()->doCheckForFeature(cap);
 	}
 
+	int DisplayDevice::getDrawCallCount()
+	{
+		return g_draw_call_count;
+	}
+
+	void DisplayDevice::countDrawCall()
+	{
+		++g_draw_call_count;
+	}
+
 	WindowPtr DisplayDevice::getParentWindow() const
 	{
 		auto parent = parent_.lock();
@@ -193,6 +193,10 @@ namespace KRE
 
 		static bool checkForFeature(DisplayDeviceCapabilties cap);
 
+		// Running count of draw calls submitted to the device, for profiling.
+		static int getDrawCallCount();
+		static void countDrawCall();
+
 		static void registerFactoryFunction(const std::string& type, std::function<DisplayDevicePtr(WindowPtr)>);
 	private:
 		std::weak_ptr<Window> parent_;
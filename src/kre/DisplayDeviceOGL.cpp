@@ -434,6 +434,7 @@ namespace KRE
 				}
 			}
 
+			countDrawCall();
 			if(as->isInstanced()) {
 				if(as->isIndexed()) {
 					as->bindIndex();
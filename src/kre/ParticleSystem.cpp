@@ -21,9 +21,15 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <cmath>
 #include <chrono>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define PARTICLE_POOL_SSE2
+#endif
+
 #include "ModelMatrixScope.hpp"
 #include "ParticleSystem.hpp"
 #include "ParticleSystemAffectors.hpp"
@@ -33,6 +39,9 @@
 #include "Shaders.hpp"
 #include "spline.hpp"
 #include "WindowManager.hpp"
+#include "profile_timer.hpp"
+#include "reference_counted_object.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 namespace KRE
@@ -52,6 +61,38 @@ namespace KRE
 				}
 				return *res;
 			}
+
+			bool g_async_update = false;
+
+			std::function<unsigned()>& get_seed_generator()
+			{
+				static std::function<unsigned()> fn;
+				return fn;
+			}
+
+			unsigned generate_seed()
+			{
+				const auto& fn = get_seed_generator();
+				if(fn) {
+					return fn();
+				}
+				return static_cast<unsigned>(get_rng_engine()());
+			}
+
+			// Engine of the particle system currently being updated on this
+			// thread, so that each system draws from its own seeded stream.
+			THREAD_LOCAL std::default_random_engine* g_current_rng = nullptr;
+
+			struct RngScope
+			{
+				explicit RngScope(std::default_random_engine* rng) : prev_(g_current_rng) {
+					g_current_rng = rng;
+				}
+				~RngScope() {
+					g_current_rng = prev_;
+				}
+				std::default_random_engine* prev_;
+			};
 		}
 
 		void init_physics_parameters(PhysicsParameters& pp)
@@ -73,7 +114,422 @@ namespace KRE
 				std::swap(min, max);
 			}
 			std::uniform_real_distribution<float> gen(min, max);
-			return gen(get_rng_engine());
+			return gen(g_current_rng != nullptr ? *g_current_rng : get_rng_engine());
+		}
+
+		void ParticlePool::reserve(size_t n)
+		{
+			for(auto a : { &px_, &py_, &pz_, &dx_, &dy_, &dz_, &velocity_, &ttl_, &initial_ttl_, &mass_, &width_, &height_, &depth_ }) {
+				a->reserve(n);
+			}
+			color_.reserve(n);
+			initial_color_.reserve(n);
+			state_.reserve(n);
+		}
+
+		void ParticlePool::clear()
+		{
+			resize(0);
+		}
+
+		void ParticlePool::resize(size_t n)
+		{
+			for(auto a : { &px_, &py_, &pz_, &dx_, &dy_, &dz_, &velocity_, &ttl_, &initial_ttl_, &mass_, &width_, &height_, &depth_ }) {
+				a->resize(n);
+			}
+			color_.resize(n);
+			initial_color_.resize(n);
+			state_.resize(n);
+		}
+
+		void ParticlePool::push_back(const Particle& p)
+		{
+			resize(size() + 1);
+			set(size() - 1, p);
+		}
+
+		Particle ParticlePool::get(size_t n) const
+		{
+			Particle p;
+			p.current.position = glm::vec3(px_[n], py_[n], pz_[n]);
+			p.current.color = color_[n];
+			p.current.dimensions = glm::vec3(width_[n], height_[n], depth_[n]);
+			p.current.time_to_live = ttl_[n];
+			p.current.mass = mass_[n];
+			p.current.velocity = velocity_[n];
+			p.current.direction = glm::vec3(dx_[n], dy_[n], dz_[n]);
+			p.current.orientation = state_[n].orientation;
+			p.current.area = state_[n].area;
+			p.initial = state_[n].initial;
+			p.emitted_by = state_[n].emitted_by;
+			p.init_pos = state_[n].init_pos;
+			return p;
+		}
+
+		void ParticlePool::set(size_t n, const Particle& p)
+		{
+			px_[n] = p.current.position.x;
+			py_[n] = p.current.position.y;
+			pz_[n] = p.current.position.z;
+			color_[n] = p.current.color;
+			width_[n] = p.current.dimensions.x;
+			height_[n] = p.current.dimensions.y;
+			depth_[n] = p.current.dimensions.z;
+			ttl_[n] = p.current.time_to_live;
+			mass_[n] = p.current.mass;
+			velocity_[n] = p.current.velocity;
+			dx_[n] = p.current.direction.x;
+			dy_[n] = p.current.direction.y;
+			dz_[n] = p.current.direction.z;
+			initial_ttl_[n] = p.initial.time_to_live;
+			initial_color_[n] = p.initial.color;
+			state_[n].orientation = p.current.orientation;
+			state_[n].area = p.current.area;
+			state_[n].initial = p.initial;
+			state_[n].emitted_by = p.emitted_by;
+			state_[n].init_pos = p.init_pos;
+		}
+
+		void ParticlePool::move(size_t from, size_t to)
+		{
+			for(auto a : { &px_, &py_, &pz_, &dx_, &dy_, &dz_, &velocity_, &ttl_, &initial_ttl_, &mass_, &width_, &height_, &depth_ }) {
+				(*a)[to] = (*a)[from];
+			}
+			color_[to] = color_[from];
+			initial_color_[to] = initial_color_[from];
+			state_[to] = state_[from];
+		}
+
+		void ParticlePool::removeExpired()
+		{
+			const size_t count = size();
+			size_t kept = 0;
+			while(kept != count && ttl_[kept] > 0.0f) {
+				++kept;
+			}
+
+			if(kept == count) {
+				return;
+			}
+
+			for(size_t n = kept + 1; n != count; ++n) {
+				if(ttl_[n] > 0.0f) {
+					move(n, kept++);
+				}
+			}
+
+			resize(kept);
+		}
+
+		void ParticlePool::age(float dt)
+		{
+			const size_t count = size();
+			float* ttl = ttl_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			const __m128 vdt = _mm_set1_ps(dt);
+			for(; n + 4 <= count; n += 4) {
+				_mm_store_ps(ttl + n, _mm_sub_ps(_mm_load_ps(ttl + n), vdt));
+			}
+#endif
+			for(; n < count; ++n) {
+				ttl[n] -= dt;
+			}
+		}
+
+		void ParticlePool::integrate(float step, const float* max_velocity)
+		{
+			const size_t count = size();
+			float* px = px_.data();
+			float* py = py_.data();
+			float* pz = pz_.data();
+			float* dx = dx_.data();
+			float* dy = dy_.data();
+			float* dz = dz_.data();
+			const float* v = velocity_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			const __m128 vstep = _mm_set1_ps(step);
+			const __m128 vmax = _mm_set1_ps(max_velocity ? *max_velocity : 0.0f);
+			const __m128 one = _mm_set1_ps(1.0f);
+			for(; n + 4 <= count; n += 4) {
+				__m128 x = _mm_load_ps(dx + n);
+				__m128 y = _mm_load_ps(dy + n);
+				__m128 z = _mm_load_ps(dz + n);
+				const __m128 vel = _mm_load_ps(v + n);
+				if(max_velocity) {
+					const __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+					const __m128 too_fast = _mm_cmpgt_ps(_mm_mul_ps(vel, len), vmax);
+					const __m128 f = _mm_or_ps(_mm_and_ps(too_fast, _mm_div_ps(vmax, len)), _mm_andnot_ps(too_fast, one));
+					x = _mm_mul_ps(x, f);
+					y = _mm_mul_ps(y, f);
+					z = _mm_mul_ps(z, f);
+					_mm_store_ps(dx + n, x);
+					_mm_store_ps(dy + n, y);
+					_mm_store_ps(dz + n, z);
+				}
+				const __m128 k = _mm_mul_ps(vel, vstep);
+				_mm_store_ps(px + n, _mm_add_ps(_mm_load_ps(px + n), _mm_mul_ps(x, k)));
+				_mm_store_ps(py + n, _mm_add_ps(_mm_load_ps(py + n), _mm_mul_ps(y, k)));
+				_mm_store_ps(pz + n, _mm_add_ps(_mm_load_ps(pz + n), _mm_mul_ps(z, k)));
+			}
+#endif
+			for(; n < count; ++n) {
+				if(max_velocity) {
+					const float len = std::sqrt(dx[n]*dx[n] + dy[n]*dy[n] + dz[n]*dz[n]);
+					if(v[n] * len > *max_velocity) {
+						const float f = *max_velocity / len;
+						dx[n] *= f;
+						dy[n] *= f;
+						dz[n] *= f;
+					}
+				}
+				const float k = v[n] * step;
+				px[n] += dx[n] * k;
+				py[n] += dy[n] * k;
+				pz[n] += dz[n] * k;
+			}
+		}
+
+		void ParticlePool::getLifeFractions(float* out) const
+		{
+			const size_t count = size();
+			const float* ttl = ttl_.data();
+			const float* ittl = initial_ttl_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			const __m128 one = _mm_set1_ps(1.0f);
+			for(; n + 4 <= count; n += 4) {
+				_mm_storeu_ps(out + n, _mm_sub_ps(one, _mm_div_ps(_mm_load_ps(ttl + n), _mm_load_ps(ittl + n))));
+			}
+#endif
+			for(; n < count; ++n) {
+				out[n] = 1.0f - ttl[n] / ittl[n];
+			}
+		}
+
+		void ParticlePool::addToDirection(const glm::vec3& v, float scale)
+		{
+			const glm::vec3 d = v * scale;
+			const size_t count = size();
+			float* dx = dx_.data();
+			float* dy = dy_.data();
+			float* dz = dz_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			const __m128 vx = _mm_set1_ps(d.x);
+			const __m128 vy = _mm_set1_ps(d.y);
+			const __m128 vz = _mm_set1_ps(d.z);
+			for(; n + 4 <= count; n += 4) {
+				_mm_store_ps(dx + n, _mm_add_ps(_mm_load_ps(dx + n), vx));
+				_mm_store_ps(dy + n, _mm_add_ps(_mm_load_ps(dy + n), vy));
+				_mm_store_ps(dz + n, _mm_add_ps(_mm_load_ps(dz + n), vz));
+			}
+#endif
+			for(; n < count; ++n) {
+				dx[n] += d.x;
+				dy[n] += d.y;
+				dz[n] += d.z;
+			}
+		}
+
+		void ParticlePool::addToDirection(const glm::vec3& v, const float* scales)
+		{
+			const size_t count = size();
+			float* dx = dx_.data();
+			float* dy = dy_.data();
+			float* dz = dz_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			const __m128 vx = _mm_set1_ps(v.x);
+			const __m128 vy = _mm_set1_ps(v.y);
+			const __m128 vz = _mm_set1_ps(v.z);
+			for(; n + 4 <= count; n += 4) {
+				const __m128 s = _mm_loadu_ps(scales + n);
+				_mm_store_ps(dx + n, _mm_add_ps(_mm_load_ps(dx + n), _mm_mul_ps(vx, s)));
+				_mm_store_ps(dy + n, _mm_add_ps(_mm_load_ps(dy + n), _mm_mul_ps(vy, s)));
+				_mm_store_ps(dz + n, _mm_add_ps(_mm_load_ps(dz + n), _mm_mul_ps(vz, s)));
+			}
+#endif
+			for(; n < count; ++n) {
+				dx[n] += v.x * scales[n];
+				dy[n] += v.y * scales[n];
+				dz[n] += v.z * scales[n];
+			}
+		}
+
+		void ParticlePool::attractTo(const glm::vec3& centre, float strength)
+		{
+			const size_t count = size();
+			const float* px = px_.data();
+			const float* py = py_.data();
+			const float* pz = pz_.data();
+			float* dx = dx_.data();
+			float* dy = dy_.data();
+			float* dz = dz_.data();
+			const float* mass = mass_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			const __m128 cx = _mm_set1_ps(centre.x);
+			const __m128 cy = _mm_set1_ps(centre.y);
+			const __m128 cz = _mm_set1_ps(centre.z);
+			const __m128 vstrength = _mm_set1_ps(strength);
+			const __m128 zero = _mm_setzero_ps();
+			for(; n + 4 <= count; n += 4) {
+				const __m128 x = _mm_sub_ps(cx, _mm_load_ps(px + n));
+				const __m128 y = _mm_sub_ps(cy, _mm_load_ps(py + n));
+				const __m128 z = _mm_sub_ps(cz, _mm_load_ps(pz + n));
+				const __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+				const __m128 f = _mm_and_ps(_mm_cmpgt_ps(len, zero), _mm_div_ps(_mm_mul_ps(vstrength, _mm_load_ps(mass + n)), len));
+				_mm_store_ps(dx + n, _mm_add_ps(_mm_load_ps(dx + n), _mm_mul_ps(x, f)));
+				_mm_store_ps(dy + n, _mm_add_ps(_mm_load_ps(dy + n), _mm_mul_ps(y, f)));
+				_mm_store_ps(dz + n, _mm_add_ps(_mm_load_ps(dz + n), _mm_mul_ps(z, f)));
+			}
+#endif
+			for(; n < count; ++n) {
+				const float x = centre.x - px[n];
+				const float y = centre.y - py[n];
+				const float z = centre.z - pz[n];
+				const float len = std::sqrt(x*x + y*y + z*z);
+				if(len > 0.0f) {
+					const float f = strength * mass[n] / len;
+					dx[n] += x * f;
+					dy[n] += y * f;
+					dz[n] += z * f;
+				}
+			}
+		}
+
+		void ParticlePool::rotateAbout(const glm::vec3& centre, const glm::quat& q)
+		{
+			const glm::mat3 m = glm::mat3_cast(q);
+			const size_t count = size();
+			float* px = px_.data();
+			float* py = py_.data();
+			float* pz = pz_.data();
+			float* dx = dx_.data();
+			float* dy = dy_.data();
+			float* dz = dz_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			__m128 col[3][3];
+			for(int c = 0; c != 3; ++c) {
+				for(int r = 0; r != 3; ++r) {
+					col[c][r] = _mm_set1_ps(m[c][r]);
+				}
+			}
+			const __m128 cx = _mm_set1_ps(centre.x);
+			const __m128 cy = _mm_set1_ps(centre.y);
+			const __m128 cz = _mm_set1_ps(centre.z);
+			for(; n + 4 <= count; n += 4) {
+				const __m128 x = _mm_sub_ps(_mm_load_ps(px + n), cx);
+				const __m128 y = _mm_sub_ps(_mm_load_ps(py + n), cy);
+				const __m128 z = _mm_sub_ps(_mm_load_ps(pz + n), cz);
+				_mm_store_ps(px + n, _mm_add_ps(cx, _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][0], x), _mm_mul_ps(col[1][0], y)), _mm_mul_ps(col[2][0], z))));
+				_mm_store_ps(py + n, _mm_add_ps(cy, _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][1], x), _mm_mul_ps(col[1][1], y)), _mm_mul_ps(col[2][1], z))));
+				_mm_store_ps(pz + n, _mm_add_ps(cz, _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][2], x), _mm_mul_ps(col[1][2], y)), _mm_mul_ps(col[2][2], z))));
+
+				const __m128 vx = _mm_load_ps(dx + n);
+				const __m128 vy = _mm_load_ps(dy + n);
+				const __m128 vz = _mm_load_ps(dz + n);
+				_mm_store_ps(dx + n, _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][0], vx), _mm_mul_ps(col[1][0], vy)), _mm_mul_ps(col[2][0], vz)));
+				_mm_store_ps(dy + n, _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][1], vx), _mm_mul_ps(col[1][1], vy)), _mm_mul_ps(col[2][1], vz)));
+				_mm_store_ps(dz + n, _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][2], vx), _mm_mul_ps(col[1][2], vy)), _mm_mul_ps(col[2][2], vz)));
+			}
+#endif
+			for(; n < count; ++n) {
+				const glm::vec3 p = centre + m * (glm::vec3(px[n], py[n], pz[n]) - centre);
+				const glm::vec3 d = m * glm::vec3(dx[n], dy[n], dz[n]);
+				px[n] = p.x;
+				py[n] = p.y;
+				pz[n] = p.z;
+				dx[n] = d.x;
+				dy[n] = d.y;
+				dz[n] = d.z;
+			}
+		}
+
+		void ParticlePool::setColorsFromKeys(const std::vector<color_key>& keys, bool interpolate, bool multiply)
+		{
+			if(keys.empty()) {
+				return;
+			}
+
+			// Each key k applies to life fractions from its own time up to the
+			// next key's as color[k] + slope[k] * (fraction - time[k]). The first
+			// key also covers fractions before it.
+			const size_t nkeys = keys.size();
+			std::vector<glm::vec4> slope(nkeys, glm::vec4(0.0f));
+			if(interpolate) {
+				for(size_t k = 0; k + 1 < nkeys; ++k) {
+					slope[k] = (keys[k+1].second - keys[k].second) / (keys[k+1].first - keys[k].first);
+				}
+			}
+
+			const size_t count = size();
+			const float* ttl = ttl_.data();
+			const float* ittl = initial_ttl_.data();
+			color_vector* color = color_.data();
+			const color_vector* initial = initial_color_.data();
+			size_t n = 0;
+#ifdef PARTICLE_POOL_SSE2
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 max_channel = _mm_set1_ps(255.0f);
+			const __m128i byte_mask = _mm_set1_epi32(0xff);
+			for(; n + 4 <= count; n += 4) {
+				const __m128 f = _mm_sub_ps(one, _mm_div_ps(_mm_load_ps(ttl + n), _mm_load_ps(ittl + n)));
+
+				__m128 t0 = _mm_set1_ps(keys[0].first);
+				__m128 c[4], s[4];
+				for(int ch = 0; ch != 4; ++ch) {
+					c[ch] = _mm_set1_ps(keys[0].second[ch]);
+					s[ch] = _mm_set1_ps(slope[0][ch]);
+				}
+				for(size_t k = 1; k < nkeys; ++k) {
+					const __m128 tk = _mm_set1_ps(keys[k].first);
+					const __m128 sel = _mm_cmple_ps(tk, f);
+					t0 = _mm_or_ps(_mm_and_ps(sel, tk), _mm_andnot_ps(sel, t0));
+					for(int ch = 0; ch != 4; ++ch) {
+						c[ch] = _mm_or_ps(_mm_and_ps(sel, _mm_set1_ps(keys[k].second[ch])), _mm_andnot_ps(sel, c[ch]));
+						s[ch] = _mm_or_ps(_mm_and_ps(sel, _mm_set1_ps(slope[k][ch])), _mm_andnot_ps(sel, s[ch]));
+					}
+				}
+
+				const __m128 dt = _mm_sub_ps(f, t0);
+				__m128 scale[4];
+				if(multiply) {
+					const __m128i init = _mm_load_si128(reinterpret_cast<const __m128i*>(initial + n));
+					for(int ch = 0; ch != 4; ++ch) {
+						scale[ch] = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(init, ch*8), byte_mask));
+					}
+				} else {
+					for(int ch = 0; ch != 4; ++ch) {
+						scale[ch] = max_channel;
+					}
+				}
+
+				__m128i packed = _mm_setzero_si128();
+				for(int ch = 0; ch != 4; ++ch) {
+					__m128 v = _mm_mul_ps(_mm_add_ps(c[ch], _mm_mul_ps(s[ch], dt)), scale[ch]);
+					v = _mm_min_ps(_mm_max_ps(v, zero), max_channel);
+					packed = _mm_or_si128(packed, _mm_slli_epi32(_mm_cvttps_epi32(v), ch*8));
+				}
+				_mm_store_si128(reinterpret_cast<__m128i*>(color + n), packed);
+			}
+#endif
+			for(; n < count; ++n) {
+				const float f = 1.0f - ttl[n] / ittl[n];
+				size_t k = 0;
+				while(k + 1 < nkeys && keys[k+1].first <= f) {
+					++k;
+				}
+				const glm::vec4 c = keys[k].second + slope[k] * (f - keys[k].first);
+				for(int ch = 0; ch != 4; ++ch) {
+					const float v = c[ch] * (multiply ? static_cast<float>(initial[n][ch]) : 255.0f);
+					color[n][ch] = static_cast<color_vector::value_type>(std::min(std::max(v, 0.0f), 255.0f));
+				}
+			}
 		}
 
 		std::ostream& operator<<(std::ostream& os, const glm::vec3& v)
@@ -157,8 +613,16 @@ namespace KRE
 			  scale_time_(1.0f),
 			  scale_dimensions_(1.0f),
 			  texture_node_(),
-			  use_position_(node["use_position"].as_bool(true))
+			  use_position_(node["use_position"].as_bool(true)),
+			  back_vertices_valid_(false),
+			  ready_vertices_changed_(false),
+			  debug_draw_(false)
 		{
+			if(node.has_key("seed")) {
+				seed_.reset(new unsigned(node["seed"].as_int()));
+			}
+			rng_.seed(seed_ ? *seed_ : generate_seed());
+
 			if(node.has_key("fast_forward")) {
 				float ff_time = float(node["fast_forward"]["time"].as_float());
 				float ff_interval = float(node["fast_forward"]["interval"].as_float());
@@ -215,14 +679,52 @@ namespace KRE
 			initAttributes();
 		}
 
+		ParticleSystem::~ParticleSystem()
+		{
+			if(job_) {
+				try {
+					worker_pool::wait(job_);
+				} catch(...) {
+				}
+			}
+		}
+
 		void ParticleSystem::init()
 		{
+			sync();
+			RngScope rng_scope(&rng_);
 			active_emitter_ = emitter_->clone();
 			active_emitter_->init();
 			// In order to create as few re-allocations of particles, reserve space here
 			active_particles_.reserve(particle_quota_);
 		}
 
+		void ParticleSystem::sync()
+		{
+			if(job_) {
+				worker_pool::JobPtr job;
+				job.swap(job_);
+				worker_pool::wait(job);
+			}
+		}
+
+		void ParticleSystem::setSeed(unsigned seed)
+		{
+			sync();
+			seed_.reset(new unsigned(seed));
+			rng_.seed(seed);
+		}
+
+		void ParticleSystem::setAsyncUpdate(bool f)
+		{
+			g_async_update = f;
+		}
+
+		void ParticleSystem::setSeedGenerator(std::function<unsigned()> fn)
+		{
+			get_seed_generator() = fn;
+		}
+
 		void ParticleSystem::setTextureNode(const variant& node)
 		{
 			texture_node_ = node;
@@ -264,9 +766,16 @@ namespace KRE
 			  scale_time_(ps.scale_time_),
 			  scale_dimensions_(ps.scale_dimensions_),
 			  texture_node_(),
-			  use_position_(ps.use_position_)
-
+			  use_position_(ps.use_position_),
+			  back_vertices_valid_(false),
+			  ready_vertices_changed_(false),
+			  debug_draw_(false)
 		{
+			if(ps.seed_) {
+				seed_.reset(new unsigned(*ps.seed_));
+			}
+			rng_.seed(seed_ ? *seed_ : generate_seed());
+
 			if(ps.fast_forward_) {
 				fast_forward_.reset(new std::pair<float,float>(ps.fast_forward_->first, ps.fast_forward_->second));
 			}
@@ -327,6 +836,9 @@ namespace KRE
 			if(max_velocity_) {
 				build->add("max_velocity", *max_velocity_);
 			}
+			if(seed_) {
+				build->add("seed", static_cast<int>(*seed_));
+			}
 			build->add("emitter", emitter_->write());
 			for(const auto& aff : affectors_) {
 				build->add("affector", aff->write());
@@ -335,6 +847,8 @@ namespace KRE
 
 		void ParticleSystem::update(float dt)
 		{
+			RngScope rng_scope(&rng_);
+
 			// run objects
 			active_emitter_->emitProcess(dt);
 			for(auto a : affectors_) {
@@ -342,16 +856,12 @@ namespace KRE
 			}
 
 			// Decrement the ttl on particles
-			for(auto& p : active_particles_) {
-				p.current.time_to_live -= dt;
-			}
+			active_particles_.age(dt);
 
 			active_emitter_->current.time_to_live -= dt;
 
 			// Kill end-of-life particles
-			active_particles_.erase(std::remove_if(active_particles_.begin(), active_particles_.end(),
-				[](decltype(active_particles_[0]) p){return p.current.time_to_live <= 0.0f;}), 
-				active_particles_.end());
+			active_particles_.removeExpired();
 			// Kill end-of-life emitters
 			if(active_emitter_->current.time_to_live <= 0.0f) {
 				active_emitter_.reset();
@@ -378,15 +888,7 @@ namespace KRE
 			}*/
 
 			// update particle positions
-			for(auto& p : active_particles_) {
-				if(max_velocity_ && p.current.velocity*glm::length(p.current.direction) > *max_velocity_) {
-					p.current.direction *= *max_velocity_ / glm::length(p.current.direction);
-				}
-
-				p.current.position += p.current.direction * p.current.velocity * getScaleVelocity() * dt;
-
-				//std::cerr << p << std::endl;
-			}
+			active_particles_.integrate(getScaleVelocity() * dt, max_velocity_.get());
 			//if(active_particles_.size() > 0) {
 			//	std::cerr << active_particles_[0] << std::endl;
 			//}
@@ -398,8 +900,41 @@ namespace KRE
 		void ParticleSystem::handleEmitProcess(float t)
 		{
 			t *= scale_time_;
-			update(t);
-			elapsed_time_ += t;
+
+			sync();
+			debug_draw_ = active_emitter_ && active_emitter_->doDebugDraw();
+			for(const auto& aff : affectors_) {
+				debug_draw_ = debug_draw_ || aff->doDebugDraw();
+			}
+
+			if(!g_async_update) {
+				update(t);
+				elapsed_time_ += t;
+				return;
+			}
+
+			// The step run last frame has finished, so its vertices are what
+			// gets drawn this frame.
+			if(back_vertices_valid_) {
+				ready_vertices_.swap(back_vertices_);
+				ready_vertices_changed_ = true;
+				back_vertices_valid_ = false;
+			}
+
+			const RenderState rs = render_state_;
+			// the translation is what the screen moved since the last step,
+			// so the step consumes it.
+			render_state_.has_translation = false;
+			render_state_.translation = glm::vec3(0.0f);
+
+			job_ = worker_pool::submit([this, t, rs]() {
+				update(t);
+				elapsed_time_ += t;
+				if(rs.valid) {
+					buildVertices(rs, &back_vertices_);
+					back_vertices_valid_ = true;
+				}
+			});
 		}
 
 		ParticleSystemPtr ParticleSystem::factory(std::weak_ptr<ParticleSystemContainer> parent, const variant& node)
@@ -446,109 +981,178 @@ namespace KRE
 		ParticleSystem::TranslationScope::~TranslationScope() {
 		}
 
-		void ParticleSystem::preRender(const WindowPtr& wnd)
+		ParticleSystem::RenderState ParticleSystem::captureRenderState() const
 		{
-			if(active_particles_.size() == 0) {
-				arv_->clear();
-				Renderable::disable();
-				return;
+			RenderState rs;
+			rs.valid = true;
+			rs.position = getPosition();
+			rs.ignore_model_matrix = ignoreGlobalModelMatrix();
+			if(!rs.ignore_model_matrix) {
+				rs.model_translation = glm::vec3(get_global_model_matrix()[3]);
 			}
-			Renderable::enable();
-			//LOG_DEBUG("Technique::preRender, particle count: " << active_particles_.size());
-			std::vector<particle_s> vtc;
-			vtc.reserve(active_particles_.size() * 6);
-
-			const auto tex = getTexture();
-			//if(!tex) {
-			//	return;
-			//}
-			for(auto it = active_particles_.begin(); it != active_particles_.end(); ++it) {
-				auto& p = *it;
+			if(g_particle_system_translation.empty() == false) {
+				rs.has_translation = true;
+				rs.translation = g_particle_system_translation.back();
+			}
+			return rs;
+		}
 
-				const auto rf = p.current.area;//tex->getSourceRectNormalised();
+		void ParticleSystem::buildVertices(const RenderState& rs, std::vector<particle_s>* vtc)
+		{
+			vtc->clear();
+			vtc->reserve(active_particles_.size() * 6);
+
+			float* px = active_particles_.positionX();
+			float* py = active_particles_.positionY();
+			float* pz = active_particles_.positionZ();
+			const float* width = active_particles_.width();
+			const float* height = active_particles_.height();
+			const float* depth = active_particles_.depth();
+			const color_vector* colors = active_particles_.colors();
+			for(size_t n = 0; n != active_particles_.size(); ++n) {
+				auto& p = active_particles_.getState(n);
+				glm::vec3 position(px[n], py[n], pz[n]);
+
+				const auto rf = p.area;//tex->getSourceRectNormalised();
 				const glm::vec2 tl{ rf.x1(), rf.y2() };
 				const glm::vec2 bl{ rf.x1(), rf.y1() };
 				const glm::vec2 tr{ rf.x2(), rf.y2() };
 				const glm::vec2 br{ rf.x2(), rf.y1() };
 
 				if(!p.init_pos) {
-					p.current.position += getPosition();
-					if(!ignoreGlobalModelMatrix() && !useParticleSystemPosition()) {
-						p.current.position += glm::vec3(get_global_model_matrix()[3]); // need global model translation.
+					position += rs.position;
+					if(!rs.ignore_model_matrix && !useParticleSystemPosition()) {
+						position += rs.model_translation; // need global model translation.
 					}
 
 					p.init_pos = true;
-				} else if(!useParticleSystemPosition() && g_particle_system_translation.empty() == false) {
+				} else if(!useParticleSystemPosition() && rs.has_translation) {
 					//This particle doesn't move relative to its object, so
 					//just adjust it according to how much the screen translation
 					//has changed since last frame.'
-					p.current.position += g_particle_system_translation.back();
+					position += rs.translation;
 				}
 
-				auto cp = p.current.position;
+				px[n] = position.x;
+				py[n] = position.y;
+				pz[n] = position.z;
+
+				auto cp = position;
 
 				for(int n = 0; n != 3; ++n) {
 					cp[n] *= getScaleDimensions()[n];
 				}
 
-				if(!ignoreGlobalModelMatrix()) {
+				if(!rs.ignore_model_matrix) {
 					if(useParticleSystemPosition()) {
-						cp += glm::vec3(get_global_model_matrix()[3]); // need global model translation.
+						cp += rs.model_translation; // need global model translation.
 					}
 				}
 
-				const glm::vec3 p1 = cp - p.current.dimensions / 2.0f;
-				const glm::vec3 p2 = cp + p.current.dimensions / 2.0f;
-				const glm::vec4 q{ p.current.orientation.x, p.current.orientation.y, p.current.orientation.z, p.current.orientation.w };
-				vtc.emplace_back(
+				const glm::vec3 dimensions(width[n], height[n], depth[n]);
+				const glm::vec3 p1 = cp - dimensions / 2.0f;
+				const glm::vec3 p2 = cp + dimensions / 2.0f;
+				const glm::vec4 q{ p.orientation.x, p.orientation.y, p.orientation.z, p.orientation.w };
+				vtc->emplace_back(
 					glm::vec3(p1.x, p1.y, p1.z),
 					cp,		// center position
 					q,
 					getScaleDimensions(),		// scale
 					tl,						// tex coord
-					p.current.color);		// color
-				vtc.emplace_back(
+					colors[n]);		// color
+				vtc->emplace_back(
 					glm::vec3(p2.x, p1.y, p1.z),
 					cp,		// center position
 					q,
 					getScaleDimensions(),	// scale
 					tr,						// tex coord
-					p.current.color);		// color
-				vtc.emplace_back(
+					colors[n]);		// color
+				vtc->emplace_back(
 					glm::vec3(p1.x, p2.y, p1.z),
 					cp,		// center position
 					q,
 					getScaleDimensions(),		// scale
 					bl,						// tex coord
-					p.current.color);		// color
+					colors[n]);		// color
 
-				vtc.emplace_back(
+				vtc->emplace_back(
 					glm::vec3(p1.x, p2.y, p1.z),
 					cp,		// center position
 					q,
 					getScaleDimensions(),		// scale
 					bl,						// tex coord
-					p.current.color);		// color
-				vtc.emplace_back(
+					colors[n]);		// color
+				vtc->emplace_back(
 					glm::vec3(p2.x, p2.y, p1.z),
 					cp,		// center position
 					q,
 					getScaleDimensions(),		// scale
 					br,						// tex coord
-					p.current.color);		// color
-				vtc.emplace_back(
+					colors[n]);		// color
+				vtc->emplace_back(
 					glm::vec3(p2.x, p1.y, p1.z),
 					cp,		// center position
 					q,
 					getScaleDimensions(),		// scale
 					tr,						// tex coord
-					p.current.color);		// color
+					colors[n]);		// color
+			}
+		}
+
+		void ParticleSystem::preRender(const WindowPtr& wnd)
+		{
+			if(g_async_update) {
+				// Each draw passes the translation since the previous draw, so
+				// add them up until a step applies them.
+				RenderState rs = captureRenderState();
+				if(render_state_.has_translation) {
+					rs.translation += render_state_.translation;
+					rs.has_translation = true;
+				}
+
+				if(!job_) {
+					// No step is running, e.g. while processing is paused, so
+					// apply the translation here as the synchronous path does.
+					buildVertices(rs, &ready_vertices_);
+					back_vertices_valid_ = false;
+					ready_vertices_changed_ = true;
+					rs.has_translation = false;
+					rs.translation = glm::vec3(0.0f);
+				}
+
+				render_state_ = rs;
+				if(ready_vertices_changed_) {
+					ready_vertices_changed_ = false;
+					if(ready_vertices_.empty()) {
+						arv_->clear();
+						Renderable::disable();
+					} else {
+						Renderable::enable();
+						arv_->update(&ready_vertices_);
+					}
+				}
+				return;
+			}
+
+			sync();
+			if(active_particles_.empty()) {
+				arv_->clear();
+				Renderable::disable();
+				return;
 			}
+			Renderable::enable();
+			//LOG_DEBUG("Technique::preRender, particle count: " << active_particles_.size());
+			std::vector<particle_s> vtc;
+			buildVertices(captureRenderState(), &vtc);
 			arv_->update(&vtc);
 		}
 
 		void ParticleSystem::postRender(const WindowPtr& wnd)
 		{
+			if(!debug_draw_) {
+				return;
+			}
+			sync();
 			if(active_emitter_) {
 				if(active_emitter_->doDebugDraw()) {
 					active_emitter_->draw(wnd);
@@ -735,3 +1339,141 @@ namespace KRE
 		}
 	}
 }
+
+namespace
+{
+	void fill_test_particles(KRE::Particles::ParticlePool* pool, int count)
+	{
+		using namespace KRE::Particles;
+		pool->clear();
+		pool->reserve(count);
+		for(int n = 0; n != count; ++n) {
+			Particle p;
+			init_physics_parameters(p.current);
+			p.current.position = glm::vec3(static_cast<float>(n % 97), static_cast<float>(n % 31), static_cast<float>(n % 7));
+			p.current.direction = glm::vec3(static_cast<float>(n % 5) - 2.0f, static_cast<float>(n % 3) - 1.0f, 0.5f);
+			p.current.velocity = static_cast<float>(n % 50);
+			p.current.mass = 1.0f + static_cast<float>(n % 3);
+			p.current.time_to_live = 1.0f + static_cast<float>(n % 10);
+			p.initial = p.current;
+			p.initial.time_to_live = 11.0f;
+			p.initial.color = color_vector(n % 256, (n * 7) % 256, (n * 13) % 256, 255);
+			pool->push_back(p);
+		}
+	}
+}
+
+UNIT_TEST(particle_pool_kernels)
+{
+	using namespace KRE::Particles;
+	ParticlePool pool;
+	fill_test_particles(&pool, 103);
+
+	std::vector<Particle> expected;
+	for(size_t n = 0; n != pool.size(); ++n) {
+		expected.emplace_back(pool.get(n));
+	}
+
+	const float max_velocity = 40.0f;
+	pool.age(3.5f);
+	pool.integrate(0.1f, &max_velocity);
+	pool.attractTo(glm::vec3(50.0f, 10.0f, 0.0f), 2.0f);
+	pool.removeExpired();
+
+	for(auto& p : expected) {
+		p.current.time_to_live -= 3.5f;
+		if(p.current.velocity*glm::length(p.current.direction) > max_velocity) {
+			p.current.direction *= max_velocity / glm::length(p.current.direction);
+		}
+		p.current.position += p.current.direction * p.current.velocity * 0.1f;
+		const glm::vec3 d = glm::vec3(50.0f, 10.0f, 0.0f) - p.current.position;
+		if(glm::length(d) > 0.0f) {
+			p.current.direction += d * (2.0f * p.current.mass / glm::length(d));
+		}
+	}
+	expected.erase(std::remove_if(expected.begin(), expected.end(), [](const Particle& p) { return p.current.time_to_live <= 0.0f; }), expected.end());
+
+	CHECK_EQ(pool.size(), expected.size());
+	for(size_t n = 0; n != pool.size(); ++n) {
+		const Particle p = pool.get(n);
+		CHECK_LE(glm::length(p.current.position - expected[n].current.position), 0.01f);
+		CHECK_LE(glm::length(p.current.direction - expected[n].current.direction), 0.01f);
+		CHECK(p.initial.color == expected[n].initial.color, "initial color of particle " << n << " changed");
+	}
+
+	std::vector<ParticlePool::color_key> keys;
+	keys.emplace_back(0.0f, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+	keys.emplace_back(1.0f, glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
+	pool.setColorsFromKeys(keys, true, false);
+	for(size_t n = 0; n != pool.size(); ++n) {
+		const Particle p = pool.get(n);
+		const float f = 1.0f - p.current.time_to_live / p.initial.time_to_live;
+		CHECK_LE(std::abs(static_cast<int>(p.current.color.r) - static_cast<int>((1.0f - f) * 255.0f)), 1);
+		CHECK_LE(std::abs(static_cast<int>(p.current.color.b) - static_cast<int>(f * 255.0f)), 1);
+	}
+}
+
+UNIT_TEST(particle_rng_streams)
+{
+	using namespace KRE::Particles;
+	std::default_random_engine a(42), b(42);
+
+	// Drawing from another system's stream in between, or from another
+	// thread, mustn't change what a system sees.
+	std::vector<float> expected;
+	{
+		RngScope scope(&a);
+		for(int n = 0; n != 16; ++n) {
+			expected.push_back(get_random_float());
+		}
+	}
+
+	std::vector<float> results;
+	worker_pool::wait(worker_pool::submit([&b, &results]() {
+		std::default_random_engine other(7);
+		for(int n = 0; n != 16; ++n) {
+			RngScope scope(&b);
+			results.push_back(get_random_float());
+			RngScope other_scope(&other);
+			get_random_float();
+		}
+	}));
+
+	CHECK(results == expected, "seeded particle random streams differ");
+}
+
+// One update of a system with color, force and gravity affectors, without
+// any rendering, reported as particles updated per second.
+BENCHMARK_ARG(particle_update, int nparticles)
+{
+	using namespace KRE::Particles;
+	static ParticlePool pool;
+	fill_test_particles(&pool, nparticles);
+
+	std::vector<ParticlePool::color_key> keys;
+	keys.emplace_back(0.0f, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	keys.emplace_back(0.5f, glm::vec4(1.0f, 0.5f, 0.0f, 0.8f));
+	keys.emplace_back(1.0f, glm::vec4(0.2f, 0.0f, 0.0f, 0.0f));
+
+	const float max_velocity = 200.0f;
+	const float dt = 0.000001f;
+	int updates = 0;
+	profile::timer timer;
+	BENCHMARK_LOOP {
+		pool.age(dt);
+		pool.setColorsFromKeys(keys, true, true);
+		pool.addToDirection(glm::vec3(0.0f, 1.0f, 0.0f), 9.8f * dt);
+		pool.attractTo(glm::vec3(50.0f, 50.0f, 0.0f), 0.5f * dt);
+		pool.integrate(dt, &max_velocity);
+		pool.removeExpired();
+		updates += static_cast<int>(pool.size());
+	}
+
+	const double elapsed_us = timer.get_time();
+	if(elapsed_us > 0.0) {
+		LOG_INFO("particle_update: " << nparticles << " particles, " << static_cast<int64_t>(updates / elapsed_us * 1000000.0) << " particles/second");
+	}
+}
+
+BENCHMARK_ARG_CALL(particle_update, 1k, 1000);
+BENCHMARK_ARG_CALL(particle_update, 50k, 50000);
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <random>
 #include <sstream>
@@ -30,12 +31,14 @@
 #include <glm/vec4.hpp>
 
 #include "asserts.hpp"
+#include "AlignedAllocator.hpp"
 #include "AttributeSet.hpp"
 #include "ParticleSystemFwd.hpp"
 #include "SceneNode.hpp"
 #include "SceneObject.hpp"
 #include "SceneUtil.hpp"
 #include "Texture.hpp"
+#include "worker_pool.hpp"
 
 namespace KRE
 {
@@ -98,6 +101,84 @@ namespace KRE
 			bool init_pos;
 		};
 
+		// The parts of a particle that aren't touched by the bulk update kernels.
+		struct ParticleState
+		{
+			glm::quat orientation;
+			rectf area;
+			PhysicsParameters initial;
+			Emitter* emitted_by;
+			bool init_pos;
+		};
+
+		// Storage for the live particles of a system, laid out as a structure
+		// of arrays. The fields updated every frame (position, direction, speed,
+		// age, mass, size and color) are kept in separate 16-byte aligned arrays
+		// so the kernels below can process four particles at a time; the rest
+		// lives in a ParticleState per particle.
+		class ParticlePool
+		{
+		public:
+			typedef std::vector<float, AlignedStdAllocator<float, 16>> float_array;
+			typedef std::vector<color_vector, AlignedStdAllocator<color_vector, 16>> color_array;
+			typedef std::pair<float,glm::vec4> color_key;
+
+			size_t size() const { return ttl_.size(); }
+			bool empty() const { return ttl_.empty(); }
+			void reserve(size_t n);
+			void clear();
+
+			void push_back(const Particle& p);
+			// Copy a particle out of or back into the pool, for code that
+			// works on one whole particle at a time.
+			Particle get(size_t n) const;
+			void set(size_t n, const Particle& p);
+
+			float* positionX() { return px_.data(); }
+			float* positionY() { return py_.data(); }
+			float* positionZ() { return pz_.data(); }
+			const float* width() const { return width_.data(); }
+			const float* height() const { return height_.data(); }
+			const float* depth() const { return depth_.data(); }
+			const color_vector* colors() const { return color_.data(); }
+			ParticleState& getState(size_t n) { return state_[n]; }
+
+			// time_to_live -= dt
+			void age(float dt);
+			// Clamps speed to max_velocity (if not null) then moves each
+			// particle by direction * velocity * step.
+			void integrate(float step, const float* max_velocity);
+			// Removes particles whose time to live has run out, keeping order.
+			void removeExpired();
+			// out[n] = fraction of its life particle n has used.
+			void getLifeFractions(float* out) const;
+			// direction += v * scale, or v * scales[n].
+			void addToDirection(const glm::vec3& v, float scale);
+			void addToDirection(const glm::vec3& v, const float* scales);
+			// direction += (centre - position) * strength * mass / |centre - position|
+			void attractTo(const glm::vec3& centre, float strength);
+			// Rotates positions about centre, and directions, by q.
+			void rotateAbout(const glm::vec3& centre, const glm::quat& q);
+			// Sets colors from keys sorted by life fraction, as TimeColorAffector
+			// does. If multiply the key colors scale the initial color, otherwise
+			// they replace it.
+			void setColorsFromKeys(const std::vector<color_key>& keys, bool interpolate, bool multiply);
+		private:
+			void move(size_t from, size_t to);
+			void resize(size_t n);
+
+			float_array px_, py_, pz_;
+			float_array dx_, dy_, dz_;
+			float_array velocity_;
+			float_array ttl_;
+			float_array initial_ttl_;
+			float_array mass_;
+			float_array width_, height_, depth_;
+			color_array color_;
+			color_array initial_color_;
+			std::vector<ParticleState> state_;
+		};
+
 		// General class for emitter objects which encapsulate and exposes physical parameters
 		// Used as a base class for everything that is not 
 		class EmitObject : public Particle
@@ -148,17 +229,31 @@ namespace KRE
 
 			explicit ParticleSystem(std::weak_ptr<ParticleSystemContainer> parent, const variant& node);
 			ParticleSystem(const ParticleSystem& ps);
+			~ParticleSystem();
 			void init();
 
+			// Waits for a simulation step running on a worker thread. Must be
+			// called before touching the emitters, affectors or particles from
+			// anywhere other than process/render.
+			void sync();
+
+			void setSeed(unsigned seed);
+
+			// When set, each process() hands the simulation step to a worker
+			// thread and rendering shows the results of the previous step.
+			static void setAsyncUpdate(bool f);
+			// Where systems without a "seed" attribute get their seed from.
+			static void setSeedGenerator(std::function<unsigned()> fn);
+
 			void setTextureNode(const variant& node);
 
 			const EmitterPtr& getEmitter() const { return emitter_; }
 			void setEmitter(const EmitterPtr& e) { emitter_ = e; init(); }
 			const EmitterPtr& getActiveEmitter() const { return active_emitter_; }
 			std::vector<AffectorPtr>& getAffectors() { return affectors_; }
-			std::vector<Particle>& getActiveParticles() { return active_particles_; }
+			ParticlePool& getActiveParticles() { return active_particles_; }
 
-			int getParticleCount() const { return active_particles_.size(); };
+			int getParticleCount() const { return static_cast<int>(active_particles_.size()); };
 			int getParticleQuota() const { return particle_quota_; }
 			glm::vec3 getDefaultDimensions() const { return glm::vec3(default_particle_width_, default_particle_height_, default_particle_depth_); }
 
@@ -198,12 +293,39 @@ namespace KRE
 			std::pair<float,float> getFastForward() const;
 			void setFastForward(const std::pair<float,float>& p);
 		private:
+			// Render time state the vertices are built from, captured on the
+			// main thread so that worker threads don't read it.
+			struct RenderState {
+				RenderState() : valid(false), ignore_model_matrix(false), has_translation(false) {}
+				bool valid;
+				glm::vec3 position;
+				bool ignore_model_matrix;
+				glm::vec3 model_translation;
+				bool has_translation;
+				glm::vec3 translation;
+			};
+
 			virtual void handleEmitProcess(float t) override;
 			void update(float t);
 			void handleWrite(variant_builder* build) const override;
+			RenderState captureRenderState() const;
+			void buildVertices(const RenderState& rs, std::vector<particle_s>* vtc);
 
 			std::shared_ptr<Attribute<particle_s>> arv_;
 
+			std::default_random_engine rng_;
+			std::unique_ptr<unsigned> seed_;
+
+			worker_pool::JobPtr job_;
+			// Written by the running job, then handed to ready_vertices_ by
+			// the next process() and uploaded to arv_ by preRender().
+			std::vector<particle_s> back_vertices_;
+			std::vector<particle_s> ready_vertices_;
+			bool back_vertices_valid_;
+			bool ready_vertices_changed_;
+			RenderState render_state_;
+			bool debug_draw_;
+
 			float elapsed_time_;
 			float scale_velocity_;
 			float scale_time_;
@@ -220,7 +342,7 @@ namespace KRE
 			std::unique_ptr<std::pair<float,float>> fast_forward_;
 
 			// List of particles currently active.
-			std::vector<Particle> active_particles_;
+			ParticlePool active_particles_;
 			EmitterPtr active_emitter_;
 
 			EmitterPtr emitter_;
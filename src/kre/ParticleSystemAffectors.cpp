@@ -171,9 +171,15 @@ namespace KRE
 		{
 			auto& psystem = getParentContainer()->getParticleSystem();
 			internalApply(*psystem->getEmitter(),t);
-			
-			for(auto& p : psystem->getActiveParticles()) {
-				internalApply(p,t);
+			applyToParticles(psystem->getActiveParticles(), t);
+		}
+
+		void Affector::applyToParticles(ParticlePool& particles, float t)
+		{
+			for(size_t n = 0; n != particles.size(); ++n) {
+				Particle p = particles.get(n);
+				internalApply(p, t);
+				particles.set(n, p);
 			}
 		}
 
@@ -388,6 +394,10 @@ namespace KRE
 			}
 		}
 
+		void TimeColorAffector::applyToParticles(ParticlePool& particles, float t)
+		{
+			particles.setColorsFromKeys(tc_data_, interpolate_, operation_ == ColourOperation::COLOR_OP_MULTIPLY);
+		}
 
 		void TimeColorAffector::handleWrite(variant_builder* build) const 
 		{
@@ -493,6 +503,18 @@ namespace KRE
 			p.current.direction = rotation * p.current.direction;
 		}
 
+		void VortexAffector::applyToParticles(ParticlePool& particles, float t)
+		{
+			if(rotation_speed_->getType() == ParameterType::RANDOM) {
+				// needs a fresh speed per particle.
+				Affector::applyToParticles(particles, t);
+				return;
+			}
+			auto& psystem = getParentContainer()->getParticleSystem();
+			float spd = rotation_speed_->getValue(psystem->getElapsedTime());
+			particles.rotateAbout(getPosition(), glm::angleAxis(glm::radians(spd), rotation_axis_));
+		}
+
 		void VortexAffector::handleWrite(variant_builder* build) const 
 		{
 			if(rotation_speed_ && rotation_speed_->getType() != ParameterType::FIXED && rotation_speed_->getValue() != 1.0f) {
@@ -535,6 +557,16 @@ namespace KRE
 			}
 		}
 
+		void GravityAffector::applyToParticles(ParticlePool& particles, float t)
+		{
+			if(gravity_->getType() == ParameterType::RANDOM) {
+				// needs a fresh value per particle.
+				Affector::applyToParticles(particles, t);
+				return;
+			}
+			particles.attractTo(getPosition(), gravity_->getValue(t) * getMass() * t);
+		}
+
 		void GravityAffector::handleWrite(variant_builder* build) const 
 		{
 			if(gravity_ && gravity_->getType() != ParameterType::FIXED && gravity_->getValue() != 1.0f) {
@@ -687,6 +719,20 @@ namespace KRE
 			p.current.direction += direction_*scale;
 		}
 
+		void LinearForceAffector::applyToParticles(ParticlePool& particles, float t)
+		{
+			if(force_->getType() == ParameterType::FIXED) {
+				particles.addToDirection(direction_, t * force_->getValue());
+				return;
+			}
+			scales_.resize(particles.size());
+			particles.getLifeFractions(scales_.data());
+			for(auto& s : scales_) {
+				s = t * force_->getValue(s);
+			}
+			particles.addToDirection(direction_, scales_.data());
+		}
+
 		void LinearForceAffector::handleWrite(variant_builder* build) const 
 		{
 			if(force_) {
@@ -721,23 +767,25 @@ namespace KRE
 		void ParticleFollowerAffector::handleEmitProcess(float t) 
 		{
 			auto& psystem = getParentContainer()->getParticleSystem();
-			std::vector<Particle>& particles = psystem->getActiveParticles();
+			ParticlePool& particles = psystem->getActiveParticles();
 			// keeps particles following wihin [min_distance, max_distance]
-			if(particles.size() < 1) {
+			if(particles.empty()) {
 				return;
 			}
-			prev_particle_ = particles.begin();
-			for(auto p = particles.begin(); p != particles.end(); ++p) {
-				internalApply(*p, t);
+			prev_particle_ = particles.get(0);
+			for(size_t n = 0; n != particles.size(); ++n) {
+				Particle p = particles.get(n);
+				internalApply(p, t);
+				particles.set(n, p);
 				prev_particle_ = p;
 			}
 		}
 
 		void ParticleFollowerAffector::internalApply(Particle& p, float t) 
 		{
-			auto distance = glm::length(p.current.position - prev_particle_->current.position);
+			auto distance = glm::length(p.current.position - prev_particle_.current.position);
 			if(distance > min_distance_ && distance < max_distance_) {
-				p.current.position = prev_particle_->current.position + (min_distance_/distance)*(p.current.position-prev_particle_->current.position);
+				p.current.position = prev_particle_.current.position + (min_distance_/distance)*(p.current.position-prev_particle_.current.position);
 			}
 		}
 
@@ -773,7 +821,7 @@ namespace KRE
 
 		void AlignAffector::internalApply(Particle& p, float t) 
 		{
-			glm::vec3 distance = prev_particle_->current.position - p.current.position;
+			glm::vec3 distance = prev_particle_.current.position - p.current.position;
 			if(resize_) {
 				p.current.dimensions.y = glm::length(distance);
 			}
@@ -788,13 +836,15 @@ namespace KRE
 		void AlignAffector::handleEmitProcess(float t) 
 		{
 			auto& psystem = getParentContainer()->getParticleSystem();
-			std::vector<Particle>& particles = psystem->getActiveParticles();
-			if(particles.size() < 1) {
+			ParticlePool& particles = psystem->getActiveParticles();
+			if(particles.empty()) {
 				return;
 			}
-			prev_particle_ = particles.begin();				
-			for(auto p = particles.begin(); p != particles.end(); ++p) {
-				internalApply(*p, t);
+			prev_particle_ = particles.get(0);
+			for(size_t n = 0; n != particles.size(); ++n) {
+				Particle p = particles.get(n);
+				internalApply(p, t);
+				particles.set(n, p);
 				prev_particle_ = p;
 			}
 		}
@@ -833,20 +883,22 @@ namespace KRE
 		void FlockCenteringAffector::handleEmitProcess(float t) 
 		{
 			auto& psystem = getParentContainer()->getParticleSystem();
-			std::vector<Particle>& particles = psystem->getActiveParticles();
-			if(particles.size() < 1) {
+			ParticlePool& particles = psystem->getActiveParticles();
+			if(particles.empty()) {
 				return;
 			}
 			auto count = particles.size();
 			glm::vec3 sum(0.0f);
-			for(const auto& p : particles) {
-				sum += p.current.position;
+			for(size_t n = 0; n != particles.size(); ++n) {
+				sum += glm::vec3(particles.positionX()[n], particles.positionY()[n], particles.positionZ()[n]);
 			}
 			average_ /= static_cast<float>(count);
 
-			prev_particle_ = particles.begin();				
-			for(auto p = particles.begin(); p != particles.end(); ++p) {
-				internalApply(*p, t);
+			prev_particle_ = particles.get(0);
+			for(size_t n = 0; n != particles.size(); ++n) {
+				Particle p = particles.get(n);
+				internalApply(p, t);
+				particles.set(n, p);
 				prev_particle_ = p;
 			}
 		}
@@ -988,14 +1040,16 @@ namespace KRE
 				return;
 			}
 			auto& psystem = getParentContainer()->getParticleSystem();
-			std::vector<Particle>& particles = psystem->getActiveParticles();
-			if(particles.size() < 1) {
+			ParticlePool& particles = psystem->getActiveParticles();
+			if(particles.empty()) {
 				return;
 			}
 
-			prev_particle_ = particles.begin();				
-			for(auto p = particles.begin(); p != particles.end(); ++p) {
-				internalApply(*p, t);
+			prev_particle_ = particles.get(0);
+			for(size_t n = 0; n != particles.size(); ++n) {
+				Particle p = particles.get(n);
+				internalApply(p, t);
+				particles.set(n, p);
 				prev_particle_ = p;
 			}
 		}
@@ -1058,14 +1112,12 @@ namespace KRE
 			}
 		}
 
-		void RandomiserAffector::handle_apply(std::vector<Particle>& particles, float t)
+		void RandomiserAffector::handle_apply(ParticlePool& particles, float t)
 		{
 			last_update_time_[0] += t;
 			if(last_update_time_[0] > time_step_) {
 				last_update_time_[0] -= time_step_;
-				for(auto& p : particles) {
-					internalApply(p, t);
-				}
+				Affector::applyToParticles(particles, t);
 			}
 		}
 
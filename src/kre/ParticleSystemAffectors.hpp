@@ -75,6 +75,11 @@ namespace KRE
 
 			variant write() const;
 
+			// Applies the affector to every live particle. The default copies
+			// each particle out of the pool and calls internalApply() on it;
+			// affectors with a bulk kernel override this.
+			virtual void applyToParticles(ParticlePool& particles, float t);
+
 			static AffectorPtr factory(std::weak_ptr<ParticleSystemContainer> parent, const variant& node);
 			static AffectorPtr factory(std::weak_ptr<ParticleSystemContainer> parent, AffectorType type);
 		protected:
@@ -118,6 +123,8 @@ namespace KRE
 
 			bool isInterpolated() const { return interpolate_; }
 			void setInterpolate(bool f) { interpolate_ = f; }
+
+			void applyToParticles(ParticlePool& particles, float t) override;
 		private:
 			void internalApply(Particle& p, float t) override;
 			AffectorPtr clone() const override {
@@ -207,6 +214,8 @@ namespace KRE
 
 			virtual bool showMassUI() const override { return true; }
 			virtual bool showPositionUI() const override { return true; }
+
+			void applyToParticles(ParticlePool& particles, float t) override;
 		private:
 			void internalApply(Particle& p, float t) override;
 			AffectorPtr clone() const override {
@@ -228,6 +237,8 @@ namespace KRE
 			const ParameterPtr& getForce() const { return force_; }
 			const glm::vec3& getDirection() const { return direction_; }
 			void setDirection(const glm::vec3& d) { direction_ = d; }
+
+			void applyToParticles(ParticlePool& particles, float t) override;
 		private:
 			void internalApply(Particle& p, float t) override;
 			AffectorPtr clone() const override {
@@ -237,6 +248,8 @@ namespace KRE
 
 			ParameterPtr force_;
 			glm::vec3 direction_;
+			// working variables
+			std::vector<float> scales_;
 			LinearForceAffector() = delete;
 		};
 
@@ -282,6 +295,8 @@ namespace KRE
 			void setRotationAxis(const glm::vec3& axis) { rotation_axis_ = axis; }
 			const ParameterPtr& getRotationSpeed() const { return rotation_speed_; }
 			virtual bool showPositionUI() const override { return true; }
+
+			void applyToParticles(ParticlePool& particles, float t) override;
 		private:
 			void internalApply(Particle& p, float t) override;
 			AffectorPtr clone() const override {
@@ -326,7 +341,7 @@ namespace KRE
 			float min_distance_;
 			float max_distance_;
 			// working variables
-			std::vector<Particle>::iterator prev_particle_;
+			Particle prev_particle_;
 			ParticleFollowerAffector() = delete;
 		};
 
@@ -348,7 +363,7 @@ namespace KRE
 			virtual void handleWrite(variant_builder* build) const override;
 		
 			bool resize_;			
-			std::vector<Particle>::iterator prev_particle_;
+			Particle prev_particle_;
 			AlignAffector() = delete;
 		};
 
@@ -367,7 +382,7 @@ namespace KRE
 			virtual void handleWrite(variant_builder* build) const override;
 		
 			glm::vec3 average_;
-			std::vector<Particle>::iterator prev_particle_;
+			Particle prev_particle_;
 			FlockCenteringAffector() = delete;
 		};
 
@@ -419,7 +434,7 @@ namespace KRE
 			std::vector<glm::vec3> points_;
 			// working variables.
 			std::shared_ptr<geometry::spline3d<float>> spl_;
-			std::vector<Particle>::iterator prev_particle_;
+			Particle prev_particle_;
 			PathFollowerAffector() = delete;
 		};
 
@@ -441,7 +456,7 @@ namespace KRE
 			bool showScaleUI() const override { return true; }
 		private:
 			void internalApply(Particle& p, float t) override;
-			void handle_apply(std::vector<Particle>& particles, float t);
+			void handle_apply(ParticlePool& particles, float t);
 			void handle_apply(const EmitterPtr& objs, float t);
 			virtual void handleProcess(float t);
 			AffectorPtr clone() const override {
@@ -354,10 +354,9 @@ namespace KRE
 		void Emitter::visualEmitProcess(float t)
 		{
 			auto& psystem = getParentContainer()->getParticleSystem();
-			std::vector<Particle>& particles = psystem->getActiveParticles();
-			std::vector<Particle>::iterator start;
+			ParticlePool& particles = psystem->getActiveParticles();
 
-			int cnt = calculateParticlesToEmit(t, particles_remaining_, particles.size());
+			int cnt = calculateParticlesToEmit(t, particles_remaining_, static_cast<int>(particles.size()));
 			if(duration_) {
 				particles_remaining_ -= cnt;
 				if(particles_remaining_ <= 0) {
@@ -367,24 +366,18 @@ namespace KRE
 
 			//LOG_DEBUG(name() << " emits " << cnt << " particles, " << particles_remaining_ << " remain. active_particles=" << particles.size() << ", t=" << getTechnique()->getParticleSystem()->getElapsedTime());
 
-			// XXX: techincally this shouldn't be needed as we reserve the default quota upon initialising
-			// the particle list. We could hit some pathological case where we allocate particles past
-			// the quota (since it isn't enforced yet). This saves us from start from being invalidated
-			// if push_back were to cause a reallocation.
-			auto last_index = particles.size();
-			particles.resize(particles.size() + cnt);
-			//start = particles.end();
-			for(int n = 0; n != cnt; ++n) {
-				Particle p;
+			new_particles_.assign(cnt, Particle());
+			for(auto& p : new_particles_) {
 				initParticle(p, t);
-				particles[n+last_index] = p;
 			}
+			for(auto& p : new_particles_) {
+				internalCreate(p, t);
+			}
+			setParticleStartingValues(new_particles_.begin(), new_particles_.end());
 
-			start = particles.begin() + last_index;
-			for(auto it = start; it != particles.end(); ++it) {
-				internalCreate(*it, t);
+			for(const auto& p : new_particles_) {
+				particles.push_back(p);
 			}
-			setParticleStartingValues(start, particles.end());
 		}
 
 		void Emitter::handleEnable()
@@ -161,6 +161,8 @@ namespace KRE
 			float repeat_delay_remaining_;
 
 			int particles_remaining_;
+			// particles emitted this update, before they're added to the system.
+			std::vector<Particle> new_particles_;
 
 			glm::vec3 scale_;
 
@@ -30,6 +30,7 @@
 #include "BlendModeScope.hpp"
 #include "CameraObject.hpp"
 #include "ColorScope.hpp"
+#include "DisplayDevice.hpp"
 #include "Font.hpp"
 #include "ModelMatrixScope.hpp"
 #include "RenderManager.hpp"
@@ -39,6 +40,7 @@
 #include "SceneNode.hpp"
 #include "WindowManager.hpp"
 
+#include "activation_index.hpp"
 #include "asserts.hpp"
 #include "collision_utils.hpp"
 #include "controls.hpp"
@@ -73,6 +75,7 @@
 #include "thread.hpp"
 #include "tile_map.hpp"
 #include "unit_test.hpp"
+#include "user_collision_grid.hpp"
 #include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
@@ -93,6 +96,9 @@ namespace
 	PREF_INT(debug_skip_draw_zorder_begin, INT_MIN, "Avoid drawing the given zorder");
 	PREF_INT(debug_skip_draw_zorder_end, INT_MIN, "Avoid drawing the given zorder");
 	PREF_BOOL(debug_shadows, false, "Show debug visualization of shadow drawing");
+	PREF_BOOL(incremental_tile_rebuild, true, "When tiles in an area change, only rebuild and upload the tiles in that area");
+	PREF_BOOL(report_tile_rebuild_times, false, "Log how long each rebuild of an area of tiles takes");
+	PREF_BOOL(auto_sprite_batching, true, "Draw consecutive objects that share a texture, shader and blend state in a single draw call");
 
 	LevelPtr& get_current_level() 
 	{
@@ -1369,6 +1375,8 @@ void Level::rebuild_tiles_rect(const rect& r)
 		return;
 	}
 
+	profile::timer timer;
+
 	for(int x = r.x(); x < r.x2(); x += TileSize) {
 		for(int y = r.y(); y < r.y2(); y += TileSize) {
 			tile_pos pos(x/TileSize, y/TileSize);
@@ -1377,23 +1385,52 @@ void Level::rebuild_tiles_rect(const rect& r)
 		}
 	}
 
-	tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), TileInRect(r)), tiles_.end());
+	//the layers which lose or gain tiles are the only ones to redraw.
+	std::set<int> changed_layers;
+	const TileInRect in_rect(r);
+	for(const LevelTile& t : tiles_) {
+		if(in_rect(t)) {
+			changed_layers.insert(t.zorder);
+		}
+	}
+
+	tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), in_rect), tiles_.end());
 
 	std::vector<LevelTile> tiles;
 	for(auto& i : tile_maps_) {
 		i.second.buildTiles(&tiles, &r);
 	}
 
+	const double build_us = timer.get_time();
+
 	for(LevelTile& t : tiles) {
 		add_tile_solid(t);
-		tiles_.push_back(t);
 		layers_.insert(t.zorder);
+		changed_layers.insert(t.zorder);
 	}
 
+	//the new tiles are merged in, so the tiles stay sorted without sorting
+	//all of them again.
+	std::sort(tiles.begin(), tiles.end(), level_tile_zorder_pos_comparer());
+	const auto old_size = tiles_.size();
+	tiles_.insert(tiles_.end(), tiles.begin(), tiles.end());
+	std::inplace_merge(tiles_.begin(), tiles_.begin() + old_size, tiles_.end(), level_tile_zorder_pos_comparer());
+
 	if(std::adjacent_find(tiles_.rbegin(), tiles_.rend(), level_tile_zorder_pos_comparer()) != tiles_.rend()) {
 		std::sort(tiles_.begin(), tiles_.end(), level_tile_zorder_pos_comparer());
 	}
-	prepare_tiles_for_drawing();
+
+	tiles_by_position_.clear();
+
+	const double patch_us = timer.get_time();
+
+	const int nvertices = prepare_tiles_for_drawing(g_incremental_tile_rebuild ? &changed_layers : nullptr);
+
+	if(g_report_tile_rebuild_times) {
+		LOG_INFO("rebuilt tiles in " << r << ": " << tiles.size() << " tiles in " << changed_layers.size() << " layers; "
+			<< "build " << build_us/1000.0 << "ms, patch " << (patch_us - build_us)/1000.0 << "ms, "
+			<< "upload " << nvertices << " vertices " << (timer.get_time() - patch_us)/1000.0 << "ms");
+	}
 }
 
 std::string Level::package() const
@@ -1919,19 +1956,25 @@ void Level::draw_layer_solid(int layer, int x, int y, int w, int h) const
 	}
 }
 
-void Level::prepare_tiles_for_drawing()
+int Level::prepare_tiles_for_drawing(const std::set<int>* layers)
 {
 	auto main_wnd = KRE::WindowManager::getMainWindow();
 	LevelObject::setCurrentPalette(palettes_used_);
 
 	solid_color_rects_.clear();
-	blit_cache_.clear();
+	if(layers == nullptr) {
+		blit_cache_.clear();
+	}
 
 	for(int n = 0; n != tiles_.size(); ++n) {
 		if(!is_arcade_level() && tiles_[n].object->getSolidColor()) {
 			continue;
 		}
 
+		if(layers && layers->count(tiles_[n].zorder) == 0) {
+			continue;
+		}
+
 		//in the editor we want to draw the whole level, so don't exclude
 		//things outside the level bounds. Also if the camera is unconstrained
 //		if(!editor_ && (tiles_[n].x <= boundaries().x() - TileSize || tiles_[n].y <= boundaries().y() - TileSize || tiles_[n].x >= boundaries().x2() || tiles_[n].y >= boundaries().y2())) {
@@ -1958,6 +2001,14 @@ void Level::prepare_tiles_for_drawing()
 	}
 
 	std::map<int, std::pair<std::vector<tile_corner>, std::vector<tile_corner>>> vertices_ot;
+	if(layers) {
+		//layers which no longer have any tiles still need their vertices cleared.
+		for(int layer : *layers) {
+			if(blit_cache_.count(layer)) {
+				vertices_ot[layer];
+			}
+		}
+	}
 
 	for(int n = 0; n != tiles_.size(); ++n) {
 //		if(!editor_ && (tiles_[n].x <= boundaries().x() - TileSize || tiles_[n].y <= boundaries().y() - TileSize || tiles_[n].x >= boundaries().x2() || tiles_[n].y >= boundaries().y2())) {
@@ -1982,10 +2033,14 @@ void Level::prepare_tiles_for_drawing()
 			continue;
 		}
 
-		auto blit_cache_info_ptr = blit_cache_[tiles_[n].zorder];
-
 		tiles_[n].draw_disabled = false;
 
+		if(layers && layers->count(tiles_[n].zorder) == 0) {
+			continue;
+		}
+
+		auto blit_cache_info_ptr = blit_cache_[tiles_[n].zorder];
+
 		const int npoints = LevelObject::calculateTileCorners(tiles_[n].object->isOpaque() ? &vertices_ot[tiles_[n].zorder].first : &vertices_ot[tiles_[n].zorder].second, tiles_[n]);
 		if(npoints > 0) {
 			if(*tiles_[n].object->texture() != *blit_cache_info_ptr->getTexture()) {
@@ -1996,9 +2051,15 @@ void Level::prepare_tiles_for_drawing()
 		}
 	}
 
+	int nvertices = 0;
 	for(auto& v_ot : vertices_ot) {
 		auto blit_cache_info_ptr = blit_cache_[v_ot.first];
-		blit_cache_info_ptr->setVertices(&v_ot.second.first, &v_ot.second.second);
+		if(layers) {
+			nvertices += blit_cache_info_ptr->updateVertices(&v_ot.second.first, &v_ot.second.second);
+		} else {
+			nvertices += static_cast<int>(v_ot.second.first.size() + v_ot.second.second.size());
+			blit_cache_info_ptr->setVertices(&v_ot.second.first, &v_ot.second.second);
+		}
 	}
 
 	for(int n = 1; n < static_cast<int>(solid_color_rects_.size()); ++n) {
@@ -2035,6 +2096,7 @@ void Level::prepare_tiles_for_drawing()
 		}
 	}
 
+	return nvertices;
 }
 
 void Level::draw_status() const
@@ -2084,6 +2146,47 @@ namespace
 		KRE::ModelManager2D model_scope(diffx, diffy);
 		obj.drawLater(x, y);
 	}
+
+	//draws the entities in [i, end) in order, submitting runs of consecutive
+	//objects that are plain frame blits with a compatible texture, shader
+	//and blend state as a single batch.
+	void draw_entities(std::vector<EntityPtr>::const_iterator i, std::vector<EntityPtr>::const_iterator end, int x, int y, bool editor)
+	{
+		if(editor || !g_auto_sprite_batching) {
+			for(; i != end; ++i) {
+				draw_entity(**i, x, y, editor);
+			}
+			return;
+		}
+
+		std::vector<Frame::BatchDrawItem> batch;
+		Frame::BatchDrawItem item;
+		while(i != end) {
+			if(!(*i)->getAutoBatchItem(&item)) {
+				draw_entity(**i, x, y, editor);
+				++i;
+				continue;
+			}
+
+			batch.clear();
+			batch.emplace_back(item);
+			++i;
+
+			while(i != end && (*i)->getAutoBatchItem(&item) && item.frame->canBatchWith(*batch.front().frame)) {
+				batch.emplace_back(item);
+				++i;
+			}
+
+			if(batch.size() == 1) {
+				draw_entity(**(i-1), x, y, editor);
+				continue;
+			}
+
+			CustomObject::drawAutoBatch(&batch[0], &batch[0] + batch.size());
+			formula_profiler::add_counter("SPRITE_BATCHES");
+			formula_profiler::add_counter("BATCHED_SPRITES", batch.size());
+		}
+	}
 }
 
 extern std::vector<rect> background_rects_drawn;
@@ -2113,6 +2216,8 @@ void Level::draw(int x, int y, int w, int h) const
 	}
 	++draw_count;
 
+	const int draw_calls_begin = KRE::DisplayDevice::getDrawCallCount();
+
 	const int start_x = x;
 	const int start_y = y;
 	const int start_w = w;
@@ -2233,11 +2338,14 @@ void Level::draw(int x, int y, int w, int h) const
 
 			CustomObjectDrawZOrderManager draw_manager;
 
-			while(entity_itor != chars.end() && (*entity_itor)->zorder() <= *layer) {
-				draw_entity(**entity_itor, x, y, editor_);
-				++entity_itor;
+			std::vector<EntityPtr>::const_iterator layer_end = entity_itor;
+			while(layer_end != chars.end() && (*layer_end)->zorder() <= *layer) {
+				++layer_end;
 			}
 
+			draw_entities(entity_itor, layer_end, x, y, editor_);
+			entity_itor = layer_end;
+
 			}
 
 			draw_layer(*layer, x, y, w, h);
@@ -2249,18 +2357,20 @@ void Level::draw(int x, int y, int w, int h) const
 			water_drawn = true;
 		}
 
-		int last_zorder = -1000000;
 		while(entity_itor != chars.end()) {
-			if((*entity_itor)->zorder() != last_zorder) {
-				last_zorder = (*entity_itor)->zorder();
-				frameBufferEnterZorder(last_zorder);
-				const bool alpha_test = last_zorder >= begin_alpha_test && last_zorder < end_alpha_test;
-				graphics::set_alpha_test(alpha_test);
-				stencil->updateMask(alpha_test ? 0x02 : 0x0);
+			const int zorder = (*entity_itor)->zorder();
+			frameBufferEnterZorder(zorder);
+			const bool alpha_test = zorder >= begin_alpha_test && zorder < end_alpha_test;
+			graphics::set_alpha_test(alpha_test);
+			stencil->updateMask(alpha_test ? 0x02 : 0x0);
+
+			std::vector<EntityPtr>::const_iterator zorder_end = entity_itor;
+			while(zorder_end != chars.end() && (*zorder_end)->zorder() == zorder) {
+				++zorder_end;
 			}
 
-			draw_entity(**entity_itor, x, y, editor_);
-			++entity_itor;
+			draw_entities(entity_itor, zorder_end, x, y, editor_);
+			entity_itor = zorder_end;
 		}
 
 		graphics::set_alpha_test(false);
@@ -2334,6 +2444,8 @@ void Level::draw(int x, int y, int w, int h) const
 		rr.update(rect(x,y,w,h), KRE::Color(255, 255, 255, 196 + static_cast<int>(std::sin(profile::get_tick_time() / 100.0f) * 8.0f)));
 		wnd->render(&rr);
 	}
+
+	formula_profiler::add_counter("LEVEL_DRAW_CALLS", KRE::DisplayDevice::getDrawCallCount() - draw_calls_begin);
 }
 
 void Level::frameBufferEnterZorder(int zorder) const
@@ -2524,7 +2636,7 @@ void Level::draw_debug_solid(int x, int y, int w, int h) const
 	for(int xpos = 0; xpos < w/TileSize + 4; ++xpos) {
 		for(int ypos = 0; ypos < h/TileSize + 4; ++ypos) {
 			const tile_pos pos(tile_x + xpos, tile_y + ypos);
-			const TileSolidInfo* info = solid_.find(pos);
+			const SurfaceInfo* info = solid_.getTileInfo(pos);
 			if(info == nullptr) {
 				continue;
 			}
@@ -2533,22 +2645,22 @@ void Level::draw_debug_solid(int x, int y, int w, int h) const
 			const int ypixel = (tile_y + ypos)*TileSize;
 
 			RectRenderable rr;
-			if(info->all_solid) {
+			if(solid_.isTileAllSolid(pos)) {
 				rr.update(rect(xpixel, ypixel, TileSize, TileSize),
-					info->info.damage ? KRE::Color(255, 0, 0, 196) : KRE::Color(255, 255, 255, 196));
+					info->damage ? KRE::Color(255, 0, 0, 196) : KRE::Color(255, 255, 255, 196));
 			} else {
 				std::vector<glm::u16vec2> v;
 
 				for(int suby = 0; suby != TileSize; ++suby) {
 					for(int subx = 0; subx != TileSize; ++subx) {
-						if(info->bitmap.test(suby*TileSize + subx)) {
+						if(solid_.isTilePixelSolid(pos, subx, suby)) {
 							v.emplace_back(xpixel + subx + 1, ypixel + suby + 1);
 						}
 					}
 				}
 
 				if(!v.empty()) {
-					rr.update(&v, info->info.damage ? KRE::Color(255, 0, 0, 196) : KRE::Color(255, 255, 255, 196));
+					rr.update(&v, info->damage ? KRE::Color(255, 0, 0, 196) : KRE::Color(255, 255, 255, 196));
 				}
 
 			}
@@ -2714,6 +2826,29 @@ namespace
 	}
 }
 
+namespace
+{
+	//sorts a sequence which is expected to already be close to sorted, such
+	//as last cycle's z-ordering of objects. Falls back to a regular sort if
+	//it turns out to be far from sorted.
+	template<typename Itor, typename Cmp>
+	void sort_nearly_sorted(Itor begin, Itor end, Cmp cmp)
+	{
+		const int MaxMovesPerItem = 4;
+		int moves_left = static_cast<int>(end - begin)*MaxMovesPerItem;
+		for(Itor i = begin; i != end; ++i) {
+			for(Itor j = i; j != begin && cmp(*j, *(j-1)); --j) {
+				if(--moves_left < 0) {
+					std::sort(begin, end, cmp);
+					return;
+				}
+
+				std::iter_swap(j, j-1);
+			}
+		}
+	}
+}
+
 void Level::set_active_chars()
 {
 	int screen_width = graphics::GameScreen::get().getVirtualWidth();
@@ -2728,33 +2863,74 @@ void Level::set_active_chars()
 	const int screen_bottom = last_draw_position().y/100 + screen_height + zoom_buffer;
 
 	const rect screen_area(screen_left, screen_top, screen_right - screen_left, screen_bottom - screen_top);
-	active_chars_.clear();
+
+	if(!activation_index_ || activation_index_->size() != chars_.size()) {
+		activation_index_.reset(new ActivationIndex);
+		for(const EntityPtr& c : chars_) {
+			activation_index_->add(c.get());
+		}
+	}
+
+	//only objects which are awake or whose cells the screen touches need
+	//to be tested, and they come back in the same order as in chars_.
+	activation_index_->getCandidates(screen_area, &activation_candidates_);
+	formula_profiler::add_counter("ACTIVATION_TESTS", activation_candidates_.size());
+
+	std::vector<EntityPtr> active_chars;
 	std::vector<EntityPtr> objects_to_remove;
-	for(EntityPtr& c : chars_) {
+	for(Entity* c : activation_candidates_) {
 		const bool isActive = c->isActive(screen_area) || c->useAbsoluteScreenCoordinates();
+		activation_index_->setActive(c, isActive);
 
 		if(isActive) {
 			if(c->group() >= 0) {
 				assert(c->group() < static_cast<int>(groups_.size()));
 				const entity_group& group = groups_[c->group()];
-				active_chars_.insert(active_chars_.end(), group.begin(), group.end());
+				active_chars.insert(active_chars.end(), group.begin(), group.end());
 			} else {
-				active_chars_.push_back(c);
+				active_chars.push_back(EntityPtr(c));
 			}
 		} else { //char is inactive
 			if(c->diesOnInactive()) {
-				objects_to_remove.push_back(c);
+				objects_to_remove.push_back(EntityPtr(c));
 			}
 		}
 	}
 
+	std::sort(active_chars.begin(), active_chars.end());
+	active_chars.erase(std::unique(active_chars.begin(), active_chars.end()), active_chars.end());
+
+	//keep the objects that were already active in the order they were in,
+	//which will usually still be correct, and merge in the new ones.
+	std::vector<bool> already_active(active_chars.size());
+	std::vector<EntityPtr> result;
+	result.reserve(active_chars.size());
+	for(const EntityPtr& c : active_chars_) {
+		auto i = std::lower_bound(active_chars.begin(), active_chars.end(), c);
+		if(i != active_chars.end() && *i == c && !already_active[i - active_chars.begin()]) {
+			already_active[i - active_chars.begin()] = true;
+			result.push_back(c);
+		}
+	}
+
+	const EntityZOrderCompare cmp;
+	sort_nearly_sorted(result.begin(), result.end(), cmp);
+
+	const auto nkept = result.size();
+	for(int n = 0; n != active_chars.size(); ++n) {
+		if(!already_active[n]) {
+			result.push_back(active_chars[n]);
+		}
+	}
+
+	std::sort(result.begin() + nkept, result.end(), cmp);
+	std::inplace_merge(result.begin(), result.begin() + nkept, result.end(), cmp);
+
+	active_chars_.swap(result);
+
 	for(auto& e : objects_to_remove) {
 		remove_character(e);
 	}
-
-	std::sort(active_chars_.begin(), active_chars_.end());
-	active_chars_.erase(std::unique(active_chars_.begin(), active_chars_.end()), active_chars_.end());
-	std::sort(active_chars_.begin(), active_chars_.end(), zorder_compare);
 }
 
 void Level::do_processing()
@@ -2833,6 +3009,9 @@ void Level::erase_char(EntityPtr c)
 		chars_by_label_.erase(c->label());
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), c), chars_.end());
+	if(activation_index_) {
+		activation_index_->remove(c.get());
+	}
 	if(c->group() >= 0) {
 		assert(c->group() < static_cast<int>(groups_.size()));
 		entity_group& group = groups_[c->group()];
@@ -2844,68 +3023,15 @@ void Level::erase_char(EntityPtr c)
 
 bool Level::isSolid(const LevelSolidMap& map, const Entity& e, const std::vector<point>& points, const SurfaceInfo** surf_info) const
 {
-	const TileSolidInfo* info = nullptr;
-	int prev_x = std::numeric_limits<int>::min(), prev_y = std::numeric_limits<int>::min();
-
 	const Frame& current_frame = e.getCurrentFrame();
-	
-	for(std::vector<point>::const_iterator p = points.begin(); p != points.end(); ++p) {
-		int x, y;
-		if(prev_x != std::numeric_limits<int>::min()) {
-			const int diff_x = (p->x - (p-1)->x) * (e.isFacingRight() ? 1 : -1);
-			const int diff_y = p->y - (p-1)->y;
-
-			x = prev_x + diff_x;
-			y = prev_y + diff_y;
-			
-			if(x < 0 || y < 0 || x >= TileSize || y >= TileSize) {
-				//we need to recalculate the info, since we've stepped into
-				//another tile.
-				prev_x = std::numeric_limits<int>::min();
-			}
-		}
-		
-		if(prev_x == std::numeric_limits<int>::min()) {
-			x = e.x() + (e.isFacingRight() ? p->x : (current_frame.width() - 1 - p->x));
-			y = e.y() + p->y;
-
-			tile_pos pos(x/TileSize, y/TileSize);
-			x = x%TileSize;
-			y = y%TileSize;
-			if(x < 0) {
-				pos.first--;
-				x += TileSize;
-			}
-
-			if(y < 0) {
-				pos.second--;
-				y += TileSize;
-			}
-
-			info = map.find(pos);
-		}
-
-		if(info != nullptr) {
-			if(info->all_solid) {
-				if(surf_info) {
-					*surf_info = &info->info;
-				}
-
-				return true;
-			}
-		
-			const int index = y*TileSize + x;
-			if(info->bitmap.test(index)) {
-				if(surf_info) {
-					*surf_info = &info->info;
-				}
+	const bool facing_right = e.isFacingRight();
 
-				return true;
-			}
+	for(const point& p : points) {
+		const int x = e.x() + (facing_right ? p.x : (current_frame.width() - 1 - p.x));
+		const int y = e.y() + p.y;
+		if(map.isSolid(x, y, surf_info)) {
+			return true;
 		}
-
-		prev_x = x;
-		prev_y = y;
 	}
 
 	return false;
@@ -2913,42 +3039,7 @@ bool Level::isSolid(const LevelSolidMap& map, const Entity& e, const std::vector
 
 bool Level::isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo** surf_info) const
 {
-	tile_pos pos(x/TileSize, y/TileSize);
-	x = x%TileSize;
-	y = y%TileSize;
-	if(x < 0) {
-		pos.first--;
-		x += TileSize;
-	}
-
-	if(y < 0) {
-		pos.second--;
-		y += TileSize;
-	}
-
-	const TileSolidInfo* info = map.find(pos);
-	if(info != nullptr) {
-		if(info->all_solid) {
-			if(surf_info) {
-				*surf_info = &info->info;
-			}
-
-			return true;
-		}
-		
-		const int index = y*TileSize + x;
-		if(info->bitmap.test(index)) {
-			if(surf_info) {
-				*surf_info = &info->info;
-			}
-
-			return true;
-		} else {
-			return false;
-		}
-	}
-
-	return false;
+	return map.isSolid(x, y, surf_info);
 }
 
 bool Level::standable(const rect& r, const SurfaceInfo** info) const
@@ -2958,11 +3049,27 @@ bool Level::standable(const rect& r, const SurfaceInfo** info) const
 	const int xbegin = r.x();
 	const int xend = r.x2();
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(standable(x, y, info)) {
-				return true;
+	for(int y = ybegin; y < yend; ++y) {
+		//take whichever map has the leftmost solid pixel in the row,
+		//preferring solid_ as a per-pixel test would.
+		const SurfaceInfo* solid_info = nullptr;
+		const SurfaceInfo* standable_info = nullptr;
+		const int solid_x = solid_.findSolidInRow(y, xbegin, xend, &solid_info);
+		const int standable_x = standable_.findSolidInRow(y, xbegin, solid_x, &standable_info);
+		if(standable_x < solid_x) {
+			if(info) {
+				*info = standable_info;
 			}
+
+			return true;
+		}
+
+		if(solid_x < xend) {
+			if(info) {
+				*info = solid_info;
+			}
+
+			return true;
 		}
 	}
 
@@ -2998,70 +3105,35 @@ bool Level::solid(const Entity& e, const std::vector<point>& points, const Surfa
 	return isSolid(solid_, e, points, info);
 }
 
-bool Level::solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info) const
+bool Level::solid(const Entity& e, const std::vector<SolidSpan>& spans, const SurfaceInfo** info) const
 {
-	const int xend = xbegin + w;
-	const int yend = ybegin + h;
+	const int width = e.getCurrentFrame().width();
+	const bool facing_right = e.isFacingRight();
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
-			}
+	for(const SolidSpan& span : spans) {
+		const int x1 = e.x() + (facing_right ? span.x1 : width - span.x2);
+		const int x2 = e.x() + (facing_right ? span.x2 : width - span.x1);
+		if(solid_.findSolidInRow(e.y() + span.y, x1, x2, info) != x2) {
+			return true;
 		}
 	}
 
 	return false;
 }
 
-bool Level::solid(const rect& r, const SurfaceInfo** info) const
+bool Level::solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info) const
 {
-	//TODO: consider optimizing this function.
-	const int ybegin = r.y();
-	const int yend = r.y2();
-	const int xbegin = r.x();
-	const int xend = r.x2();
-
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
-			}
-		}
-	}
+	return solid_.isSolidInRect(rect(xbegin, ybegin, w, h), info);
+}
 
-	return false;
+bool Level::solid(const rect& r, const SurfaceInfo** info) const
+{
+	return solid_.isSolidInRect(r, info);
 }
 
 bool Level::may_be_solid_in_rect(const rect& r) const
 {
-	int x = r.x();
-	int y = r.y();
-	tile_pos pos(x/TileSize, y/TileSize);
-	x = x%TileSize;
-	y = y%TileSize;
-	if(x < 0) {
-		pos.first--;
-		x += TileSize;
-	}
-
-	if(y < 0) {
-		pos.second--;
-		y += TileSize;
-	}
-
-	const int x2 = (x + r.w())/TileSize + ((x + r.w())%TileSize ? 1 : 0);
-	const int y2 = (y + r.h())/TileSize + ((y + r.h())%TileSize ? 1 : 0);
-
-	for(int ypos = 0; ypos < y2; ++ypos) {
-		for(int xpos = 0; xpos < x2; ++xpos) {
-			if(solid_.find(tile_pos(pos.first + xpos, pos.second + ypos))) {
-				return true;
-			}
-		}
-	}
-
-	return false;
+	return solid_.hasTilesInRect(r);
 }
 
 void Level::set_solid_area(const rect& r, bool solid)
@@ -3312,8 +3384,7 @@ std::vector<point> Level::get_solid_contiguous_region(int xpos, int ypos) const
 	ypos = round_tile_size(ypos);
 
 	tile_pos base(xpos/TileSize, ypos/TileSize);
-	const TileSolidInfo* info = solid_.find(base);
-	if(info == nullptr || (info->all_solid == false && info->bitmap.any() == false)) {
+	if(!solid_.tileHasSolid(base)) {
 		return result;
 	}
 
@@ -3337,8 +3408,7 @@ std::vector<point> Level::get_solid_contiguous_region(int xpos, int ypos) const
 				continue;
 			}
 
-			const TileSolidInfo* info = solid_.find(pos);
-			if(info == nullptr || (info->all_solid == false && info->bitmap.any() == false)) {
+			if(!solid_.tileHasSolid(pos)) {
 				continue;
 			}
 
@@ -3370,6 +3440,9 @@ void Level::remove_character(EntityPtr e)
 		chars_by_label_.erase(e->label());
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), e), chars_.end());
+	if(activation_index_) {
+		activation_index_->remove(e.get());
+	}
 	solid_chars_.erase(std::remove(solid_chars_.begin(), solid_chars_.end(), e), solid_chars_.end());
 	active_chars_.erase(std::remove(active_chars_.begin(), active_chars_.end(), e), active_chars_.end());
 	new_chars_.erase(std::remove(new_chars_.begin(), new_chars_.end(), e), new_chars_.end());
@@ -3471,19 +3544,19 @@ void Level::add_solid_rect(int x1, int y1, int x2, int y2, int friction, int tra
 	for(int y = y1; y < y2; y += TileSize) {
 		for(int x = x1; x < x2; x += TileSize) {
 			tile_pos pos(x/TileSize, y/TileSize);
-			TileSolidInfo& s = solid_.insertOrFind(pos);
-			s.all_solid = true;
-			s.info.friction = friction;
-			s.info.traction = traction;
+			solid_.setTileAllSolid(pos);
+			SurfaceInfo& s = solid_.insertTile(pos);
+			s.friction = friction;
+			s.traction = traction;
 
-			if(s.info.damage >= 0) {
-				s.info.damage = std::min(s.info.damage, damage);
+			if(s.damage >= 0) {
+				s.damage = std::min(s.damage, damage);
 			} else {
-				s.info.damage = damage;
+				s.damage = damage;
 			}
 
 			if(info_str.empty() == false) {
-				s.info.info = SurfaceInfo::get_info_str(info_str);
+				s.info = SurfaceInfo::get_info_str(info_str);
 			}
 		}
 	}
@@ -3502,41 +3575,31 @@ void Level::add_standable(int x, int y, int friction, int traction, int damage,
 void Level::setSolid(LevelSolidMap& map, int x, int y, int friction, int traction, int damage, const std::string& info_str, bool solid)
 {
 	tile_pos pos(x/TileSize, y/TileSize);
-	x = x%TileSize;
-	y = y%TileSize;
-	if(x < 0) {
+	if(x%TileSize < 0) {
 		pos.first--;
-		x += TileSize;
 	}
 
-	if(y < 0) {
+	if(y%TileSize < 0) {
 		pos.second--;
-		y += TileSize;
 	}
-	const int index = y*TileSize + x;
-	TileSolidInfo& info = map.insertOrFind(pos);
 
-	if(info.info.damage >= 0) {
-		info.info.damage = std::min(info.info.damage, damage);
+	SurfaceInfo& info = map.insertTile(pos);
+
+	if(info.damage >= 0) {
+		info.damage = std::min(info.damage, damage);
 	} else {
-		info.info.damage = damage;
+		info.damage = damage;
 	}
 
 	if(solid) {
-		info.info.friction = friction;
-		info.info.traction = traction;
-		info.bitmap.set(index);
-	} else {
-		if(info.all_solid) {
-			info.all_solid = false;
-			info.bitmap.set();
-		}
-
-		info.bitmap.reset(index);
+		info.friction = friction;
+		info.traction = traction;
 	}
 
+	map.setSolid(x, y, solid);
+
 	if(info_str.empty() == false) {
-		info.info.info = SurfaceInfo::get_info_str(info_str);
+		info.info = SurfaceInfo::get_info_str(info_str);
 	}
 }
 
@@ -3567,6 +3630,7 @@ void Level::add_player(EntityPtr p)
 		}
 
 		chars_.erase(std::remove(chars_.begin(), chars_.end(), players_[nslot]), chars_.end());
+		invalidate_activation_index();
 	}
 
 	if(LevelRunner::getCurrent()) {
@@ -3639,6 +3703,9 @@ void Level::add_character(EntityPtr p)
 		add_player(p);
 	} else {
 		chars_.push_back(p);
+		if(activation_index_) {
+			activation_index_->add(p.get());
+		}
 	}
 
 	p->addToLevel();
@@ -4245,6 +4312,15 @@ Water& Level::get_or_create_water()
 	return *water_;
 }
 
+UserCollisionGrid& Level::user_collision_grid()
+{
+	if(!user_collision_grid_) {
+		user_collision_grid_.reset(new UserCollisionGrid);
+	}
+
+	return *user_collision_grid_;
+}
+
 EntityPtr Level::get_entity_by_label(const std::string& label)
 {
 	std::map<std::string, EntityPtr>::iterator itor = chars_by_label_.find(label);
@@ -4425,6 +4501,7 @@ void Level::restore_from_backup(backup_snapshot& snapshot)
 	rng::set_seed(snapshot.rng_seed);
 	cycle_ = snapshot.cycle;
 	chars_ = snapshot.chars;
+	invalidate_activation_index();
 	players_ = snapshot.players;
 	player_ = snapshot.player;
 	groups_ = snapshot.groups;
@@ -5094,6 +5171,36 @@ BENCHMARK(level_solid)
 	}
 }
 
+BENCHMARK(level_solid_rect)
+{
+	//benchmark for the rect queries used by collision checks.
+	static Level* lvl = new Level("stairway-to-heaven.cfg");
+	BENCHMARK_LOOP {
+		lvl->solid(rect(rng::generate()%1000, rng::generate()%1000, 32, 64));
+	}
+}
+
+//rebuilds every tile in one of our largest levels, which is dominated by
+//matching tile patterns.
+BENCHMARK(level_rebuild_tiles)
+{
+	static Level* lvl = new Level("stairway-to-heaven.cfg");
+	BENCHMARK_LOOP {
+		lvl->rebuildTiles();
+	}
+}
+
+//rebuilds a small area of tiles, as happens when tiles are edited.
+BENCHMARK(level_refresh_tile_rect)
+{
+	static Level* lvl = new Level("stairway-to-heaven.cfg");
+	BENCHMARK_LOOP {
+		const int x = rng::generate()%1000;
+		const int y = rng::generate()%1000;
+		lvl->refresh_tile_rect(x, y, x + 64, y + 64);
+	}
+}
+
 BENCHMARK(load_nene)
 {
 	BENCHMARK_LOOP {
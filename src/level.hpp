@@ -58,6 +58,9 @@
 class Level;
 typedef ffl::IntrusivePtr<Level> LevelPtr;
 
+class ActivationIndex;
+class UserCollisionGrid;
+
 class CurrentLevelScope 
 {
 	LevelPtr old_;
@@ -122,6 +125,7 @@ public:
 	bool standable_tile(int x, int y, const SurfaceInfo** info=nullptr) const;
 	bool solid(int x, int y, const SurfaceInfo** info=nullptr) const;
 	bool solid(const Entity& e, const std::vector<point>& points, const SurfaceInfo** info=nullptr) const;
+	bool solid(const Entity& e, const std::vector<SolidSpan>& spans, const SurfaceInfo** info=nullptr) const;
 	bool solid(const rect& r, const SurfaceInfo** info=nullptr) const;
 	bool solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info=nullptr) const;
 	bool may_be_solid_in_rect(const rect& r) const;
@@ -285,6 +289,9 @@ public:
 
 	Water& get_or_create_water();
 
+	//broad-phase index used to find objects whose collision areas may touch.
+	UserCollisionGrid& user_collision_grid();
+
 	EntityPtr get_entity_by_label(const std::string& label);
 	ConstEntityPtr get_entity_by_label(const std::string& label) const;
 
@@ -293,7 +300,7 @@ public:
 	const std::vector<EntityPtr>& get_active_chars() const { return active_chars_; }
 	const std::vector<EntityPtr>& get_chars() const { return chars_; }
 	const std::vector<EntityPtr>& get_solid_chars() const;
-	void swap_chars(std::vector<EntityPtr>& v) { chars_.swap(v); solid_chars_.clear(); }
+	void swap_chars(std::vector<EntityPtr>& v) { chars_.swap(v); solid_chars_.clear(); invalidate_activation_index(); }
 	int num_active_chars() const { return static_cast<int>(active_chars_.size()); }
 
 	//function which, given the rect of the player's body will return true iff
@@ -452,7 +459,11 @@ private:
 	void read_compiled_tiles(variant node, std::vector<LevelTile>::iterator& out);
 
 	void complete_tiles_refresh();
-	void prepare_tiles_for_drawing();
+
+	//builds the vertices for drawing tiles. If layers is given only those
+	//layers are rebuilt, and only the vertices which changed are uploaded.
+	//Returns the number of vertices uploaded.
+	int prepare_tiles_for_drawing(const std::set<int>* layers=nullptr);
 
 	void do_processing();
 
@@ -549,6 +560,12 @@ private:
 	std::vector<EntityPtr> new_chars_;
 	mutable std::vector<EntityPtr> solid_chars_;
 
+	//spatial index of chars_ used to avoid testing every object for
+	//activity each cycle. Rebuilt when chars_ is changed wholesale.
+	std::shared_ptr<ActivationIndex> activation_index_;
+	std::vector<Entity*> activation_candidates_;
+	void invalidate_activation_index() { activation_index_.reset(); }
+
 	std::vector<EntityPtr> chars_immune_from_time_freeze_;
 
 	std::map<std::string, EntityPtr> chars_by_label_;
@@ -627,6 +644,8 @@ private:
 
 	std::shared_ptr<Water> water_;
 
+	std::shared_ptr<UserCollisionGrid> user_collision_grid_;
+
 	std::shared_ptr<point> lock_screen_;
 
 	struct backup_snapshot {
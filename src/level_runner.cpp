@@ -133,6 +133,19 @@ namespace
 
 	PREF_BOOL(theme_imgui_ui, false, "Displays a dialog to customize the ImGui User Interface.");
 
+	PREF_BOOL(gc_incremental, false, "Collect garbage when changing levels incrementally, spread over several frames, rather than all at once");
+	PREF_INT(gc_frame_budget_us, 1000, "Number of microseconds allowed each frame for incremental garbage collection");
+
+	void collect_level_garbage()
+	{
+		if(g_gc_incremental) {
+			beginIncrementalGarbageCollection();
+		} else {
+			runGarbageCollection();
+			reapGarbageCollection();
+		}
+	}
+
 	LevelRunner* current_level_runner = nullptr;
 
 	class current_level_runner_scope 
@@ -1120,8 +1133,7 @@ bool LevelRunner::play_cycle()
 		last_draw_position() = screen_position();
 
 		//trigger a garbage collection of objects now.
-		runGarbageCollection();
-		reapGarbageCollection();
+		collect_level_garbage();
 	} else if(lvl_->players().size() > 1) {
 		for(const EntityPtr& c : lvl_->players()) {
 			if(c->getHitpoints() <= 0) {
@@ -1288,8 +1300,7 @@ bool LevelRunner::play_cycle()
 			last_draw_position() = screen_position();
 
 			//garbage collect objects from the last level.
-			runGarbageCollection();
-			reapGarbageCollection();
+			collect_level_garbage();
 			CustomObject::run_garbage_collection();
 
 //			if(transition == "flip") {
@@ -1947,6 +1958,10 @@ bool LevelRunner::play_cycle()
 		profiling_summary_ = formula_profiler::get_profile_summary();
 	}
 
+	if(isIncrementalGarbageCollectionInProgress()) {
+		stepIncrementalGarbageCollection(g_gc_frame_budget_us);
+	}
+
 	const int raw_wait_time = desired_end_time - profile::get_tick_time();
 	int wait_time = std::max<int>(1, desired_end_time - profile::get_tick_time());
 
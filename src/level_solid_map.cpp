@@ -22,11 +22,32 @@
 */
 
 
-#include <iostream>
+#include <algorithm>
 #include <set>
 
+#include "asserts.hpp"
 #include "level_solid_map.hpp"
 #include "preferences.hpp"
+#include "random.hpp"
+#include "unit_test.hpp"
+
+struct LevelSolidMap::Chunk
+{
+	Chunk() {
+		std::fill(present, present + ChunkTiles, 0);
+		std::fill(all_solid, all_solid + ChunkTiles, 0);
+		std::fill(info, info + ChunkTiles*ChunkTiles, -1);
+		std::fill(bitmap, bitmap + ChunkTiles*ChunkTiles, -1);
+	}
+
+	//one word per row of tiles, with bit n representing tile column n.
+	uint32_t present[ChunkTiles];
+	uint32_t all_solid[ChunkTiles];
+
+	//indexes into the surface info table and the bitmap pool, or -1.
+	int info[ChunkTiles*ChunkTiles];
+	int bitmap[ChunkTiles*ChunkTiles];
+};
 
 namespace 
 {
@@ -39,6 +60,42 @@ namespace
 			a.info = b.info;
 		}
 	}
+
+	int floor_div(int a, int b)
+	{
+		return a >= 0 ? a/b : -((-a - 1)/b) - 1;
+	}
+
+	//splits a level coordinate into a tile and an offset within it.
+	void split_coord(int v, int size, int* tile, int* sub)
+	{
+		*tile = floor_div(v, size);
+		*sub = v - *tile*size;
+	}
+
+	int lowest_bit(uint64_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_ctzll(v);
+#else
+		int n = 0;
+		while((v&0xFFFFFFFF) == 0) { v >>= 32; n += 32; }
+		while((v&1) == 0) { v >>= 1; ++n; }
+		return n;
+#endif
+	}
+
+	//mask of bits [begin, end) in a word, where 0 <= begin < end <= 64.
+	uint64_t bit_range(int begin, int end)
+	{
+		const uint64_t upper = end == 64 ? ~uint64_t(0) : ((uint64_t(1) << end) - 1);
+		return upper & ~((uint64_t(1) << begin) - 1);
+	}
+
+	uint32_t tile_range(int begin, int end)
+	{
+		return static_cast<uint32_t>(bit_range(begin, end));
+	}
 }
 
 const std::string* SurfaceInfo::get_info_str(const std::string& key)
@@ -48,10 +105,12 @@ const std::string* SurfaceInfo::get_info_str(const std::string& key)
 }
 
 LevelSolidMap::LevelSolidMap()
+	: chunk_x_(0), chunk_y_(0), chunk_w_(0), chunk_h_(0)
 {
 }
 
 LevelSolidMap::LevelSolidMap(const LevelSolidMap& m)
+	: chunk_x_(0), chunk_y_(0), chunk_w_(0), chunk_h_(0)
 {
 }
 
@@ -65,181 +124,545 @@ LevelSolidMap::~LevelSolidMap()
 	clear();
 }
 
-TileSolidInfo& LevelSolidMap::insertOrFind(const tile_pos& pos)
+LevelSolidMap::Chunk* LevelSolidMap::findChunk(int cx, int cy) const
 {
-	TileSolidInfo** result = insertRaw(pos);
-	if(!*result) {
-		*result = new TileSolidInfo;
+	cx -= chunk_x_;
+	cy -= chunk_y_;
+	if(cx < 0 || cy < 0 || cx >= chunk_w_ || cy >= chunk_h_) {
+		return nullptr;
 	}
 
-	return **result;
+	return chunks_[cy*chunk_w_ + cx];
 }
 
-TileSolidInfo** LevelSolidMap::insertRaw(const tile_pos& pos)
+LevelSolidMap::Chunk* LevelSolidMap::getOrCreateChunk(int cx, int cy)
 {
-	row* r = nullptr;
-	if(pos.second >= 0) {
-		if(positive_rows_.size() <= static_cast<unsigned>(pos.second)) {
-			positive_rows_.resize(pos.second + 1);
+	if(chunks_.empty()) {
+		chunk_x_ = cx;
+		chunk_y_ = cy;
+		chunk_w_ = chunk_h_ = 1;
+		chunks_.push_back(nullptr);
+	} else if(cx < chunk_x_ || cy < chunk_y_ || cx >= chunk_x_ + chunk_w_ || cy >= chunk_y_ + chunk_h_) {
+		const int x1 = std::min(cx, chunk_x_);
+		const int y1 = std::min(cy, chunk_y_);
+		const int x2 = std::max(cx + 1, chunk_x_ + chunk_w_);
+		const int y2 = std::max(cy + 1, chunk_y_ + chunk_h_);
+
+		std::vector<Chunk*> chunks((x2 - x1)*(y2 - y1));
+		for(int y = 0; y != chunk_h_; ++y) {
+			for(int x = 0; x != chunk_w_; ++x) {
+				chunks[(y + chunk_y_ - y1)*(x2 - x1) + x + chunk_x_ - x1] = chunks_[y*chunk_w_ + x];
+			}
 		}
 
-		r = &positive_rows_[pos.second];
-	} else {
-		const int index = -(pos.second+1);
-		if(negative_rows_.size() <= static_cast<unsigned>(index)) {
-			negative_rows_.resize(index + 1);
-		}
+		chunks_.swap(chunks);
+		chunk_x_ = x1;
+		chunk_y_ = y1;
+		chunk_w_ = x2 - x1;
+		chunk_h_ = y2 - y1;
+	}
 
-		r = &negative_rows_[index];
+	Chunk*& c = chunks_[(cy - chunk_y_)*chunk_w_ + cx - chunk_x_];
+	if(!c) {
+		c = new Chunk;
 	}
 
-	if(pos.first >= 0) {
-		if(r->positive_cells.size() <= static_cast<unsigned>(pos.first)) {
-			r->positive_cells.resize(pos.first + 1);
-		}
+	return c;
+}
 
-		return &r->positive_cells[pos.first];
-	} else {
-		const int index = -(pos.first+1);
-		if(r->negative_cells.size() <= static_cast<unsigned>(index)) {
-			r->negative_cells.resize(index + 1);
-		}
+int LevelSolidMap::findTile(const tile_pos& pos, const Chunk** chunk) const
+{
+	int cx, cy, lx, ly;
+	split_coord(pos.first, ChunkTiles, &cx, &lx);
+	split_coord(pos.second, ChunkTiles, &cy, &ly);
 
-		return &r->negative_cells[index];
+	const Chunk* c = findChunk(cx, cy);
+	if(c == nullptr || (c->present[ly] & (1u << lx)) == 0) {
+		return -1;
 	}
+
+	*chunk = c;
+	return ly*ChunkTiles + lx;
 }
 
-const TileSolidInfo* LevelSolidMap::find(const tile_pos& pos) const
+int LevelSolidMap::createTile(const tile_pos& pos, Chunk** chunk)
 {
-	const row* r = nullptr;
-	if(pos.second >= 0) {
-		if(static_cast<unsigned>(pos.second) < positive_rows_.size()) {
-			r = &positive_rows_[pos.second];
+	int cx, cy, lx, ly;
+	split_coord(pos.first, ChunkTiles, &cx, &lx);
+	split_coord(pos.second, ChunkTiles, &cy, &ly);
+
+	Chunk* c = getOrCreateChunk(cx, cy);
+	const int index = ly*ChunkTiles + lx;
+	if((c->present[ly] & (1u << lx)) == 0) {
+		c->present[ly] |= 1u << lx;
+		if(free_infos_.empty()) {
+			c->info[index] = static_cast<int>(infos_.size());
+			infos_.push_back(SurfaceInfo());
 		} else {
-			return nullptr;
+			c->info[index] = free_infos_.back();
+			free_infos_.pop_back();
 		}
+	}
+
+	*chunk = c;
+	return index;
+}
+
+int LevelSolidMap::allocBitmap(bool fill)
+{
+	const int nwords = bitmapWords();
+	int index;
+	if(free_bitmaps_.empty()) {
+		index = static_cast<int>(bitmaps_.size()/nwords);
+		bitmaps_.resize(bitmaps_.size() + nwords);
 	} else {
-		const int index = -(pos.second+1);
-		if(static_cast<unsigned>(index) < negative_rows_.size()) {
-			r = &negative_rows_[index];
-		} else {
-			return nullptr;
-		}
+		index = free_bitmaps_.back();
+		free_bitmaps_.pop_back();
 	}
 
-	if(pos.first >= 0) {
-		if(static_cast<unsigned>(pos.first) < r->positive_cells.size()) {
-			return r->positive_cells[pos.first];
-		} else {
-			return nullptr;
+	uint64_t* bitmap = getBitmap(index);
+	std::fill(bitmap, bitmap + nwords, 0);
+	if(fill) {
+		//set only the bits which correspond to pixels, so padding at the
+		//end of each row never reads as solid.
+		const int words = rowWords();
+		for(int y = 0; y != TileSize; ++y) {
+			for(int x = 0; x < TileSize; x += 64) {
+				bitmap[y*words + x/64] = bit_range(0, std::min(64, TileSize - x));
+			}
 		}
-	} else {
-		const int index = -(pos.first+1);
-		if(static_cast<unsigned>(index) < r->negative_cells.size()) {
-			return r->negative_cells[index];
-		} else {
-			return nullptr;
+	}
+
+	return index;
+}
+
+bool LevelSolidMap::hasTile(const tile_pos& pos) const
+{
+	const Chunk* c = nullptr;
+	return findTile(pos, &c) != -1;
+}
+
+bool LevelSolidMap::isTileAllSolid(const tile_pos& pos) const
+{
+	const Chunk* c = nullptr;
+	const int index = findTile(pos, &c);
+	return index != -1 && (c->all_solid[index/ChunkTiles] & (1u << (index%ChunkTiles)));
+}
+
+bool LevelSolidMap::tileHasSolid(const tile_pos& pos) const
+{
+	const Chunk* c = nullptr;
+	const int index = findTile(pos, &c);
+	if(index == -1) {
+		return false;
+	}
+
+	if(c->all_solid[index/ChunkTiles] & (1u << (index%ChunkTiles))) {
+		return true;
+	}
+
+	if(c->bitmap[index] == -1) {
+		return false;
+	}
+
+	const uint64_t* bitmap = getBitmap(c->bitmap[index]);
+	const int nwords = bitmapWords();
+	for(int n = 0; n != nwords; ++n) {
+		if(bitmap[n]) {
+			return true;
 		}
 	}
+
+	return false;
 }
 
-void LevelSolidMap::erase(const tile_pos& pos)
+const SurfaceInfo* LevelSolidMap::getTileInfo(const tile_pos& pos) const
 {
-	TileSolidInfo** info = insertRaw(pos);
-	delete *info;
-	*info = nullptr;
+	const Chunk* c = nullptr;
+	const int index = findTile(pos, &c);
+	return index == -1 ? nullptr : &infos_[c->info[index]];
 }
 
-void LevelSolidMap::clear()
+SurfaceInfo& LevelSolidMap::insertTile(const tile_pos& pos)
+{
+	Chunk* c = nullptr;
+	const int index = createTile(pos, &c);
+	return infos_[c->info[index]];
+}
+
+void LevelSolidMap::setTileAllSolid(const tile_pos& pos)
 {
-	for(row& r : positive_rows_) {
-		for(TileSolidInfo* info : r.positive_cells) {
-			delete info;
+	Chunk* c = nullptr;
+	const int index = createTile(pos, &c);
+	c->all_solid[index/ChunkTiles] |= 1u << (index%ChunkTiles);
+}
+
+bool LevelSolidMap::isSolid(int x, int y, const SurfaceInfo** info) const
+{
+	tile_pos pos;
+	split_coord(x, TileSize, &pos.first, &x);
+	split_coord(y, TileSize, &pos.second, &y);
+
+	const Chunk* c = nullptr;
+	const int index = findTile(pos, &c);
+	if(index == -1) {
+		return false;
+	}
+
+	bool result = (c->all_solid[index/ChunkTiles] & (1u << (index%ChunkTiles))) != 0;
+	if(!result && c->bitmap[index] != -1) {
+		const uint64_t* bitmap = getBitmap(c->bitmap[index]);
+		result = (bitmap[y*rowWords() + x/64] & (uint64_t(1) << (x%64))) != 0;
+	}
+
+	if(result && info) {
+		*info = &infos_[c->info[index]];
+	}
+
+	return result;
+}
+
+void LevelSolidMap::setSolid(int x, int y, bool solid)
+{
+	tile_pos pos;
+	split_coord(x, TileSize, &pos.first, &x);
+	split_coord(y, TileSize, &pos.second, &y);
+
+	Chunk* c = nullptr;
+	const int index = createTile(pos, &c);
+	const uint64_t bit = uint64_t(1) << (x%64);
+	const int word = y*rowWords() + x/64;
+
+	if(solid) {
+		if(c->bitmap[index] == -1) {
+			c->bitmap[index] = allocBitmap(false);
+		}
+
+		getBitmap(c->bitmap[index])[word] |= bit;
+	} else {
+		uint32_t& all_solid = c->all_solid[index/ChunkTiles];
+		const uint32_t tile_bit = 1u << (index%ChunkTiles);
+		if(all_solid & tile_bit) {
+			all_solid &= ~tile_bit;
+			if(c->bitmap[index] != -1) {
+				free_bitmaps_.push_back(c->bitmap[index]);
+			}
+
+			c->bitmap[index] = allocBitmap(true);
 		}
 
-		for(TileSolidInfo* info : r.negative_cells) {
-			delete info;
+		if(c->bitmap[index] != -1) {
+			getBitmap(c->bitmap[index])[word] &= ~bit;
 		}
 	}
+}
+
+bool LevelSolidMap::isTilePixelSolid(const tile_pos& pos, int x, int y) const
+{
+	const Chunk* c = nullptr;
+	const int index = findTile(pos, &c);
+	if(index == -1) {
+		return false;
+	}
+
+	if(c->all_solid[index/ChunkTiles] & (1u << (index%ChunkTiles))) {
+		return true;
+	}
+
+	return c->bitmap[index] != -1 &&
+	       (getBitmap(c->bitmap[index])[y*rowWords() + x/64] & (uint64_t(1) << (x%64))) != 0;
+}
 
-	for(row& r : negative_rows_) {
-		for(TileSolidInfo* info : r.positive_cells) {
-			delete info;
+bool LevelSolidMap::rowHasTiles(int tile_y, int tile_x1, int tile_x2) const
+{
+	int cy, ly;
+	split_coord(tile_y, ChunkTiles, &cy, &ly);
+
+	const int cx1 = floor_div(tile_x1, ChunkTiles);
+	const int cx2 = floor_div(tile_x2, ChunkTiles);
+	for(int cx = cx1; cx <= cx2; ++cx) {
+		const Chunk* c = findChunk(cx, cy);
+		if(c == nullptr) {
+			continue;
 		}
 
-		for(TileSolidInfo* info : r.negative_cells) {
-			delete info;
+		const int begin = std::max(tile_x1 - cx*ChunkTiles, 0);
+		const int end = std::min(tile_x2 - cx*ChunkTiles + 1, static_cast<int>(ChunkTiles));
+		if(c->present[ly] & tile_range(begin, end)) {
+			return true;
 		}
 	}
 
-	positive_rows_.clear();
-	negative_rows_.clear();
+	return false;
 }
 
-void LevelSolidMap::merge(const LevelSolidMap& map, int xoffset, int yoffset)
+int LevelSolidMap::findSolidInTileRow(int tile_y, int suby, int x1, int x2, const SurfaceInfo** info) const
 {
-	for(int n = 0; n != map.negative_rows_.size(); ++n) {
-		for(int m = 0; m != map.negative_rows_[n].negative_cells.size(); ++m) {
-			const tile_pos pos(-m - 1 + xoffset, -n - 1 + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.negative_rows_[n].negative_cells[m];
-			if(!src) {
-				continue;
+	const int tile_size = TileSize;
+	const int words = rowWords();
+	const int tile_x1 = floor_div(x1, tile_size);
+	const int tile_x2 = floor_div(x2 - 1, tile_size);
+
+	int cy, ly;
+	split_coord(tile_y, ChunkTiles, &cy, &ly);
+
+	const int cx1 = floor_div(tile_x1, ChunkTiles);
+	const int cx2 = floor_div(tile_x2, ChunkTiles);
+	for(int cx = cx1; cx <= cx2; ++cx) {
+		const Chunk* c = findChunk(cx, cy);
+		if(c == nullptr) {
+			continue;
+		}
+
+		const int begin = std::max(tile_x1 - cx*ChunkTiles, 0);
+		const int end = std::min(tile_x2 - cx*ChunkTiles + 1, static_cast<int>(ChunkTiles));
+		uint32_t tiles = c->present[ly] & tile_range(begin, end);
+		while(tiles) {
+			const int lx = lowest_bit(tiles);
+			tiles &= tiles - 1;
+
+			const int index = ly*ChunkTiles + lx;
+			const int xpixel = (cx*ChunkTiles + lx)*tile_size;
+			const int lo = std::max(x1, xpixel) - xpixel;
+			const int hi = std::min(x2, xpixel + tile_size) - xpixel;
+
+			int found = -1;
+			if(c->all_solid[ly] & (1u << lx)) {
+				found = lo;
+			} else if(c->bitmap[index] != -1) {
+				const uint64_t* row = getBitmap(c->bitmap[index]) + suby*words;
+				for(int w = lo/64; w <= (hi - 1)/64; ++w) {
+					const uint64_t bits = row[w] & bit_range(std::max(lo - w*64, 0), std::min(hi - w*64, 64));
+					if(bits) {
+						found = w*64 + lowest_bit(bits);
+						break;
+					}
+				}
 			}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
+			if(found != -1) {
+				if(info) {
+					*info = &infos_[c->info[index]];
+				}
+
+				return xpixel + found;
 			}
 		}
+	}
 
-		for(int m = 0; m != map.negative_rows_[n].positive_cells.size(); ++m) {
-			const tile_pos pos(m + xoffset, -n - 1 + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.negative_rows_[n].positive_cells[m];
-			if(!src) {
-				continue;
-			}
+	return x2;
+}
+
+int LevelSolidMap::findSolidInRow(int y, int x1, int x2, const SurfaceInfo** info) const
+{
+	if(x1 >= x2) {
+		return x2;
+	}
+
+	int tile_y, suby;
+	split_coord(y, TileSize, &tile_y, &suby);
+	return findSolidInTileRow(tile_y, suby, x1, x2, info);
+}
+
+bool LevelSolidMap::isSolidInRect(const rect& r, const SurfaceInfo** info) const
+{
+	if(r.w() <= 0 || r.h() <= 0 || chunks_.empty()) {
+		return false;
+	}
+
+	const int tile_size = TileSize;
+	const int tile_x1 = floor_div(r.x(), tile_size);
+	const int tile_x2 = floor_div(r.x2() - 1, tile_size);
+	const int tile_y1 = floor_div(r.y(), tile_size);
+	const int tile_y2 = floor_div(r.y2() - 1, tile_size);
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
+	for(int tile_y = tile_y1; tile_y <= tile_y2; ++tile_y) {
+		if(!rowHasTiles(tile_y, tile_x1, tile_x2)) {
+			continue;
+		}
+
+		const int ybegin = std::max(r.y(), tile_y*tile_size) - tile_y*tile_size;
+		const int yend = std::min(r.y2(), (tile_y + 1)*tile_size) - tile_y*tile_size;
+		for(int suby = ybegin; suby < yend; ++suby) {
+			if(findSolidInTileRow(tile_y, suby, r.x(), r.x2(), info) != r.x2()) {
+				return true;
 			}
 		}
 	}
 
-	for(int n = 0; n != map.positive_rows_.size(); ++n) {
-		for(int m = 0; m != map.positive_rows_[n].negative_cells.size(); ++m) {
-			const tile_pos pos(-m - 1 + xoffset, n + yoffset);
-			TileSolidInfo& dst = insertOrFind(pos);
-			const TileSolidInfo* src = map.positive_rows_[n].negative_cells[m];
-			if(!src) {
+	return false;
+}
+
+bool LevelSolidMap::hasTilesInRect(const rect& r) const
+{
+	if(r.w() <= 0 || r.h() <= 0 || chunks_.empty()) {
+		return false;
+	}
+
+	const int tile_x1 = floor_div(r.x(), TileSize);
+	const int tile_x2 = floor_div(r.x2() - 1, TileSize);
+	const int tile_y1 = floor_div(r.y(), TileSize);
+	const int tile_y2 = floor_div(r.y2() - 1, TileSize);
+	for(int tile_y = tile_y1; tile_y <= tile_y2; ++tile_y) {
+		if(rowHasTiles(tile_y, tile_x1, tile_x2)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void LevelSolidMap::erase(const tile_pos& pos)
+{
+	int cx, cy, lx, ly;
+	split_coord(pos.first, ChunkTiles, &cx, &lx);
+	split_coord(pos.second, ChunkTiles, &cy, &ly);
+
+	Chunk* c = findChunk(cx, cy);
+	if(c == nullptr || (c->present[ly] & (1u << lx)) == 0) {
+		return;
+	}
+
+	const int index = ly*ChunkTiles + lx;
+	c->present[ly] &= ~(1u << lx);
+	c->all_solid[ly] &= ~(1u << lx);
+
+	infos_[c->info[index]] = SurfaceInfo();
+	free_infos_.push_back(c->info[index]);
+	c->info[index] = -1;
+
+	if(c->bitmap[index] != -1) {
+		free_bitmaps_.push_back(c->bitmap[index]);
+		c->bitmap[index] = -1;
+	}
+}
+
+void LevelSolidMap::clear()
+{
+	for(Chunk* c : chunks_) {
+		delete c;
+	}
+
+	chunks_.clear();
+	chunk_x_ = chunk_y_ = chunk_w_ = chunk_h_ = 0;
+
+	infos_.clear();
+	free_infos_.clear();
+	bitmaps_.clear();
+	free_bitmaps_.clear();
+}
+
+void LevelSolidMap::merge(const LevelSolidMap& map, int xoffset, int yoffset)
+{
+	const int nwords = bitmapWords();
+	for(int cy = 0; cy != map.chunk_h_; ++cy) {
+		for(int cx = 0; cx != map.chunk_w_; ++cx) {
+			const Chunk* src = map.chunks_[cy*map.chunk_w_ + cx];
+			if(src == nullptr) {
 				continue;
 			}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
+			for(int ly = 0; ly != ChunkTiles; ++ly) {
+				uint32_t tiles = src->present[ly];
+				while(tiles) {
+					const int lx = lowest_bit(tiles);
+					tiles &= tiles - 1;
+
+					const int src_index = ly*ChunkTiles + lx;
+					const tile_pos pos((map.chunk_x_ + cx)*ChunkTiles + lx + xoffset,
+					                   (map.chunk_y_ + cy)*ChunkTiles + ly + yoffset);
+
+					Chunk* dst = nullptr;
+					const int index = createTile(pos, &dst);
+					uint32_t& all_solid = dst->all_solid[index/ChunkTiles];
+					const uint32_t tile_bit = 1u << (index%ChunkTiles);
+
+					if(src->all_solid[ly] & (1u << lx)) {
+						all_solid |= tile_bit;
+					}
+
+					merge_SurfaceInfo(infos_[dst->info[index]], map.infos_[src->info[src_index]]);
+					if((all_solid & tile_bit) == 0 && src->bitmap[src_index] != -1) {
+						if(dst->bitmap[index] == -1) {
+							dst->bitmap[index] = allocBitmap(false);
+						}
+
+						uint64_t* dst_bitmap = getBitmap(dst->bitmap[index]);
+						const uint64_t* src_bitmap = map.getBitmap(src->bitmap[src_index]);
+						for(int n = 0; n != nwords; ++n) {
+							dst_bitmap[n] |= src_bitmap[n];
+						}
+					}
+				}
 			}
 		}
+	}
+}
 
-		for(int m = 0; m != map.positive_rows_[n].positive_cells.size(); ++m) {
-			const tile_pos pos(m + xoffset, n + yoffset);
-			const TileSolidInfo* src = map.positive_rows_[n].positive_cells[m];
-			if(!src) {
-				continue;
-			}
+UNIT_TEST(level_solid_map)
+{
+	//compare the map against a plain set of solid pixels, covering
+	//negative coordinates and more than one chunk.
+	const int tile_size = TileSize;
+	const rect area(-tile_size*40, -tile_size*3, tile_size*80, tile_size*6);
+
+	LevelSolidMap map;
+	std::set<std::pair<int,int> > pixels;
+
+	map.setTileAllSolid(tile_pos(-35, 1));
+	for(int y = 0; y != tile_size; ++y) {
+		for(int x = 0; x != tile_size; ++x) {
+			pixels.insert(std::make_pair(-35*tile_size + x, tile_size + y));
+		}
+	}
 
-			TileSolidInfo& dst = insertOrFind(pos);
+	for(int n = 0; n != 2000; ++n) {
+		const int x = area.x() + rng::generate()%area.w();
+		const int y = area.y() + rng::generate()%area.h();
+		const bool solid = rng::generate()%4 != 0;
+		map.setSolid(x, y, solid);
+		if(solid) {
+			pixels.insert(std::make_pair(x, y));
+		} else {
+			pixels.erase(std::make_pair(x, y));
+		}
+	}
 
-			dst.all_solid = dst.all_solid || src->all_solid;
-			merge_SurfaceInfo(dst.info, src->info);
-			if(!dst.all_solid) {
-				dst.bitmap = dst.bitmap | src->bitmap;
+	for(const std::pair<int,int>& p : pixels) {
+		CHECK(map.isSolid(p.first, p.second), "pixel should be solid");
+	}
+
+	for(int n = 0; n != 500; ++n) {
+		const rect r(area.x() + rng::generate()%area.w(), area.y() + rng::generate()%area.h(),
+		             1 + rng::generate()%(tile_size*3), 1 + rng::generate()%(tile_size*3));
+
+		bool expected = false;
+		int expected_x = 0, expected_y = 0;
+		for(int y = r.y(); y < r.y2() && !expected; ++y) {
+			for(int x = r.x(); x < r.x2(); ++x) {
+				if(pixels.count(std::make_pair(x, y))) {
+					expected = true;
+					expected_x = x;
+					expected_y = y;
+					break;
+				}
 			}
 		}
+
+		CHECK_EQ(map.isSolidInRect(r), expected);
+		if(expected) {
+			CHECK_EQ(map.findSolidInRow(expected_y, r.x(), r.x2()), expected_x);
+		}
+	}
+
+	LevelSolidMap merged;
+	merged.merge(map, 3, -2);
+	for(const std::pair<int,int>& p : pixels) {
+		CHECK(merged.isSolid(p.first + 3*tile_size, p.second - 2*tile_size), "merged pixel should be solid");
 	}
+
+	map.erase(tile_pos(-35, 1));
+	CHECK(map.hasTile(tile_pos(-35, 1)) == false, "erased tile still present");
+	map.clear();
+	CHECK(map.isSolidInRect(area) == false, "cleared map has solid pixels");
 }
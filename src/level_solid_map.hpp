@@ -23,10 +23,13 @@
 
 #pragma once
 
-#include <boost/dynamic_bitset.hpp>
-#include <map>
+#include <cstdint>
+#include <deque>
+#include <string>
 #include <vector>
 
+#include "geometry.hpp"
+
 #ifndef MAX_TILE_SIZE
 #define MAX_TILE_SIZE 64
 #endif
@@ -37,7 +40,6 @@ extern int g_tile_size;
 #define TileSize (g_tile_size*g_tile_scale)
 
 typedef std::pair<int,int> tile_pos;
-typedef boost::dynamic_bitset<> tile_bitmap;
 
 struct SurfaceInfo 
 {
@@ -48,35 +50,84 @@ struct SurfaceInfo
 	static const std::string* get_info_str(const std::string& key);
 };
 
-struct TileSolidInfo 
-{
-	TileSolidInfo() : bitmap(TileSize*TileSize), all_solid(false)
-	{}
-	tile_bitmap bitmap;
-	SurfaceInfo info;
-	bool all_solid;
-};
-
+//Map of which pixels in a level are solid. Tiles are grouped into square
+//chunks held in a dense grid, so a lookup is a couple of divisions and
+//array indexes. Each chunk keeps one bitmask word per tile row recording
+//which tiles exist and which are entirely solid, so most queries never
+//touch the per-pixel bitmaps. Pixel bitmaps are stored in a shared pool
+//with each pixel row padded to whole 64-bit words, letting span queries
+//test a word at a time.
 class LevelSolidMap 
 {
 public:
+	enum { ChunkTiles = 32 };
+
 	LevelSolidMap();
 	LevelSolidMap(const LevelSolidMap& m);
 	LevelSolidMap& operator=(const LevelSolidMap& m);
 	~LevelSolidMap();
-	TileSolidInfo& insertOrFind(const tile_pos& pos);
-	const TileSolidInfo* find(const tile_pos& pos) const;
+
+	bool hasTile(const tile_pos& pos) const;
+	bool isTileAllSolid(const tile_pos& pos) const;
+
+	//true if the tile exists and has at least one solid pixel.
+	bool tileHasSolid(const tile_pos& pos) const;
+
+	const SurfaceInfo* getTileInfo(const tile_pos& pos) const;
+
+	//finds the tile, creating an empty one if it doesn't exist.
+	SurfaceInfo& insertTile(const tile_pos& pos);
+	void setTileAllSolid(const tile_pos& pos);
+
+	//tests or sets a single pixel, in level coordinates. setSolid creates
+	//the tile if necessary.
+	bool isSolid(int x, int y, const SurfaceInfo** info=nullptr) const;
+	void setSolid(int x, int y, bool solid);
+
+	//tests pixel (x, y) of a tile, with x and y relative to the tile.
+	bool isTilePixelSolid(const tile_pos& pos, int x, int y) const;
+
+	//finds the first solid pixel in row y in the range [x1, x2). Returns
+	//x2 if there isn't one.
+	int findSolidInRow(int y, int x1, int x2, const SurfaceInfo** info=nullptr) const;
+
+	//true if any pixel in the rect is solid. info is set from the first
+	//solid pixel in row-major order.
+	bool isSolidInRect(const rect& r, const SurfaceInfo** info=nullptr) const;
+
+	//true if any tile exists overlapping the rect, solid or not.
+	bool hasTilesInRect(const rect& r) const;
+
 	void erase(const tile_pos& pos);
 	void clear();
 
 	void merge(const LevelSolidMap& m, int xoffset, int yoffset);
 private:
+	struct Chunk;
+
+	Chunk* findChunk(int cx, int cy) const;
+	Chunk* getOrCreateChunk(int cx, int cy);
+	int findTile(const tile_pos& pos, const Chunk** chunk) const;
+	int createTile(const tile_pos& pos, Chunk** chunk);
+
+	uint64_t* getBitmap(int index) { return &bitmaps_[index*bitmapWords()]; }
+	const uint64_t* getBitmap(int index) const { return &bitmaps_[index*bitmapWords()]; }
+	int allocBitmap(bool fill);
+	int bitmapWords() const { return TileSize*rowWords(); }
+	int rowWords() const { return (TileSize + 63)/64; }
+
+	bool rowHasTiles(int tile_y, int tile_x1, int tile_x2) const;
+	int findSolidInTileRow(int tile_y, int suby, int x1, int x2, const SurfaceInfo** info) const;
 
-	TileSolidInfo** insertRaw(const tile_pos& pos);
+	//dense grid of chunks, chunk_w_ x chunk_h_ starting at chunk
+	//(chunk_x_, chunk_y_).
+	std::vector<Chunk*> chunks_;
+	int chunk_x_, chunk_y_, chunk_w_, chunk_h_;
 
-	struct row {
-		std::vector<TileSolidInfo*> positive_cells, negative_cells;
-	};
+	//surface info for each tile. A deque so pointers handed out stay valid.
+	std::deque<SurfaceInfo> infos_;
+	std::vector<int> free_infos_;
 
-	std::vector<row> positive_rows_, negative_rows_;
+	std::vector<uint64_t> bitmaps_;
+	std::vector<int> free_bitmaps_;
 };
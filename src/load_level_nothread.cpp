@@ -22,6 +22,7 @@
 */
 
 #include "asserts.hpp"
+#include "binary_cache.hpp"
 #include "filesystem.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
@@ -85,7 +86,21 @@ variant load_level_wml_nowait(const std::string& lvl)
 			preferences::set_save_slot(lvl);
 			return json::parse_from_file(preferences::save_file_path());
 		}
-		return json::parse_from_file(get_level_path(lvl));
+
+		const std::string cache_key = "level-" + module::get_module_name() + "-" + lvl;
+		if(binary_cache::enabled()) {
+			variant node = binary_cache::load(cache_key);
+			if(node.is_null() == false) {
+				return node;
+			}
+		}
+
+		binary_cache::DependencyScope deps;
+		variant node = json::parse_from_file(get_level_path(lvl));
+		if(binary_cache::enabled()) {
+			binary_cache::store(cache_key, node, deps.dependencies());
+		}
+		return node;
 	} catch(json::ParseError& e) {
 		ASSERT_LOG(false, e.errorMessage());
 	}
@@ -53,6 +53,7 @@
 #include "controls.hpp"
 #include "custom_object.hpp"
 #include "custom_object_functions.hpp"
+#include "custom_object_type.hpp"
 #include "draw_scene.hpp"
 #include "editor.hpp"
 #include "difficulty.hpp"
@@ -1148,6 +1149,8 @@ int main(int argcount, char* argvec[])
 
 		game_logic::FormulaObject::loadAllClasses();
 
+		CustomObjectType::preloadAll();
+
 	} catch(const json::ParseError& e) {
 		LOG_ERROR("ERROR PARSING: " << e.errorMessage());
 		return 0;
@@ -22,11 +22,13 @@
 */
 
 #include <deque>
+#include <set>
 
 #include <boost/filesystem/operations.hpp>
 
 #include "asserts.hpp"
 #include "base64.hpp"
+#include "chunking.hpp"
 #include "compress.hpp"
 #include "custom_object_type.hpp"
 #include "i18n.hpp"
@@ -639,6 +641,45 @@ namespace module
 
 		return true;
 	}
+
+	//version 2 added files sent as content-defined chunks.
+	static const int ModuleProtocolVersion = 2;
+	}
+
+	std::string encode_chunk_data(const std::string& contents)
+	{
+		std::vector<char> data(contents.begin(), contents.end());
+		data = base64::b64encode(zip::compress(data));
+		return std::string(data.begin(), data.end());
+	}
+
+	std::string decode_chunk_data(const std::string& data, int size)
+	{
+		std::vector<char> data_buf(data.begin(), data.end());
+		std::vector<char> contents = zip::decompress_known_size(base64::b64decode(data_buf), size);
+		return std::string(contents.begin(), contents.end());
+	}
+
+	namespace {
+	//puts the whole contents back into the files of a manifest which were
+	//split into chunks, for servers which don't understand chunks.
+	void unchunk_manifest(variant manifest)
+	{
+		static const variant ChunksVariant("chunks");
+		for(auto p : manifest.as_map()) {
+			if(p.second[ChunksVariant].is_list() == false) {
+				continue;
+			}
+
+			std::string contents;
+			for(variant chunk : p.second[ChunksVariant].as_list()) {
+				contents += decode_chunk_data(chunk["data"].as_string(), chunk["size"].as_int());
+			}
+
+			p.second.remove_attr_mutation(ChunksVariant);
+			p.second.add_attr_mutation(variant("data"), variant(encode_chunk_data(contents)));
+		}
+	}
 	}
 
 	variant build_package(const std::string& id, bool increment_version, variant version_override, std::string path)
@@ -700,14 +741,24 @@ namespace module
 
 			manifest_file[variant(fname)] = variant(&attr_copy);
 
-			std::vector<char> data(contents.begin(), contents.end());
-
-			data = base64::b64encode(zip::compress(data));
-
-			const std::string data_str(data.begin(), data.end());
-
+			//larger files are sent in content-defined chunks, so a new
+			//version only needs the chunks which changed.
+			const std::vector<chunking::Chunk> chunks = chunking::split(contents);
+			if(chunks.size() > 1) {
+				std::vector<variant> chunk_list;
+				for(const chunking::Chunk& chunk : chunks) {
+					const std::string chunk_contents(contents, chunk.offset, chunk.size);
+					std::map<variant, variant> chunk_attr;
+					chunk_attr[variant("md5")] = variant(md5::sum(chunk_contents));
+					chunk_attr[variant("size")] = variant(static_cast<int>(chunk.size));
+					chunk_attr[variant("data")] = variant(encode_chunk_data(chunk_contents));
+					chunk_list.push_back(variant(&chunk_attr));
+				}
 
-			attr[variant("data")] = variant(data_str);
+				attr[variant("chunks")] = variant(&chunk_list);
+			} else {
+				attr[variant("data")] = variant(encode_chunk_data(contents));
+			}
 
 			file_attr[variant(fname)] = variant(&attr);
 		}
@@ -817,11 +868,66 @@ COMMAND_LINE_UTILITY(generate_manifest)
 
 	for(auto p : manifest.as_map()) {
 		p.second.remove_attr_mutation(variant("data"));
+		if(p.second["chunks"].is_list()) {
+			for(variant chunk : p.second["chunks"].as_list()) {
+				chunk.remove_attr_mutation(variant("data"));
+			}
+		}
 	}
 
 	std::cout << manifest.write_json();
 }
 
+//Reports how much an update between two local copies of a module would
+//transfer, in chunks and as whole files, without needing a server.
+COMMAND_LINE_UTILITY(module_update_size)
+{
+	ASSERT_LOG(args.size() == 3, "Expected arguments: module_name old_path new_path");
+
+	variant old_manifest = build_package(args[0], false, variant(), args[1])["manifest"];
+	variant new_manifest = build_package(args[0], false, variant(), args[2])["manifest"];
+
+	int nfiles = 0, whole_bytes = 0, chunked_bytes = 0;
+	std::set<variant> chunks_sent;
+	for(auto p : new_manifest.as_map()) {
+		variant old_info = old_manifest.has_key(p.first) ? old_manifest[p.first] : variant();
+		if(old_info.is_map() && old_info["md5"] == p.second["md5"]) {
+			continue;
+		}
+
+		++nfiles;
+
+		if(p.second["chunks"].is_list() == false) {
+			whole_bytes += static_cast<int>(p.second["data"].as_string().size());
+			chunked_bytes += static_cast<int>(p.second["data"].as_string().size());
+			continue;
+		}
+
+		//the client reuses the chunks of its copy of the same file.
+		std::set<variant> old_chunks;
+		if(old_info.is_map() && old_info["chunks"].is_list()) {
+			for(variant chunk : old_info["chunks"].as_list()) {
+				old_chunks.insert(chunk["md5"]);
+			}
+		}
+
+		int file_bytes = 0;
+		for(variant chunk : p.second["chunks"].as_list()) {
+			whole_bytes += static_cast<int>(chunk["data"].as_string().size());
+			if(old_chunks.count(chunk["md5"]) || chunks_sent.insert(chunk["md5"]).second == false) {
+				continue;
+			}
+
+			file_bytes += static_cast<int>(chunk["data"].as_string().size());
+		}
+
+		chunked_bytes += file_bytes;
+		std::cout << p.first.as_string() << ": " << file_bytes << " bytes in chunks\n";
+	}
+
+	std::cout << nfiles << " files changed: " << whole_bytes << " bytes as whole files, " << chunked_bytes << " bytes with chunking\n";
+}
+
 	COMMAND_LINE_UTILITY(replicate_module)
 	{
 		std::string server = g_module_server;
@@ -1004,6 +1110,12 @@ COMMAND_LINE_UTILITY(generate_manifest)
 
 			attr[variant("lock_id")] = response_doc["lock_id"];
 
+			variant server_version = response_doc["protocol_version"];
+			if(server_version.is_int() == false || server_version.as_int() < ModuleProtocolVersion) {
+				LOG_INFO("Server does not take chunked files, uploading whole files");
+				unchunk_manifest(package["manifest"]);
+			}
+
 
 			if(response_doc.has_key("manifest")) {
 				variant their_manifest = response_doc["manifest"];
@@ -1037,6 +1149,30 @@ COMMAND_LINE_UTILITY(generate_manifest)
 					our_manifest.remove_attr_mutation(key);
 				}
 
+				//chunks the server already has are sent without their data.
+				std::set<variant> their_chunks;
+				for(auto p : their_manifest.as_map()) {
+					if(p.second["chunks"].is_list()) {
+						for(variant chunk : p.second["chunks"].as_list()) {
+							their_chunks.insert(chunk["md5"]);
+						}
+					}
+				}
+
+				int chunks_skipped = 0;
+				for(auto p : our_manifest.as_map()) {
+					if(p.second["chunks"].is_list()) {
+						for(variant chunk : p.second["chunks"].as_list()) {
+							if(their_chunks.count(chunk["md5"])) {
+								chunk.remove_attr_mutation(variant("data"));
+								++chunks_skipped;
+							}
+						}
+					}
+				}
+
+				LOG_INFO("Server already has " << chunks_skipped << " chunks, not uploading them");
+
 			}
 
 		}
@@ -1140,8 +1276,6 @@ const char* InstallImagePath = "../../";
 #else
 const char* InstallImagePath = ".";
 #endif
-
-static const int ModuleProtocolVersion = 1;
 }
 
 	bool client::install_module(const std::string& module_id, bool force)
@@ -1478,6 +1612,28 @@ static const int ModuleProtocolVersion = 1;
 		operation_ = OPERATION_NONE;
 	}
 
+	namespace
+	{
+		//reads a file or chunk from the update cache, removing the entry if
+		//it doesn't have the expected contents.
+		bool read_update_cache(const std::string& md5sum, int size, std::string* contents)
+		{
+			const std::string cached_fname = "update-cache/" + md5sum;
+			if(!sys::file_exists(cached_fname)) {
+				return false;
+			}
+
+			*contents = decode_chunk_data(sys::read_file(cached_fname), size);
+			if(md5::sum(*contents) != md5sum) {
+				LOG_INFO("ERROR: CACHE INVALID FOR " << md5sum);
+				sys::remove_file(cached_fname);
+				return false;
+			}
+
+			return true;
+		}
+	}
+
 	void client::perform_install(const variant& doc_ref)
 	{
 		variant doc = doc_ref;
@@ -1501,8 +1657,8 @@ static const int ModuleProtocolVersion = 1;
 
 		int last_progress_update = SDL_GetTicks();
 
-		int nfound_in_cache = 0;
-
+		int nfound_in_cache = 0, nchunks_in_cache = 0, nchunks_reused = 0;
+		std::set<std::string> chunks_seen;
 
 		int ncount = 0;
 		for(auto p : manifest.as_map()) {
@@ -1518,26 +1674,60 @@ static const int ModuleProtocolVersion = 1;
 				continue;
 			}
 
-			bool cached = false;
+			if(p.second["data"].is_null() && p.second["chunks"].is_list()) {
+				//only fetch the chunks that neither the update cache nor the
+				//version of the file we have already hold.
+				const bool high_priority = isHighPriorityChunk(p.first, p.second);
 
-			std::string cached_fname = "update-cache/" + p.second["md5"].as_string();
-			if(p.second["data"].is_null() && sys::file_exists(cached_fname)) {
-				std::string contents = sys::read_file(cached_fname);
-				std::vector<char> data_buf(contents.begin(), contents.end());
-				const int data_size = p.second["size"].as_int();
+				std::string local_contents;
+				std::map<std::string, chunking::Chunk> local_chunks;
+				const std::string local_path = module_path() + "/" + p.first.as_string();
+				if(!force_install_ && sys::file_exists(local_path)) {
+					local_contents = sys::read_file(local_path);
+					for(const chunking::Chunk& chunk : chunking::split(local_contents)) {
+						local_chunks[md5::sum(local_contents.substr(chunk.offset, chunk.size))] = chunk;
+					}
+				}
 
-				std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), data_size);
-				std::string data_str(data.begin(), data.end());
+				for(variant chunk : p.second["chunks"].as_list()) {
+					const std::string chunk_id = chunk[md5_variant].as_string();
+					if(chunks_seen.insert(chunk_id).second == false) {
+						continue;
+					}
 
-				if(variant(md5::sum(data_str)) == p.second["md5"]) {
-					LOG_INFO("Cached data found for " << p.second["md5"].as_string());
-					cached = true;
-					++nfound_in_cache;
-				} else {
-					LOG_INFO("ERROR: CACHE INVALID FOR " << p.second["md5"].as_string());
-					sys::remove_file(cached_fname);
+					std::string chunk_contents;
+					if(read_update_cache(chunk_id, chunk["size"].as_int(), &chunk_contents)) {
+						++nchunks_in_cache;
+						continue;
+					}
+
+					//the file may be overwritten before this chunk is used,
+					//so it's copied into the cache.
+					auto local_itor = local_chunks.find(chunk_id);
+					if(local_itor != local_chunks.end()) {
+						sys::write_file("update-cache/" + chunk_id, encode_chunk_data(local_contents.substr(local_itor->second.offset, local_itor->second.size)));
+						++nchunks_reused;
+						continue;
+					}
+
+					nbytes_total_ += chunk["size"].as_int();
+					if(high_priority) {
+						high_priority_chunks.push_back(chunk);
+					} else {
+						chunks_to_get_.push_back(chunk);
+					}
 				}
 
+				continue;
+			}
+
+			bool cached = false;
+
+			std::string data_str;
+			if(p.second["data"].is_null() && read_update_cache(p.second["md5"].as_string(), p.second["size"].as_int(), &data_str)) {
+				LOG_INFO("Cached data found for " << p.second["md5"].as_string());
+				cached = true;
+				++nfound_in_cache;
 			}
 			
 			if(cached || p.second["data"].is_null() == false) {
@@ -1554,7 +1744,7 @@ static const int ModuleProtocolVersion = 1;
 			}
 		}
 
-		LOG_INFO("Found " << nfound_in_cache << " files in cache");
+		LOG_INFO("Found " << nfound_in_cache << " files and " << nchunks_in_cache << " chunks in cache, reused " << nchunks_reused << " chunks of existing files");
 
 		for(auto v : high_priority_chunks) {
 			chunks_to_get_.push_back(v);
@@ -1687,8 +1877,15 @@ static const int ModuleProtocolVersion = 1;
 				}
 			}
 
-			std::vector<char> data_buf;
-			{
+			std::string contents;
+			if(info["data"].is_null() && info["chunks"].is_list()) {
+				for(variant chunk : info["chunks"].as_list()) {
+					std::string chunk_contents;
+					const bool found = read_update_cache(chunk["md5"].as_string(), chunk["size"].as_int(), &chunk_contents);
+					ASSERT_LOG(found, "Could not find data for chunk " << chunk["md5"].as_string() << " of " << path.as_string());
+					contents += chunk_contents;
+				}
+			} else {
 				std::string data_str;
 				if(info["data"].is_null()) {
 					const std::string cache_path = "update-cache/" + info["md5"].as_string();
@@ -1700,15 +1897,12 @@ static const int ModuleProtocolVersion = 1;
 				} else {
 					data_str = info["data"].as_string();
 				}
-				data_buf.insert(data_buf.begin(), data_str.begin(), data_str.end());
-			}
-			const int data_size = info["size"].as_int();
 
-			std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), data_size);
+				contents = decode_chunk_data(data_str, info["size"].as_int());
+			}
 
 			LOG_INFO("CREATING FILE AT " << path_str);
 
-			std::string contents(data.begin(), data.end());
 			ASSERT_LOG(variant(md5::sum(contents)) == info["md5"], "md5 sum for " << path.as_string() << " does not match");
 
 			try {
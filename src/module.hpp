@@ -117,6 +117,11 @@ namespace module
 
 	variant build_package(const std::string& id);
 
+	//the form the contents of files and of their chunks take in packages,
+	//on the module server and in the update cache: base64 of zip data.
+	std::string encode_chunk_data(const std::string& contents);
+	std::string decode_chunk_data(const std::string& data, int size);
+
 	bool uninstall_downloaded_module(const std::string& id);
 
 	void set_module_args(game_logic::ConstFormulaCallablePtr callable);
@@ -39,6 +39,7 @@
 #include "formatter.hpp"
 #include "json_parser.hpp"
 #include "md5.hpp"
+#include "module.hpp"
 #include "module_web_server.hpp"
 #include "string_utils.hpp"
 #include "utils.hpp"
@@ -87,9 +88,60 @@ void ModuleWebServer::add_chunks_to_manifest(const std::string& data_path, varia
 	}
 }
 
+//writes out the chunks of an uploaded file which arrived with their data,
+//and the whole file, which clients from before content chunking fetch.
+void ModuleWebServer::storeContentChunks(variant file_info) const
+{
+	static const variant DataVariant("data");
+
+	const std::string file_id = file_info["md5"].as_string();
+	const std::string file_path = getChunkPath(file_id);
+
+	bool has_data = false;
+	for(variant chunk : file_info["chunks"].as_list()) {
+		has_data = has_data || chunk[DataVariant].is_string();
+	}
+
+	//a file carried over from the previous version is already stored.
+	if(!has_data && sys::file_exists(file_path)) {
+		return;
+	}
+
+	std::string contents;
+	for(variant chunk : file_info["chunks"].as_list()) {
+		const std::string chunk_id = chunk["md5"].as_string();
+		const int size = chunk["size"].as_int();
+
+		std::string chunk_contents;
+		if(chunk[DataVariant].is_string()) {
+			const std::string& data = chunk[DataVariant].as_string();
+			chunk_contents = module::decode_chunk_data(data, size);
+			ASSERT_LOG(md5::sum(chunk_contents) == chunk_id, "Chunk does not match its md5: " << chunk_id);
+			sys::write_file(getChunkPath(chunk_id), zip::compress(data));
+			chunk.remove_attr_mutation(DataVariant);
+		} else {
+			const std::string chunk_path = getChunkPath(chunk_id);
+			ASSERT_LOG(sys::file_exists(chunk_path), "Object has no chunk: " << chunk_id);
+			chunk_contents = module::decode_chunk_data(zip::decompress(sys::read_file(chunk_path)), size);
+		}
+
+		contents += chunk_contents;
+	}
+
+	ASSERT_LOG(md5::sum(contents) == file_id, "Chunks do not make up file: " << file_id);
+
+	if(!sys::file_exists(file_path)) {
+		sys::write_file(file_path, zip::compress(module::encode_chunk_data(contents)));
+	}
+}
+
 namespace {
 
-static const int ModuleProtocolVersion = 1;
+//version 2 added files uploaded as content-defined chunks.
+static const int ModuleProtocolVersion = 2;
+
+//clients older than this need the data of every file sent inline.
+static const int InlineDataProtocolVersion = 1;
 }
 
 void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::environment& env, const std::string& raw_msg)
@@ -107,7 +159,7 @@ void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::env
 
 			variant proto_version = doc["protocol_version"];
 			bool require_back_compat = false;
-			if(proto_version.is_null() || proto_version.as_int() < ModuleProtocolVersion) {
+			if(proto_version.is_null() || proto_version.as_int() < InlineDataProtocolVersion) {
 				require_back_compat = true;
 				//send_msg(socket, "text/json", "{ status: \"need_to_download_new_installer\", out_of_date: true, message: \"Your version of the\nArgentum Age installer is out of date.\nIt needs to be downloaded and installed again.\" }", "");
 				//return;
@@ -309,6 +361,7 @@ void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::env
 
 			module_lock_ids_[module_id] = next_lock_id_;
 			response[variant("status")] = variant("ok");
+			response[variant("protocol_version")] = variant(ModuleProtocolVersion);
 			response[variant("lock_id")] = variant(next_lock_id_);
 
 			++next_lock_id_;
@@ -396,7 +449,13 @@ void ModuleWebServer::handlePost(socket_ptr socket, variant doc, const http::env
 			static const variant SizeVariant("size");
 			static const variant DataVariant("data");
 			static const variant MD5Variant("md5");
+			static const variant ChunksVariant("chunks");
 			for(auto p : manifest.as_map()) {
+				if(p.second[ChunksVariant].is_list()) {
+					storeContentChunks(p.second);
+					continue;
+				}
+
 				const int size = p.second[SizeVariant].as_int();
 				if(size >= 128) {
 					if(p.second[DataVariant].is_string()) {
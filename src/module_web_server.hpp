@@ -42,6 +42,7 @@ private:
 
 	std::string getChunkPath(const std::string& chunk_id) const;
 	void add_chunks_to_manifest(const std::string& data_path, variant manifest) const;
+	void storeContentChunks(variant file_info) const;
 
 	boost::asio::deadline_timer timer_;
 	int nheartbeat_;
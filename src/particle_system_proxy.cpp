@@ -26,6 +26,7 @@
 #include "particle_system_proxy.hpp"
 #include "preferences.hpp"
 #include "profile_timer.hpp"
+#include "random.hpp"
 #include "variant_utils.hpp"
 
 #include "formula_callable.hpp"
@@ -40,15 +41,44 @@
 #include "WindowManager.hpp"
 
 PREF_BOOL(particle_editor, false, "Show the particle editor");
+PREF_BOOL(async_particles, true, "Step particle systems on a worker thread, one frame ahead of drawing them");
 
 namespace graphics
 {
 	using namespace KRE;
 
+	namespace
+	{
+		void init_particle_settings()
+		{
+			static bool done = false;
+			if(done) {
+				return;
+			}
+			done = true;
+
+			Particles::ParticleSystem::setAsyncUpdate(g_async_particles);
+
+			//seed each system from the game's generator, so replays see the
+			//same particles.
+			Particles::ParticleSystem::setSeedGenerator([]() {
+				return static_cast<unsigned>(rng::generate());
+			});
+		}
+	}
+
+	const KRE::Particles::ParticleSystemPtr& ParticleSystemContainerProxy::getParticleSystem() const
+	{
+		auto& psystem = particle_system_container_->getParticleSystem();
+		if(psystem) {
+			psystem->sync();
+		}
+		return psystem;
+	}
 
 	const KRE::Particles::Emitter& ParticleSystemContainerProxy::getActiveEmitter() const
 	{
-		auto psystem = particle_system_container_->getParticleSystem();
+		auto psystem = getParticleSystem();
 		if(psystem) {
 			auto emitter = psystem->getActiveEmitter();
 			return *emitter;
@@ -59,7 +89,7 @@ namespace graphics
 
 	KRE::Particles::Emitter& ParticleSystemContainerProxy::getActiveEmitter()
 	{
-		auto psystem = particle_system_container_->getParticleSystem();
+		auto psystem = getParticleSystem();
 		if(psystem) {
 			auto emitter = psystem->getActiveEmitter();
 			return *emitter;
@@ -79,6 +109,7 @@ namespace graphics
 		  invert_mouselook_(false)
 	{
 		root_->setNodeName("root_node");
+		init_particle_settings();
 
 		rmanager_ = std::make_shared<RenderManager>();
 		rmanager_->addQueue(0, "PS");
@@ -92,6 +123,12 @@ namespace graphics
 		}
 	}
 
+	ParticleSystemContainerProxy::~ParticleSystemContainerProxy()
+	{
+		//a step still running needs the container alive until it is done.
+		getParticleSystem();
+	}
+
 	void ParticleSystemContainerProxy::draw(const WindowPtr& wnd) const
 	{
 		if(running_) {
@@ -131,6 +168,7 @@ namespace graphics
 						f = "particles/" + f;
 					}
 				}
+				getParticleSystem();
 				KRE::Particles::ParticleUI(particle_system_container_, &enable_mouselook_, &invert_mouselook_, ifiles);
 			}
 #endif
@@ -170,28 +208,43 @@ namespace graphics
 		KRE::Particles::ParticleSystemPtr obj_;
 	};
 
+	//emitter and affector proxies may be kept in FFL across frames, so they
+	//wait for their system's background step before every access.
 	class ParticleEmitterProxy : public game_logic::FormulaCallable
 	{
 	public:
-		explicit ParticleEmitterProxy(KRE::Particles::EmitterPtr obj) : obj_(obj)
+		ParticleEmitterProxy(KRE::Particles::EmitterPtr obj, const KRE::Particles::ParticleSystemPtr& system) : obj_(obj), system_(system)
 		{}
+		void sync() const {
+			if(auto psystem = system_.lock()) {
+				psystem->sync();
+			}
+		}
 	private:
 		DECLARE_CALLABLE(ParticleEmitterProxy);
 		KRE::Particles::EmitterPtr obj_;
+		std::weak_ptr<KRE::Particles::ParticleSystem> system_;
 	};
 
 	class ParticleAffectorProxy : public game_logic::FormulaCallable
 	{
 	public:
-		explicit ParticleAffectorProxy(KRE::Particles::AffectorPtr obj) : obj_(obj)
+		ParticleAffectorProxy(KRE::Particles::AffectorPtr obj, const KRE::Particles::ParticleSystemPtr& system) : obj_(obj), system_(system)
 		{}
+		void sync() const {
+			if(auto psystem = system_.lock()) {
+				psystem->sync();
+			}
+		}
 	private:
 		DECLARE_CALLABLE(ParticleAffectorProxy);
 		KRE::Particles::AffectorPtr obj_;
+		std::weak_ptr<KRE::Particles::ParticleSystem> system_;
 	};
 
 	BEGIN_DEFINE_CALLABLE_NOBASE(ParticleSystemContainerProxy)
 		DEFINE_FIELD(write, "map")
+			obj.getParticleSystem();
 			return obj.particle_system_container_->write();
 		DEFINE_FIELD(running, "bool")
 			return variant::from_bool(obj.running_);
@@ -199,20 +252,20 @@ namespace graphics
 			obj.running_ = value.as_bool();
 
 		DEFINE_FIELD(scale_time, "decimal")
-			auto psystem = obj.particle_system_container_->getParticleSystem();
+			auto psystem = obj.getParticleSystem();
 			return variant(psystem->getScaleTime());
 			
 		DEFINE_SET_FIELD
-			auto psystem = obj.particle_system_container_->getParticleSystem();
+			auto psystem = obj.getParticleSystem();
 			psystem->setScaleTime(value.as_float());
 
 		DEFINE_FIELD(scale_dimensions, "[decimal,decimal,decimal]")
-			auto psystem = obj.particle_system_container_->getParticleSystem();
+			auto psystem = obj.getParticleSystem();
 			glm::vec3 dim = psystem->getScaleDimensions();
 			return vec3_to_variant(dim);
 			
 		DEFINE_SET_FIELD
-			auto psystem = obj.particle_system_container_->getParticleSystem();
+			auto psystem = obj.getParticleSystem();
 			psystem->setScaleDimensions(variant_to_vec3(value));
 
 		DEFINE_FIELD(emission_rate, "any")
@@ -235,27 +288,27 @@ namespace graphics
 
 		DEFINE_FIELD(systems, "[builtin particle_system_proxy]")
 
-			auto psystem = obj.particle_system_container_->getParticleSystem();
+			auto psystem = obj.getParticleSystem();
 			return variant(new ParticleSystemProxy(psystem));
 
 		DEFINE_FIELD(emitters, "[builtin particle_emitter_proxy]")
 
-			auto psystem = obj.particle_system_container_->getParticleSystem();
+			auto psystem = obj.getParticleSystem();
 			if(psystem) {
 				auto emitter = psystem->getEmitter();
-				return variant(new ParticleEmitterProxy(emitter));
+				return variant(new ParticleEmitterProxy(emitter, psystem));
 			}
 			return variant();
 
 		DEFINE_FIELD(affectors, "[builtin particle_affector_proxy]")
 
-			auto psystem = obj.particle_system_container_->getParticleSystem();
+			auto psystem = obj.getParticleSystem();
 			if(psystem) {
 				auto v = psystem->getAffectors();
 				std::vector<variant> result;
 				result.reserve(v.size());
 				for(auto p : v) {
-					result.emplace_back(variant(new ParticleAffectorProxy(p)));
+					result.emplace_back(variant(new ParticleAffectorProxy(p, psystem)));
 				}
 				return variant(&result);
 			}
@@ -276,20 +329,25 @@ namespace graphics
 		sprintf(buf, "%p", obj.obj_.get());
 		return variant(std::string(buf));
 	DEFINE_FIELD(position, "[decimal,decimal,decimal]")
+		obj.sync();
 		const glm::vec3& v = obj.obj_->current.position;
 		return vec3_to_variant(v);
 
 	DEFINE_SET_FIELD
+		obj.sync();
 		obj.obj_->current.position = obj.obj_->initial.position = variant_to_vec3(value);
 	
 	DEFINE_FIELD(emission_rate, "any")
 		return variant();
 	DEFINE_SET_FIELD
+		obj.sync();
 		obj.obj_->setEmissionRate(value);
 	
 	DEFINE_FIELD(orientation_follows_direction, "bool")
+		obj.sync();
 		return variant::from_bool(obj.obj_->doesOrientationFollowDirection());
 	DEFINE_SET_FIELD
+		obj.sync();
 		obj.obj_->setOrientationFollowsDirection(value.as_bool());
 
 	END_DEFINE_CALLABLE(ParticleEmitterProxy)
@@ -300,11 +358,14 @@ namespace graphics
 		sprintf(buf, "%p", obj.obj_.get());
 		return variant(std::string(buf));
 	DEFINE_FIELD(node, "map")
+		obj.sync();
 		return obj.obj_->node();
 	DEFINE_SET_FIELD
+		obj.sync();
 		obj.obj_->setNode(value);
 
 	DEFINE_FIELD(path, "null|[[decimal]]")
+		obj.sync();
 		KRE::Particles::PathFollowerAffector* pfa = dynamic_cast<KRE::Particles::PathFollowerAffector*>(obj.obj_.get());
 		if(pfa == nullptr) {
 			return variant();
@@ -320,6 +381,7 @@ namespace graphics
 
 		return variant(&v);
 	DEFINE_SET_FIELD
+		obj.sync();
 		KRE::Particles::PathFollowerAffector* pfa = dynamic_cast<KRE::Particles::PathFollowerAffector*>(obj.obj_.get());
 		if(pfa) {
 			pfa->setPoints(value);
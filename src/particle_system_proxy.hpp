@@ -37,6 +37,7 @@ namespace graphics
 	{
 	public:
 		ParticleSystemContainerProxy(const variant& node);
+		~ParticleSystemContainerProxy();
 
 		void draw(const KRE::WindowPtr& wnd) const;
 		void process();
@@ -47,6 +48,8 @@ namespace graphics
 	private:
 		DECLARE_CALLABLE(ParticleSystemContainerProxy);
 
+		//waits for any background step before handing the system out.
+		const KRE::Particles::ParticleSystemPtr& getParticleSystem() const;
 		const KRE::Particles::Emitter& getActiveEmitter() const;
 		KRE::Particles::Emitter& getActiveEmitter();
 
@@ -27,6 +27,7 @@
 #include <sstream>
 #include <string>
 
+#include "binary_cache.hpp"
 #include "formula.hpp"
 #include "preprocessor.hpp"
 #include "filesystem.hpp"
@@ -160,6 +161,7 @@ variant preprocess_string_value(const std::string& input, const game_logic::Form
 			return variant(&res);
 		}
 	} else if(directive == "@eval") {
+		binary_cache::note_eval();
 		game_logic::Formula f(variant(std::string(i, input.end())));
 		if(callable) {
 			return f.execute(*callable);
@@ -67,18 +67,18 @@ void SolidMap::createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>
 		SolidMapPtr body_map(new SolidMap());
 		body_map->id_ = "body";
 		body_map->area_ = body;
-		body_map->solid_.resize(body.w()*body.h(), true);
+		body_map->init(true);
 		if(node.has_key("solid_offsets")) {
 			body_map->applyOffsets(node["solid_offsets"].as_list_int());
 		}
 
-		body_map->calculateSide(0, -1, body_map->top_);
-		body_map->calculateSide(-1, 0, body_map->left_);
-		body_map->calculateSide(1, 0, body_map->right_);
-		body_map->calculateSide(-100000, 0, body_map->all_);
+		body_map->calculateSide(0, -1, body_map->top_, body_map->top_spans_);
+		body_map->calculateSide(-1, 0, body_map->left_, body_map->left_spans_);
+		body_map->calculateSide(1, 0, body_map->right_, body_map->right_spans_);
+		body_map->calculateSide(-100000, 0, body_map->all_, body_map->all_spans_);
 
 		if(legs_height == 0) {
-			body_map->calculateSide(0, 1, body_map->bottom_);
+			body_map->calculateSide(0, 1, body_map->bottom_, body_map->bottom_spans_);
 		}
 		v.push_back(body_map);
 	} else {
@@ -90,7 +90,7 @@ void SolidMap::createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>
 		SolidMapPtr legs_map(new SolidMap());
 		legs_map->id_ = "legs";
 		legs_map->area_ = legs;
-		legs_map->solid_.resize(legs.w()*legs.h(), false);
+		legs_map->init(false);
 		for(int y = 0; y < legs.h()-1; ++y) {
 			for(int x = y; x < legs.w() - y; ++x) {
 				legs_map->setSolid(x, y);
@@ -98,13 +98,13 @@ void SolidMap::createObjectSolidMaps(variant node, std::vector<ConstSolidMapPtr>
 		}
 
 		if(area.h() <= legs_height) {
-			legs_map->calculateSide(0, -1, legs_map->top_);
+			legs_map->calculateSide(0, -1, legs_map->top_, legs_map->top_spans_);
 		}
 
-		legs_map->calculateSide(0, 1, legs_map->bottom_);
-		legs_map->calculateSide(-1, 0, legs_map->left_);
-		legs_map->calculateSide(1, 0, legs_map->right_);
-		legs_map->calculateSide(-10000, 0, legs_map->all_);
+		legs_map->calculateSide(0, 1, legs_map->bottom_, legs_map->bottom_spans_);
+		legs_map->calculateSide(-1, 0, legs_map->left_, legs_map->left_spans_);
+		legs_map->calculateSide(1, 0, legs_map->right_, legs_map->right_spans_);
+		legs_map->calculateSide(-10000, 0, legs_map->all_, legs_map->all_spans_);
 		v.push_back(legs_map);
 	}
 }
@@ -120,12 +120,12 @@ void SolidMap::createObjectPlatformMaps(const rect& area_ref, std::vector<ConstS
 	SolidMapPtr platform(new SolidMap());
 	platform->id_ = "platform";
 	platform->area_ = area;
-	platform->solid_.resize(area.w()*area.h(), true);
-	platform->calculateSide(0, -1, platform->top_);
-	platform->calculateSide(0, 1, platform->bottom_);
-	platform->calculateSide(-1, 0, platform->left_);
-	platform->calculateSide(1, 0, platform->right_);
-	platform->calculateSide(-100000, 0, platform->all_);
+	platform->init(true);
+	platform->calculateSide(0, -1, platform->top_, platform->top_spans_);
+	platform->calculateSide(0, 1, platform->bottom_, platform->bottom_spans_);
+	platform->calculateSide(-1, 0, platform->left_, platform->left_spans_);
+	platform->calculateSide(1, 0, platform->right_, platform->right_spans_);
+	platform->calculateSide(-100000, 0, platform->all_, platform->all_spans_);
 	v.push_back(platform);
 }
 SolidMapPtr SolidMap::createFromTexture(const KRE::TexturePtr& t, const rect& area_rect)
@@ -190,7 +190,7 @@ SolidMapPtr SolidMap::createFromTexture(const KRE::TexturePtr& t, const rect& ar
 
 	SolidMapPtr solid(new SolidMap());
 	solid->area_ = rect(area.x()*2, area.y()*2, area.w()*2, area.h()*2);
-	solid->solid_.resize(solid->area_.w()*solid->area_.h(), false);
+	solid->init(false);
 	for(int y = 0; y < solid->area_.h(); ++y) {
 		for(int x = 0; x < solid->area_.w(); ++x) {
 			bool is_solid = !t->getFrontSurface()->isAlpha(area.x() + x/2, area.y() + y/2);
@@ -220,7 +220,56 @@ bool SolidMap::isSolidAt(int x, int y) const
 		return false;
 	}
 
-	return solid_[y*area_.w() + x];
+	return (rows_[y*row_words_ + x/64] & (uint64_t(1) << (x%64))) != 0;
+}
+
+namespace 
+{
+	int lowest_bit(uint64_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_ctzll(v);
+#else
+		int n = 0;
+		while((v&0xFFFFFFFF) == 0) { v >>= 32; n += 32; }
+		while((v&1) == 0) { v >>= 1; ++n; }
+		return n;
+#endif
+	}
+
+	//index of the first set bit in [begin, end) of a bit array, or end.
+	int find_first_set(const uint64_t* words, int begin, int end)
+	{
+		for(int w = begin/64; w*64 < end; ++w) {
+			uint64_t bits = words[w];
+			if(w == begin/64) {
+				bits &= ~uint64_t(0) << (begin%64);
+			}
+
+			if(bits) {
+				const int result = w*64 + lowest_bit(bits);
+				return result < end ? result : end;
+			}
+		}
+
+		return end;
+	}
+}
+
+int SolidMap::findSolidInRow(int y, int x1, int x2) const
+{
+	if(y < 0 || y >= area_.h()) {
+		return x2;
+	}
+
+	const int begin = std::max(x1, 0);
+	const int end = std::min(x2, area_.w());
+	if(begin >= end) {
+		return x2;
+	}
+
+	const int result = find_first_set(&rows_[y*row_words_], begin, end);
+	return result == end ? x2 : result;
 }
 
 const std::vector<point>& SolidMap::dir(MOVE_DIRECTION d) const
@@ -237,14 +286,46 @@ const std::vector<point>& SolidMap::dir(MOVE_DIRECTION d) const
 	}
 }
 
+const std::vector<SolidSpan>& SolidMap::dirSpans(MOVE_DIRECTION d) const
+{
+	switch(d) {
+		case MOVE_DIRECTION::LEFT: return left_spans_;
+		case MOVE_DIRECTION::RIGHT: return right_spans_;
+		case MOVE_DIRECTION::UP: return top_spans_;
+		case MOVE_DIRECTION::DOWN: return bottom_spans_;
+		case MOVE_DIRECTION::NONE: return all_spans_;
+		default:
+			assert(false);
+			return all_spans_;
+	}
+}
+
+void SolidMap::init(bool value)
+{
+	row_words_ = (area_.w() + 63)/64;
+	rows_.assign(row_words_*area_.h(), 0);
+	if(value) {
+		for(int y = 0; y < area_.h(); ++y) {
+			for(int x = 0; x < area_.w(); ++x) {
+				setSolid(x, y);
+			}
+		}
+	}
+}
+
 void SolidMap::setSolid(int x, int y, bool value)
 {
-	ASSERT_EQ(solid_.size(), area_.w()*area_.h());
+	ASSERT_EQ(rows_.size(), row_words_*area_.h());
 	if(x < 0 || y < 0 || x >= area_.w() || y >= area_.h()) {
 		return;
 	}
 
-	solid_[y*area_.w() + x] = value;
+	const uint64_t row_bit = uint64_t(1) << (x%64);
+	if(value) {
+		rows_[y*row_words_ + x/64] |= row_bit;
+	} else {
+		rows_[y*row_words_ + x/64] &= ~row_bit;
+	}
 }
 
 void SolidMap::applyOffsets(const std::vector<int>& offsets)
@@ -269,20 +350,23 @@ void SolidMap::applyOffsets(const std::vector<int>& offsets)
 	}
 }
 
-void SolidMap::calculateSide(int xdir, int ydir, std::vector<point>& points) const
+void SolidMap::calculateSide(int xdir, int ydir, std::vector<point>& points, std::vector<SolidSpan>& spans) const
 {
-	int index = 0;
 	const int height = area_.h();
 	const int width = area_.w();
 	for(int y = 0; y < height; ++y) {
-		for(int x = 0; x < width; ++x) {
-			//for performance reasons, check our current position directly
-			//rather than calling isSolidAt() so we don't do bounds checking.
-			if(solid_[index] && !isSolidAt(x + xdir, y + ydir)) {
-				points.push_back(point(area_.x() + x, area_.y() + y));
+		for(int x = findSolidInRow(y, 0, width); x < width; x = findSolidInRow(y, x + 1, width)) {
+			if(!isSolidAt(x + xdir, y + ydir)) {
+				const point p(area_.x() + x, area_.y() + y);
+				points.push_back(p);
+
+				if(!spans.empty() && spans.back().y == p.y && spans.back().x2 == p.x) {
+					++spans.back().x2;
+				} else {
+					SolidSpan span = { p.y, p.x, p.x + 1 };
+					spans.push_back(span);
+				}
 			}
-
-			++index;
 		}
 	}
 }
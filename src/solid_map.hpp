@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "geometry.hpp"
@@ -45,7 +46,14 @@ public:
 
 	bool isSolidAt(int x, int y) const;
 
+	//find the first solid pixel in row y between [x1, x2). Returns x2 if
+	//there isn't one.
+	int findSolidInRow(int y, int x1, int x2) const;
+
 	const std::vector<point>& dir(MOVE_DIRECTION d) const;
+
+	//the same points as dir(), merged into horizontal runs.
+	const std::vector<SolidSpan>& dirSpans(MOVE_DIRECTION d) const;
 	const std::vector<point>& left() const { return left_; }
 	const std::vector<point>& right() const { return right_; }
 	const std::vector<point>& top() const { return top_; }
@@ -54,21 +62,26 @@ public:
 private:
 	static ConstSolidMapPtr createObjectSolidMapFromSolidNode(variant node);
 
-	SolidMap() {}
+	SolidMap() : row_words_(0) {}
 
+	void init(bool value);
 	void setSolid(int x, int y, bool value=true);
 
-	void calculateSide(int xdir, int ydir, std::vector<point>& points) const;
+	void calculateSide(int xdir, int ydir, std::vector<point>& points, std::vector<SolidSpan>& spans) const;
 
 	void applyOffsets(const std::vector<int>& offsets);
 
 	std::string id_;
 	rect area_;
 
-	std::vector<bool> solid_;
+	//the solid pixels, one bit each, row by row so spans can be scanned
+	//a word at a time.
+	std::vector<uint64_t> rows_;
+	int row_words_;
 
 	//all the solid points that are on the different sides of the solid area.
 	std::vector<point> left_, right_, top_, bottom_, all_;
+	std::vector<SolidSpan> left_spans_, right_spans_, top_spans_, bottom_spans_, all_spans_;
 };
 
 class SolidInfo
@@ -31,3 +31,9 @@ typedef std::shared_ptr<const SolidMap> ConstSolidMapPtr;
 
 class SolidInfo;
 typedef std::shared_ptr<const SolidInfo> ConstSolidInfoPtr;
+
+//a horizontal run of solid pixels [x1, x2) in row y.
+struct SolidSpan
+{
+	int y, x1, x2;
+};
@@ -127,6 +127,7 @@ private:
 
 			ASSERT_LOG(send.is_map(), "NO REQUEST TO SEND: " << send.write_json() << " IN " << script.write_json());
 			game_logic::MapFormulaCallablePtr callable(new game_logic::MapFormulaCallable(this));
+			request_timer_ = profile::timer();
 			if(ipc_client_) {
 				LOG_INFO("tbs_bot send using ipc_client");
 				ipc_client_->set_callable(callable);
@@ -151,6 +152,11 @@ private:
 		if(has_quit_) {
 			return;
 		}
+
+		if(type == "message_received") {
+			latencies_us_.push_back(static_cast<int>(request_timer_.get_time()));
+		}
+
 		if(on_create_) {
 			executeCommand(on_create_->execute(*this));
 			on_create_.reset();
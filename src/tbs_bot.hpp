@@ -30,6 +30,7 @@
 
 #include "formula.hpp"
 #include "formula_callable.hpp"
+#include "profile_timer.hpp"
 #include "tbs_client.hpp"
 #include "tbs_internal_client.hpp"
 #include "tbs_ipc_client.hpp"
@@ -51,6 +52,9 @@ class bot : public game_logic::FormulaCallable
 
 		void surrenderReferences(GarbageCollector* collector) override;
 
+		//time from sending each request to getting its response, in microseconds.
+		const std::vector<int>& latencies_us() const { return latencies_us_; }
+
 	private:
 		DECLARE_CALLABLE(bot)
 		variant getValueDefault(const std::string& key) const override;
@@ -80,5 +84,8 @@ class bot : public game_logic::FormulaCallable
 		bool has_quit_;
 
 		tbs_bot_timer_proxy* timer_proxy_;
+
+		profile::timer request_timer_;
+		std::vector<int> latencies_us_;
 	};
 }
@@ -25,9 +25,13 @@
 
 #include "asserts.hpp"
 #include "json_parser.hpp"
+#include "md5.hpp"
 #include "preferences.hpp"
 #include "tbs_client.hpp"
 #include "tbs_game.hpp"
+#include "variant_binary.hpp"
+#include "variant_diff.hpp"
+#include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
 #if defined(_MSC_VER)
@@ -38,12 +42,22 @@ namespace tbs
 {
 	PREF_BOOL(tbs_client_prediction, false, "Use client-side prediction for tbs games");
 	PREF_INT(tbs_fake_error_rate, 0, "Percentage error rate for tbs connections; used to debug issues");
+	PREF_BOOL(tbs_client_state_patches, false, "Ask the tbs server to send game states as patches against states we already have");
+	PREF_BOOL(tbs_binary_wire, false, "Ask the tbs server to send messages in the binary variant format rather than JSON");
+
+	namespace
+	{
+		const size_t MaxPatchStates = 4;
+	}
 
 	client::client(const std::string& host, const std::string& port,
 				   int session, boost::asio::io_service* service)
 	  : http_client(host, port, session, service), use_local_cache_(g_tbs_client_prediction),
 		local_game_cache_(nullptr), local_nplayer_(-1)
 	{
+		if(g_tbs_binary_wire) {
+			set_accept(std::string(variant_binary::MimeType) + ", */*");
+		}
 	}
 
 	void client::send_request(variant request, game_logic::MapFormulaCallablePtr callable, std::function<void(std::string)> handler)
@@ -53,6 +67,12 @@ namespace tbs
 		handler_ = handler;
 		callable_ = callable;
 
+		if(g_tbs_client_state_patches && request.is_map()) {
+			std::map<variant,variant> m = request.as_map();
+			m[variant("patch_basis")] = variant(patch_states_.empty() ? -1 : patch_states_.back().first);
+			request = variant(&m);
+		}
+
 		std::string request_str = game_logic::serialize_doc_with_objects(request).write_json();
 
 		http_client::send_request("POST /tbs", 
@@ -114,6 +134,21 @@ namespace tbs
 				return;
 			}
 
+			static const variant GameVariant("game");
+			static const variant GamePatchVariant("game_patch");
+
+			if(g_tbs_client_state_patches && v.is_map() && v["type"] == GamePatchVariant) {
+				std::string text;
+				if(!apply_state_patch(v, &text)) {
+					request_full_state();
+					return;
+				}
+
+				v = game_logic::deserialize_doc_with_objects(text);
+			} else if(g_tbs_client_state_patches && v.is_map() && v["type"] == GameVariant) {
+				remember_state(v["state_id"].as_int(), variant_binary::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR));
+			}
+
 			if(use_local_cache_ && v["type"].as_string() == "game") {
 				//local cache currently disabled.
 				//local_game_cache_ = new tbs::game(v["game_type"].as_string(), v);
@@ -142,6 +177,61 @@ namespace tbs
 		handler_(connection_id_ + "message_received");
 	}
 
+	bool client::apply_state_patch(const variant& msg, std::string* text)
+	{
+		const int basis = msg["basis"].as_int();
+		for(const auto& state : patch_states_) {
+			if(state.first != basis) {
+				continue;
+			}
+
+			variant tree;
+			try {
+				const assert_recover_scope guard;
+				tree = variant_diff::apply(state.second, msg["patch"]);
+			} catch(validation_failure_exception& e) {
+				LOG_ERROR("Could not apply game state patch against " << basis << ": " << e.msg);
+				break;
+			}
+
+			*text = tree.write_json();
+			if(md5::sum(*text) != msg["md5"].as_string()) {
+				LOG_ERROR("Game state patch against " << basis << " gave the wrong state");
+				break;
+			}
+
+			remember_state(msg["state_id"].as_int(), tree);
+			return true;
+		}
+
+		patch_states_.clear();
+		return false;
+	}
+
+	void client::remember_state(int state_id, const variant& tree)
+	{
+		if(patch_states_.empty() == false && patch_states_.back().first == state_id) {
+			patch_states_.back().second = tree;
+			return;
+		}
+
+		patch_states_.push_back(std::make_pair(state_id, tree));
+		if(patch_states_.size() > MaxPatchStates) {
+			patch_states_.pop_front();
+		}
+	}
+
+	void client::request_full_state()
+	{
+		//we have no state the server can patch, so with patch_basis -1 the
+		//server sends the whole game state again.
+		LOG_INFO("Requesting full game state");
+		variant_builder request;
+		request.add("type", "request_updates");
+		request.add("state_id", -1);
+		send_request(request.build(), callable_, handler_);
+	}
+
 	void client::error_handler(const std::string& err)
 	{
 		LOG_ERROR("ERROR IN TBS CLIENT: " << err << (handler_ ? " SENDING TO HANDLER..." : " NO HANDLER"));
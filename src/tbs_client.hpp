@@ -23,6 +23,8 @@
 
 #pragma once
 
+#include <deque>
+
 #include "http_client.hpp"
 
 namespace tbs 
@@ -54,6 +56,14 @@ namespace tbs
 
 		void handle_message(variant node);
 
+		bool apply_state_patch(const variant& msg, std::string* text);
+		void remember_state(int state_id, const variant& tree);
+		void request_full_state();
+
+		//plain trees of the last few game states received, which the server
+		//may send patches against.
+		std::deque<std::pair<int, variant> > patch_states_;
+
 		std::string connection_id_;
 
 		bool use_local_cache_;
@@ -34,6 +34,7 @@
 #include "formula.hpp"
 #include "formula_object.hpp"
 #include "json_parser.hpp"
+#include "md5.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
 #include "profile_timer.hpp"
@@ -45,6 +46,7 @@
 #include "tbs_web_server.hpp"
 #include "string_utils.hpp"
 #include "unit_test.hpp"
+#include "variant_diff.hpp"
 #include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
@@ -53,6 +55,7 @@ extern bool g_tbs_server_local;
 
 PREF_STRING(tbs_server_save_replay, "", "ID for the tbs server to save the replay as");
 PREF_STRING(tbs_server_save_replay_file, "", "File for the tbs server to save the replay to");
+PREF_BOOL(tbs_server_state_patches, true, "Send game states as patches to clients which ask for them");
 
 namespace game_logic 
 {
@@ -602,7 +605,7 @@ namespace {
 		queue_message(result.build(), nplayer);
 	}
 
-	game::player::player() : side(-1), is_human(true), confirmed_state_id(-1), state_id_sent(-1), allow_deltas(false)
+	game::player::player() : side(-1), is_human(true), confirmed_state_id(-1), state_id_sent(-1), allow_deltas(false), accepts_patches(false), patch_basis(-1)
 	{
 	}
 
@@ -719,8 +722,7 @@ namespace {
 				return;
 			}
 
-			queue_message(write(nplayer, processing_ms), nplayer);
-
+			queue_game_state(nplayer, processing_ms);
 
 			if(g_tbs_server_local && players_[nplayer].confirmed_state_id != -1) {
 				//a local game has a guaranteed connection, so once we send a state
@@ -730,6 +732,119 @@ namespace {
 		}
 	}
 
+	namespace
+	{
+		//how many recent states we keep per player to patch against.
+		const size_t MaxPatchStates = 4;
+
+		std::string write_state_patch(int basis, int state_id, const variant& patch, const std::string& md5)
+		{
+			variant_builder msg;
+			msg.add("type", "game_patch");
+			msg.add("basis", basis);
+			msg.add("state_id", state_id);
+			msg.add("patch", patch);
+			msg.add("md5", md5);
+			return msg.build().write_json();
+		}
+
+		int g_state_patch_full_bytes = 0;
+		int g_state_patch_sent_bytes = 0;
+	}
+
+	void game::queue_game_state(int nplayer, int processing_ms)
+	{
+		player& p = players_[nplayer];
+		std::string text = write(nplayer, processing_ms).write_json();
+		if(!g_tbs_server_state_patches || !p.accepts_patches) {
+			queue_message(text, nplayer);
+			return;
+		}
+
+		const auto start_time = profile::get_tick_time();
+
+		//patches are made against the plain tree the client will get by
+		//parsing what we sent, so both ends hash exactly the same thing.
+		const variant tree = json::parse(text, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+
+		const int full_size = static_cast<int>(text.size());
+		for(const auto& sent : p.patch_states) {
+			if(sent.first == p.patch_basis) {
+				std::string patch = write_state_patch(sent.first, state_id_, variant_diff::diff(sent.second, tree), md5::sum(tree.write_json()));
+				if(patch.size() < text.size()) {
+					text.swap(patch);
+				}
+				break;
+			}
+		}
+
+		if(p.patch_states.empty() == false && p.patch_states.back().first == state_id_) {
+			p.patch_states.back().second = tree;
+		} else {
+			p.patch_states.push_back(std::make_pair(state_id_, tree));
+			if(p.patch_states.size() > MaxPatchStates) {
+				p.patch_states.pop_front();
+			}
+		}
+
+		g_state_patch_full_bytes += full_size;
+		g_state_patch_sent_bytes += static_cast<int>(text.size());
+		LOG_DEBUG("STATE PATCH: player " << nplayer << " state " << state_id_ << " basis " << p.patch_basis << ": " << text.size() << "/" << full_size << " bytes in " << (profile::get_tick_time() - start_time) << "ms; " << g_state_patch_sent_bytes << "/" << g_state_patch_full_bytes << " bytes so far");
+
+		queue_message(text, nplayer);
+	}
+
+	void game::report_state_patches(const std::vector<std::string>& replay, std::ostream& out)
+	{
+		replay_ = replay;
+
+		const int nplayers = std::max<int>(1, static_cast<int>(players_.size()));
+		std::vector<variant> sent(nplayers);
+
+		int nstates = 0, last_id = -1;
+		int64_t full_bytes = 0, patch_bytes = 0;
+		double write_us = 0.0, patch_us = 0.0;
+
+		for(const std::string& entry : replay) {
+			const int id = json::parse(entry, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR)["state_id"].as_int();
+			restore_replay(id);
+			state_id_ = id;
+
+			for(int n = 0; n != nplayers; ++n) {
+				const int nplayer = players_.empty() ? -1 : n;
+
+				profile::timer write_timer;
+				const std::string text = write(nplayer).write_json();
+				write_us += write_timer.get_time();
+
+				profile::timer patch_timer;
+				const variant tree = json::parse(text, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+				std::string msg = text;
+				if(sent[n].is_null() == false) {
+					msg = write_state_patch(last_id, state_id_, variant_diff::diff(sent[n], tree), md5::sum(tree.write_json()));
+				}
+				patch_us += patch_timer.get_time();
+
+				sent[n] = tree;
+
+				full_bytes += text.size();
+				patch_bytes += std::min(msg.size(), text.size());
+				++nstates;
+
+				out << "state " << id << " player " << nplayer << ": " << text.size() << " bytes full, " << msg.size() << " bytes patched\n";
+			}
+
+			last_id = id;
+		}
+
+		out << nstates << " states sent: " << full_bytes << " bytes full, " << patch_bytes << " bytes patched";
+		if(full_bytes > 0) {
+			out << " (" << (100*patch_bytes/full_bytes) << "%)";
+		}
+
+		out << "\nwriting states took " << static_cast<int>(write_us/1000.0) << "ms, making patches another " << static_cast<int>(patch_us/1000.0) << "ms\n";
+	}
+
 	void game::ai_play()
 	{
 		for(int n = 0; n != ai_.size(); ++n) {
@@ -918,6 +1033,21 @@ namespace {
 
 	void game::handle_message(int nplayer, const variant& msg)
 	{
+		static const variant PatchBasisKey("patch_basis");
+		if(msg.is_map() && msg.has_key(PatchBasisKey)) {
+			//transport bookkeeping from clients that take patched states;
+			//record it and pass the message on without it.
+			if(nplayer >= 0 && nplayer < static_cast<int>(players_.size())) {
+				players_[nplayer].accepts_patches = true;
+				players_[nplayer].patch_basis = msg[PatchBasisKey].as_int();
+			}
+
+			std::map<variant,variant> m = msg.as_map();
+			m.erase(PatchBasisKey);
+			handle_message(nplayer, variant(&m));
+			return;
+		}
+
 		LOG_INFO("HANDLE MESSAGE " << nplayer << " (((" << msg.write_json() << ")))");
 		const std::string type = msg["type"].as_string();
 		if(type == "start_game") {
@@ -1130,6 +1260,43 @@ namespace
 	}
 }
 
+//usage: tbs_state_patch_stats --request <create_game message> <replay file>
+//the replay file is either a list of replay entries as written by
+//save_state or the replay log written by --tbs_server_save_replay_file,
+//in which case the latest game in it is used.
+COMMAND_LINE_UTILITY(tbs_state_patch_stats)
+{
+	using namespace tbs;
+
+	variant request;
+	std::string fname;
+	for(int i = 0; i != args.size(); ++i) {
+		if(args[i] == "--request" && i+1 != args.size()) {
+			request = json::parse(args[++i]);
+		} else {
+			fname = args[i];
+		}
+	}
+
+	ASSERT_LOG(request.is_map() && fname.empty() == false, "usage: tbs_state_patch_stats --request <create_game message> <replay file>");
+
+	variant doc = json::parse(sys::read_file(fname), json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+	if(doc.is_list() && doc.num_elements() > 0 && doc[doc.num_elements()-1].is_map()) {
+		doc = doc[doc.num_elements()-1]["replay"];
+	}
+
+	ASSERT_LOG(doc.is_list(), "No replay found in " << fname);
+
+	game_ptr g = game::create(request);
+	const game_context context(g.get());
+	for(const variant& user : request["users"].as_list()) {
+		g->add_player(user["user"].as_string());
+	}
+
+	g->setup_game();
+	g->report_state_patches(doc.as_list_string(), std::cout);
+}
+
 COMMAND_LINE_UTILITY(tbs_bot_game) 
 {
 	using namespace tbs;
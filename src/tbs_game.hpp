@@ -26,6 +26,7 @@
 #include <boost/scoped_ptr.hpp>
 #include "intrusive_ptr.hpp"
 #include <deque>
+#include <iosfwd>
 #include <set>
 
 #include "db_client.hpp"
@@ -94,6 +95,12 @@ namespace tbs
 			mutable int state_id_sent;
 			bool allow_deltas;
 
+			//set once the client asks for patched game states. patch_basis is
+			//the newest state the client says it holds, and patch_states the
+			//plain trees of the last few states it was sent.
+			bool accepts_patches;
+			int patch_basis;
+			std::deque<std::pair<int, variant> > patch_states;
 		};
 
 		int get_player_index(const std::string& nick) const;
@@ -120,12 +127,18 @@ namespace tbs
 		void observer_connect(int nclient, const std::string& username);
 		void observer_disconnect(const std::string& username);
 
+		//replays a saved game, reporting what sending each state to the
+		//players costs in full and as a patch against the state before it.
+		void report_state_patches(const std::vector<std::string>& replay, std::ostream& out);
+
 	protected:
 		void start_game();
 		virtual void send_game_state(int nplayer=-1, int processing_ms=-1);
 
 		void ai_play();
 
+		void queue_game_state(int nplayer, int processing_ms);
+
 		void send_notify(const std::string& msg, int nplayer=-1);
 		void send_error(const std::string& msg, int nplayer=-1);
 
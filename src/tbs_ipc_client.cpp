@@ -2,10 +2,12 @@
 #include "formula_callable.hpp"
 #include "formula_profiler.hpp"
 #include "tbs_ipc_client.hpp"
+#include "variant_binary.hpp"
 #include "wml_formula_callable.hpp"
 
 namespace tbs
 {
+extern bool g_tbs_binary_wire;
 
 ipc_client::ipc_client(SharedMemoryPipePtr pipe) : pipe_(pipe), in_flight_(0)
 {
@@ -15,7 +17,9 @@ ipc_client::ipc_client(SharedMemoryPipePtr pipe) : pipe_(pipe), in_flight_(0)
 void ipc_client::send_request(variant request)
 {
 	ASSERT_LOG(pipe_.get() != nullptr, "Invalid pipe in ipc_client");	
-	pipe_->write(request.write_json());
+	//the server answers in whichever format we write in.
+	const std::string msg = request.write_json();
+	pipe_->write(g_tbs_binary_wire ? variant_binary::from_json(msg) : msg);
 	pipe_->process();
 
 	++in_flight_;
@@ -39,6 +39,7 @@
 #include "tbs_web_server.hpp"
 #include "string_utils.hpp"
 #include "utils.hpp"
+#include "variant_binary.hpp"
 #include "variant_utils.hpp"
 
 namespace {
@@ -136,7 +137,7 @@ namespace tbs
 			if(cli_info.msg_queue.size() > 1 && socket->client_version >= 1) {
 				std::vector<variant> items;
 				for(const std::string& s : cli_info.msg_queue) {
-					items.push_back(variant(s));
+					items.push_back(variant(socket->supports_binary_variant ? variant_binary::from_json(s) : s));
 				}
 
 				cli_info.msg_queue.clear();
@@ -168,7 +169,7 @@ namespace tbs
 
 		auto ipc_itor = ipc_clients_.find(session_id);
 		if(ipc_itor != ipc_clients_.end()) {
-			ipc_itor->second.pipe->write(msg);
+			ipc_itor->second.pipe->write(ipc_itor->second.binary ? variant_binary::from_json(msg) : msg);
 			LOG_INFO("queue to ipc: " << ipc_clients_.size());
 			return;
 		}
@@ -203,6 +204,11 @@ namespace tbs
 
 	void server::send_msg(socket_ptr socket, const variant& msg)
 	{
+		if(socket->supports_binary_variant) {
+			send_msg(socket, variant_binary::encode(msg));
+			return;
+		}
+
 		send_msg(socket, msg.write_json(true, variant::JSON_COMPLIANT));
 	}
 
@@ -213,7 +219,12 @@ namespace tbs
 
 	void server::send_msg(socket_ptr socket, const std::string& msg_ref)
 	{
-		LOG_INFO("DO send_msg: " << msg_ref);
+		if(socket->supports_binary_variant && !variant_binary::is_binary(msg_ref)) {
+			send_msg(socket, variant_binary::from_json(msg_ref));
+			return;
+		}
+
+		LOG_INFO("DO send_msg: " << (variant_binary::is_binary(msg_ref) ? std::string("(binary)") : msg_ref));
 		std::string compressed_buf;
 		std::string compress_header;
 		const std::string* msg_ptr = &msg_ref;
@@ -237,7 +248,7 @@ namespace tbs
 			"Server: Wizard/1.0\r\n"
 			"Accept-Ranges: bytes\r\n"
 			"Access-Control-Allow-Origin: *\r\n"
-			"Content-Type: application/json\r\n"
+			"Content-Type: " << (variant_binary::is_binary(msg_ref) ? variant_binary::MimeType : "application/json") << "\r\n"
 			"Content-Length: " << std::dec << (int)msg.size() << "\r\n" <<
 			compress_header <<
 			"Last-Modified: " << get_http_datetime() << "\r\n\r\n";
@@ -303,10 +314,12 @@ namespace tbs
 			for(const std::string& msg : messages) {
 				//LOG_INFO("read IPC message " << msg);
 				SharedMemoryPipePtr pipe = i->second.pipe;
-				variant v(json::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR));
+				const bool binary = variant_binary::is_binary(msg);
+				i->second.binary = binary;
+				variant v(variant_binary::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR));
 				handle_message(
 					[=](variant v) {
-						pipe->write(v.write_json());
+						pipe->write(binary ? variant_binary::encode(v) : v.write_json());
 					},
 					[](client_info& info) {
 					},
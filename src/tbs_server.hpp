@@ -74,8 +74,12 @@ namespace tbs
 		http::web_server* web_server_;
 
 		struct IPCClientInfo {
+			IPCClientInfo() : binary(false) {}
 			SharedMemoryPipePtr pipe;
 			socket_info info;
+
+			//set once the client sends a binary message; we then reply in kind.
+			bool binary;
 		};
 
 		std::map<int, IPCClientInfo> ipc_clients_;
@@ -379,3 +379,100 @@ COMMAND_LINE_UTILITY(tbs_server) {
 		}
 	}
 }
+
+namespace
+{
+	//gives a copy of a bot its own sessions by shifting every session_id in
+	//its script, so many copies can play separate games on one server.
+	variant offset_session_ids(const variant& v, int offset)
+	{
+		if(v.is_list()) {
+			std::vector<variant> items;
+			for(const variant& item : v.as_list()) {
+				items.push_back(offset_session_ids(item, offset));
+			}
+			return variant(&items);
+		} else if(v.is_map()) {
+			std::map<variant,variant> m;
+			for(const auto& p : v.as_map()) {
+				if(p.first.is_string() && p.first.as_string() == "session_id" && p.second.is_int()) {
+					m[p.first] = variant(p.second.as_int() + offset);
+				} else {
+					m[p.first] = offset_session_ids(p.second, offset);
+				}
+			}
+			return variant(&m);
+		}
+
+		return v;
+	}
+}
+
+COMMAND_LINE_UTILITY(tbs_load_test) {
+	int port = 23456;
+	std::string bot_id;
+	int ngames = 16;
+	int seconds = 30;
+
+	std::vector<std::string>::const_iterator it = args.begin();
+	while(it != args.end()) {
+		const std::string arg = *it++;
+		if(it == args.end()) {
+			break;
+		}
+
+		if(arg == "--bot") {
+			bot_id = *it++;
+		} else if(arg == "--games") {
+			ngames = atoi((it++)->c_str());
+		} else if(arg == "--port") {
+			port = atoi((it++)->c_str());
+			ASSERT_LOG(port > 0 && port <= 65535, "tbs_load_test(): Port must lie in the range 1-65535.");
+		} else if(arg == "--seconds") {
+			seconds = atoi((it++)->c_str());
+		}
+	}
+
+	ASSERT_LOG(bot_id.empty() == false, "usage: tbs_load_test --bot <id> [--games <n>] [--seconds <n>] [--port <n>]");
+
+	boost::asio::io_service io_service;
+
+	tbs::g_service = &io_service;
+	tbs::g_listening_port = port;
+
+	tbs::server s(io_service);
+
+	boost::shared_ptr<tbs::web_server> ws(new tbs::web_server(s, io_service, port));
+	s.set_http_server(ws.get());
+
+	const variant bot_script = json::parse_from_file("data/tbs_test/" + bot_id + ".cfg");
+
+	std::vector<ffl::IntrusivePtr<tbs::bot> > bots;
+	for(int n = 0; n != ngames; ++n) {
+		bots.push_back(ffl::IntrusivePtr<tbs::bot>(new tbs::bot(io_service, "127.0.0.1", formatter() << port, offset_session_ids(bot_script, n*1000))));
+	}
+
+	boost::asio::deadline_timer deadline(io_service, boost::posix_time::seconds(seconds));
+	deadline.async_wait([&io_service](const boost::system::error_code& error) {
+		io_service.stop();
+	});
+
+	try {
+		io_service.run();
+	} catch(tbs::exit_exception&) {
+	}
+
+	std::vector<int> latencies;
+	for(const ffl::IntrusivePtr<tbs::bot>& b : bots) {
+		latencies.insert(latencies.end(), b->latencies_us().begin(), b->latencies_us().end());
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	std::cout << "games: " << ngames << " responses: " << latencies.size() << "\n";
+	if(latencies.empty() == false) {
+		std::cout << "latency p50: " << latencies[latencies.size()/2]/1000.0 << "ms"
+		          << " p99: " << latencies[(latencies.size()*99)/100]/1000.0 << "ms"
+		          << " max: " << latencies.back()/1000.0 << "ms\n";
+	}
+}
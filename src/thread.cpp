@@ -58,10 +58,17 @@ namespace threading
 		thread_(nullptr),
 		allocates_collectible_objects_((flags&THREAD_ALLOCATES_COLLECTIBLE_OBJECTS) != 0)
 	{
+		std::function<void()>* thread_fn = new std::function<void()>(fn_);
 		if(allocates_collectible_objects_) {
 			GarbageCollectible::incrementWorkerThreads();
+
+			//hand any memory the thread cached for collectibles back once it is done.
+			*thread_fn = [fn]() {
+				fn();
+				GarbageCollectible::releaseThreadCache();
+			};
 		}
-		thread_ = SDL_CreateThread(call_boost_function, name.c_str(), new std::function<void()>(fn_));
+		thread_ = SDL_CreateThread(call_boost_function, name.c_str(), thread_fn);
 	}
 
 	thread::~thread()
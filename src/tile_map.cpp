@@ -22,11 +22,13 @@
 */
 
 #include <boost/regex.hpp>
+#include <array>
 #include <cmath>
 #include <iostream>
 #include <limits>
 #include <sstream>
 #include <set>
+#include <unordered_map>
 
 #include "asserts.hpp"
 #include "formatter.hpp"
@@ -419,7 +421,7 @@ void TileMap::rebuildAll()
 }
 #endif
 
-TileMap::TileMap() : xpos_(0), ypos_(0), x_speed_(100), y_speed_(100), zorder_(0), patterns_version_(-1)
+TileMap::TileMap() : xpos_(0), ypos_(0), x_speed_(100), y_speed_(100), zorder_(0), match_table_words_(0), patterns_version_(-1)
 {
 #ifndef NO_EDITOR
 	create_tile_map(this);
@@ -430,7 +432,6 @@ TileMap::TileMap() : xpos_(0), ypos_(0), x_speed_(100), y_speed_(100), zorder_(0
 
 	//make an entry for the empty string.
 	pattern_index_.push_back(PatternIndexEntry());
-	pattern_index_.back().matching_patterns.push_back(&get_regex_from_pool(""));
 }
 
 TileMap::TileMap(variant node)
@@ -438,7 +439,8 @@ TileMap::TileMap(variant node)
 	ypos_(node["y"].as_int()),
 	x_speed_(node["x_speed"].as_int(100)), 
 	y_speed_(node["y_speed"].as_int(100)),
-    zorder_(parse_zorder(node["zorder"]))
+    zorder_(parse_zorder(node["zorder"])),
+	match_table_words_(0)
 #ifndef NO_EDITOR
 	, node_(node)
 #endif
@@ -460,7 +462,6 @@ TileMap::TileMap(variant node)
 
 	//make an entry for the empty string.
 	pattern_index_.push_back(PatternIndexEntry());
-	pattern_index_.back().matching_patterns.push_back(&get_regex_from_pool(""));
 
 	{
 	const std::string& tiles_str = node["tiles"].as_string();
@@ -542,92 +543,134 @@ TileMap::~TileMap()
 #endif
 }
 
-void TileMap::buildPatterns()
+namespace
 {
-	std::vector<const boost::regex*> all_regexes;
+	int floor_div(int a, int b)
+	{
+		return a >= 0 ? a/b : -((-a + b - 1)/b);
+	}
 
+	//an inverted regex has the low bit of its pointer set, so it can't be
+	//looked at directly; any other regex which is empty matches every tile.
+	bool matches_any_tile(const boost::regex* re)
+	{
+		return (reinterpret_cast<intptr_t>(re)&1) == 0 && re->empty();
+	}
+}
+
+void TileMap::buildPatterns()
+{
 	patterns_version_ = current_patterns_version;
 	const unsigned begin_time = profile::get_tick_time();
-	patterns_.clear();
-	for(const TilePattern& p : patterns) {
-		std::vector<const boost::regex*> re;
-		std::vector<const boost::regex*> accepted_re;
-		if(!p.current_tile_pattern->empty()) {
-			re.push_back(p.current_tile_pattern);
+
+	//give every regex any pattern uses an id.
+	std::map<const boost::regex*, int> regex_ids;
+	std::vector<const boost::regex*> regexes;
+	auto add_regex = [&regex_ids, &regexes](const boost::regex* re) {
+		if(regex_ids.count(re) == 0) {
+			regex_ids[re] = static_cast<int>(regexes.size());
+			regexes.push_back(re);
 		}
-		
+	};
+
+	for(const TilePattern& p : patterns) {
+		add_regex(p.current_tile_pattern);
 		for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
-			re.push_back(t.pattern);
+			add_regex(t.pattern);
 		}
+	}
 
-		int matches = 0;
-		for(PatternIndexEntry& e : pattern_index_) {
-			for(const boost::regex*& regex : re) {
-				if(regex && match_regex(e.str, regex)) {
-					accepted_re.push_back(regex);
-					regex = nullptr;
-					++matches;
-					if(matches == re.size()) {
-						break;
-					}
-				}
+	for(const MultiTilePattern& p : MultiTilePattern::getAll()) {
+		for(int x = 0; x < p.width(); ++x) {
+			for(int y = 0; y < p.height(); ++y) {
+				add_regex(p.getTileAt(x, y).re);
 			}
+		}
+	}
 
-			if(matches == re.size()) {
-				break;
+	//match every regex against every string in this map once, so building
+	//tiles only has to look bits up.
+	match_table_words_ = (static_cast<int>(regexes.size()) + 31)/32;
+	match_table_.assign(pattern_index_.size()*match_table_words_, 0);
+
+	std::vector<bool> regex_used(regexes.size(), false);
+	for(int entry = 0; entry != static_cast<int>(pattern_index_.size()); ++entry) {
+		uint32_t* row = &match_table_[0] + entry*match_table_words_;
+		for(int id = 0; id != static_cast<int>(regexes.size()); ++id) {
+			if(match_regex(pattern_index_[entry].str, regexes[id])) {
+				row[id/32] |= 1u << (id%32);
+				regex_used[id] = true;
 			}
 		}
+	}
+
+	//only patterns where each regex matches something in this map can apply.
+	patterns_.clear();
+	compiled_patterns_.clear();
+	for(const TilePattern& p : patterns) {
+		CompiledTilePattern compiled;
+		compiled.pattern = &p;
+		compiled.regex_id = -1;
+
+		bool usable = true;
+		if(!matches_any_tile(p.current_tile_pattern)) {
+			compiled.regex_id = regex_ids[p.current_tile_pattern];
+			usable = regex_used[compiled.regex_id];
+		}
+
+		for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
+			CompiledTilePattern::Neighbor neighbor;
+			neighbor.xoffset = t.xoffset;
+			neighbor.yoffset = t.yoffset;
+			neighbor.regex_id = regex_ids[t.pattern];
+			usable = usable && regex_used[neighbor.regex_id];
+			compiled.surrounding_tiles.push_back(neighbor);
+		}
 
-		if(matches == re.size()) {
-			all_regexes.insert(all_regexes.end(), accepted_re.begin(), accepted_re.end());
+		if(usable) {
 			patterns_.push_back(&p);
+			compiled_patterns_.push_back(compiled);
 		}
 	}
 
+	multi_patterns_.clear();
+	multi_pattern_regex_ids_.clear();
 	for(const MultiTilePattern& p : MultiTilePattern::getAll()) {
-		std::vector<const boost::regex*> re;
-		std::vector<const boost::regex*> accepted_re;
-
-		re.reserve(p.width()*p.height());
+		std::vector<int> ids(p.width()*p.height());
+		bool usable = true;
 		for(int x = 0; x < p.width(); ++x) {
 			for(int y = 0; y < p.height(); ++y) {
-				re.push_back(p.getTileAt(x, y).re);
-			}
-		}
-
-		int matches = 0;
-		for(PatternIndexEntry& e : pattern_index_) {
-			for(const boost::regex*& regex : re) {
-				if(regex && match_regex(e.str, regex)) {
-					accepted_re.push_back(regex);
-					regex = nullptr;
-					++matches;
-					if(matches == re.size()) {
-						break;
-					}
-				}
-			}
-
-			if(matches == re.size()) {
-				break;
+				const int id = regex_ids[p.getTileAt(x, y).re];
+				ids[y*p.width() + x] = id;
+				usable = usable && regex_used[id];
 			}
 		}
 
-		if(matches == re.size()) {
-			all_regexes.insert(all_regexes.end(), accepted_re.begin(), accepted_re.end());
+		if(usable) {
 			multi_patterns_.push_back(&p);
+			multi_pattern_regex_ids_.push_back(ids);
 		}
 	}
 
-	std::sort(all_regexes.begin(), all_regexes.end());
-	all_regexes.erase(std::unique(all_regexes.begin(), all_regexes.end()), all_regexes.end());
+	entry_patterns_.assign(pattern_index_.size(), std::vector<int>());
+	entry_patterns_local_.assign(pattern_index_.size(), true);
+	for(int entry = 0; entry != static_cast<int>(pattern_index_.size()); ++entry) {
+		for(int n = 0; n != static_cast<int>(compiled_patterns_.size()); ++n) {
+			const CompiledTilePattern& compiled = compiled_patterns_[n];
+			if(compiled.regex_id != -1 && !entryMatches(entry, compiled.regex_id)) {
+				continue;
+			}
+
+			entry_patterns_[entry].push_back(n);
 
-	for(PatternIndexEntry& e : pattern_index_) {
-		e.matching_patterns.clear();
+			if(compiled.pattern->filter_formula) {
+				entry_patterns_local_[entry] = false;
+			}
 
-		for(const boost::regex* re : all_regexes) {
-			if(match_regex(e.str, re)) {
-				e.matching_patterns.push_back(re);
+			for(const CompiledTilePattern::Neighbor& neighbor : compiled.surrounding_tiles) {
+				if(neighbor.xoffset < -1 || neighbor.xoffset > 1 || neighbor.yoffset < -1 || neighbor.yoffset > 1) {
+					entry_patterns_local_[entry] = false;
+				}
 			}
 		}
 	}
@@ -736,27 +779,35 @@ const char* TileMap::getTile(int y, int x) const
 	return pattern_index_[map_[y][x]].str.data();
 }
 
-const TileMap::PatternIndexEntry& TileMap::getTileEntry(int y, int x) const
+int TileMap::getTileEntryIndex(int y, int x) const
 {
 	if(x < 0 || y < 0 
 		|| static_cast<std::vector<std::vector<int>>::size_type>(y) >= map_.size() 
 		|| static_cast<std::vector<std::vector<int>>::size_type>(x) >= map_[y].size()) {
-		return pattern_index_.front();
+		//the first entry is always the empty string.
+		return 0;
 	}
 
-	return pattern_index_[map_[y][x]];
+	return map_[y][x];
 }
 
 namespace 
 {
-	struct cstr_less 
+	struct NeighborhoodHash
 	{
-		bool operator()(const char* a, const char* b) const {
-			return strcmp(a, b) < 0;
+		size_t operator()(const std::array<int, 9>& a) const {
+			size_t result = 0;
+			for(int n : a) {
+				result = result*1000003 + n;
+			}
+			return result;
 		}
 	};
 
-	typedef std::map<const char*, std::vector<const TilePattern*>, cstr_less> TilePatternCacheMap;
+	//maps the pattern index entries of a 3x3 block of tiles to the pattern
+	//they give the middle tile, as an index into the compiled patterns (-1
+	//for none) and whether it faces right.
+	typedef std::unordered_map<std::array<int, 9>, std::pair<int, bool>, NeighborhoodHash> TilePatternCacheMap;
 	struct TilePatternCache 
 	{
 		TilePatternCacheMap cache;
@@ -855,6 +906,7 @@ namespace
 
 void TileMap::applyMatchingMultiPattern(int& x, int y,
 	const MultiTilePattern& pattern,
+	const std::vector<int>& regex_ids,
 	point_map<LevelObject*>& mapping,
 	std::map<point_zorder, LevelObject*>& different_zorder_mapping) const
 {
@@ -868,8 +920,7 @@ void TileMap::applyMatchingMultiPattern(int& x, int y,
 		const int xpos = pattern.tryOrder()[n].loc.x;
 		const int ypos = pattern.tryOrder()[n].loc.y;
 
-		const PatternIndexEntry& entry = getTileEntry(y + ypos, x + xpos);
-		if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), pattern.getTileAt(xpos, ypos).re) == entry.matching_patterns.end()) {
+		if(!entryMatches(getTileEntryIndex(y + ypos, x + xpos), regex_ids[ypos*pattern.width() + xpos])) {
 			//the regex doesn't match
 			match = false;
 
@@ -910,6 +961,10 @@ void TileMap::applyMatchingMultiPattern(int& x, int y,
 void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 {
 	const int begin_time = profile::get_tick_time();
+
+	//make sure the match tables are up to date.
+	getPatterns();
+
 	int width = 0;
 	for(const auto& row : map_) {
 		int rs = static_cast<int>(row.size());
@@ -921,16 +976,18 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 	point_map<LevelObject*> multi_pattern_matches;
 	std::map<point_zorder, LevelObject*> different_zorder_multi_pattern_matches;
 
-	for(const MultiTilePattern* p : multi_patterns_) {
+	for(int n = 0; n != static_cast<int>(multi_patterns_.size()); ++n) {
+		const MultiTilePattern* p = multi_patterns_[n];
 		for(int y = -p->height(); y < static_cast<int>(map_.size()) + p->height(); ++y) {
 			const int ypos = ypos_ + y*TileSize;
 	
-			if((r && ypos < r->y()) || (r && ypos > r->y2())) {
+			//patterns starting above the rect may still cover some of it.
+			if((r && ypos + (p->height()-1)*TileSize < r->y()) || (r && ypos > r->y2())) {
 				continue;
 			}
 
 			for(int x = -p->width(); x < width + p->width(); ++x) {
-				applyMatchingMultiPattern(x, y, *p, multi_pattern_matches, different_zorder_multi_pattern_matches);
+				applyMatchingMultiPattern(x, y, *p, multi_pattern_regex_ids_[n], multi_pattern_matches, different_zorder_multi_pattern_matches);
 			}
 		}
 	}
@@ -944,6 +1001,10 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 		const int xpos = xpos_ + x*TileSize;
 		const int ypos = ypos_ + y*TileSize;
 
+		if(r && !pointInRect(point(xpos, ypos), *r)) {
+			continue;
+		}
+
 		LevelTile t;
 		t.x = xpos;
 		t.y = ypos;
@@ -957,6 +1018,14 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 
 	TilePatternCache cache;
 
+	//with a rect, only the columns inside it need to be looked at.
+	int xbegin = -g_tile_pattern_search_border;
+	int xend = width + g_tile_pattern_search_border;
+	if(r) {
+		xbegin = std::max(xbegin, -floor_div(xpos_ - r->x(), TileSize));
+		xend = std::min(xend, floor_div(r->x2() - xpos_, TileSize) + 1);
+	}
+
 	int ntiles = 0;
 	for(int y = -g_tile_pattern_search_border; y < static_cast<int>(map_.size()) + g_tile_pattern_search_border; ++y) {
 		const int ypos = ypos_ + y*TileSize;
@@ -965,7 +1034,7 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 			continue;
 		}
 
-		for(int x = -g_tile_pattern_search_border; x < width + g_tile_pattern_search_border; ++x) {
+		for(int x = xbegin; x < xend; ++x) {
 			const int xpos = xpos_ + x*TileSize;
 
 			const LevelObject* obj = multi_pattern_matches.get(point(x, y));
@@ -1045,76 +1114,86 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 		return nullptr;
 	}
 
-	const int xpos = xpos_ + x*TileSize;
+	getPatterns();
 
-	ffl::IntrusivePtr<FilterCallable> callable_ptr(new FilterCallable(*this, x, y));
-	FilterCallable& callable = *callable_ptr;
+	const int entry = getTileEntryIndex(y, x);
+	const std::vector<int>& matching_patterns = entry_patterns_[entry];
+	if(matching_patterns.empty()) {
+		return nullptr;
+	}
 
-	const char* current_tile = getTile(y,x);
+	//when the patterns for this tile only look at its neighbors, tiles with
+	//the same neighbors get the same pattern, so we only work it out once.
+	std::array<int, 9> neighborhood;
+	const bool use_cache = entry_patterns_local_[entry];
+	if(use_cache) {
+		for(int n = 0; n != 9; ++n) {
+			neighborhood[n] = getTileEntryIndex(y + n/3 - 1, x + n%3 - 1);
+		}
 
-	//we build a cache of all of the patterns which have some chance of
-	//matching the current tile.
-	TilePatternCacheMap::iterator itor = cache.cache.find(current_tile);
-	if(itor == cache.cache.end()) {
-		itor = cache.cache.insert(std::pair<const char*,std::vector<const TilePattern*> >(current_tile, std::vector<const TilePattern*>())).first;
-		for(const TilePattern* p : getPatterns()) {
-			if(!p->current_tile_pattern->empty() && !boost::regex_match(current_tile, current_tile + strlen(current_tile), *p->current_tile_pattern)) {
-				continue;
+		TilePatternCacheMap::const_iterator itor = cache.cache.find(neighborhood);
+		if(itor != cache.cache.end()) {
+			if(itor->second.first == -1) {
+				return nullptr;
 			}
 
-			itor->second.push_back(&*p);
+			*face_right = itor->second.second;
+			return compiled_patterns_[itor->second.first].pattern;
 		}
 	}
 
-	const std::vector<const TilePattern*>& matching_patterns = itor->second;
+	ffl::IntrusivePtr<FilterCallable> callable;
 
-	for(const TilePattern* ptr : matching_patterns) {
-		const TilePattern& p = *ptr;
-		if(p.filter_formula && p.filter_formula->execute(callable).as_bool() == false) {
-			continue;
-		}
-
-		bool match = true;
-		for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
-			const PatternIndexEntry& entry = getTileEntry(y + t.yoffset, x + t.xoffset);
-			if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), t.pattern) == entry.matching_patterns.end()) {
-				match = false;
-				break;
+	auto neighbors_match = [this, x, y](const CompiledTilePattern& p, int xdir) -> bool {
+		for(const CompiledTilePattern::Neighbor& t : p.surrounding_tiles) {
+			if(!entryMatches(getTileEntryIndex(y + t.yoffset, x + t.xoffset*xdir), t.regex_id)) {
+				return false;
 			}
 		}
+		return true;
+	};
 
-		if(match) {
-			if(p.empty) {
-				return nullptr;
+	int result = -1;
+	bool result_face_right = false;
+	for(int index : matching_patterns) {
+		const CompiledTilePattern& compiled = compiled_patterns_[index];
+		const TilePattern& p = *compiled.pattern;
+		if(p.filter_formula) {
+			if(!callable) {
+				callable.reset(new FilterCallable(*this, x, y));
 			}
 
-			*face_right = false;
-			return &p;
+			if(p.filter_formula->execute(*callable).as_bool() == false) {
+				continue;
+			}
 		}
 
-		if(p.reverse) {
-			match = true;
-
-			for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
-				const PatternIndexEntry& entry = getTileEntry(y + t.yoffset, x - t.xoffset);
-				if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), t.pattern) == entry.matching_patterns.end()) {
-					match = false;
-					break;
-				}
-			}
+		bool match = neighbors_match(compiled, 1);
+		if(match) {
+			result_face_right = false;
+		} else if(p.reverse) {
+			match = neighbors_match(compiled, -1);
+			result_face_right = true;
 		}
 
 		if(match) {
-			if(p.empty) {
-				return nullptr;
+			if(!p.empty) {
+				result = index;
 			}
-
-			*face_right = true;
-			return &p;
+			break;
 		}
 	}
 
-	return nullptr;
+	if(use_cache) {
+		cache.cache[neighborhood] = std::make_pair(result, result_face_right);
+	}
+
+	if(result == -1) {
+		return nullptr;
+	}
+
+	*face_right = result_face_right;
+	return compiled_patterns_[result].pattern;
 }
 
 bool TileMap::setTile(int xpos, int ypos, const std::string& str)
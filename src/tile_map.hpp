@@ -26,6 +26,7 @@
 #include <boost/array.hpp>
 #include <boost/regex.hpp>
 
+#include <cstdint>
 #include <map>
 #include <string>
 
@@ -103,19 +104,57 @@ private:
 	//a map of all of our strings, which maps into pattern_index.
 	std::vector<std::vector<int>> map_;
 
-	//an entry which holds one of the strings found in this map, as well
-	//as the patterns it matches.
+	//an entry which holds one of the strings found in this map.
 	struct PatternIndexEntry 
 	{
 		PatternIndexEntry() { for(int n = 0; n != str.size(); ++n) { str[n] = 0; } }
 		tile_string str;
-		mutable std::vector<const boost::regex*> matching_patterns;
 	};
 
-	const PatternIndexEntry& getTileEntry(int y, int x) const;
+	int getTileEntryIndex(int y, int x) const;
 
 	std::vector<PatternIndexEntry> pattern_index_;
 
+	//every regex our patterns use is given an id, and matched against every
+	//entry in pattern_index_ when the patterns are built. Each entry has a
+	//row of match_table_words_ words in match_table_, with bit n set if the
+	//entry matches regex n.
+	std::vector<uint32_t> match_table_;
+	int match_table_words_;
+
+	bool entryMatches(int entry, int regex_id) const {
+		return ((match_table_[entry*match_table_words_ + regex_id/32] >> (regex_id%32))&1) != 0;
+	}
+
+	//a pattern from patterns_ with its surrounding tiles as regex ids.
+	struct CompiledTilePattern
+	{
+		struct Neighbor {
+			int xoffset, yoffset;
+			int regex_id;
+		};
+
+		const TilePattern* pattern;
+
+		//the regex of the middle tile, or -1 if it matches any tile.
+		int regex_id;
+		std::vector<Neighbor> surrounding_tiles;
+	};
+
+	std::vector<CompiledTilePattern> compiled_patterns_;
+
+	//for each entry in pattern_index_, the compiled patterns whose middle
+	//tile it matches, in the order they are tried.
+	std::vector<std::vector<int>> entry_patterns_;
+
+	//for each entry in pattern_index_, whether all of its patterns only look
+	//at the surrounding 3x3 tiles and have no filter, so that the match only
+	//depends on those tiles.
+	std::vector<bool> entry_patterns_local_;
+
+	//the regex ids of each of multi_patterns_, indexed by y*width + x.
+	std::vector<std::vector<int>> multi_pattern_regex_ids_;
+
 	int getPatternIndexEntry(const tile_string& str);
 
 	//the subset of all multi tile patterns which might be valid for this map.
@@ -128,6 +167,7 @@ private:
 	//to this tile_map.
 	void applyMatchingMultiPattern(int& x, int y,
 		const MultiTilePattern& pattern,
+		const std::vector<int>& regex_ids,
 		point_map<LevelObject*>& mapping,
 		std::map<point_zorder, LevelObject*>& different_zorder_mapping) const;
 
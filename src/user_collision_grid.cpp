@@ -0,0 +1,289 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+
+#include "asserts.hpp"
+#include "random.hpp"
+#include "unit_test.hpp"
+#include "user_collision_grid.hpp"
+
+namespace
+{
+	//an object covering more than this many cells is kept in a separate
+	//list instead of being inserted into every cell it covers.
+	const int MaxCellsPerObject = 64;
+
+	int cell_floor(int n, int cell_size)
+	{
+		return n >= 0 ? n/cell_size : -((-n - 1)/cell_size) - 1;
+	}
+
+	bool share_dimensions(unsigned int a_dims, unsigned int a_weak, unsigned int b_dims, unsigned int b_weak)
+	{
+		return (a_weak&b_dims) != 0 || (a_dims&b_weak) != 0;
+	}
+
+	void add_pair(std::vector<std::pair<int,int> >* pairs, int a, int b)
+	{
+		if(a < b) {
+			pairs->push_back(std::pair<int,int>(a, b));
+		} else {
+			pairs->push_back(std::pair<int,int>(b, a));
+		}
+	}
+}
+
+UserCollisionGrid::UserCollisionGrid(int cell_size)
+	: cell_size_(cell_size), generation_(0)
+{
+	ASSERT_LOG(cell_size_ > 0, "Illegal collision grid cell size: " << cell_size_);
+}
+
+void UserCollisionGrid::beginUpdate()
+{
+	++generation_;
+}
+
+void UserCollisionGrid::add(const void* owner, int index, const rect& bounds, unsigned int collide_dimensions, unsigned int weak_collide_dimensions)
+{
+	auto ins = entries_.insert(std::pair<const void*, Entry>(owner, Entry()));
+	Entry& e = ins.first->second;
+	if(ins.second) {
+		e.bucketed = false;
+		e.oversized = false;
+		e.cx1 = e.cy1 = e.cx2 = e.cy2 = 0;
+	}
+
+	e.index = index;
+	e.generation = generation_;
+	e.bounds = bounds;
+	e.dims = collide_dimensions;
+	e.weak_dims = weak_collide_dimensions;
+
+	if(bounds.empty()) {
+		removeFromCells(&e);
+		return;
+	}
+
+	const int cx1 = cell_floor(bounds.x(), cell_size_);
+	const int cy1 = cell_floor(bounds.y(), cell_size_);
+	const int cx2 = cell_floor(bounds.x2() - 1, cell_size_);
+	const int cy2 = cell_floor(bounds.y2() - 1, cell_size_);
+	const bool oversized = static_cast<int64_t>(cx2 - cx1 + 1)*(cy2 - cy1 + 1) > MaxCellsPerObject;
+
+	if(e.bucketed && e.oversized == oversized && e.cx1 == cx1 && e.cy1 == cy1 && e.cx2 == cx2 && e.cy2 == cy2) {
+		//still covers the same cells, nothing to do.
+		return;
+	}
+
+	removeFromCells(&e);
+
+	e.cx1 = cx1;
+	e.cy1 = cy1;
+	e.cx2 = cx2;
+	e.cy2 = cy2;
+	e.oversized = oversized;
+	insertIntoCells(&e);
+}
+
+void UserCollisionGrid::endUpdate()
+{
+	for(auto i = entries_.begin(); i != entries_.end(); ) {
+		if(i->second.generation != generation_) {
+			removeFromCells(&i->second);
+			i = entries_.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+void UserCollisionGrid::insertIntoCells(Entry* e)
+{
+	if(e->oversized) {
+		oversized_.push_back(e);
+	} else {
+		for(int cy = e->cy1; cy <= e->cy2; ++cy) {
+			for(int cx = e->cx1; cx <= e->cx2; ++cx) {
+				cells_[cellKey(cx, cy)].push_back(e);
+			}
+		}
+	}
+
+	e->bucketed = true;
+}
+
+void UserCollisionGrid::removeFromCells(Entry* e)
+{
+	if(!e->bucketed) {
+		return;
+	}
+
+	if(e->oversized) {
+		auto i = std::find(oversized_.begin(), oversized_.end(), e);
+		ASSERT_LOG(i != oversized_.end(), "Collision grid entry not found in oversized list");
+		*i = oversized_.back();
+		oversized_.pop_back();
+	} else {
+		for(int cy = e->cy1; cy <= e->cy2; ++cy) {
+			for(int cx = e->cx1; cx <= e->cx2; ++cx) {
+				auto cell = cells_.find(cellKey(cx, cy));
+				ASSERT_LOG(cell != cells_.end(), "Collision grid cell not found: " << cx << ", " << cy);
+				std::vector<Entry*>& v = cell->second;
+				auto i = std::find(v.begin(), v.end(), e);
+				ASSERT_LOG(i != v.end(), "Collision grid entry not found in cell: " << cx << ", " << cy);
+				*i = v.back();
+				v.pop_back();
+				if(v.empty()) {
+					cells_.erase(cell);
+				}
+			}
+		}
+	}
+
+	e->bucketed = false;
+}
+
+void UserCollisionGrid::getCandidatePairs(std::vector<std::pair<int,int> >* pairs) const
+{
+	for(const auto& cell : cells_) {
+		const std::vector<Entry*>& v = cell.second;
+		if(v.size() < 2) {
+			continue;
+		}
+
+		const int cx = static_cast<int32_t>(static_cast<uint32_t>(cell.first >> 32));
+		const int cy = static_cast<int32_t>(static_cast<uint32_t>(cell.first));
+
+		for(auto i = v.begin(); i != v.end(); ++i) {
+			const Entry& a = **i;
+			for(auto j = i + 1; j != v.end(); ++j) {
+				const Entry& b = **j;
+				if(!share_dimensions(a.dims, a.weak_dims, b.dims, b.weak_dims)) {
+					continue;
+				}
+
+				//a pair of objects which span several cells will meet in
+				//each of them. Only report the pair from the top-left cell
+				//they have in common.
+				if(std::max(a.cx1, b.cx1) != cx || std::max(a.cy1, b.cy1) != cy) {
+					continue;
+				}
+
+				if(rects_intersect(a.bounds, b.bounds)) {
+					add_pair(pairs, a.index, b.index);
+				}
+			}
+		}
+	}
+
+	for(auto i = oversized_.begin(); i != oversized_.end(); ++i) {
+		const Entry& a = **i;
+		for(auto j = i + 1; j != oversized_.end(); ++j) {
+			const Entry& b = **j;
+			if(share_dimensions(a.dims, a.weak_dims, b.dims, b.weak_dims) && rects_intersect(a.bounds, b.bounds)) {
+				add_pair(pairs, a.index, b.index);
+			}
+		}
+
+		for(const auto& p : entries_) {
+			const Entry& b = p.second;
+			if(!b.bucketed || b.oversized) {
+				continue;
+			}
+
+			if(share_dimensions(a.dims, a.weak_dims, b.dims, b.weak_dims) && rects_intersect(a.bounds, b.bounds)) {
+				add_pair(pairs, a.index, b.index);
+			}
+		}
+	}
+
+	std::sort(pairs->begin(), pairs->end());
+}
+
+void UserCollisionGrid::clear()
+{
+	entries_.clear();
+	cells_.clear();
+	oversized_.clear();
+}
+
+UNIT_TEST(user_collision_grid)
+{
+	struct Obj {
+		rect bounds;
+		unsigned int dims, weak_dims;
+		bool present;
+	};
+
+	std::vector<Obj> objs(300);
+
+	UserCollisionGrid grid(32);
+
+	for(int cycle = 0; cycle != 8; ++cycle) {
+		for(Obj& o : objs) {
+			if(cycle == 0 || rng::generate()%3 == 0) {
+				//mostly small objects, with the odd huge one that will
+				//be too big to bucket.
+				const bool huge = rng::generate()%50 == 0;
+				const int w = huge ? 400 + rng::generate()%400 : 1 + rng::generate()%48;
+				const int h = huge ? 400 + rng::generate()%400 : 1 + rng::generate()%48;
+				o.bounds = rect(static_cast<int>(rng::generate()%1000) - 500, static_cast<int>(rng::generate()%1000) - 500, w, h);
+				o.dims = 1 << (rng::generate()%3);
+				o.weak_dims = o.dims | ((rng::generate()%4 == 0) ? 8 : 0);
+				o.present = rng::generate()%8 != 0;
+			}
+		}
+
+		grid.beginUpdate();
+		for(int n = 0; n != objs.size(); ++n) {
+			if(objs[n].present) {
+				grid.add(&objs[n], n, objs[n].bounds, objs[n].dims, objs[n].weak_dims);
+			}
+		}
+		grid.endUpdate();
+
+		std::vector<std::pair<int,int> > expected;
+		for(int i = 0; i != objs.size(); ++i) {
+			for(int j = i + 1; j != objs.size(); ++j) {
+				const Obj& a = objs[i];
+				const Obj& b = objs[j];
+				if(a.present && b.present && share_dimensions(a.dims, a.weak_dims, b.dims, b.weak_dims) && rects_intersect(a.bounds, b.bounds)) {
+					expected.push_back(std::pair<int,int>(i, j));
+				}
+			}
+		}
+
+		std::vector<std::pair<int,int> > found;
+		grid.getCandidatePairs(&found);
+
+		CHECK_EQ(found.size(), expected.size());
+		CHECK(found == expected, "collision grid pairs differ from brute force");
+	}
+
+	grid.beginUpdate();
+	grid.endUpdate();
+	CHECK_EQ(grid.size(), 0);
+	CHECK_EQ(grid.numCells(), 0);
+}
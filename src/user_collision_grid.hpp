@@ -0,0 +1,94 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "geometry.hpp"
+
+//Broad-phase spatial index used by detect_user_collisions(). Objects are
+//bucketed into a uniform grid of cells based on the bounding rect of their
+//collision areas. The grid persists between cycles and an object is only
+//re-bucketed when the range of cells it covers changes, so objects that
+//stay still or move within a cell cost nothing to maintain.
+//
+//Objects are identified by an opaque owner pointer which is never
+//dereferenced; callers also provide an index which is what is reported
+//back when candidate pairs are found.
+class UserCollisionGrid
+{
+public:
+	enum { DefaultCellSize = 128 };
+
+	explicit UserCollisionGrid(int cell_size=DefaultCellSize);
+
+	//Marks the start of a cycle. Every object which should remain in the grid
+	//must be add()ed before endUpdate() is called.
+	void beginUpdate();
+	void add(const void* owner, int index, const rect& bounds, unsigned int collide_dimensions, unsigned int weak_collide_dimensions);
+
+	//Removes any objects which were not add()ed since beginUpdate().
+	void endUpdate();
+
+	//Finds all pairs of objects which share a collide dimension and whose
+	//bounds intersect. Each pair is reported once as (i, j) with i < j, and
+	//the result is sorted.
+	void getCandidatePairs(std::vector<std::pair<int,int> >* pairs) const;
+
+	void clear();
+
+	int size() const { return static_cast<int>(entries_.size()); }
+	int numCells() const { return static_cast<int>(cells_.size()); }
+private:
+	struct Entry {
+		int index;
+		unsigned int generation;
+		rect bounds;
+		unsigned int dims, weak_dims;
+
+		//inclusive range of cells covered. Only meaningful if bucketed.
+		int cx1, cy1, cx2, cy2;
+		bool bucketed, oversized;
+	};
+
+	static uint64_t cellKey(int cx, int cy) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+	}
+
+	void insertIntoCells(Entry* e);
+	void removeFromCells(Entry* e);
+
+	int cell_size_;
+	unsigned int generation_;
+
+	std::unordered_map<const void*, Entry> entries_;
+	std::unordered_map<uint64_t, std::vector<Entry*> > cells_;
+
+	//objects which cover too many cells to be worth bucketing. These are
+	//tested against everything.
+	std::vector<Entry*> oversized_;
+};
@@ -22,6 +22,7 @@
 */
 
 #include <cmath>
+#include <memory>
 #include <set>
 #include <stdlib.h>
 #include <stdio.h>
@@ -110,8 +111,23 @@ struct VariantThreadInfo {
 	variant last_query_map;
 	variant UnfoundInMapNullVariant;
 	int to_debug_string_depth;
+
+	//released string nodes kept for reuse, so creating short strings,
+	//whose characters fit inside the node, doesn't touch the heap.
+	std::vector<void*> free_strings;
 };
 
+const size_t MaxFreeStrings = 4096;
+
+//maps with fewer entries than this are looked up in their tree alone.
+const size_t MinIndexedMapSize = 8;
+
+size_t string_hash(const std::string& str)
+{
+	const size_t hash = std::hash<std::string>()(str);
+	return hash != 0 ? hash : 1;
+}
+
 THREAD_LOCAL VariantThreadInfo *g_variant_thread_info;
 
 struct ToDebugStringDepthContext {
@@ -135,6 +151,19 @@ void variant::registerThread()
 
 void variant::unregisterThread()
 {
+	if(g_variant_thread_info) {
+		//detach the info first: destroying its variant members frees
+		//strings, which must not go back onto the free list being destroyed.
+		VariantThreadInfo* info = g_variant_thread_info;
+		g_variant_thread_info = nullptr;
+
+		for(void* p : info->free_strings) {
+			::operator delete(p);
+		}
+
+		info->free_strings.clear();
+		delete info;
+	}
 }
 
 void init_call_stack(int min_size)
@@ -332,27 +361,79 @@ struct variant_list : public GarbageCollectible {
 	std::vector<variant>::iterator begin, end;
 };
 
-struct variant_string {
+//The parts of a string most strings never use, kept out of variant_string
+//so the node stays small.
+struct variant_string_extra {
 	variant::debug_info info;
 	ffl::IntrusivePtr<const game_logic::FormulaExpression> expression;
+	std::string translated_from;
+	std::vector<const game_logic::Formula*> formulae_using_this;
+};
 
-	variant_string() : refcount(0), str_len(0)
-	{}
-	variant_string(const variant_string& o) : str(o.str), translated_from(o.translated_from), refcount(1), str_len(o.str_len)
+struct variant_string {
+	variant_string() : refcount(0), str_len(0), hash(0)
 	{}
-	explicit variant_string(const std::string& s) : str(s), refcount(0) {
+	variant_string(const variant_string& o) : str(o.str), refcount(1), str_len(o.str_len), hash(o.hash)
+	{
+		if(o.extra && !o.extra->translated_from.empty()) {
+			mutable_extra().translated_from = o.extra->translated_from;
+		}
+	}
+	explicit variant_string(const std::string& s) : str(s), refcount(0), hash(0) {
 		str_len = utils::str_len_utf8(str);
 	}
 
-	std::string str, translated_from;
-	IntRefCount refcount;
+	static void* operator new(size_t sz) {
+		if(sz == sizeof(variant_string) && g_variant_thread_info && !g_variant_thread_info->free_strings.empty()) {
+			void* result = g_variant_thread_info->free_strings.back();
+			g_variant_thread_info->free_strings.pop_back();
+			return result;
+		}
 
-	std::vector<const game_logic::Formula*> formulae_using_this;
+		return ::operator new(sz);
+	}
+
+	static void operator delete(void* p) {
+		if(g_variant_thread_info && g_variant_thread_info->free_strings.size() < MaxFreeStrings) {
+			g_variant_thread_info->free_strings.push_back(p);
+			return;
+		}
+
+		::operator delete(p);
+	}
+
+	variant_string_extra& mutable_extra() {
+		if(!extra) {
+			extra.reset(new variant_string_extra);
+		}
+
+		return *extra;
+	}
+
+	size_t get_hash() const {
+		if(hash == 0) {
+			hash = string_hash(str);
+		}
+
+		return hash;
+	}
+
+	const std::string* translated_from() const {
+		return extra && !extra->translated_from.empty() ? &extra->translated_from : nullptr;
+	}
+
+	std::string str;
+	IntRefCount refcount;
 
 	//number of characters. Might not be equal to str.size() if the string contains
 	//extended utf-8 characters.
 	size_t str_len;
 
+	//hash of str for map lookups, or 0 until it's first needed.
+	mutable size_t hash;
+
+	std::unique_ptr<variant_string_extra> extra;
+
 	private:
 	void operator=(const variant_string&);
 };
@@ -361,13 +442,56 @@ struct variant_map : public GarbageCollectible {
 	variant::debug_info info;
 	ffl::IntrusivePtr<const game_logic::FormulaExpression> expression;
 
-	variant_map() : GarbageCollectible(), modcount(0)
+	variant_map() : GarbageCollectible(), modcount(0), index_count(0)
 	{
 	}
-	variant_map(const variant_map& o) : GarbageCollectible(o), expression(o.expression), elements(o.elements), modcount(0)
+	variant_map(const variant_map& o) : GarbageCollectible(o), expression(o.expression), elements(o.elements), modcount(0), index_count(0)
 	{
 	}
 
+	typedef std::pair<const variant,variant> Node;
+
+	const Node* find(const variant& key) const {
+#if !defined(MT_FFL)
+		if(key.type_ == variant::VARIANT_TYPE_STRING && elements.size() >= MinIndexedMapSize) {
+			return find_string(key.string_->str, key.string_->get_hash());
+		}
+#endif
+
+		auto i = elements.find(key);
+		return i == elements.end() ? nullptr : &*i;
+	}
+
+	const Node* find(const std::string& key) const {
+#if !defined(MT_FFL)
+		if(elements.size() >= MinIndexedMapSize) {
+			return find_string(key, string_hash(key));
+		}
+#endif
+
+		auto i = elements.find(variant(key));
+		return i == elements.end() ? nullptr : &*i;
+	}
+
+	Node* find_mutable(const variant& key) {
+		return const_cast<Node*>(find(key));
+	}
+
+	void set(const variant& key, const variant& value) {
+		auto result = elements.insert(Node(key, value));
+		if(result.second) {
+			index_insert(*result.first);
+		} else {
+			result.first->second = value;
+		}
+	}
+
+	void erase(const variant& key) {
+		if(elements.erase(key)) {
+			index.clear();
+		}
+	}
+
 	~variant_map()
 	{
 	}
@@ -409,6 +533,83 @@ struct variant_map : public GarbageCollectible {
 	int modcount;
 private:
 	void operator=(const variant_map&);
+
+	//Open addressing index of the string keys in elements, built by the
+	//first string lookup once the map is big enough, so those don't walk
+	//the tree comparing variants. It points at elements' nodes, which
+	//stay put while they're in the map. Unused with threaded FFL, since
+	//lookups on a shared map would race to build it.
+	struct IndexEntry {
+		size_t hash;
+		const Node* node;
+	};
+
+	mutable std::vector<IndexEntry> index;
+	mutable size_t index_count;
+
+	const Node* find_string(const std::string& key, size_t hash) const {
+		if(index.empty()) {
+			build_index();
+		}
+
+		const size_t mask = index.size() - 1;
+		for(size_t n = hash & mask;; n = (n+1) & mask) {
+			const IndexEntry& entry = index[n];
+			if(entry.node == nullptr) {
+				return nullptr;
+			}
+
+			if(entry.hash == hash && entry.node->first.string_->str == key) {
+				return entry.node;
+			}
+		}
+	}
+
+	void build_index() const {
+		size_t nstrings = 0;
+		for(const Node& node : elements) {
+			if(node.first.is_string()) {
+				++nstrings;
+			}
+		}
+
+		size_t capacity = 16;
+		while(capacity < nstrings*2) {
+			capacity *= 2;
+		}
+
+		const IndexEntry empty = { 0, nullptr };
+		index.assign(capacity, empty);
+		index_count = 0;
+
+		for(const Node& node : elements) {
+			index_insert(node);
+		}
+	}
+
+	//adds a new node to the index if it's been built. Past half full the
+	//index is dropped, to be rebuilt bigger by the next lookup.
+	void index_insert(const Node& node) const {
+		if(index.empty() || !node.first.is_string()) {
+			return;
+		}
+
+		if((index_count+1)*2 > index.size()) {
+			index.clear();
+			return;
+		}
+
+		const size_t hash = node.first.string_->get_hash();
+		const size_t mask = index.size() - 1;
+		size_t n = hash & mask;
+		while(index[n].node != nullptr) {
+			n = (n+1) & mask;
+		}
+
+		index[n].hash = hash;
+		index[n].node = &node;
+		++index_count;
+	}
 };
 
 struct variant_fn : public GarbageCollectible {
@@ -636,7 +837,9 @@ const game_logic::FormulaExpression* variant::get_source_expression() const
 {
 	switch(type_) {
 	case VARIANT_TYPE_LIST:
+		return list_ ? list_->expression.get() : nullptr;
 	case VARIANT_TYPE_STRING:
+		return string_->extra ? string_->extra->expression.get() : nullptr;
 	case VARIANT_TYPE_MAP:
 		return map_->expression.get();
 	default:
@@ -650,7 +853,13 @@ void variant::set_source_expression(const game_logic::FormulaExpression* expr)
 {
 	switch(type_) {
 	case VARIANT_TYPE_LIST:
+		if(list_) list_->expression.reset(expr);
+		break;
 	case VARIANT_TYPE_STRING:
+		if(expr || string_->extra) {
+			string_->mutable_extra().expression.reset(expr);
+		}
+		break;
 	case VARIANT_TYPE_MAP:
 		map_->expression.reset(expr);
 		break;
@@ -666,7 +875,9 @@ void variant::setDebugInfo(const debug_info& info)
 		if(list_) list_->info = info;
 		break;
 	case VARIANT_TYPE_STRING:
-		string_->info = info;
+		if(info.filename || string_->extra) {
+			string_->mutable_extra().info = info;
+		}
 		break;
 	case VARIANT_TYPE_MAP:
 		map_->info = info;
@@ -683,7 +894,7 @@ const variant::debug_info* variant::get_debug_info() const
 		if(list_ && list_->info.filename) { return &list_->info; }
 		break;
 	case VARIANT_TYPE_STRING:
-		if(string_->info.filename) { return &string_->info; }
+		if(string_->extra && string_->extra->info.filename) { return &string_->extra->info; }
 		break;
 	case VARIANT_TYPE_MAP:
 		if(map_->info.filename) { return &map_->info; }
@@ -799,10 +1010,15 @@ variant variant::create_translated_string(const std::string& str)
 variant variant::create_translated_string(const std::string& str, const std::string& translation)
 {
 	variant v(translation);
-	v.string_->translated_from = str;
+	v.string_->mutable_extra().translated_from = str;
 	return v;
 }
 
+const std::string* variant::get_translated_from() const
+{
+	return type_ == VARIANT_TYPE_STRING ? string_->translated_from() : nullptr;
+}
+
 variant::variant(std::map<variant,variant>* map)
     : type_(VARIANT_TYPE_MAP)
 {
@@ -917,22 +1133,6 @@ variant::variant(game_logic::ConstFormulaPtr fml, const std::vector<std::string>
 }
 */
 
-const variant& variant::operator=(const variant& v)
-{
-	if(&v != this) {
-		if (type_ > VARIANT_TYPE_DECIMAL) {
-			release();
-		}
-
-		type_ = v.type_;
-		value_ = v.value_;
-		if (type_ > VARIANT_TYPE_DECIMAL) {
-			increment_refcount();
-		}
-	}
-	return *this;
-}
-
 const variant& variant::operator[](size_t n) const
 {
 	if(type_ == VARIANT_TYPE_CALLABLE) {
@@ -957,8 +1157,8 @@ const variant& variant::operator[](const variant& v) const
 
 	if(type_ == VARIANT_TYPE_MAP) {
 		assert(map_);
-		std::map<variant,variant>::const_iterator i = map_->elements.find(v);
-		if (i == map_->elements.end())
+		const variant_map::Node* i = map_->find(v);
+		if (i == nullptr)
 		{
 			g_variant_thread_info->last_failed_query_map = *this;
 			g_variant_thread_info->last_failed_query_key = v;
@@ -983,6 +1183,18 @@ const variant& variant::operator[](const variant& v) const
 
 const variant& variant::operator[](const std::string& key) const
 {
+	if(type_ == VARIANT_TYPE_MAP) {
+		const variant_map::Node* i = map_->find(key);
+		if(i == nullptr) {
+			g_variant_thread_info->last_failed_query_map = *this;
+			g_variant_thread_info->last_failed_query_key = variant(key);
+			return g_variant_thread_info->UnfoundInMapNullVariant;
+		}
+
+		g_variant_thread_info->last_query_map = *this;
+		return i->second;
+	}
+
 	return (*this)[variant(key)];
 }
 
@@ -992,17 +1204,18 @@ bool variant::has_key(const variant& key) const
 		return false;
 	}
 
-	std::map<variant,variant>::const_iterator i = map_->elements.find(key);
-	if(i != map_->elements.end() && i->second.is_null() == false) {
-		return true;
-	} else {
-		return false;
-	}
+	const variant_map::Node* i = map_->find(key);
+	return i != nullptr && i->second.is_null() == false;
 }
 
 bool variant::has_key(const std::string& key) const
 {
-	return has_key(variant(key));
+	if(type_ != VARIANT_TYPE_MAP) {
+		return false;
+	}
+
+	const variant_map::Node* i = map_->find(key);
+	return i != nullptr && i->second.is_null() == false;
 }
 
 variant variant::getKeys() const
@@ -1595,7 +1808,7 @@ variant variant::add_attr(variant key, variant value)
 		}
 
 		make_unique();
-		map_->elements[key] = value;
+		map_->set(key, value);
 		return *this;
 	} else {
 		return variant();
@@ -1614,7 +1827,7 @@ variant variant::remove_attr(variant key)
 		}
 
 		make_unique();
-		map_->elements.erase(key);
+		map_->erase(key);
 		return *this;
 	} else {
 		return variant();
@@ -1624,7 +1837,7 @@ variant variant::remove_attr(variant key)
 void variant::add_attr_mutation(variant key, variant value)
 {
 	if(is_map()) {
-		map_->elements[key] = value;
+		map_->set(key, value);
 		map_->modcount++;
 	}
 }
@@ -1632,7 +1845,7 @@ void variant::add_attr_mutation(variant key, variant value)
 void variant::remove_attr_mutation(variant key)
 {
 	if(is_map()) {
-		map_->elements.erase(key);
+		map_->erase(key);
 		map_->modcount++;
 	}
 }
@@ -1640,8 +1853,8 @@ void variant::remove_attr_mutation(variant key)
 variant* variant::get_attr_mutable(variant key)
 {
 	if(is_map()) {
-		std::map<variant,variant>::iterator i = map_->elements.find(key);
-		if(i != map_->elements.end()) {
+		variant_map::Node* i = map_->find_mutable(key);
+		if(i != nullptr) {
 			map_->modcount++;
 			return &i->second;
 		}
@@ -2948,8 +3161,9 @@ void variant::write_json(std::ostream& s, unsigned int flags) const
 		return;
 	}
 	case VARIANT_TYPE_STRING: {
-		const std::string& str = string_->translated_from.empty() ? string_->str : string_->translated_from;
-		const char delim = string_->translated_from.empty() ? '"' : '~';
+		const std::string* translated_from = string_->translated_from();
+		const std::string& str = translated_from ? *translated_from : string_->str;
+		const char delim = translated_from ? '~' : '"';
 		if(std::count(str.begin(), str.end(), '\\') 
 			|| std::count(str.begin(), str.end(), delim) 
 			|| ((flags&JSON_COMPLIANT) && std::count(str.begin(), str.end(), '\n'))) {
@@ -3136,21 +3350,31 @@ void variant::write_json_pretty(std::ostream& s, std::string indent, unsigned in
 void variant::add_formula_using_this(const game_logic::Formula* f)
 {
 	if(is_string()) {
-		string_->formulae_using_this.push_back(f);
+		string_->mutable_extra().formulae_using_this.push_back(f);
 	}
 }
 
 void variant::remove_formula_using_this(const game_logic::Formula* f)
 {
 	if(is_string()) {
-		string_->formulae_using_this.erase(std::remove(string_->formulae_using_this.begin(), string_->formulae_using_this.end(), f), string_->formulae_using_this.end());
+		if(string_->extra) {
+			std::vector<const game_logic::Formula*>& formulae = string_->extra->formulae_using_this;
+			formulae.erase(std::remove(formulae.begin(), formulae.end(), f), formulae.end());
+		}
 	}
 }
 
 const std::vector<const game_logic::Formula*>* variant::formulae_using_this() const
 {
 	if(is_string()) {
-		return &string_->formulae_using_this;
+		if(string_->extra) {
+			return &string_->extra->formulae_using_this;
+		}
+
+		//strings without extra data have no formulae, and reading shouldn't
+		//allocate one.
+		static const std::vector<const game_logic::Formula*> empty_formulae;
+		return &empty_formulae;
 	} else {
 		return nullptr;
 	}
@@ -3210,6 +3434,143 @@ BENCHMARK(variant_assign)
 	}
 }
 
+BENCHMARK(variant_assign_string)
+{
+	variant v("abc");
+	std::vector<variant> vec(1000);
+	BENCHMARK_LOOP {
+		for(int n = 0; n != vec.size(); ++n) {
+			vec[n] = v;
+		}
+	}
+}
+
+BENCHMARK(construct_short_string_variant)
+{
+	const std::string str = "short";
+	BENCHMARK_LOOP {
+		variant v(str);
+	}
+}
+
+UNIT_TEST(variant_string_node)
+{
+	variant str("abc");
+	CHECK(str.get_debug_info() == nullptr, "new strings have no debug info");
+	CHECK(str.formulae_using_this() != nullptr && str.formulae_using_this()->empty(), "strings have an empty list of formulae");
+
+	static const std::string filename = "test.cfg";
+	variant::debug_info info;
+	info.filename = &filename;
+	info.line = 3;
+	str.setDebugInfo(info);
+	CHECK(str.get_debug_info() != nullptr && str.get_debug_info()->line == 3, "string lost its debug info");
+
+	variant copy = str;
+	copy.make_unique();
+	CHECK_EQ(copy.as_string(), "abc");
+	CHECK(copy.get_debug_info() == nullptr, "unique copies of strings don't keep debug info");
+
+	variant translated = variant::create_translated_string("abc", "xyz");
+	CHECK_EQ(translated.as_string(), "xyz");
+}
+
+namespace {
+	std::vector<variant> map_test_keys(int size)
+	{
+		std::vector<variant> keys;
+		for(int n = 0; n != size; ++n) {
+			keys.push_back(variant("key" + boost::lexical_cast<std::string>(n)));
+		}
+
+		return keys;
+	}
+
+	variant map_test_map(const std::vector<variant>& keys)
+	{
+		std::map<variant,variant> m;
+		for(int n = 0; n != static_cast<int>(keys.size()); ++n) {
+			m[keys[n]] = variant(n);
+		}
+
+		return variant(&m);
+	}
+}
+
+UNIT_TEST(variant_map_string_index)
+{
+	const std::vector<variant> keys = map_test_keys(100);
+	variant m = map_test_map(keys);
+	for(int n = 0; n != static_cast<int>(keys.size()); ++n) {
+		CHECK_EQ(m[keys[n]], variant(n));
+		CHECK_EQ(m[keys[n].as_string()], variant(n));
+	}
+
+	CHECK(m["missing"].is_null(), "found a missing key");
+	CHECK(!m.has_key("missing"), "found a missing key");
+
+	//keys added and removed after the index is built.
+	for(int n = 100; n != 200; ++n) {
+		m.add_attr_mutation(variant("key" + boost::lexical_cast<std::string>(n)), variant(n));
+	}
+
+	m.remove_attr_mutation(variant("key5"));
+	CHECK_EQ(m["key150"], variant(150));
+	CHECK_EQ(m["key99"], variant(99));
+	CHECK(!m.has_key("key5"), "removed key still found");
+	CHECK_EQ(m.num_elements(), 199);
+
+	//iteration stays in key order.
+	CHECK_EQ(m.as_map().begin()->first, variant("key0"));
+}
+
+BENCHMARK_ARG(variant_map_lookup, int size)
+{
+	const std::vector<variant> keys = map_test_keys(size);
+	const variant m = map_test_map(keys);
+	BENCHMARK_LOOP {
+		for(int n = 0; n < 64; ++n) {
+			m[keys[n % keys.size()]];
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(variant_map_lookup, lookup_4, 4);
+BENCHMARK_ARG_CALL(variant_map_lookup, lookup_64, 64);
+BENCHMARK_ARG_CALL(variant_map_lookup, lookup_1024, 1024);
+BENCHMARK_ARG_CALL(variant_map_lookup, lookup_10000, 10000);
+
+BENCHMARK_ARG(variant_map_insert, int size)
+{
+	const std::vector<variant> keys = map_test_keys(size);
+	BENCHMARK_LOOP {
+		std::map<variant,variant> empty;
+		variant m(&empty);
+		for(int n = 0; n != size; ++n) {
+			m.add_attr_mutation(keys[n], variant(n));
+			m[keys[n/2]];
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(variant_map_insert, insert_4, 4);
+BENCHMARK_ARG_CALL(variant_map_insert, insert_64, 64);
+BENCHMARK_ARG_CALL(variant_map_insert, insert_1024, 1024);
+BENCHMARK_ARG_CALL(variant_map_insert, insert_10000, 10000);
+
+BENCHMARK_ARG(variant_map_write_json, int size)
+{
+	const variant m = map_test_map(map_test_keys(size));
+	BENCHMARK_LOOP {
+		m.write_json();
+	}
+}
+
+BENCHMARK_ARG_CALL(variant_map_write_json, json_4, 4);
+BENCHMARK_ARG_CALL(variant_map_write_json, json_64, 64);
+BENCHMARK_ARG_CALL(variant_map_write_json, json_1024, 1024);
+BENCHMARK_ARG_CALL(variant_map_write_json, json_10000, 10000);
+
 /**  Log (debug) unit test variable name and value. */
 #define LOG_DEBUG_UT_VAR(test_name, variable_suffix, variable_name)         \
 	LOG_DEBUG(                                                          \
@@ -125,6 +125,8 @@ public:
 
 	friend class GarbageCollectorImpl;
 	friend class GarbageCollectorAnalyzer;
+	friend class IncrementalGarbageCollector;
+	friend struct variant_map;
 
 	static void registerThread();
 	static void unregisterThread();
@@ -154,6 +156,10 @@ public:
 	explicit variant(const std::string& str);
 	static variant create_translated_string(const std::string& str);
 	static variant create_translated_string(const std::string& str, const std::string& translation);
+
+	//the untranslated text of a string made by create_translated_string(),
+	//or nullptr for any other variant.
+	const std::string* get_translated_from() const;
 	explicit variant(std::map<variant,variant>* map);
 	variant(const variant& formula_var, const game_logic::FormulaCallable& callable, int base_slot, const VariantFunctionTypeInfoPtr& type_info, const std::vector<std::string>& types, std::function<game_logic::ConstFormulaPtr(const std::vector<variant_type_ptr>&)> factory);
 	variant(const game_logic::ConstFormulaPtr& formula, const game_logic::FormulaCallable& callable, int base_slot, const VariantFunctionTypeInfoPtr& type_info);
@@ -214,7 +220,23 @@ public:
 		return *this;
 	}
 
-	const variant& operator=(const variant& v);
+	//inline since copying scalars, the common case in FFL, only copies
+	//two words.
+	const variant& operator=(const variant& v)
+	{
+		if(&v != this) {
+			if (type_ > VARIANT_TYPE_DECIMAL) {
+				release();
+			}
+
+			type_ = v.type_;
+			value_ = v.value_;
+			if (type_ > VARIANT_TYPE_DECIMAL) {
+				increment_refcount();
+			}
+		}
+		return *this;
+	}
 
 	void swap(variant& v) {
 		if(type_ == VARIANT_TYPE_CALLABLE_LOADING || type_ == VARIANT_TYPE_DELAYED ||
@@ -497,6 +519,12 @@ private:
 	void release();
 };
 
+//variants are copied constantly, so they stay two words: a type tag and
+//either a scalar or a pointer to a reference counted node. Short strings
+//and points can't be stored inline, since as_string() and as_list_ref()
+//hand out references to a std::string and a std::vector.
+static_assert(sizeof(variant) <= 16, "variant should be no more than 16 bytes");
+
 std::ostream& operator<<(std::ostream& os, const variant& v);
 
 typedef std::pair<variant,variant> variant_pair;
@@ -0,0 +1,400 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <sstream>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "asserts.hpp"
+#include "compress.hpp"
+#include "formatter.hpp"
+#include "preprocessor.hpp"
+#include "unit_test.hpp"
+#include "variant_binary.hpp"
+#include "wml_formula_callable.hpp"
+
+namespace variant_binary
+{
+	namespace
+	{
+		const char Version = 1;
+
+		enum TAG { TAG_NULL, TAG_FALSE, TAG_TRUE, TAG_INT, TAG_DECIMAL, TAG_STRING, TAG_STRING_REF, TAG_LIST, TAG_MAP };
+
+		//tags from here up are the integers 0, 1, 2, ... in a single byte.
+		const int SmallIntTag = 0x20;
+		const int MaxSmallInt = 0xff - SmallIntTag;
+
+		uint64_t zigzag(int64_t n)
+		{
+			return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+		}
+
+		int64_t unzigzag(uint64_t n)
+		{
+			return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1);
+		}
+
+		class Encoder
+		{
+		public:
+			explicit Encoder(std::string* out) : out_(out)
+			{}
+
+			void write(const variant& v)
+			{
+				switch(v.type()) {
+				case variant::VARIANT_TYPE_NULL:
+					out_->push_back(TAG_NULL);
+					break;
+				case variant::VARIANT_TYPE_BOOL:
+					out_->push_back(v.as_bool() ? TAG_TRUE : TAG_FALSE);
+					break;
+				case variant::VARIANT_TYPE_INT: {
+					const int n = v.as_int();
+					if(n >= 0 && n <= MaxSmallInt) {
+						out_->push_back(static_cast<char>(SmallIntTag + n));
+					} else {
+						out_->push_back(TAG_INT);
+						write_varint(zigzag(n));
+					}
+					break;
+				}
+				case variant::VARIANT_TYPE_DECIMAL:
+					out_->push_back(TAG_DECIMAL);
+					write_varint(zigzag(v.as_decimal().value()));
+					break;
+				case variant::VARIANT_TYPE_STRING:
+					write_string(v.as_string());
+					break;
+				case variant::VARIANT_TYPE_LIST: {
+					const int n = v.num_elements();
+					out_->push_back(TAG_LIST);
+					write_varint(n);
+					for(int i = 0; i != n; ++i) {
+						write(v[i]);
+					}
+					break;
+				}
+				case variant::VARIANT_TYPE_MAP: {
+					const std::map<variant,variant>& m = v.as_map();
+					out_->push_back(TAG_MAP);
+					write_varint(m.size());
+					for(const auto& p : m) {
+						write(p.first);
+						write(p.second);
+					}
+					break;
+				}
+				default:
+					ASSERT_LOG(false, "Cannot encode a " << variant::variant_type_to_string(v.type()) << " in a binary message");
+				}
+			}
+
+		private:
+			void write_varint(uint64_t n)
+			{
+				while(n >= 0x80) {
+					out_->push_back(static_cast<char>((n & 0x7f) | 0x80));
+					n >>= 7;
+				}
+
+				out_->push_back(static_cast<char>(n));
+			}
+
+			void write_string(const std::string& s)
+			{
+				auto itor = strings_.find(s);
+				if(itor != strings_.end()) {
+					out_->push_back(TAG_STRING_REF);
+					write_varint(itor->second);
+					return;
+				}
+
+				const int index = static_cast<int>(strings_.size());
+				strings_[s] = index;
+
+				out_->push_back(TAG_STRING);
+				write_varint(s.size());
+				out_->append(s);
+			}
+
+			std::string* out_;
+			std::unordered_map<std::string, int> strings_;
+		};
+
+		class Decoder
+		{
+		public:
+			Decoder(const std::string& msg, bool preprocess)
+			  : p_(msg.data() + 2), end_(msg.data() + msg.size()), preprocess_(preprocess)
+			{}
+
+			variant read()
+			{
+				const uint8_t tag = read_byte();
+				if(tag >= SmallIntTag) {
+					return variant(static_cast<int>(tag - SmallIntTag));
+				}
+
+				switch(tag) {
+				case TAG_NULL:
+					return variant();
+				case TAG_FALSE:
+					return variant::from_bool(false);
+				case TAG_TRUE:
+					return variant::from_bool(true);
+				case TAG_INT:
+					return variant(static_cast<int>(unzigzag(read_varint())));
+				case TAG_DECIMAL:
+					return variant(decimal::from_raw_value(unzigzag(read_varint())));
+				case TAG_STRING: {
+					const uint64_t len = read_varint();
+					ASSERT_LOG(len <= static_cast<uint64_t>(end_ - p_), "Truncated string in binary message");
+					strings_.push_back(variant(std::string(p_, p_ + len)));
+					p_ += len;
+					return finish_string(strings_.back());
+				}
+				case TAG_STRING_REF: {
+					const uint64_t index = read_varint();
+					ASSERT_LOG(index < strings_.size(), "Bad string reference in binary message: " << index);
+					return finish_string(strings_[index]);
+				}
+				case TAG_LIST: {
+					const uint64_t n = read_varint();
+					ASSERT_LOG(n <= static_cast<uint64_t>(end_ - p_), "Bad list size in binary message: " << n);
+					std::vector<variant> items;
+					items.reserve(n);
+					for(uint64_t i = 0; i != n; ++i) {
+						items.push_back(read());
+					}
+					return variant(&items);
+				}
+				case TAG_MAP: {
+					const uint64_t n = read_varint();
+					ASSERT_LOG(n <= static_cast<uint64_t>(end_ - p_), "Bad map size in binary message: " << n);
+					std::map<variant,variant> m;
+					for(uint64_t i = 0; i != n; ++i) {
+						const variant key = read();
+						const variant value = read();
+
+						//keys were written in order, so each goes at the end.
+						m.insert(m.end(), std::pair<variant,variant>(key, value));
+					}
+
+					variant res(&m);
+					if(preprocess_) {
+						game_logic::WmlSerializableFormulaCallable::deserializeObj(res, &res);
+					}
+					return res;
+				}
+				default:
+					ASSERT_LOG(false, "Unknown tag in binary message: " << static_cast<int>(tag));
+					return variant();
+				}
+			}
+
+			bool at_end() const { return p_ == end_; }
+
+		private:
+			uint8_t read_byte()
+			{
+				ASSERT_LOG(p_ != end_, "Truncated binary message");
+				return static_cast<uint8_t>(*p_++);
+			}
+
+			uint64_t read_varint()
+			{
+				uint64_t n = 0;
+				for(int shift = 0; ; shift += 7) {
+					ASSERT_LOG(shift < 64, "Bad varint in binary message");
+					const uint8_t b = read_byte();
+					n |= static_cast<uint64_t>(b & 0x7f) << shift;
+					if((b & 0x80) == 0) {
+						return n;
+					}
+				}
+			}
+
+			//strings starting with @ are what json::parse preprocesses.
+			variant finish_string(const variant& s) const
+			{
+				if(preprocess_ && s.as_string().empty() == false && s.as_string()[0] == '@') {
+					return preprocess_string_value(s.as_string());
+				}
+
+				return s;
+			}
+
+			const char* p_;
+			const char* end_;
+			bool preprocess_;
+			std::vector<variant> strings_;
+		};
+	}
+
+	bool is_binary(const std::string& msg)
+	{
+		return msg.empty() == false && msg[0] == Magic;
+	}
+
+	std::string encode(const variant& v)
+	{
+		std::string res;
+		res.push_back(Magic);
+		res.push_back(Version);
+		Encoder(&res).write(v);
+		return res;
+	}
+
+	variant decode(const std::string& msg, json::JSON_PARSE_OPTIONS options)
+	{
+		ASSERT_LOG(msg.size() >= 2 && is_binary(msg), "Not a binary message");
+		ASSERT_LOG(msg[1] == Version, "Unsupported binary message version: " << static_cast<int>(msg[1]));
+
+		Decoder decoder(msg, options == json::JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
+		variant res = decoder.read();
+		ASSERT_LOG(decoder.at_end(), "Trailing data in binary message");
+		return res;
+	}
+
+	variant parse(const std::string& msg, json::JSON_PARSE_OPTIONS options)
+	{
+		if(is_binary(msg)) {
+			return decode(msg, options);
+		}
+
+		return json::parse(msg, options);
+	}
+
+	std::string from_json(const std::string& msg)
+	{
+		if(is_binary(msg)) {
+			return msg;
+		}
+
+		return encode(json::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR));
+	}
+}
+
+namespace
+{
+	//a game message shaped like what tbs::game::write() sends.
+	std::string sample_game_message()
+	{
+		static const char* const Names[] = { "goblin", "knight", "archer", "wizard" };
+
+		std::ostringstream s;
+		s << "{\"id\": 17, \"type\": \"game\", \"game_type\": \"citadel\", \"started\": true, \"state_id\": 58, "
+		     "\"observers\": [], \"nplayer\": 0, \"players\": [\"alice\", \"bob\"], \"log\": \"alice moved\", "
+		     "\"serialized_objects\": {\"character\": [";
+
+		for(int n = 0; n != 300; ++n) {
+			if(n) {
+				s << ", ";
+			}
+
+			s << "{\"@class\": \"creature\", \"_uuid\": \"" << std::hex << (0x4d3c2b1a00000000ULL + n*2654435761ULL) << std::dec << "0000000000000000\", "
+			     "\"state\": {\"name\": \"" << Names[n%4] << "\", \"owner\": " << (n%2) << ", \"hitpoints\": " << (n*7%40) << ", "
+			     "\"loc\": [" << (n%17) << ", " << (n%13) << "], \"speed\": " << (n%3) << ".5, \"experience\": " << (n*1013) << ", "
+			     "\"abilities\": [\"melee\", \"" << (n%2 ? "swift" : "armored") << "\"]}}";
+		}
+
+		s << "]}}";
+		return s.str();
+	}
+}
+
+UNIT_TEST(variant_binary_roundtrip)
+{
+	const char* const Docs[] = {
+		"null", "true", "[false, 0, 223, 224, -1, 2147483647, -2147483648]",
+		"[1.5, -0.000001, 123456.75, \"\", \"abc\", \"abc\", [], {}]",
+		"{\"a\": {\"b\": [1, {\"a\": \"b\"}]}, \"b\": \"a\", \"@x\": null}",
+	};
+
+	for(const char* doc : Docs) {
+		const variant v = json::parse(doc, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+		const std::string msg = variant_binary::encode(v);
+		CHECK(variant_binary::is_binary(msg), "Encoded message must be recognized as binary");
+		CHECK_EQ(variant_binary::decode(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR).write_json(), v.write_json());
+	}
+
+	const std::string game = sample_game_message();
+	CHECK(!variant_binary::is_binary(game), "JSON must not be taken for binary");
+	CHECK_EQ(variant_binary::parse(variant_binary::from_json(game), json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR).write_json(),
+	         json::parse(game, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR).write_json());
+}
+
+UNIT_TEST(variant_binary_rejects_truncated_messages)
+{
+	const std::string msg = variant_binary::from_json(sample_game_message());
+	for(size_t len = 2; len < msg.size(); len += msg.size()/7) {
+		bool excepted = false;
+		{
+			const assert_recover_scope unit_test_exception_expected;
+			try {
+				variant_binary::decode(msg.substr(0, len), json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+			} catch(const validation_failure_exception&) {
+				excepted = true;
+			}
+		}
+		CHECK(excepted, "Truncated message of " << len << " bytes decoded");
+	}
+}
+
+UNIT_TEST(variant_binary_message_size)
+{
+	const std::string json_msg = sample_game_message();
+	const std::string binary_msg = variant_binary::from_json(json_msg);
+	LOG_INFO("game message: " << json_msg.size() << " bytes as JSON, " << binary_msg.size() << " bytes binary; deflated "
+	         << zip::compress(json_msg).size() << " vs " << zip::compress(binary_msg).size());
+	CHECK(binary_msg.size()*3 < json_msg.size()*2, "Binary message of " << binary_msg.size() << " bytes is not much smaller than " << json_msg.size() << " bytes of JSON");
+}
+
+BENCHMARK_ARG(tbs_wire_encode, const std::string& format)
+{
+	const variant v = json::parse(sample_game_message(), json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+	BENCHMARK_LOOP {
+		if(format == "binary") {
+			variant_binary::encode(v);
+		} else {
+			v.write_json();
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(tbs_wire_encode, write_json, "json");
+BENCHMARK_ARG_CALL(tbs_wire_encode, encode_binary, "binary");
+
+BENCHMARK_ARG(tbs_wire_decode, const std::string& format)
+{
+	const std::string json_msg = sample_game_message();
+	const std::string msg = format == "binary" ? variant_binary::from_json(json_msg) : json_msg;
+	BENCHMARK_LOOP {
+		variant_binary::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+	}
+}
+
+BENCHMARK_ARG_CALL(tbs_wire_decode, parse_json, "json");
+BENCHMARK_ARG_CALL(tbs_wire_decode, decode_binary, "binary");
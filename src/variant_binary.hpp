@@ -0,0 +1,57 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+
+#include "json_parser.hpp"
+#include "variant.hpp"
+
+//A compact binary encoding of plain variant trees -- maps, lists, strings,
+//numbers, bools and null -- which TBS connections can use on the wire
+//instead of JSON. Values are tagged with a byte, integers are varints and
+//each string is sent once; later uses of it refer back to the first.
+namespace variant_binary
+{
+	//every encoded message starts with this byte. It can't begin a JSON
+	//document, so the two formats can be told apart.
+	static const char Magic = '\xb1';
+
+	//the MIME type TBS clients accept to ask for binary messages.
+	static const char* const MimeType = "application/x-anura-variant";
+
+	bool is_binary(const std::string& msg);
+
+	std::string encode(const variant& v);
+
+	//with USE_PREPROCESSOR strings and maps are preprocessed the way
+	//json::parse does it, so serialized objects come back as objects.
+	variant decode(const std::string& msg, json::JSON_PARSE_OPTIONS options=json::JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
+
+	//parses a message in either format.
+	variant parse(const std::string& msg, json::JSON_PARSE_OPTIONS options=json::JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
+
+	//re-encodes a JSON message. Messages already in binary are returned as is.
+	std::string from_json(const std::string& msg);
+}
@@ -0,0 +1,409 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "asserts.hpp"
+#include "formatter.hpp"
+#include "json_parser.hpp"
+#include "unit_test.hpp"
+#include "variant_diff.hpp"
+
+namespace variant_diff
+{
+	namespace
+	{
+		const variant& replace_key() { static const variant k("="); return k; }
+		const variant& map_key() { static const variant k("m"); return k; }
+		const variant& remove_key() { static const variant k("d"); return k; }
+		const variant& length_key() { static const variant k("l"); return k; }
+		const variant& items_key() { static const variant k("i"); return k; }
+		const variant& keyed_key() { static const variant k("k"); return k; }
+
+		variant replacement(const variant& v)
+		{
+			std::map<variant,variant> res;
+			res[replace_key()] = v;
+			return variant(&res);
+		}
+
+		const std::string* object_id(const variant& v)
+		{
+			static const variant UuidKey("_uuid");
+			if(!v.is_map()) {
+				return nullptr;
+			}
+
+			const std::map<variant,variant>& m = v.as_map();
+			auto itor = m.find(UuidKey);
+			if(itor == m.end() || !itor->second.is_string()) {
+				return nullptr;
+			}
+
+			return &itor->second.as_string();
+		}
+
+		bool is_object_list(const std::vector<variant>& items)
+		{
+			if(items.empty()) {
+				return false;
+			}
+
+			for(const variant& item : items) {
+				if(object_id(item) == nullptr) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		variant diff_maps(const std::map<variant,variant>& a, const std::map<variant,variant>& b)
+		{
+			std::map<variant,variant> changes;
+			std::vector<variant> removed;
+
+			//both maps are sorted the same way, so walk them side by side.
+			auto i = a.begin();
+			auto j = b.begin();
+			while(i != a.end() || j != b.end()) {
+				if(j == b.end() || (i != a.end() && i->first < j->first)) {
+					removed.push_back(i->first);
+					++i;
+				} else if(i == a.end() || j->first < i->first) {
+					changes[j->first] = replacement(j->second);
+					++j;
+				} else {
+					variant sub = diff(i->second, j->second);
+					if(!sub.is_null()) {
+						changes[j->first] = sub;
+					}
+					++i;
+					++j;
+				}
+			}
+
+			if(changes.empty() && removed.empty()) {
+				return variant();
+			}
+
+			std::map<variant,variant> res;
+			if(!changes.empty()) {
+				res[map_key()] = variant(&changes);
+			}
+
+			if(!removed.empty()) {
+				res[remove_key()] = variant(&removed);
+			}
+
+			return variant(&res);
+		}
+
+		variant diff_lists(const std::vector<variant>& a, const std::vector<variant>& b)
+		{
+			std::vector<variant> items;
+			const size_t common = std::min(a.size(), b.size());
+			for(size_t n = 0; n != common; ++n) {
+				variant sub = diff(a[n], b[n]);
+				if(!sub.is_null()) {
+					items.push_back(variant(static_cast<int>(n)));
+					items.push_back(sub);
+				}
+			}
+
+			for(size_t n = common; n < b.size(); ++n) {
+				items.push_back(variant(static_cast<int>(n)));
+				items.push_back(replacement(b[n]));
+			}
+
+			if(items.empty() && a.size() == b.size()) {
+				return variant();
+			}
+
+			//when most of the list changed, just send the new list.
+			if(items.size() > b.size()) {
+				std::vector<variant> list = b;
+				return replacement(variant(&list));
+			}
+
+			std::map<variant,variant> res;
+			res[length_key()] = variant(static_cast<int>(b.size()));
+			res[items_key()] = variant(&items);
+			return variant(&res);
+		}
+
+		//lists of serialized objects come out in no particular order, so
+		//match their elements up by uuid rather than by position. Each
+		//entry rebuilding the new list is an index into the old list, an
+		//[index, count] run of them, an [index, patch] pair or a patch
+		//giving a new element.
+		variant diff_object_lists(const std::vector<variant>& a, const std::vector<variant>& b)
+		{
+			std::unordered_map<std::string, int> index;
+			for(size_t n = 0; n != a.size(); ++n) {
+				index[*object_id(a[n])] = static_cast<int>(n);
+			}
+
+			std::vector<variant> entries;
+			bool unchanged = a.size() == b.size();
+			bool matched_any = false;
+
+			int run_start = 0, run_length = 0;
+			auto flush_run = [&]() {
+				if(run_length == 1) {
+					entries.push_back(variant(run_start));
+				} else if(run_length > 1) {
+					std::vector<variant> run;
+					run.push_back(variant(run_start));
+					run.push_back(variant(run_length));
+					entries.push_back(variant(&run));
+				}
+				run_length = 0;
+			};
+
+			for(size_t n = 0; n != b.size(); ++n) {
+				auto itor = index.find(*object_id(b[n]));
+				if(itor == index.end()) {
+					flush_run();
+					entries.push_back(replacement(b[n]));
+					unchanged = false;
+					continue;
+				}
+
+				matched_any = true;
+
+				const int old_index = itor->second;
+				variant sub = diff(a[old_index], b[n]);
+				if(sub.is_null()) {
+					if(old_index != static_cast<int>(n)) {
+						unchanged = false;
+					}
+
+					if(run_length > 0 && run_start + run_length == old_index) {
+						++run_length;
+					} else {
+						flush_run();
+						run_start = old_index;
+						run_length = 1;
+					}
+				} else {
+					flush_run();
+					std::vector<variant> pair;
+					pair.push_back(variant(old_index));
+					pair.push_back(sub);
+					entries.push_back(variant(&pair));
+					unchanged = false;
+				}
+			}
+
+			flush_run();
+
+			if(unchanged) {
+				return variant();
+			}
+
+			if(!matched_any) {
+				std::vector<variant> list = b;
+				return replacement(variant(&list));
+			}
+
+			std::map<variant,variant> res;
+			res[keyed_key()] = variant(&entries);
+			return variant(&res);
+		}
+
+		variant apply_object_list(const variant& a, const variant& entries)
+		{
+			ASSERT_LOG(a.is_list(), "Variant patch expects a list: " << a.write_json());
+			const std::vector<variant> old = a.as_list();
+			const int old_size = static_cast<int>(old.size());
+
+			std::vector<variant> res;
+			for(const variant& entry : entries.as_list()) {
+				if(entry.is_int()) {
+					const int n = entry.as_int();
+					ASSERT_LOG(n >= 0 && n < old_size, "Variant patch index out of range: " << n);
+					res.push_back(old[n]);
+				} else if(entry.is_list()) {
+					ASSERT_LOG(entry.num_elements() == 2, "Bad variant patch entry: " << entry.write_json());
+					const int n = entry[0].as_int();
+					if(entry[1].is_int()) {
+						const int count = entry[1].as_int();
+						ASSERT_LOG(n >= 0 && count >= 0 && n + count <= old_size, "Variant patch run out of range: " << n << "+" << count);
+						res.insert(res.end(), old.begin() + n, old.begin() + n + count);
+					} else {
+						ASSERT_LOG(n >= 0 && n < old_size, "Variant patch index out of range: " << n);
+						res.push_back(apply(old[n], entry[1]));
+					}
+				} else {
+					res.push_back(apply(variant(), entry));
+				}
+			}
+
+			return variant(&res);
+		}
+	}
+
+	variant diff(const variant& a, const variant& b)
+	{
+		if(a.type() != b.type()) {
+			return replacement(b);
+		}
+
+		if(a.is_map()) {
+			return diff_maps(a.as_map(), b.as_map());
+		}
+
+		if(a.is_list()) {
+			const std::vector<variant> a_items = a.as_list();
+			const std::vector<variant> b_items = b.as_list();
+			if(is_object_list(a_items) && is_object_list(b_items)) {
+				return diff_object_lists(a_items, b_items);
+			}
+
+			return diff_lists(a_items, b_items);
+		}
+
+		return a == b ? variant() : replacement(b);
+	}
+
+	variant apply(const variant& a, const variant& patch)
+	{
+		if(patch.is_null()) {
+			return a;
+		}
+
+		ASSERT_LOG(patch.is_map(), "Bad variant patch: " << patch.write_json());
+		const std::map<variant,variant>& p = patch.as_map();
+
+		auto itor = p.find(replace_key());
+		if(itor != p.end()) {
+			return itor->second;
+		}
+
+		itor = p.find(keyed_key());
+		if(itor != p.end()) {
+			return apply_object_list(a, itor->second);
+		}
+
+		itor = p.find(length_key());
+		if(itor != p.end()) {
+			ASSERT_LOG(a.is_list(), "Variant patch expects a list: " << a.write_json());
+			std::vector<variant> res = a.as_list();
+			res.resize(itor->second.as_int());
+
+			const std::vector<variant> items = patch[items_key()].as_list();
+			ASSERT_LOG(items.size()%2 == 0, "Bad variant patch items: " << patch.write_json());
+			for(size_t n = 0; n != items.size(); n += 2) {
+				const int index = items[n].as_int();
+				ASSERT_LOG(index >= 0 && index < static_cast<int>(res.size()), "Variant patch index out of range: " << index);
+				res[index] = apply(res[index], items[n+1]);
+			}
+
+			return variant(&res);
+		}
+
+		ASSERT_LOG(a.is_map(), "Variant patch expects a map: " << a.write_json());
+		std::map<variant,variant> res = a.as_map();
+
+		for(const variant& key : patch[remove_key()].as_list_optional()) {
+			ASSERT_LOG(res.erase(key) == 1, "Variant patch removes a missing key: " << key.write_json());
+		}
+
+		const variant changes = patch[map_key()];
+		if(changes.is_map()) {
+			for(const auto& change : changes.as_map()) {
+				variant& value = res[change.first];
+				value = apply(value, change.second);
+			}
+		}
+
+		return variant(&res);
+	}
+}
+
+namespace
+{
+	void check_patch(const char* before, const char* after)
+	{
+		const variant a = json::parse(before, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+		const variant b = json::parse(after, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+
+		//send the patch the way it goes over the wire.
+		const variant patch = json::parse(variant_diff::diff(a, b).write_json(), json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+		CHECK_EQ(variant_diff::apply(a, patch).write_json(), b.write_json());
+	}
+
+	variant object_state(int nobjects, int changed)
+	{
+		std::vector<variant> objects;
+		for(int n = 0; n != nobjects; ++n) {
+			std::map<variant,variant> obj;
+			obj[variant("_uuid")] = variant(std::string(formatter() << "uuid" << n));
+			obj[variant("hitpoints")] = variant(n == changed ? 1 : 10);
+			obj[variant("name")] = variant(std::string(formatter() << "creature " << n));
+			objects.push_back(variant(&obj));
+		}
+
+		//serialization emits objects in an arbitrary order.
+		std::reverse(objects.begin(), objects.begin() + nobjects/2);
+
+		std::map<variant,variant> res;
+		res[variant("character")] = variant(&objects);
+		return variant(&res);
+	}
+}
+
+UNIT_TEST(variant_diff_roundtrip)
+{
+	check_patch("{a: 1, b: [1,2,3], c: {x: 'y'}}", "{a: 1, b: [1,2,3], c: {x: 'y'}}");
+	check_patch("{a: 1, b: [1,2,3], c: {x: 'y'}}", "{a: 2, b: [1,5,3,4], d: null}");
+	check_patch("{a: 1, b: [1,2,3,4,5]}", "{a: 1.5, b: [1,2]}");
+	check_patch("{a: [{x: 1}, {y: 2}]}", "{a: [{x: 1}, {y: 3, z: true}, 'new']}");
+	check_patch("[1, 2, 3]", "{a: 1}");
+	check_patch("{character: [{_uuid: 'a', hp: 1}, {_uuid: 'b', hp: 2}, {_uuid: 'c', hp: 3}]}",
+	            "{character: [{_uuid: 'c', hp: 3}, {_uuid: 'd', hp: 4}, {_uuid: 'a', hp: 0}, {_uuid: 'b', hp: 2}]}");
+	check_patch("{character: [{_uuid: 'a'}, {_uuid: 'b'}, {_uuid: 'c'}, {_uuid: 'd'}]}",
+	            "{character: [{_uuid: 'b'}, {_uuid: 'c'}, {_uuid: 'd'}]}");
+
+	CHECK(variant_diff::diff(object_state(100, 3), object_state(100, 3)).is_null(), "Identical trees must give an empty patch");
+}
+
+UNIT_TEST(variant_diff_is_small)
+{
+	const variant a = object_state(200, -1);
+	const variant b = object_state(200, 150);
+	const variant patch = variant_diff::diff(a, b);
+	CHECK_EQ(variant_diff::apply(a, patch).write_json(), b.write_json());
+	CHECK(patch.write_json().size()*20 < b.write_json().size(), "Patch is too large: " << patch.write_json());
+}
+
+BENCHMARK(variant_diff_object_state)
+{
+	const variant a = object_state(1000, -1);
+	const variant b = object_state(1000, 500);
+	BENCHMARK_LOOP {
+		variant_diff::apply(a, variant_diff::diff(a, b));
+	}
+}
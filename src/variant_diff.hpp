@@ -0,0 +1,47 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include "variant.hpp"
+
+//Structural diffs of plain variant trees: maps, lists and scalars as
+//they come out of a JSON document. A patch only describes the parts of
+//the tree that changed, so it is usually far smaller than the tree.
+//
+//A patch is one of:
+//  null                       -- unchanged
+//  {"=": value}               -- replaced by value
+//  {"m": {key: patch}, "d": [key]} -- a map with some keys changed/removed
+//  {"l": len, "i": [index, patch, ...]} -- a list changed in place
+//  {"k": [entry, ...]}        -- a list of objects identified by _uuid,
+//                                rebuilt from the old list's elements
+namespace variant_diff
+{
+	//returns a patch which turns a into b, or null if they are the same.
+	variant diff(const variant& a, const variant& b);
+
+	//applies a patch made by diff() to a. Asserts if the patch does not
+	//fit a, which means a is not the tree the patch was made against.
+	variant apply(const variant& a, const variant& patch);
+}
@@ -33,6 +33,8 @@
 #include "preferences.hpp"
 #include "water_particle_system.hpp"
 
+extern bool g_async_particles;
+
 WaterParticleSystemInfo::WaterParticleSystemInfo(variant node)
 	: number_of_particles(node["number_of_particles"].as_int(1500)),
 	  repeat_period(node["repeat_period"].as_int(1000)),
@@ -68,7 +70,8 @@ WaterParticleSystem::WaterParticleSystem(const Entity& e, const WaterParticleSys
 	  velocity_x_(factory.info.velocity_x), 
 	  velocity_y_(factory.info.velocity_y), 
 	  cycle_(0),
-	  u_point_size_(-1)
+	  u_point_size_(-1),
+	  next_particles_valid_(false)
 {
 	area_ = rect("0,0,1,1");
 	base_velocity = sqrtf(static_cast<float>(info_.velocity_x*info_.velocity_x + info_.velocity_y*info_.velocity_y));
@@ -96,21 +99,60 @@ WaterParticleSystem::WaterParticleSystem(const Entity& e, const WaterParticleSys
 	addAttributeSet(as);
 }
 
+WaterParticleSystem::~WaterParticleSystem()
+{
+	if(job_) {
+		worker_pool::wait(job_);
+	}
+}
+
 void WaterParticleSystem::executeOnDraw()
 {
 	getShader()->setUniformValue(u_point_size_, info_.dot_size);
 }
 
+void WaterParticleSystem::step(const std::vector<particle>& src, std::vector<particle>* dst) const
+{
+	dst->resize(src.size());
+	for(size_t n = 0; n != src.size(); ++n)
+	{
+		const particle& p = src[n];
+		particle& out = (*dst)[n];
+		out.pos[0] = fmod(p.pos[0]+direction[0] * p.velocity, static_cast<float>(info_.repeat_period));
+		out.pos[1] = fmod(p.pos[1]+direction[1] * p.velocity, static_cast<float>(info_.repeat_period));
+		out.velocity = p.velocity;
+	}
+}
+
+void WaterParticleSystem::sync()
+{
+	if(job_) {
+		worker_pool::JobPtr job;
+		job.swap(job_);
+		worker_pool::wait(job);
+	}
+}
+
 void WaterParticleSystem::process(const Entity& e)
 {
 	++cycle_;
-	
-	for(particle& p : particles_)
-	{		
-		p.pos[0] = fmod(p.pos[0]+direction[0] * p.velocity, static_cast<float>(info_.repeat_period));
-		p.pos[1] = fmod(p.pos[1]+direction[1] * p.velocity, static_cast<float>(info_.repeat_period));
+
+	sync();
+	if(next_particles_valid_) {
+		particles_.swap(next_particles_);
+		next_particles_valid_ = false;
+	} else {
+		step(particles_, &particles_);
 	}
-	
+
+	//work out next frame's positions while this frame draws.
+	if(g_async_particles) {
+		next_particles_valid_ = true;
+		job_ = worker_pool::submit([this]() {
+			step(particles_, &next_particles_);
+		});
+	}
+
 
 	// XXX set is_circlular uniform to false/true
 	setColor(info_.color);
@@ -167,6 +209,8 @@ BEGIN_DEFINE_CALLABLE(WaterParticleSystem, ParticleSystem)
 	DEFINE_FIELD(velocity_x, "int")
 		return variant(obj.velocity_x_);
 	DEFINE_SET_FIELD
+		obj.sync();
+		obj.next_particles_valid_ = false;
 		obj.velocity_x_ = value.as_int();
 		obj.direction[0] = obj.velocity_x_ / obj.base_velocity;
 		obj.direction[1] = obj.velocity_y_ / obj.base_velocity;
@@ -174,6 +218,8 @@ BEGIN_DEFINE_CALLABLE(WaterParticleSystem, ParticleSystem)
 	DEFINE_FIELD(velocity_y, "int")
 		return variant(obj.velocity_y_);
 	DEFINE_SET_FIELD
+		obj.sync();
+		obj.next_particles_valid_ = false;
 		obj.velocity_y_ = value.as_int();
 		obj.direction[0] = obj.velocity_x_ / obj.base_velocity;
 		obj.direction[1] = obj.velocity_y_ / obj.base_velocity;
@@ -26,6 +26,7 @@
 #include <deque>
 
 #include "particle_system.hpp"
+#include "worker_pool.hpp"
 
 struct WaterParticleSystemInfo 
 {
@@ -53,6 +54,7 @@ class WaterParticleSystem : public ParticleSystem
 {
 public:
 	WaterParticleSystem(const Entity& e, const WaterParticleSystemFactory& factory);
+	~WaterParticleSystem();
 	
 	bool isDestroyed() const override { return false; }
 	void process(const Entity& e) override;
@@ -81,5 +83,13 @@ private:
 	std::shared_ptr<KRE::Attribute<glm::u16vec2>> attribs_;
 	
 	std::vector<particle> particles_;
+
+	//the next frame's positions, stepped on a worker thread while this
+	//frame's are drawn.
+	void step(const std::vector<particle>& src, std::vector<particle>* dst) const;
+	void sync();
+	std::vector<particle> next_particles_;
+	bool next_particles_valid_;
+	worker_pool::JobPtr job_;
 	int u_point_size_;
 };
@@ -32,6 +32,8 @@
 #include "weather_particle_system.hpp"
 #include "variant_utils.hpp"
 
+extern bool g_async_particles;
+
 WeatherParticleSystemFactory::WeatherParticleSystemFactory (variant node)
  : info(node)
 {
@@ -45,7 +47,7 @@ ParticleSystemPtr WeatherParticleSystemFactory::create(const Entity& e) const
 
 
 WeatherParticleSystem::WeatherParticleSystem(const Entity& e, const WeatherParticleSystemFactory& factory)
- : factory_(factory), info_(factory.info), cycle_(0)
+ : factory_(factory), info_(factory.info), cycle_(0), next_particles_valid_(false)
 {
 	base_velocity = sqrtf(static_cast<float>(info_.velocity_x*info_.velocity_x + info_.velocity_y*info_.velocity_y));
 	direction[0] = info_.velocity_x / base_velocity;
@@ -69,14 +71,53 @@ WeatherParticleSystem::WeatherParticleSystem(const Entity& e, const WeatherParti
 	addAttributeSet(as);
 }
 
+WeatherParticleSystem::~WeatherParticleSystem()
+{
+	if(job_) {
+		worker_pool::wait(job_);
+	}
+}
+
+void WeatherParticleSystem::step(const std::vector<particle>& src, std::vector<particle>* dst) const
+{
+	dst->resize(src.size());
+	for(size_t n = 0; n != src.size(); ++n)
+	{
+		const particle& p = src[n];
+		particle& out = (*dst)[n];
+		out.pos[0] = static_cast<float>(static_cast<int>(p.pos[0]+direction[0] * p.velocity) % info_.repeat_period);
+		out.pos[1] = static_cast<float>(static_cast<int>(p.pos[1]+direction[1] * p.velocity) % info_.repeat_period);
+		out.velocity = p.velocity;
+	}
+}
+
+void WeatherParticleSystem::sync()
+{
+	if(job_) {
+		worker_pool::JobPtr job;
+		job.swap(job_);
+		worker_pool::wait(job);
+	}
+}
+
 void WeatherParticleSystem::process(const Entity& e)
 {
 	++cycle_;
-	
-	for(particle& p : particles_)
-	{
-		p.pos[0] = static_cast<float>(static_cast<int>(p.pos[0]+direction[0] * p.velocity) % info_.repeat_period);
-		p.pos[1] = static_cast<float>(static_cast<int>(p.pos[1]+direction[1] * p.velocity) % info_.repeat_period);
+
+	sync();
+	if(next_particles_valid_) {
+		particles_.swap(next_particles_);
+		next_particles_valid_ = false;
+	} else {
+		step(particles_, &particles_);
+	}
+
+	//work out next frame's positions while this frame draws.
+	if(g_async_particles) {
+		next_particles_valid_ = true;
+		job_ = worker_pool::submit([this]() {
+			step(particles_, &next_particles_);
+		});
 	}
 
 	// XXX set line width uniform from "info_.line_width" here
@@ -119,10 +160,14 @@ BEGIN_DEFINE_CALLABLE(WeatherParticleSystem, ParticleSystem)
 	DEFINE_FIELD(velocity_x, "decimal|int")
 		return variant(decimal(obj.direction[0]));
 	DEFINE_SET_FIELD
+		obj.sync();
+		obj.next_particles_valid_ = false;
 		obj.direction[0] = value.as_float();	
 
 	DEFINE_FIELD(velocity_y, "decimal|int")
 		return variant(decimal(obj.direction[1]));
 	DEFINE_SET_FIELD
+		obj.sync();
+		obj.next_particles_valid_ = false;
 		obj.direction[1] = value.as_float();	
 END_DEFINE_CALLABLE(WeatherParticleSystem)
@@ -28,6 +28,7 @@
 #include "AttributeSet.hpp"
 
 #include "particle_system.hpp"
+#include "worker_pool.hpp"
 
 struct WeatherParticleSystemInfo 
 {
@@ -65,6 +66,7 @@ class WeatherParticleSystem : public ParticleSystem
 {
 public:
 	WeatherParticleSystem(const Entity& e, const WeatherParticleSystemFactory& factory);
+	~WeatherParticleSystem();
 	
 	bool isDestroyed() const override { return false; }
 	void process(const Entity& e) override;
@@ -88,4 +90,12 @@ private:
 	std::shared_ptr<KRE::Attribute<glm::vec2>> attribs_;
 
 	std::vector<particle> particles_;
+
+	//the next frame's positions, stepped on a worker thread while this
+	//frame's are drawn.
+	void step(const std::vector<particle>& src, std::vector<particle>* dst) const;
+	void sync();
+	std::vector<particle> next_particles_;
+	bool next_particles_valid_;
+	worker_pool::JobPtr job_;
 };
@@ -30,6 +30,7 @@
 #include "asserts.hpp"
 #include "formula_object.hpp"
 #include "json_parser.hpp"
+#include "variant_binary.hpp"
 #include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
@@ -274,10 +275,10 @@ namespace game_logic
 					v = json::parse_from_file(msg);
 				} else {
 					try {
-						v = json::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+						v = variant_binary::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
 
 						if(v.is_map() && v.has_key(variant("serialized_objects"))) {
-							v = json::parse(msg);
+							v = variant_binary::parse(msg);
 						}
 					} catch(json::ParseError& e) {
 						ASSERT_LOG(false, "ERROR PROCESSING FSON: --BEGIN--" << msg << "--END-- ERROR: " << e.errorMessage());
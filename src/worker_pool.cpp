@@ -0,0 +1,359 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "asserts.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+#include "worker_pool.hpp"
+
+namespace worker_pool
+{
+	class Job
+	{
+	public:
+		enum class STATE { PENDING, RUNNING, FINISHED };
+
+		explicit Job(std::function<void()> fn) : fn_(fn), state_(STATE::PENDING)
+		{}
+
+		void run() {
+			try {
+				fn_();
+			} catch(...) {
+				error_ = std::current_exception();
+			}
+
+			fn_ = std::function<void()>();
+		}
+
+		std::function<void()> fn_;
+		STATE state_;
+		std::exception_ptr error_;
+	};
+
+	namespace 
+	{
+		class Pool
+		{
+		public:
+			Pool() : nworkers_(0), generation_(0), running_(0), quit_(false), count_(0), next_(0)
+			{}
+
+			~Pool() {
+				{
+					threading::lock l(mutex_);
+					quit_ = true;
+					start_.notify_all();
+				}
+
+				for(threading::thread* t : threads_) {
+					delete t;
+				}
+			}
+
+			void run(int count, int nthreads, std::function<void(int)> fn) {
+				nthreads = std::min(nthreads, count);
+				if(nthreads <= 1) {
+					for(int n = 0; n != count; ++n) {
+						fn(n);
+					}
+
+					return;
+				}
+
+				while(static_cast<int>(threads_.size()) < nthreads - 1) {
+					const int id = static_cast<int>(threads_.size());
+					threads_.push_back(new threading::thread("worker_pool", std::bind(&Pool::workerLoop, this, id, generation_), threading::THREAD_ALLOCATES_COLLECTIBLE_OBJECTS));
+				}
+
+				{
+					threading::lock l(mutex_);
+					fn_ = fn;
+					count_ = count;
+					next_ = 0;
+					nworkers_ = nthreads - 1;
+					running_ = nworkers_;
+					++generation_;
+					start_.notify_all();
+				}
+
+				work();
+
+				threading::lock l(mutex_);
+				while(running_ > 0) {
+					done_.wait(mutex_);
+				}
+
+				fn_ = std::function<void(int)>();
+			}
+
+			int size() const { return static_cast<int>(threads_.size()); }
+		private:
+			void workerLoop(int id, int seen) {
+				for(;;) {
+					{
+						threading::lock l(mutex_);
+						while(generation_ == seen && !quit_) {
+							start_.wait(mutex_);
+						}
+
+						if(quit_) {
+							return;
+						}
+
+						seen = generation_;
+
+						//workers beyond the requested thread count sit this
+						//job out.
+						if(id >= nworkers_) {
+							continue;
+						}
+					}
+
+					work();
+
+					threading::lock l(mutex_);
+					if(--running_ == 0) {
+						done_.notify_all();
+					}
+				}
+			}
+
+			//hand out indexes one at a time, so uneven work balances out.
+			void work() {
+				for(int n = next_++; n < count_; n = next_++) {
+					fn_(n);
+				}
+			}
+
+			threading::mutex mutex_;
+			threading::condition start_, done_;
+			std::vector<threading::thread*> threads_;
+
+			int nworkers_, generation_, running_;
+			bool quit_;
+
+			std::function<void(int)> fn_;
+			int count_;
+			std::atomic<int> next_;
+		};
+
+		Pool& get_pool()
+		{
+			static Pool pool;
+			return pool;
+		}
+
+		//background threads for submit(). Kept apart from Pool, since a
+		//parallel_for may be issued while jobs are still running.
+		class JobQueue
+		{
+		public:
+			JobQueue() : quit_(false), idle_(0)
+			{}
+
+			~JobQueue() {
+				{
+					threading::lock l(mutex_);
+					quit_ = true;
+					start_.notify_all();
+				}
+
+				for(threading::thread* t : threads_) {
+					delete t;
+				}
+			}
+
+			void push(const JobPtr& job) {
+				threading::lock l(mutex_);
+				queue_.push_back(job);
+
+				//the jobs we run don't allocate collectible objects, so
+				//workers are spawned without registering with the GC.
+				const int max_threads = std::max<int>(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+				if(static_cast<int>(queue_.size()) > idle_ && static_cast<int>(threads_.size()) < max_threads) {
+					threads_.push_back(new threading::thread("worker_pool_jobs", std::bind(&JobQueue::workerLoop, this)));
+				}
+
+				start_.notify_one();
+			}
+
+			void wait(const JobPtr& job) {
+				{
+					threading::lock l(mutex_);
+					if(job->state_ == Job::STATE::PENDING) {
+						//nobody has got to it yet, so rather than sitting idle
+						//run it here.
+						queue_.erase(std::find(queue_.begin(), queue_.end(), job));
+						job->state_ = Job::STATE::RUNNING;
+					} else {
+						while(job->state_ != Job::STATE::FINISHED) {
+							done_.wait(mutex_);
+						}
+					}
+				}
+
+				if(job->state_ == Job::STATE::RUNNING) {
+					job->run();
+
+					threading::lock l(mutex_);
+					job->state_ = Job::STATE::FINISHED;
+				}
+
+				if(job->error_) {
+					std::exception_ptr error = job->error_;
+					job->error_ = std::exception_ptr();
+					std::rethrow_exception(error);
+				}
+			}
+
+			bool finished(const JobPtr& job) {
+				threading::lock l(mutex_);
+				return job->state_ == Job::STATE::FINISHED;
+			}
+		private:
+			void workerLoop() {
+				for(;;) {
+					JobPtr job;
+					{
+						threading::lock l(mutex_);
+						++idle_;
+						while(queue_.empty() && !quit_) {
+							start_.wait(mutex_);
+						}
+						--idle_;
+
+						if(quit_) {
+							return;
+						}
+
+						job = queue_.front();
+						queue_.pop_front();
+						job->state_ = Job::STATE::RUNNING;
+					}
+
+					job->run();
+
+					threading::lock l(mutex_);
+					job->state_ = Job::STATE::FINISHED;
+					done_.notify_all();
+				}
+			}
+
+			threading::mutex mutex_;
+			threading::condition start_, done_;
+			std::vector<threading::thread*> threads_;
+			std::deque<JobPtr> queue_;
+			bool quit_;
+			int idle_;
+		};
+
+		JobQueue& get_job_queue()
+		{
+			static JobQueue queue;
+			return queue;
+		}
+	}
+
+	void parallel_for(int count, int nthreads, std::function<void(int)> fn)
+	{
+		ASSERT_LOG(count >= 0, "Illegal count given to parallel_for: " << count);
+		get_pool().run(count, nthreads, fn);
+	}
+
+	int num_workers()
+	{
+		return get_pool().size();
+	}
+
+	JobPtr submit(std::function<void()> fn)
+	{
+		JobPtr job(new Job(fn));
+		get_job_queue().push(job);
+		return job;
+	}
+
+	void wait(const JobPtr& job)
+	{
+		ASSERT_LOG(job, "Null job given to worker_pool::wait");
+		get_job_queue().wait(job);
+	}
+
+	bool is_finished(const JobPtr& job)
+	{
+		ASSERT_LOG(job, "Null job given to worker_pool::is_finished");
+		return get_job_queue().finished(job);
+	}
+}
+
+UNIT_TEST(worker_pool_parallel_for)
+{
+	for(int nthreads = 1; nthreads <= 4; ++nthreads) {
+		std::vector<int> results(1000);
+		worker_pool::parallel_for(static_cast<int>(results.size()), nthreads, [&results](int n) {
+			results[n] = n*n;
+		});
+
+		for(int n = 0; n != static_cast<int>(results.size()); ++n) {
+			CHECK_EQ(results[n], n*n);
+		}
+	}
+}
+
+UNIT_TEST(worker_pool_jobs)
+{
+	std::vector<int> results(64);
+	std::vector<worker_pool::JobPtr> jobs;
+	for(int n = 0; n != static_cast<int>(results.size()); ++n) {
+		jobs.push_back(worker_pool::submit([&results, n]() {
+			results[n] = n*n;
+		}));
+	}
+
+	for(int n = 0; n != static_cast<int>(jobs.size()); ++n) {
+		worker_pool::wait(jobs[n]);
+		CHECK(worker_pool::is_finished(jobs[n]), "job not finished after wait");
+		CHECK_EQ(results[n], n*n);
+	}
+
+	worker_pool::JobPtr failing = worker_pool::submit([]() {
+		throw std::runtime_error("job failed");
+	});
+
+	bool caught = false;
+	try {
+		worker_pool::wait(failing);
+	} catch(std::runtime_error&) {
+		caught = true;
+	}
+
+	CHECK(caught, "exception thrown by job was not passed on by wait");
+}
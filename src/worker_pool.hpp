@@ -0,0 +1,58 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+//A small pool of persistent worker threads for splitting independent work
+//across cores.
+namespace worker_pool
+{
+	//calls fn(n) for every n in [0, count), spread across up to nthreads
+	//threads, the calling thread included. Returns once every call has
+	//finished. fn must not throw; callers should catch errors themselves
+	//and report them after the call returns.
+	void parallel_for(int count, int nthreads, std::function<void(int)> fn);
+
+	//the number of worker threads currently alive in the pool.
+	int num_workers();
+
+	//a single piece of work queued with submit().
+	class Job;
+	typedef std::shared_ptr<Job> JobPtr;
+
+	//queues fn to run on a background thread and returns straight away.
+	//Jobs run in the order submitted, several at once if there are cores
+	//to spare.
+	JobPtr submit(std::function<void()> fn);
+
+	//blocks until job has run. If the job has not been picked up yet it is
+	//run on the calling thread instead. Anything the job threw is rethrown
+	//here. Waiting on a finished job returns immediately.
+	void wait(const JobPtr& job);
+
+	//true if job has run to completion.
+	bool is_finished(const JobPtr& job);
+}